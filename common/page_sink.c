@@ -0,0 +1,45 @@
+// page_sink.c : the writing side of the reader-to-encoder bridge, see page_source.h
+
+#include "PdfRaster.h"
+#include "page_source.h"
+
+// page_source.c hands pages over with the writer's enum values,
+// without seeing them: if they change, this fails to compile.
+// (They're compared as ints: they are different enums.)
+typedef char check_pixel_formats[
+	((int)SOURCE_BITONAL == (int)PDFRAS_BITONAL && (int)SOURCE_GRAY8 == (int)PDFRAS_GRAY8 &&
+	(int)SOURCE_GRAY16 == (int)PDFRAS_GRAY16 && (int)SOURCE_RGB24 == (int)PDFRAS_RGB24 &&
+	(int)SOURCE_RGB48 == (int)PDFRAS_RGB48) ? 1 : -1];
+typedef char check_compressions[
+	((int)SOURCE_UNCOMPRESSED == (int)PDFRAS_UNCOMPRESSED && (int)SOURCE_JPEG == (int)PDFRAS_JPEG &&
+	(int)SOURCE_CCITTG4 == (int)PDFRAS_CCITTG4) ? 1 : -1];
+
+int page_sink_start_page(t_pdfrasencoder* enc, const t_sourcepage* page)
+{
+	// the settings apply to the next page started
+	pdfr_encoder_set_pixelformat(enc, (RasterPixelFormat)page->format);
+	pdfr_encoder_set_compression(enc, (RasterCompression)page->compression);
+	pdfr_encoder_set_resolution(enc, page->xdpi, page->ydpi);
+	pdfr_encoder_set_rotation(enc, page->rotation);
+	switch (page->colorspace) {
+	case SOURCE_CALGRAY:
+		pdfr_encoder_set_bitonal_uncalibrated(enc, 0);
+		break;
+	case SOURCE_DEVICEGRAY:
+		pdfr_encoder_set_bitonal_uncalibrated(enc, 1);
+		break;
+	case SOURCE_ICCBASED:
+		pdfr_encoder_define_rgb_icc_colorspace(enc, page->icc_profile, page->icc_profile_len);
+		break;
+	case SOURCE_CALRGB:
+		{
+			// (pdfr_encoder_define_calrgb_colorspace takes non-const arrays)
+			t_sourcepage cal = *page;
+			pdfr_encoder_define_calrgb_colorspace(enc, cal.gamma, cal.black, cal.white, cal.matrix);
+		}
+		break;
+	default:
+		return -1;
+	}
+	return pdfr_encoder_start_page(enc, page->width);
+}
@@ -0,0 +1,194 @@
+// page_source.c : the reading side of the reader-to-encoder bridge, see page_source.h
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pdfrasread_files.h"
+#include "page_source.h"
+
+static int writer_format(RasterPixelFormat format)
+{
+	switch (format) {
+	case RASREAD_BITONAL:	return SOURCE_BITONAL;
+	case RASREAD_GRAY8:		return SOURCE_GRAY8;
+	case RASREAD_GRAY16:	return SOURCE_GRAY16;
+	case RASREAD_RGB24:		return SOURCE_RGB24;
+	case RASREAD_RGB48:		return SOURCE_RGB48;
+	default:				return -1;
+	}
+}
+
+static int writer_compression(RasterCompression comp)
+{
+	switch (comp) {
+	case RASREAD_UNCOMPRESSED:	return SOURCE_UNCOMPRESSED;
+	case RASREAD_JPEG:			return SOURCE_JPEG;
+	case RASREAD_CCITTG4:		return SOURCE_CCITTG4;
+	default:					return -1;
+	}
+}
+
+// Set the colorspace of page p, in the writer's terms.
+// Returns 0 on success, PAGE_SOURCE_COLORSPACE if the encoder can't write it.
+static int source_colorspace(t_pdfrasreader* reader, int p, t_sourcepage* page)
+{
+	t_pdfrasread_colorspace cs;
+	if (!pdfrasread_page_colorspace(reader, p, &cs)) {
+		return -1;
+	}
+	int rgb = (page->format == SOURCE_RGB24 || page->format == SOURCE_RGB48);
+	switch (cs.style) {
+	case RASREAD_DEVICEGRAY:
+		page->colorspace = SOURCE_DEVICEGRAY;
+		return page->format == SOURCE_BITONAL ? 0 : PAGE_SOURCE_COLORSPACE;
+	case RASREAD_CALGRAY:
+		// the encoder only writes the one /CalGray (see pdfr_encoder_get_calgray_colorspace)
+		page->colorspace = SOURCE_CALGRAY;
+		for (int i = 0; i < 3; i++) {
+			if (cs.whitePoint[i] != 1.0 || cs.blackPoint[i] != 0.0) {
+				return PAGE_SOURCE_COLORSPACE;
+			}
+		}
+		return rgb ? PAGE_SOURCE_COLORSPACE : 0;
+	case RASREAD_ICCBASED:
+		page->colorspace = SOURCE_ICCBASED;
+		page->icc_profile = cs.iccProfile;
+		page->icc_profile_len = cs.iccProfileLen;
+		return (rgb && cs.iccProfile) ? 0 : PAGE_SOURCE_COLORSPACE;
+	case RASREAD_CALRGB:
+		page->colorspace = SOURCE_CALRGB;
+		for (int i = 0; i < 3; i++) {
+			page->gamma[i] = cs.gamma;
+			page->black[i] = cs.blackPoint[i];
+			page->white[i] = cs.whitePoint[i];
+		}
+		memcpy(page->matrix, cs.matrix, sizeof page->matrix);
+		return rgb ? 0 : PAGE_SOURCE_COLORSPACE;
+	default:
+		// /DeviceRGB
+		return PAGE_SOURCE_COLORSPACE;
+	}
+}
+
+t_pdfrasreader* page_source_open(const char* filename)
+{
+	return pdfrasread_open_filename(RASREAD_API_LEVEL, filename);
+}
+
+int page_source_page_count(t_pdfrasreader* reader)
+{
+	return pdfrasread_page_count(reader);
+}
+
+void page_source_close(t_pdfrasreader* reader)
+{
+	pdfrasread_destroy(reader);
+}
+
+int page_source_page(t_pdfrasreader* reader, int p, t_sourcepage* page)
+{
+	memset(page, 0, sizeof *page);
+	page->format = writer_format(pdfrasread_page_format(reader, p));
+	page->width = pdfrasread_page_width(reader, p);
+	page->height = pdfrasread_page_height(reader, p);
+	page->xdpi = pdfrasread_page_horizontal_dpi(reader, p);
+	page->ydpi = pdfrasread_page_vertical_dpi(reader, p);
+	page->rotation = pdfrasread_page_rotation(reader, p);
+	page->strips = pdfrasread_strip_count(reader, p);
+	page->max_strip_size = pdfrasread_max_strip_size(reader, p);
+	page->compression = -1;
+	if (page->format < 0 || page->width <= 0 || page->height <= 0 || page->strips <= 0 || page->max_strip_size == 0) {
+		return -1;
+	}
+	// The writer sets the compression per page
+	page->compression = writer_compression(pdfrasread_strip_compression(reader, p, 0));
+	for (int s = 1; s < page->strips; s++) {
+		if (writer_compression(pdfrasread_strip_compression(reader, p, s)) != page->compression) {
+			return -1;
+		}
+	}
+	if (page->compression < 0) {
+		return -1;
+	}
+	return source_colorspace(reader, p, page);
+}
+
+size_t page_source_strip(t_pdfrasreader* reader, int p, int s, void* buffer, size_t bufsize, int* prows)
+{
+	*prows = pdfrasread_strip_height(reader, p, s);
+	if (*prows <= 0) {
+		return 0;
+	}
+	return pdfrasread_read_raw_strip(reader, p, s, buffer, bufsize);
+}
+
+int page_source_read_strips(t_pdfrasreader* reader, int p, t_sourcestrips* strips)
+{
+	int n = pdfrasread_strip_count(reader, p);
+	size_t max_size = pdfrasread_max_strip_size(reader, p);
+	if (n <= 0 || max_size == 0) {
+		return -1;
+	}
+	if (n > strips->nreqs) {
+		t_pdfrasread_strip_request* reqs = (t_pdfrasread_strip_request*)realloc(strips->reqs, n * sizeof *reqs);
+		if (!reqs) {
+			return -1;
+		}
+		strips->reqs = reqs;
+		strips->nreqs = n;
+	}
+	if (n > strips->capacity) {
+		size_t* size = (size_t*)realloc(strips->size, n * sizeof *size);
+		if (size) strips->size = size;
+		int* rows = (int*)realloc(strips->rows, n * sizeof *rows);
+		if (rows) strips->rows = rows;
+		if (!size || !rows) {
+			return -1;
+		}
+		strips->capacity = n;
+	}
+	// Each strip gets a max_size slot for the read, then
+	// they are slid down to sit one after another.
+	if ((size_t)n * max_size > strips->datasize) {
+		unsigned char* data = (unsigned char*)realloc(strips->data, (size_t)n * max_size);
+		if (!data) {
+			return -1;
+		}
+		strips->data = data;
+		strips->datasize = (size_t)n * max_size;
+	}
+	t_pdfrasread_strip_request* reqs = (t_pdfrasread_strip_request*)strips->reqs;
+	for (int s = 0; s < n; s++) {
+		reqs[s].page = p;
+		reqs[s].strip = s;
+		reqs[s].buffer = strips->data + s * max_size;
+		reqs[s].bufsize = max_size;
+		reqs[s].size = 0;
+	}
+	if (pdfrasread_read_raw_strips(reader, reqs, n) != n) {
+		return -1;
+	}
+	strips->count = n;
+	strips->total = 0;
+	for (int s = 0; s < n; s++) {
+		strips->size[s] = reqs[s].size;
+		strips->rows[s] = pdfrasread_strip_height(reader, p, s);
+		if (strips->rows[s] <= 0) {
+			return -1;
+		}
+		if (reqs[s].buffer != strips->data + strips->total) {
+			memmove(strips->data + strips->total, reqs[s].buffer, strips->size[s]);
+		}
+		strips->total += strips->size[s];
+	}
+	return 0;
+}
+
+void page_source_strips_free(t_sourcestrips* strips)
+{
+	free(strips->size);
+	free(strips->rows);
+	free(strips->data);
+	free(strips->reqs);
+	memset(strips, 0, sizeof *strips);
+}
@@ -0,0 +1,115 @@
+#ifndef _H_page_source
+#define _H_page_source
+#pragma once
+
+// The bridge between the PDF/raster reader and encoder, for the tools that
+// copy pages from one to the other without decoding them (pdfras_batch, pdfras_copy).
+// The reader (pdfrasread.h) and the writer (PdfRaster.h) both declare enums
+// named RasterPixelFormat and RasterCompression, with different members, so
+// no source file can include both headers. page_source.c is the only one that
+// sees the reader, and hands pages over in the writer's terms; page_sink.c only
+// sees the writer, and starts pages like the ones handed over.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct t_pdfrasreader;
+struct t_pdfrasencoder;
+
+// The writer's pixel formats and compressions (RasterPixelFormat and
+// RasterCompression in PdfRaster.h). page_sink.c checks they still match.
+enum {
+	SOURCE_BITONAL,
+	SOURCE_GRAY8,
+	SOURCE_GRAY16,
+	SOURCE_RGB24,
+	SOURCE_RGB48
+};
+
+enum {
+	SOURCE_UNCOMPRESSED,
+	SOURCE_JPEG,
+	SOURCE_CCITTG4
+};
+
+// The colorspaces the encoder can write
+enum {
+	SOURCE_CALGRAY,					// bitonal and gray: the encoder's /CalGray (Gamma 2.2, WhitePoint [ 1 1 1 ])
+	SOURCE_DEVICEGRAY,				// bitonal: /DeviceGray
+	SOURCE_ICCBASED,				// RGB: /ICCBased, with the page's profile
+	SOURCE_CALRGB					// RGB: /CalRGB, with the page's parameters
+};
+
+// A page, in the writer's terms
+typedef struct {
+	int			format;				// SOURCE_BITONAL ... SOURCE_RGB48
+	int			compression;		// SOURCE_UNCOMPRESSED, SOURCE_JPEG or SOURCE_CCITTG4
+	int			width;
+	int			height;
+	double		xdpi;
+	double		ydpi;
+	int			rotation;			// clockwise, degrees
+	int			strips;				// number of strips
+	size_t		max_strip_size;		// size of the largest strip, before decryption
+	int			colorspace;			// SOURCE_CALGRAY ... SOURCE_CALRGB
+	const unsigned char* icc_profile;	// SOURCE_ICCBASED: the profile, valid until the reader is closed
+	size_t		icc_profile_len;
+	double		gamma[3];			// SOURCE_CALRGB: /Gamma, /BlackPoint, /WhitePoint, /Matrix
+	double		black[3];
+	double		white[3];
+	double		matrix[9];
+} t_sourcepage;
+
+// The raw strips of one page, see page_source_read_strips.
+// Reused from page to page, the buffers only ever grow.
+typedef struct {
+	int			count;				// strips on the page
+	int			capacity;			// entries allocated in size and rows
+	size_t*		size;				// raw size of each strip
+	int*		rows;				// height of each strip
+	unsigned char* data;			// the strips' data, one after another
+	size_t		datasize;			// bytes allocated at data
+	size_t		total;				// bytes used at data
+	void*		reqs;				// requests for pdfrasread_read_raw_strips
+	int			nreqs;				// entries allocated at reqs
+} t_sourcestrips;
+
+// Open a PDF/raster file, NULL if it can't be opened or isn't PDF/raster
+struct t_pdfrasreader* page_source_open(const char* filename);
+
+int page_source_page_count(struct t_pdfrasreader* reader);
+
+void page_source_close(struct t_pdfrasreader* reader);
+
+// Describe page p (from 0) of an open reader. Returns 0 on success, -1 if the
+// page can't be copied, e.g. because its strips don't all have the same compression,
+// PAGE_SOURCE_COLORSPACE if the encoder can't write its colorspace: a page is
+// never copied with a colorspace other than its own.
+#define PAGE_SOURCE_COLORSPACE	-2
+int page_source_page(struct t_pdfrasreader* reader, int p, t_sourcepage* page);
+
+// Read the raw data of strip s of page p into buffer, which holds bufsize bytes
+// (page->max_strip_size is enough). Sets *prows to the height of the strip.
+// Returns the size of the strip, 0 if it can't be read.
+size_t page_source_strip(struct t_pdfrasreader* reader, int p, int s, void* buffer, size_t bufsize, int* prows);
+
+// Read all the strips of page p into strips, packed together, with as few
+// reads as possible (see pdfrasread_read_raw_strips).
+// Returns 0 on success, -1 on failure.
+int page_source_read_strips(struct t_pdfrasreader* reader, int p, t_sourcestrips* strips);
+
+// Release the buffers of strips
+void page_source_strips_free(t_sourcestrips* strips);
+
+// Set up enc for a page like page - pixel format, compression, resolution,
+// rotation and colorspace - and start it, as pdfr_encoder_start_page. (see page_sink.c)
+// An ICC profile is copied by the encoder, which writes it once however many pages use it.
+int page_sink_start_page(struct t_pdfrasencoder* enc, const t_sourcepage* page);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
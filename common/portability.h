@@ -14,6 +14,8 @@
 
 // sprintf_s is not standard, snprintf seems to be?
 #define sprintf_s(buffer, buffer_size, stringbuffer, ...) (sprintf(buffer, stringbuffer, __VA_ARGS__))
+// sscanf_s takes a size after each %s/%c buffer; plain sscanf ignores the surplus arguments.
+#define sscanf_s sscanf
 
 #define TIMEZONE timezone
 #define TZSET tzset
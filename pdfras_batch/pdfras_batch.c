@@ -0,0 +1,864 @@
+// pdfras_batch.c : re-encode a batch of PDF/raster files, in parallel.
+//
+// Every page is read with the PDF/raster reader (pdfrasread_open_filename)
+// and written again with the PDF/raster encoder (t_pdfrasencoder), so this
+// also measures the end-to-end throughput of the two libraries.
+//
+// Files are shared among the worker threads by work stealing: each worker
+// has its own queue of files, and when that runs dry it takes files from
+// the far end of another worker's queue. Each worker keeps one encoder,
+// and reuses it for all its files with pdfr_encoder_reset.
+//
+// Neither library has image codecs, so strip data is passed through
+// as-is: the compression of a page can be checked (-c) but not changed.
+// Uncompressed pages can be cut into strips of a new height (-s).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <process.h>
+#include <psapi.h>
+typedef HANDLE t_thread;
+typedef CRITICAL_SECTION t_mutex;
+#define THREAD_PROC unsigned __stdcall
+#define PATH_SEP '\\'
+#else
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+typedef pthread_t t_thread;
+typedef pthread_mutex_t t_mutex;
+#define THREAD_PROC void*
+#define PATH_SEP '/'
+#endif
+
+#include "PdfRaster.h"
+#include "page_source.h"
+
+#define MAX_THREADS		64
+#define MAX_PATH_LEN	4096
+#define MB				(1024.0 * 1024.0)
+
+// what to do to each page
+typedef struct {
+	const char*	outdir;			// where the output files go
+	int			compression;	// required compression, -1 = any
+	double		dpi;			// new resolution, 0 = keep
+	int			strip_rows;		// new strip height for uncompressed pages, 0 = keep
+	int			quiet;			// no per-file report
+} t_options;
+
+// one file to convert, and how it went
+typedef struct {
+	char*		name;
+	int			ok;
+	int			pages;
+	long		bytes_in;
+	long		bytes_out;
+	double		seconds;
+} t_job;
+
+// double-ended queue of jobs (indexes into the job list)
+// The owner takes jobs from the bottom, thieves from the top.
+typedef struct {
+	t_mutex		lock;
+	int*		jobs;
+	int			top;			// next job to steal
+	int			bottom;			// one past the owner's next job
+} t_deque;
+
+typedef struct t_batch t_batch;
+
+typedef struct {
+	t_batch*			batch;
+	int					index;
+	t_OS				os;				// the encoder keeps a pointer to this
+	t_pdfrasencoder*	enc;
+	t_sourcestrips		strips;
+	t_deque				queue;
+	int					files;			// files done by this worker
+	int					steals;			// of which, taken from other workers
+} t_worker;
+
+struct t_batch {
+	t_options			opts;
+	t_job*				jobs;
+	int					njobs;
+	t_worker*			workers;
+	int					nworkers;
+	t_mutex				print_lock;		// keeps report lines whole
+};
+
+static const char* compression_names[] = { "none", "jpeg", "g4" };
+
+///////////////////////////////////////////////////////////////////////
+// platform
+
+static void mutex_init(t_mutex* m)
+{
+#ifdef WIN32
+	InitializeCriticalSection(m);
+#else
+	pthread_mutex_init(m, NULL);
+#endif
+}
+
+static void mutex_destroy(t_mutex* m)
+{
+#ifdef WIN32
+	DeleteCriticalSection(m);
+#else
+	pthread_mutex_destroy(m);
+#endif
+}
+
+static void mutex_lock(t_mutex* m)
+{
+#ifdef WIN32
+	EnterCriticalSection(m);
+#else
+	pthread_mutex_lock(m);
+#endif
+}
+
+static void mutex_unlock(t_mutex* m)
+{
+#ifdef WIN32
+	LeaveCriticalSection(m);
+#else
+	pthread_mutex_unlock(m);
+#endif
+}
+
+static int start_thread(t_thread* pt, THREAD_PROC (*proc)(void*), void* arg)
+{
+#ifdef WIN32
+	*pt = (HANDLE)_beginthreadex(NULL, 0, proc, arg, 0, NULL);
+	return *pt != 0;
+#else
+	return 0 == pthread_create(pt, NULL, proc, arg);
+#endif
+}
+
+static void join_thread(t_thread t)
+{
+#ifdef WIN32
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+#else
+	pthread_join(t, NULL);
+#endif
+}
+
+static int processor_count(void)
+{
+#ifdef WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#endif
+}
+
+// monotonic time in seconds
+static double now(void)
+{
+#ifdef WIN32
+	LARGE_INTEGER freq, t;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+// peak resident set size of this process so far, in MB
+static double peak_rss(void)
+{
+#ifdef WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc)) {
+		return 0.0;
+	}
+	return pmc.PeakWorkingSetSize / MB;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0) {
+		return 0.0;
+	}
+#ifdef __APPLE__
+	return ru.ru_maxrss / MB;				// bytes
+#else
+	return ru.ru_maxrss / 1024.0;			// KB
+#endif
+#endif
+}
+
+static int is_directory(const char* path)
+{
+#ifdef WIN32
+	DWORD attr = GetFileAttributesA(path);
+	return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+// TRUE if paths a and b name the same existing file, however they're spelled
+static int same_file(const char* a, const char* b)
+{
+#ifdef WIN32
+	BY_HANDLE_FILE_INFORMATION ia, ib;
+	int same = 0;
+	HANDLE ha = CreateFileA(a, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	HANDLE hb = CreateFileA(b, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (ha != INVALID_HANDLE_VALUE && hb != INVALID_HANDLE_VALUE &&
+		GetFileInformationByHandle(ha, &ia) && GetFileInformationByHandle(hb, &ib)) {
+		same = ia.dwVolumeSerialNumber == ib.dwVolumeSerialNumber &&
+			ia.nFileIndexHigh == ib.nFileIndexHigh && ia.nFileIndexLow == ib.nFileIndexLow;
+	}
+	if (ha != INVALID_HANDLE_VALUE) CloseHandle(ha);
+	if (hb != INVALID_HANDLE_VALUE) CloseHandle(hb);
+	return same;
+#else
+	struct stat sa, sb;
+	return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+static long file_size(const char* path)
+{
+	long size = -1;
+	FILE* f = fopen(path, "rb");
+	if (f) {
+		if (fseek(f, 0, SEEK_END) == 0) {
+			size = ftell(f);
+		}
+		fclose(f);
+	}
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////
+// the list of files
+
+static char* copy_string(const char* s)
+{
+	char* copy = (char*)malloc(strlen(s) + 1);
+	if (copy) {
+		strcpy(copy, s);
+	}
+	return copy;
+}
+
+static const char* base_name(const char* path)
+{
+	const char* base = path;
+	for (const char* p = path; *p; p++) {
+		if (*p == '/' || *p == '\\') {
+			base = p + 1;
+		}
+	}
+	return base;
+}
+
+static int has_pdf_extension(const char* name)
+{
+	size_t len = strlen(name);
+	if (len < 4) {
+		return 0;
+	}
+	name += len - 4;
+	return name[0] == '.' && tolower((unsigned char)name[1]) == 'p' &&
+		tolower((unsigned char)name[2]) == 'd' && tolower((unsigned char)name[3]) == 'f';
+}
+
+static int add_job(t_batch* batch, int* capacity, const char* name)
+{
+	if (batch->njobs == *capacity) {
+		int n = *capacity ? *capacity * 2 : 64;
+		t_job* jobs = (t_job*)realloc(batch->jobs, n * sizeof *jobs);
+		if (!jobs) {
+			return 0;
+		}
+		batch->jobs = jobs;
+		*capacity = n;
+	}
+	t_job* job = &batch->jobs[batch->njobs];
+	memset(job, 0, sizeof *job);
+	job->name = copy_string(name);
+	if (!job->name) {
+		return 0;
+	}
+	batch->njobs++;
+	return 1;
+}
+
+static int compare_names(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// compare the output names (the base names) of two jobs
+static int compare_base_names(const void* a, const void* b)
+{
+#ifdef WIN32
+	return _stricmp(base_name(((const t_job*)a)->name), base_name(((const t_job*)b)->name));
+#else
+	return strcmp(base_name(((const t_job*)a)->name), base_name(((const t_job*)b)->name));
+#endif
+}
+
+// Every output goes to outdir under the input's base name, so two inputs
+// with the same base name would be written to the same file at once.
+// Return FALSE (after reporting) if there are any.
+static int check_output_names(const t_batch* batch)
+{
+	t_job* jobs = (t_job*)malloc(batch->njobs * sizeof *jobs);
+	if (!jobs) {
+		fprintf(stderr, "pdfras_batch: out of memory\n");
+		return 0;
+	}
+	memcpy(jobs, batch->jobs, batch->njobs * sizeof *jobs);
+	qsort(jobs, batch->njobs, sizeof *jobs, compare_base_names);
+	int ok = 1;
+	for (int j = 1; j < batch->njobs; j++) {
+		if (compare_base_names(&jobs[j - 1], &jobs[j]) == 0) {
+			fprintf(stderr, "pdfras_batch: %s and %s would both be written to %s%c%s\n",
+				jobs[j - 1].name, jobs[j].name, batch->opts.outdir, PATH_SEP, base_name(jobs[j].name));
+			ok = 0;
+		}
+	}
+	free(jobs);
+	return ok;
+}
+
+// add the .pdf files in directory dir, in name order
+static int add_directory(t_batch* batch, int* capacity, const char* dir)
+{
+	char** names = NULL;
+	int count = 0, size = 0, ok = 1;
+	char path[MAX_PATH_LEN];
+#ifdef WIN32
+	WIN32_FIND_DATAA found;
+	snprintf(path, sizeof path, "%s\\*.pdf", dir);
+	HANDLE h = FindFirstFileA(path, &found);
+	if (h == INVALID_HANDLE_VALUE) {
+		return 1;
+	}
+	do {
+		const char* name = found.cFileName;
+		if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+#else
+	DIR* d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "pdfras_batch: can't read directory %s\n", dir);
+		return 0;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(d)) != NULL) {
+		const char* name = entry->d_name;
+#endif
+		if (!has_pdf_extension(name)) continue;
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			char** more = (char**)realloc(names, size * sizeof *names);
+			if (!more) { ok = 0; break; }
+			names = more;
+		}
+		snprintf(path, sizeof path, "%s%c%s", dir, PATH_SEP, name);
+		if (!(names[count] = copy_string(path))) { ok = 0; break; }
+		count++;
+#ifdef WIN32
+	} while (FindNextFileA(h, &found));
+	FindClose(h);
+#else
+	}
+	closedir(d);
+#endif
+	qsort(names, count, sizeof *names, compare_names);
+	for (int i = 0; i < count; i++) {
+		ok = ok && add_job(batch, capacity, names[i]);
+		free(names[i]);
+	}
+	free(names);
+	return ok;
+}
+
+static int add_path(t_batch* batch, int* capacity, const char* path)
+{
+	if (is_directory(path)) {
+		return add_directory(batch, capacity, path);
+	}
+	return add_job(batch, capacity, path);
+}
+
+// add the files or directories named in listfile, one per line ("-" = stdin)
+static int add_list(t_batch* batch, int* capacity, const char* listfile)
+{
+	FILE* f = strcmp(listfile, "-") == 0 ? stdin : fopen(listfile, "r");
+	if (!f) {
+		fprintf(stderr, "pdfras_batch: can't open list %s\n", listfile);
+		return 0;
+	}
+	char line[MAX_PATH_LEN];
+	int ok = 1;
+	while (ok && fgets(line, sizeof line, f)) {
+		size_t len = strlen(line);
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+			line[--len] = 0;
+		}
+		if (len) {
+			ok = add_path(batch, capacity, line);
+		}
+	}
+	if (f != stdin) {
+		fclose(f);
+	}
+	return ok;
+}
+
+///////////////////////////////////////////////////////////////////////
+// converting one file
+
+static int file_writer(const pduint8 *data, pduint32 offset, pduint32 len, void *cookie)
+{
+	FILE* fp = (FILE*)cookie;
+	if (!fp || !data || !len) {
+		return 0;
+	}
+	return (int)fwrite(data + offset, 1, len, fp);
+}
+
+static void *mymalloc(size_t bytes)
+{
+	return malloc(bytes);
+}
+
+static void myMemSet(void *ptr, pduint8 value, size_t count)
+{
+	memset(ptr, value, count);
+}
+
+static void report_error(const char* msg, int level, int err)
+{
+	fprintf(stderr, "pdfras_batch: encoder error %d (level %d): %s\n", err, level, msg);
+}
+
+static size_t bytes_per_row(int format, int width)
+{
+	switch (format) {
+	case PDFRAS_BITONAL:	return ((size_t)width + 7) / 8;
+	case PDFRAS_GRAY8:		return (size_t)width;
+	case PDFRAS_GRAY16:		return (size_t)width * 2;
+	case PDFRAS_RGB24:		return (size_t)width * 3;
+	case PDFRAS_RGB48:		return (size_t)width * 6;
+	default:				return 0;
+	}
+}
+
+// write the strips of one page, as they are or cut to a new height
+static int write_strips(t_worker* w, const t_sourcepage* page)
+{
+	const t_options* opts = &w->batch->opts;
+	t_sourcestrips* strips = &w->strips;
+	const pduint8* data = strips->data;
+
+	if (opts->strip_rows > 0 && page->compression == PDFRAS_UNCOMPRESSED) {
+		size_t rowbytes = bytes_per_row(page->format, page->width);
+		if (rowbytes * page->height != strips->total) {
+			return -1;
+		}
+		for (int y = 0; y < page->height; y += opts->strip_rows) {
+			int rows = page->height - y < opts->strip_rows ? page->height - y : opts->strip_rows;
+			if (pdfr_encoder_write_strip(w->enc, rows, data + y * rowbytes, rows * rowbytes) != 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+	for (int s = 0; s < strips->count; s++) {
+		if (pdfr_encoder_write_strip(w->enc, strips->rows[s], data, strips->size[s]) != 0) {
+			return -1;
+		}
+		data += strips->size[s];
+	}
+	return 0;
+}
+
+static int convert_page(t_worker* w, struct t_pdfrasreader* src, int p, const char* name)
+{
+	const t_options* opts = &w->batch->opts;
+	t_sourcepage page;
+	int status = page_source_page(src, p, &page);
+	if (status == PAGE_SOURCE_COLORSPACE) {
+		fprintf(stderr, "pdfras_batch: %s: page %d has a colorspace that can't be written\n", name, p + 1);
+		return -1;
+	}
+	if (status != 0) {
+		fprintf(stderr, "pdfras_batch: %s: page %d can't be read\n", name, p + 1);
+		return -1;
+	}
+	if (opts->compression >= 0 && page.compression != opts->compression) {
+		fprintf(stderr, "pdfras_batch: %s: page %d is %s, can't transcode to %s\n", name, p + 1,
+			compression_names[page.compression], compression_names[opts->compression]);
+		return -1;
+	}
+	if (page_source_read_strips(src, p, &w->strips) != 0) {
+		fprintf(stderr, "pdfras_batch: %s: can't read the strips of page %d\n", name, p + 1);
+		return -1;
+	}
+	if (opts->dpi > 0) {
+		page.xdpi = page.ydpi = opts->dpi;
+	}
+	if (page_sink_start_page(w->enc, &page) != 0 ||
+		write_strips(w, &page) != 0 ||
+		pdfr_encoder_end_page(w->enc) != 0) {
+		fprintf(stderr, "pdfras_batch: %s: can't write page %d\n", name, p + 1);
+		return -1;
+	}
+	return 0;
+}
+
+static void convert_file(t_worker* w, t_job* job)
+{
+	char outname[MAX_PATH_LEN];
+	double start = now();
+
+	snprintf(outname, sizeof outname, "%s%c%s", w->batch->opts.outdir, PATH_SEP, base_name(job->name));
+	// outdir can be the input's own directory, however it's spelled
+	if (same_file(outname, job->name)) {
+		fprintf(stderr, "pdfras_batch: %s: won't overwrite the input\n", job->name);
+		return;
+	}
+	job->bytes_in = file_size(job->name);
+	struct t_pdfrasreader* src = page_source_open(job->name);
+	if (!src) {
+		fprintf(stderr, "pdfras_batch: %s: can't open as PDF/raster\n", job->name);
+		return;
+	}
+	FILE* fp = fopen(outname, "wb");
+	if (!fp) {
+		fprintf(stderr, "pdfras_batch: %s: can't create %s\n", job->name, outname);
+		page_source_close(src);
+		return;
+	}
+	pdfr_encoder_reset(w->enc, fp);
+	pdfr_encoder_set_creator(w->enc, "pdfras_batch");
+
+	int pages = page_source_page_count(src);
+	int ok = pages >= 0;
+	for (int p = 0; ok && p < pages; p++) {
+		ok = convert_page(w, src, p, job->name) == 0;
+	}
+	if (ok) {
+		pdfr_encoder_end_document(w->enc);
+		job->bytes_out = pdfr_encoder_bytes_written(w->enc);
+	}
+	page_source_close(src);
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		remove(outname);
+		return;
+	}
+	job->ok = 1;
+	job->pages = pages;
+	job->seconds = now() - start;
+}
+
+static void report_file(t_batch* batch, const t_job* job)
+{
+	if (batch->opts.quiet || !job->ok) {
+		return;
+	}
+	double secs = job->seconds > 0 ? job->seconds : 1e-9;
+	mutex_lock(&batch->print_lock);
+	printf("%s: %d pages, %.3f s, %.1f pages/s, %.2f MB/s in, %.2f MB/s out, peak RSS %.1f MB\n",
+		job->name, job->pages, job->seconds, job->pages / secs,
+		job->bytes_in / MB / secs, job->bytes_out / MB / secs, peak_rss());
+	fflush(stdout);
+	mutex_unlock(&batch->print_lock);
+}
+
+///////////////////////////////////////////////////////////////////////
+// the work-stealing pool
+
+// take the next job from our own queue, -1 if it's empty
+static int pop_job(t_worker* w)
+{
+	int job = -1;
+	mutex_lock(&w->queue.lock);
+	if (w->queue.bottom > w->queue.top) {
+		job = w->queue.jobs[--w->queue.bottom];
+	}
+	mutex_unlock(&w->queue.lock);
+	return job;
+}
+
+// take the oldest job from another worker's queue, -1 if they're all empty
+static int steal_job(t_worker* w)
+{
+	t_batch* batch = w->batch;
+	for (int i = 1; i < batch->nworkers; i++) {
+		t_deque* victim = &batch->workers[(w->index + i) % batch->nworkers].queue;
+		int job = -1;
+		mutex_lock(&victim->lock);
+		if (victim->bottom > victim->top) {
+			job = victim->jobs[victim->top++];
+		}
+		mutex_unlock(&victim->lock);
+		if (job >= 0) {
+			w->steals++;
+			return job;
+		}
+	}
+	return -1;
+}
+
+static THREAD_PROC worker_proc(void* arg)
+{
+	t_worker* w = (t_worker*)arg;
+	// All jobs are queued before the workers start, and jobs don't make
+	// more jobs, so once every queue is empty the worker is done.
+	for (;;) {
+		int job = pop_job(w);
+		if (job < 0) {
+			job = steal_job(w);
+		}
+		if (job < 0) {
+			break;
+		}
+		convert_file(w, &w->batch->jobs[job]);
+		report_file(w->batch, &w->batch->jobs[job]);
+		w->files++;
+	}
+	return 0;
+}
+
+static int init_worker(t_batch* batch, int index)
+{
+	t_worker* w = &batch->workers[index];
+	memset(w, 0, sizeof *w);
+	w->batch = batch;
+	w->index = index;
+	w->os.alloc = mymalloc;
+	w->os.free = free;
+	w->os.memset = myMemSet;
+	w->os.reportError = report_error;
+	w->os.writeout = file_writer;
+	w->os.writeoutcookie = NULL;
+	w->enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &w->os);
+	// deal the jobs out round-robin, the owner takes from the
+	// bottom so put them in backwards to go through them in order
+	w->queue.jobs = (int*)malloc((batch->njobs / batch->nworkers + 1) * sizeof(int));
+	if (!w->enc || !w->queue.jobs) {
+		return 0;
+	}
+	for (int j = batch->njobs - 1; j >= 0; j--) {
+		if (j % batch->nworkers == index) {
+			w->queue.jobs[w->queue.bottom++] = j;
+		}
+	}
+	mutex_init(&w->queue.lock);
+	return 1;
+}
+
+static void free_worker(t_worker* w)
+{
+	if (w->enc) {
+		pdfr_encoder_destroy(w->enc);
+		mutex_destroy(&w->queue.lock);
+	}
+	free(w->queue.jobs);
+	page_source_strips_free(&w->strips);
+}
+
+///////////////////////////////////////////////////////////////////////
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: pdfras_batch [options] -o outdir (file | directory)...\n"
+		"Re-encode PDF/raster files into outdir, with the same names, so no two inputs can have the same name.\n"
+		"A directory stands for the .pdf files in it.\n"
+		"  -o dir        output directory (required)\n"
+		"  -l listfile   also convert the files or directories listed in listfile, one per line (- = stdin)\n"
+		"  -c comp       keep (default), none, jpeg or g4: the compression every page must have.\n"
+		"                Strip data is copied, not transcoded, so other pages fail.\n"
+		"  -r dpi        new resolution for every page, or keep (default)\n"
+		"  -s rows       strip height for uncompressed pages (compressed strips are kept)\n"
+		"  -j threads    number of worker threads (default: one per processor)\n"
+		"  -q            only report the totals\n");
+}
+
+static int parse_compression(const char* s)
+{
+	if (strcmp(s, "keep") == 0) return -1;
+	for (int i = 0; i < (int)(sizeof compression_names / sizeof compression_names[0]); i++) {
+		if (strcmp(s, compression_names[i]) == 0) return i;
+	}
+	return -2;
+}
+
+int main(int argc, char* argv[])
+{
+	t_batch batch;
+	int capacity = 0;
+	int threads = 0;
+	int ok = 1;
+
+	memset(&batch, 0, sizeof batch);
+	batch.opts.compression = -1;
+
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+		const char* opt = argv[i];
+		if (strcmp(opt, "-q") == 0) {
+			batch.opts.quiet = 1;
+			continue;
+		}
+		if (opt[2] || i + 1 == argc) {
+			usage();
+			return 2;
+		}
+		const char* val = argv[++i];
+		switch (opt[1]) {
+		case 'o':
+			batch.opts.outdir = val;
+			break;
+		case 'l':
+			ok = ok && add_list(&batch, &capacity, val);
+			break;
+		case 'c':
+			batch.opts.compression = parse_compression(val);
+			if (batch.opts.compression < -1) {
+				usage();
+				return 2;
+			}
+			break;
+		case 'r':
+			batch.opts.dpi = strcmp(val, "keep") == 0 ? 0.0 : atof(val);
+			if (batch.opts.dpi < 0 || (batch.opts.dpi == 0 && strcmp(val, "keep") != 0)) {
+				usage();
+				return 2;
+			}
+			break;
+		case 's':
+			batch.opts.strip_rows = atoi(val);
+			if (batch.opts.strip_rows <= 0) {
+				usage();
+				return 2;
+			}
+			break;
+		case 'j':
+			threads = atoi(val);
+			if (threads <= 0) {
+				usage();
+				return 2;
+			}
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+	for (; i < argc; i++) {
+		ok = ok && add_path(&batch, &capacity, argv[i]);
+	}
+	if (!ok) {
+		return 1;
+	}
+	if (!batch.opts.outdir || batch.njobs == 0) {
+		usage();
+		return 2;
+	}
+	if (!is_directory(batch.opts.outdir)) {
+		fprintf(stderr, "pdfras_batch: %s is not a directory\n", batch.opts.outdir);
+		return 2;
+	}
+	if (!check_output_names(&batch)) {
+		return 2;
+	}
+
+	if (threads == 0) {
+		threads = processor_count();
+	}
+	if (threads > batch.njobs) threads = batch.njobs;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+	mutex_init(&batch.print_lock);
+	batch.nworkers = threads;
+	batch.workers = (t_worker*)calloc(threads, sizeof(t_worker));
+	for (int w = 0; ok && w < threads; w++) {
+		ok = init_worker(&batch, w);
+	}
+	if (!ok) {
+		fprintf(stderr, "pdfras_batch: out of memory\n");
+		return 1;
+	}
+
+	t_thread handles[MAX_THREADS];
+	double start = now();
+	int started = 0;
+	for (int w = 0; w < threads; w++) {
+		if (!start_thread(&handles[started], worker_proc, &batch.workers[w])) {
+			break;
+		}
+		started++;
+	}
+	if (started == 0) {
+		// run the whole batch on this thread
+		worker_proc(&batch.workers[0]);
+	}
+	for (int w = 0; w < started; w++) {
+		join_thread(handles[w]);
+	}
+	double elapsed = now() - start;
+
+	int done = 0, failed = 0, steals = 0, pages = 0;
+	double bytes_in = 0, bytes_out = 0;
+	for (int j = 0; j < batch.njobs; j++) {
+		const t_job* job = &batch.jobs[j];
+		if (job->ok) {
+			done++;
+			pages += job->pages;
+			bytes_in += job->bytes_in;
+			bytes_out += job->bytes_out;
+		}
+		else {
+			failed++;
+		}
+	}
+	for (int w = 0; w < threads; w++) {
+		steals += batch.workers[w].steals;
+	}
+	if (elapsed <= 0) elapsed = 1e-9;
+	printf("%d files converted, %d failed, %d pages, %d threads (%d files stolen)\n",
+		done, failed, pages, threads, steals);
+	printf("%.3f s, %.1f pages/s, %.2f MB/s in, %.2f MB/s out, peak RSS %.1f MB\n",
+		elapsed, pages / elapsed, bytes_in / MB / elapsed, bytes_out / MB / elapsed, peak_rss());
+
+	for (int w = 0; w < threads; w++) {
+		free_worker(&batch.workers[w]);
+	}
+	free(batch.workers);
+	for (int j = 0; j < batch.njobs; j++) {
+		free(batch.jobs[j].name);
+	}
+	free(batch.jobs);
+	mutex_destroy(&batch.print_lock);
+	return failed ? 1 : 0;
+}
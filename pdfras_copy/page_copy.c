@@ -0,0 +1,63 @@
+// page_copy.c : copy pages from a PDF/raster reader to an encoder, see page_copy.h
+
+#include <stdlib.h>
+
+#include "PdfRaster.h"
+#include "page_source.h"
+#include "page_copy.h"
+
+// copy one page, reading its strips into *pbuf, which is grown as needed
+static int copy_page(struct t_pdfrasreader* reader, int p, t_pdfrasencoder* enc, pduint8** pbuf, size_t* pbufsize)
+{
+	t_sourcepage page;
+	int status = page_source_page(reader, p, &page);
+	if (status != 0) {
+		return status;
+	}
+	if (page.max_strip_size > *pbufsize) {
+		pduint8* buf = (pduint8*)realloc(*pbuf, page.max_strip_size);
+		if (!buf) {
+			return -1;
+		}
+		*pbuf = buf;
+		*pbufsize = page.max_strip_size;
+	}
+	if (page_sink_start_page(enc, &page) != 0) {
+		return -1;
+	}
+	for (int s = 0; s < page.strips; s++) {
+		int rows;
+		size_t len = page_source_strip(reader, p, s, *pbuf, *pbufsize, &rows);
+		if (len == 0 || pdfr_encoder_write_strip(enc, rows, *pbuf, len) != 0) {
+			return -1;
+		}
+	}
+	return pdfr_encoder_end_page(enc);
+}
+
+int pdfras_copy_page(struct t_pdfrasreader* reader, int p, t_pdfrasencoder* enc)
+{
+	pduint8* buf = NULL;
+	size_t bufsize = 0;
+	if (!reader || !enc || p < 0) {
+		return -1;
+	}
+	int status = copy_page(reader, p, enc, &buf, &bufsize);
+	free(buf);
+	return status;
+}
+
+int pdfras_copy_pages(struct t_pdfrasreader* reader, int first, int count, t_pdfrasencoder* enc)
+{
+	pduint8* buf = NULL;
+	size_t bufsize = 0;
+	int copied = 0;
+	if (!reader || !enc || first < 0) {
+		return 0;
+	}
+	while (copied < count && copy_page(reader, first + copied, enc, &buf, &bufsize) == 0) {
+		copied++;
+	}
+	free(buf);
+	return copied;
+}
@@ -0,0 +1,38 @@
+#ifndef _H_page_copy
+#define _H_page_copy
+#pragma once
+
+// Copy pages from a PDF/raster reader to a PDF/raster encoder, to split
+// documents or merge them, without decoding or re-encoding anything:
+// the compressed data of each strip is passed straight through, and only
+// the page and strip dictionaries, page tree and xref table are written anew.
+//
+// A page keeps its pixel format, compression, width, height, resolution,
+// rotation, colorspace and strips. A page whose colorspace the encoder can't
+// write (e.g. /DeviceRGB) isn't copied, rather than copied as something else.
+// The source can be encrypted, strips are read decrypted. The output is
+// encrypted if the encoder is set up for it.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct t_pdfrasreader;
+struct t_pdfrasencoder;
+
+// Append page p (from 0) of the open reader to the document being written
+// by enc, as a page of its own: a page open in enc is ended first.
+// The encoder's settings for the next page are left as the copied page's.
+// Returns 0 on success, PAGE_SOURCE_COLORSPACE (see page_source.h) if the
+// encoder can't write the page's colorspace, -1 on any other failure.
+// A page that fails part way may have been started in enc.
+int pdfras_copy_page(struct t_pdfrasreader* reader, int p, struct t_pdfrasencoder* enc);
+
+// Append count pages, starting with page first, one by one as with pdfras_copy_page.
+// Returns the number of pages copied, which is less than count if one failed.
+int pdfras_copy_pages(struct t_pdfrasreader* reader, int first, int count, struct t_pdfrasencoder* enc);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
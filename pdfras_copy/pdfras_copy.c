@@ -0,0 +1,300 @@
+// pdfras_copy.c : split and merge PDF/raster files.
+//
+// usage: pdfras_copy [-n pages] -o output.pdf input[:range]...
+// The pages of the inputs (all of them, or a range of each) are copied in
+// order to output.pdf, or with -n to a series of files of that many pages
+// each: output-1.pdf, output-2.pdf and so on.
+// Pages are copied with pdfras_copy_page, which passes the compressed strip
+// data through as-is, so this is about as fast as the files can be read and written.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "PdfRaster.h"
+#include "page_source.h"
+#include "page_copy.h"
+
+#define MAX_PATH_LEN	4096
+
+static int file_writer(const pduint8 *data, pduint32 offset, pduint32 len, void *cookie)
+{
+	FILE* fp = (FILE*)cookie;
+	if (!fp || !data || !len) {
+		return 0;
+	}
+	return (int)fwrite(data + offset, 1, len, fp);
+}
+
+static void *mymalloc(size_t bytes)
+{
+	return malloc(bytes);
+}
+
+static void myMemSet(void *ptr, pduint8 value, size_t count)
+{
+	memset(ptr, value, count);
+}
+
+static void report_error(const char* msg, int level, int err)
+{
+	fprintf(stderr, "pdfras_copy: encoder error %d (level %d): %s\n", err, level, msg);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: pdfras_copy [-n pages] -o output.pdf input[:range]...\n"
+		"Copy the pages of the inputs, in order, to output.pdf.\n"
+		"A range is a page (3), a range of pages (2-5) or the pages from one to the end (4-),\n"
+		"numbered from 1. Without one, all the pages of an input are copied.\n"
+		"  -o file       output file (required)\n"
+		"  -n pages      split the output into files of this many pages:\n"
+		"                output-1.pdf, output-2.pdf, ...\n");
+}
+
+// TRUE if paths a and b name the same existing file, however they're spelled
+static int same_file(const char* a, const char* b)
+{
+#ifdef WIN32
+	BY_HANDLE_FILE_INFORMATION ia, ib;
+	int same = 0;
+	HANDLE ha = CreateFileA(a, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	HANDLE hb = CreateFileA(b, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (ha != INVALID_HANDLE_VALUE && hb != INVALID_HANDLE_VALUE &&
+		GetFileInformationByHandle(ha, &ia) && GetFileInformationByHandle(hb, &ib)) {
+		same = ia.dwVolumeSerialNumber == ib.dwVolumeSerialNumber &&
+			ia.nFileIndexHigh == ib.nFileIndexHigh && ia.nFileIndexLow == ib.nFileIndexLow;
+	}
+	if (ha != INVALID_HANDLE_VALUE) CloseHandle(ha);
+	if (hb != INVALID_HANDLE_VALUE) CloseHandle(hb);
+	return same;
+#else
+	struct stat sa, sb;
+	return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+// Split "name:range" into the name and a range of pages from 1, *plast = 0 for
+// up to the end. The name is the whole argument if it doesn't end in a valid range.
+static void parse_input(const char* arg, char* name, size_t namesize, int* pfirst, int* plast)
+{
+	*pfirst = 1;
+	*plast = 0;
+	snprintf(name, namesize, "%s", arg);
+	char* colon = strrchr(name, ':');
+	if (!colon) {
+		return;
+	}
+	char* end;
+	long first = strtol(colon + 1, &end, 10);
+	long last = first;
+	if (end == colon + 1 || first < 1) {
+		return;
+	}
+	if (*end == '-') {
+		const char* s = end + 1;
+		last = 0;
+		if (*s) {
+			last = strtol(s, &end, 10);
+			if (end == s || last < first) {
+				return;
+			}
+		}
+		else {
+			end++;
+		}
+	}
+	if (*end) {
+		return;
+	}
+	*colon = 0;
+	*pfirst = (int)first;
+	*plast = (int)last;
+}
+
+// name of output file number part (from 1) when splitting: out.pdf => out-<part>.pdf
+static void part_name(const char* output, int part, char* name, size_t namesize)
+{
+	const char* dot = strrchr(output, '.');
+	if (!dot || strchr(dot, '/') || strchr(dot, '\\')) {
+		dot = output + strlen(output);
+	}
+	snprintf(name, namesize, "%.*s-%d%s", (int)(dot - output), output, part, dot);
+}
+
+// the output, which is one file or a series of them
+typedef struct {
+	const char*		name;			// as given with -o
+	int				split;			// pages per file, 0 for one file
+	int				part;			// number of the current file, from 1
+	FILE*			fp;				// current file, NULL if none open
+	char			current[MAX_PATH_LEN];
+	t_OS			os;
+	t_pdfrasencoder* enc;
+	int				pages;			// pages written, in all
+	char**			inputs;			// the input arguments, none of which may be overwritten
+	int				ninputs;
+} t_output;
+
+// TRUE if file is one of the inputs
+static int is_input(const t_output* out, const char* file)
+{
+	char name[MAX_PATH_LEN];
+	int first, last;
+	for (int i = 0; i < out->ninputs; i++) {
+		parse_input(out->inputs[i], name, sizeof name, &first, &last);
+		if (same_file(file, name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int end_output(t_output* out)
+{
+	int ok = 1;
+	if (out->fp) {
+		pdfr_encoder_end_document(out->enc);
+		ok = fclose(out->fp) == 0;
+		if (ok) {
+			printf("%s: %d pages, %ld bytes\n", out->current, pdfr_encoder_page_count(out->enc),
+				pdfr_encoder_bytes_written(out->enc));
+		}
+		out->fp = NULL;
+	}
+	return ok;
+}
+
+// get the output ready for the next page, starting a new file if need be
+static int next_page(t_output* out)
+{
+	if (out->fp && (out->split == 0 || pdfr_encoder_page_count(out->enc) < out->split)) {
+		return 1;
+	}
+	if (!end_output(out)) {
+		return 0;
+	}
+	if (out->split) {
+		part_name(out->name, ++out->part, out->current, sizeof out->current);
+	}
+	else {
+		snprintf(out->current, sizeof out->current, "%s", out->name);
+	}
+	if (is_input(out, out->current)) {
+		fprintf(stderr, "pdfras_copy: won't overwrite the input %s\n", out->current);
+		return 0;
+	}
+	out->fp = fopen(out->current, "wb");
+	if (!out->fp) {
+		fprintf(stderr, "pdfras_copy: can't create %s\n", out->current);
+		return 0;
+	}
+	pdfr_encoder_reset(out->enc, out->fp);
+	pdfr_encoder_set_creator(out->enc, "pdfras_copy");
+	return 1;
+}
+
+static int copy_input(t_output* out, const char* arg)
+{
+	char name[MAX_PATH_LEN];
+	int first, last;
+	parse_input(arg, name, sizeof name, &first, &last);
+	// an input that doesn't exist yet could turn out to be the output
+	if (out->fp && same_file(name, out->current)) {
+		fprintf(stderr, "pdfras_copy: %s: is the output\n", name);
+		return 0;
+	}
+	struct t_pdfrasreader* reader = page_source_open(name);
+	if (!reader) {
+		fprintf(stderr, "pdfras_copy: %s: can't open as PDF/raster\n", name);
+		return 0;
+	}
+	int pages = page_source_page_count(reader);
+	if (last == 0) {
+		last = pages;
+	}
+	int ok = 1;
+	if (pages <= 0 || last > pages) {
+		fprintf(stderr, "pdfras_copy: %s: has %d pages\n", name, pages);
+		ok = 0;
+	}
+	for (int p = first - 1; ok && p < last; p++) {
+		ok = next_page(out);
+		int status = ok ? pdfras_copy_page(reader, p, out->enc) : 0;
+		if (status == PAGE_SOURCE_COLORSPACE) {
+			fprintf(stderr, "pdfras_copy: %s: page %d has a colorspace that can't be written\n", name, p + 1);
+			ok = 0;
+		}
+		else if (status != 0) {
+			fprintf(stderr, "pdfras_copy: %s: can't copy page %d\n", name, p + 1);
+			ok = 0;
+		}
+		out->pages += ok;
+	}
+	page_source_close(reader);
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	t_output out;
+	memset(&out, 0, sizeof out);
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out.name = argv[++i];
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			out.split = atoi(argv[++i]);
+			if (out.split <= 0) {
+				usage();
+				return 2;
+			}
+		}
+		else {
+			usage();
+			return 2;
+		}
+	}
+	if (!out.name || i == argc) {
+		usage();
+		return 2;
+	}
+	out.inputs = argv + i;
+	out.ninputs = argc - i;
+	out.os.alloc = mymalloc;
+	out.os.free = free;
+	out.os.memset = myMemSet;
+	out.os.reportError = report_error;
+	out.os.writeout = file_writer;
+	out.os.writeoutcookie = NULL;
+	out.enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &out.os);
+	if (!out.enc) {
+		fprintf(stderr, "pdfras_copy: can't create an encoder\n");
+		return 1;
+	}
+	int ok = 1;
+	for (; ok && i < argc; i++) {
+		ok = copy_input(&out, argv[i]);
+	}
+	if (ok && out.pages == 0) {
+		fprintf(stderr, "pdfras_copy: no pages to copy\n");
+		ok = 0;
+	}
+	if (ok) {
+		ok = end_output(&out);
+	}
+	else if (out.fp) {
+		// don't leave a broken file behind
+		fclose(out.fp);
+		remove(out.current);
+	}
+	pdfr_encoder_destroy(out.enc);
+	return ok ? 0 : 1;
+}
@@ -1,10 +1,13 @@
 #include "pdfrasread.h"
+#include "PdfAES.h"
+#include "PdfSHA2.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
 #include <limits.h>
+#include <time.h>
 
 #define MIN(a,b) ((a)<(b) ? (a) : (b))
 #define MAX(a,b) ((a)>(b) ? (a) : (b))
@@ -16,7 +19,32 @@
 ///////////////////////////////////////////////////////////////////////
 // Internal Constants
 
-#define PDFRASREAD_VERSION "0.7.9.0"
+#define PDFRASREAD_VERSION "0.9.8.3"
+// 0.9.8.3  agent   2026.10.19  fix! pdfrasread_create_cursor walked every page again for each cursor: now only the first.
+// 0.9.8.2  agent   2026.10.19  fix! pdfrasread_stream kept 52 bytes per object, in arrays that doubled, and read
+//                              the whole xref table at the end: now 9 bytes per object, in chunks, and one entry at a time.
+// 0.9.8.1  agent   2026.10.19  fix! pdfrasread_validate kept every block it read, and every strip until the end:
+//                              it keeps the last 1 MB read now, and checks a page's strips with the page.
+// 0.9.8.0  agent   2026.10.19  new: pdfrasread_page_icc_profile. ICC profiles are read once per reader, shared, and freed at close.
+//                              Their headers are checked, a warning (READ_ICC_PROFILE) reports one that is wrong.
+// 0.9.7.0  agent   2026.10.19  new: pdfrasread_probe - page count etc. from the trailer, without loading the xref table.
+// 0.9.6.0  agent   2026.10.19  new: pdfrasread_page_colorspace - the colorspace of a page and its parameters.
+// 0.9.5.0  agent   2026.10.19  new: pdfrasread_stream - read a document front to back, from a source that can't seek.
+// 0.9.4.0  agent   2026.10.19  new: pdfrasread_validate - validation that collects all violations.
+// 0.9.3.0  agent   2026.10.19  new: pdfrasread_strip_height
+//                              fix! strip /Filter was never parsed, pdfrasread_strip_compression always failed.
+// 0.9.2.0  agent   2026.10.18  new: pdfrasread_open_with_password, pdfrasread_open_with_key -
+//                              AES-256 (/V 5 /R 6) encrypted files, strips are decrypted in place.
+// 0.9.1.0  agent   2026.10.18  new: pdfrasread_read_raw_strips, with optional vectored source reads.
+// 0.9.0.0  agent   2026.10.18  new: pdfrasread_create_cursor - cursors share one open document
+//                              across threads. file reader uses positional reads (pread).
+// 0.8.2.0  agent   2026.10.18  global error handler is set & read atomically, readers inherit
+//                              it when created. Documented thread safety.
+// 0.8.1.0  agent   2026.10.18  page tree walk uses an explicit stack, detects cycles,
+//                              has a settable depth limit: pdfrasread_set_max_page_tree_depth
+// 0.8.0.0  agent   2026.10.18  page table is built lazily, on demand - open no longer walks
+//                              the whole page tree. /Count of each node is used to skip subtrees.
+//                              fix! advance_buffer didn't update buffer offset (whitespace across blocks)
 // 0.7.9.0  spike   2016.09.23  look for PDF-raster marker in last TAILSIZE bytes
 // 0.7.8.0  spike   2016.09.23  handle PDF comments! (treat as whitespace)
 // 0.7.7.0  spike   2016.09.05  slighly improved & simplified dict & stream parsing.
@@ -59,6 +87,14 @@
 // to read the big objects like strips.
 #define BLOCK_SIZE 1024
 
+// largest gap between the data of two strips that pdfrasread_read_raw_strips
+// will read through (and discard) to fetch both strips with one read.
+#define MAX_STRIP_GAP 4096
+
+// default for the deepest page tree we will descend into.
+// Settable per reader, see pdfrasread_set_max_page_tree_depth.
+#define DEFAULT_MAX_PAGE_TREE_DEPTH 64
+
 ///////////////////////////////////////////////////////////////////////
 // Data Structures & Types
 
@@ -72,7 +108,23 @@ typedef struct t_xref_entry {
 	char		eol[2];                     // either <space>LF or CR,LF
 } t_xref_entry;
 
-typedef struct _ICCProfile ICCProfile;
+// What pdfrasread_stream has found out about OBJ_CHUNK consecutive object numbers.
+// The table is kept in chunks, so that it grows without being copied.
+#define OBJ_CHUNK 4096
+typedef struct {
+	pduint32	pos[OBJ_CHUNK];				// position of each object, 0 if not found (yet)
+	pduint32	value[OBJ_CHUNK];			// depends on kind, see t_streamedkind
+	pduint8		kind[OBJ_CHUNK];			// a t_streamedkind
+} t_objchunk;
+
+// An ICC profile, shared by all the colorspaces that refer to it, see get_icc_profile
+typedef struct _ICCProfile {
+    long                refs;               // reference count, the reader's cache holds one
+    unsigned long       num;                // object number of the profile stream, 0 if it is direct
+    pduint32            pos;                // position of the profile stream
+    size_t              len;                // size of the profile
+    pduint8*            data;               // the profile (allocated with this struct)
+} ICCProfile;
 
 typedef struct t_colorspace {
     enum { CS_CALGRAY, CS_DEVICEGRAY, CS_CALRGB, CS_DEVICERGB, CS_ICCBASED } style;
@@ -81,7 +133,7 @@ typedef struct t_colorspace {
     double				blackPoint[3];
     double              gamma;              // Gamma exponent (all?)
     double              matrix[9];          // 3x3 matrix (CALRGB only)
-    ICCProfile*         piccProfile;        // pointer to ICC profile (ICCBASED only)
+    ICCProfile*         piccProfile;        // ICC profile, from the reader's cache (ICCBASED only)
 } t_colorspace;
 
 // All the information about a single page and the image it contains
@@ -108,13 +160,25 @@ typedef struct {
     t_colorspace        cs;                 // colorspace
     unsigned long       width;
     unsigned long       height;             // of this strip
+    long                buffer_size;        // buffer needed to read the strip (raw_size, less the IV if encrypted)
 } t_pdfstripinfo;
 
+// One level of the page tree walk: a /Pages node and how far we are through its /Kids
+typedef struct {
+	unsigned long		num;				// object number of the node
+	pduint32			node;				// position of the node
+	long				first;				// index of first page under node
+	long				count;				// /Count of node
+	pduint32			kids;				// position in node's /Kids array of next kid
+	long				index;				// index of first page under that next kid
+} t_pagecursor;
+
 // Structure that represents a PDF/raster byte-stream that is open for reading
 typedef struct t_pdfrasreader {
     int                 sig;                // safety/validity signature
 	int					apiLevel;			// caller's specified API level.
 	pdfras_freader		fread;				// function to read from source
+	pdfras_freadv		freadv;				// optional function to read a range into several buffers
     pdfras_fsizer       fsize;              // function to get size of source
 	pdfras_fcloser		fclose;				// function to close source
     pdfras_err_handler  error_handler;      // external error-reporting callback
@@ -130,15 +194,70 @@ typedef struct t_pdfrasreader {
 	// cross-reference table
 	unsigned long		numxrefs;			// number of entries in xref table
 	t_xref_entry*		xrefs;				// xref table (initially NULL, freed at close)
+	pduint32			xref_entries;		// while probing, position of the xref entries, which are read one at a time
+	t_objchunk**		objchunks;			// while streaming, the objects found, instead of an xref table
 	// page table
 	long				page_count;			// actual page count, or -1 for 'unknown'
-	pduint32*			page_table;			// table of page positions (freed at close)
+	pduint32			page_root;			// position of root node of page tree
+	unsigned long		page_root_num;		// object number of root node of page tree
+	pduint32*			page_table;			// table of page positions, 0 = not found yet (freed at close)
+	// page tree walk, see find_page
+	int					max_page_depth;		// deepest page tree node we'll visit (root = 0)
+	t_pagecursor*		page_stack;			// path from root to node being scanned (freed at close)
+	int					page_depth;			// number of entries in page_stack
+	unsigned char*		page_visited;		// bitmap by object number of nodes on page_stack (freed at close)
+	// decryption, see setup_decryption
+	pduint32			encrypt_pos;		// position of the /Encrypt dictionary, 0 if none
+	pdbool				encrypted;			// strips and other streams must be decrypted
+	pduint8				file_key[32];		// the document's AES-256 file key (if encrypted)
+	t_pdaeskey			aes;				// file_key, expanded
+	// sharing, see pdfrasread_create_cursor
+	struct t_pdfrasreader* document;		// if this is a cursor, the reader whose document it shares
+	volatile long		cursors;			// number of open cursors sharing this reader's document
+	volatile long		pages_found;		// every page is in page_table, which won't change again
+	// validation, see pdfrasread_validate
+	t_pdfrasread_validation* validation;	// where violations go while validating, else NULL
+	int					validate_flags;		// RASREAD_VALIDATE_ flags while validating
+	// ICC profiles, see get_icc_profile
+	ICCProfile**		icc_profiles;		// profiles read so far, each holding a reference (released at close)
+	int					icc_count;			// entries in icc_profiles
+	int					icc_capacity;		// entries allocated at icc_profiles
 } t_pdfrasreader;
 
+// While streaming, what has been found out about object num
+#define OBJ_POS(r, num)		((r)->objchunks[(num) / OBJ_CHUNK]->pos[(num) % OBJ_CHUNK])
+#define OBJ_VALUE(r, num)	((r)->objchunks[(num) / OBJ_CHUNK]->value[(num) % OBJ_CHUNK])
+#define OBJ_KIND(r, num)	((r)->objchunks[(num) / OBJ_CHUNK]->kind[(num) % OBJ_CHUNK])
+
 ///////////////////////////////////////////////////////////////////////
 // Global (gasp!) variables
 
-static pdfras_err_handler global_error_handler = pdfrasread_default_error_handler;
+// The global error handler can be set by one thread while others are
+// reporting errors or creating readers, so it is only accessed atomically,
+// through get_global_error_handler and pdfrasread_set_global_error_handler.
+static pdfras_err_handler volatile global_error_handler = pdfrasread_default_error_handler;
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ATOMIC_LOAD_PTR(pp)			_InterlockedCompareExchangePointer((void* volatile*)(pp), NULL, NULL)
+#define ATOMIC_STORE_PTR(pp, p)		_InterlockedExchangePointer((void* volatile*)(pp), (void*)(p))
+#define ATOMIC_INC(pl)				_InterlockedIncrement(pl)
+#define ATOMIC_DEC(pl)				_InterlockedDecrement(pl)
+#define ATOMIC_LOAD(pl)				_InterlockedCompareExchange((pl), 0, 0)
+#define ATOMIC_STORE(pl, l)			_InterlockedExchange((pl), (l))
+#else
+#define ATOMIC_LOAD_PTR(pp)			__atomic_load_n((pp), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_PTR(pp, p)		__atomic_store_n((pp), (p), __ATOMIC_RELEASE)
+#define ATOMIC_INC(pl)				__atomic_add_fetch((pl), 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_DEC(pl)				__atomic_sub_fetch((pl), 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_LOAD(pl)				__atomic_load_n((pl), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(pl, l)			__atomic_store_n((pl), (l), __ATOMIC_RELEASE)
+#endif
+
+static pdfras_err_handler get_global_error_handler(void)
+{
+    return (pdfras_err_handler)ATOMIC_LOAD_PTR(&global_error_handler);
+}
 
 ///////////////////////////////////////////////////////////////////////
 // Functions
@@ -163,6 +282,25 @@ static const char * memrstr(const char* start, const char* end, const char * nee
     return NULL;
 }
 
+// Find the first occurrence of string in data between start and end pointers, and
+// return a pointer to it.  If not found, return NULL.
+static const char * memstr(const char* start, const char* end, const char * needle)
+{
+    size_t ncmp = strlen(needle);
+    end -= ncmp;
+    while (start <= end) {
+        start = (const char*)memchr(start, needle[0], end - start + 1);
+        if (!start) {
+            break;
+        }
+        if (memcmp(start, needle, ncmp) == 0) {
+            return start;
+        }
+        ++start;
+    }
+    return NULL;
+}
+
 static unsigned long ulmax(unsigned long a, unsigned long b)
 {
 	return (a >= b) ? a : b;
@@ -268,7 +406,7 @@ static void io_error(t_pdfrasreader* reader, int code, pduint32 hint)
         reader->error_handler(reader, REPORTING_IO, code, hint);
     }
     else {
-        global_error_handler(NULL, REPORTING_IO, code, hint);
+        get_global_error_handler()(NULL, REPORTING_IO, code, hint);
     }
 }
 
@@ -278,7 +416,7 @@ static void memory_error(t_pdfrasreader* reader, pduint32 hint)
         reader->error_handler(reader, REPORTING_MEMORY, READ_MEMORY_MALLOC, hint);
     }
     else {
-        global_error_handler(NULL, REPORTING_MEMORY, READ_MEMORY_MALLOC, hint);
+        get_global_error_handler()(NULL, REPORTING_MEMORY, READ_MEMORY_MALLOC, hint);
     }
 }
 
@@ -288,7 +426,7 @@ static void internal_error(t_pdfrasreader* reader, int code, pduint32 line)
         reader->error_handler(reader, REPORTING_INTERNAL, code, line);
     }
     else {
-        global_error_handler(NULL, REPORTING_INTERNAL, code, line);
+        get_global_error_handler()(NULL, REPORTING_INTERNAL, code, line);
     }
 }
 
@@ -298,7 +436,7 @@ static void api_error(t_pdfrasreader* reader, int code, pduint32 hint)
         reader->error_handler(reader, REPORTING_API, code, hint);
     }
     else {
-        global_error_handler(NULL, REPORTING_API, code, hint);
+        get_global_error_handler()(NULL, REPORTING_API, code, hint);
     }
 }
 
@@ -308,7 +446,7 @@ static void informational(t_pdfrasreader* reader, int code, pduint32 offset)
         reader->error_handler(reader, REPORTING_INFO, code, offset);
     }
     else {
-        global_error_handler(NULL, REPORTING_INFO, code, offset);
+        get_global_error_handler()(NULL, REPORTING_INFO, code, offset);
     }
 }
 
@@ -318,7 +456,7 @@ static void warning(t_pdfrasreader* reader, int code, pduint32 offset)
         reader->error_handler(reader, REPORTING_WARNING, code, offset);
     }
     else {
-        global_error_handler(NULL, REPORTING_WARNING, code, offset);
+        get_global_error_handler()(NULL, REPORTING_WARNING, code, offset);
     }
 }
 
@@ -329,7 +467,7 @@ static void compliance(t_pdfrasreader* reader, int code, pduint32 offset)
         reader->error_handler(reader, REPORTING_COMPLIANCE, code, offset);
     }
     else {
-        global_error_handler(NULL, REPORTING_COMPLIANCE, code, offset);
+        get_global_error_handler()(NULL, REPORTING_COMPLIANCE, code, offset);
     }
 }
 
@@ -418,6 +556,7 @@ static int advance_buffer(t_pdfrasreader* reader, pduint32* poff)
 {
     // Compute file position of next byte after current buffer:
     *poff = reader->buffer.off + reader->buffer.len;
+    reader->buffer.off = *poff;
     // Read into buffer as much as will fit (with trailing NUL) or up to EOF:
     reader->buffer.len = reader->fread(reader->source, *poff, sizeof reader->buffer.data - 1, reader->buffer.data);
     // NUL-terminate the buffer
@@ -455,7 +594,7 @@ static int peekch(t_pdfrasreader* reader, pduint32 off)
 	}
 	assert(off >= reader->buffer.off);
 	assert(off < reader->buffer.off + reader->buffer.len);
-	return reader->buffer.data[off - reader->buffer.off];
+	return (unsigned char)reader->buffer.data[off - reader->buffer.off];
 }
 
 // Get the next character in the file.
@@ -609,7 +748,9 @@ static int token_eat(t_pdfrasreader* reader, pduint32* poff, const char* lit)
 	assert(i <= reader->buffer.len);
 	while (TRUE) {
 		if (i == reader->buffer.len) {
-			if (!advance_buffer(reader, poff)) {
+			// (leaving *poff at the start of the token, in case it doesn't match)
+			pduint32 next;
+			if (!advance_buffer(reader, &next)) {
 				// end of file
 				return FALSE;
 			}
@@ -827,6 +968,104 @@ static int token_hex_string(t_pdfrasreader* reader, pduint32* poff)
 	return TRUE;
 }
 
+// Parse a literal or hexadecimal string and copy up to maxlen bytes of its value into buf.
+// If successful, advance *poff past the string, set *plen to the full length of the value
+// (which may be more than maxlen) and return TRUE.
+// Otherwise return FALSE and leave *poff unchanged.
+static int parse_string_value(t_pdfrasreader* reader, pduint32* poff, pduint8* buf, size_t maxlen, size_t* plen)
+{
+	pduint32 off = *poff;
+	size_t len = 0;
+	int ch = peekch(reader, off);
+	if ('<' == ch) {
+		int hi = -1;
+		while ((ch = nextch(reader, &off)) != '>') {
+			int d;
+			if (ch >= '0' && ch <= '9') d = ch - '0';
+			else if (ch >= 'A' && ch <= 'F') d = ch - 'A' + 10;
+			else if (ch >= 'a' && ch <= 'f') d = ch - 'a' + 10;
+			else if (isspace(ch)) continue;
+			else {
+				// unexpected character in hexadecimal string
+				compliance(reader, READ_HEXSTR_CHAR, off);
+				return FALSE;
+			}
+			if (hi < 0) {
+				hi = d;
+			}
+			else {
+				if (len < maxlen) buf[len] = (pduint8)(hi * 16 + d);
+				len++;
+				hi = -1;
+			}
+		}
+		if (hi >= 0) {
+			// odd number of digits, the last one is followed by an implied 0
+			if (len < maxlen) buf[len] = (pduint8)(hi * 16);
+			len++;
+		}
+	}
+	else if ('(' == ch) {
+		int nesting = 1;
+		for (;;) {
+			ch = nextch(reader, &off);
+			if (-1 == ch) {
+				// invalid PDF: unexpected EOF in literal string
+				compliance(reader, READ_LITSTR_EOF, *poff);
+				return FALSE;
+			}
+			if ('(' == ch) {
+				nesting++;
+			}
+			else if (')' == ch && --nesting == 0) {
+				break;
+			}
+			else if ('\\' == ch) {
+				ch = nextch(reader, &off);
+				switch (ch) {
+				case 'n': ch = '\n'; break;
+				case 'r': ch = '\r'; break;
+				case 't': ch = '\t'; break;
+				case 'b': ch = '\b'; break;
+				case 'f': ch = '\f'; break;
+				case 0x0D:
+					// backslash-EOL is a line continuation, not part of the string
+					if (peekch(reader, off + 1) == 0x0A) off++;
+					continue;
+				case 0x0A:
+					continue;
+				default:
+					if (ch >= '0' && ch <= '7') {
+						// up to 3 octal digits
+						int value = ch - '0';
+						for (int i = 1; i < 3 && peekch(reader, off + 1) >= '0' && peekch(reader, off + 1) <= '7'; i++) {
+							value = value * 8 + nextch(reader, &off) - '0';
+						}
+						ch = value & 0xFF;
+					}
+					// otherwise the backslash is ignored
+					break;
+				}
+			}
+			else if (0x0D == ch) {
+				// an unescaped end-of-line is read as a single LF
+				if (peekch(reader, off + 1) == 0x0A) off++;
+				ch = 0x0A;
+			}
+			if (len < maxlen) buf[len] = (pduint8)ch;
+			len++;
+		}
+	}
+	else {
+		return FALSE;
+	}
+	nextch(reader, &off);
+	skip_whitespace(reader, &off);
+	*plen = len;
+	*poff = off;
+	return TRUE;
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Xref table access
 
@@ -839,7 +1078,7 @@ static int xref_lookup(t_pdfrasreader* reader, unsigned num, unsigned gen, pduin
 		// not in PDF/raster
 		return FALSE;
 	}
-	if (!reader->xrefs) {
+	if (!reader->xrefs && !reader->xref_entries && !reader->objchunks) {
 		// internal error: no xref table loaded
         internal_error(reader, READ_INTERNAL_XREF_TABLE, __LINE__);
 		return FALSE;
@@ -849,7 +1088,27 @@ static int xref_lookup(t_pdfrasreader* reader, unsigned num, unsigned gen, pduin
 		return FALSE;
 	}
 	// parse the offset out of the indicated xref entry
-	pduint32 off = strtoul(reader->xrefs[num].offset, NULL, 10);
+	const char* entry = NULL;
+	t_xref_entry probed;
+	pduint32 off;
+	if (reader->objchunks) {
+		// streaming: an object not found yet is at 0, like a free entry
+		off = OBJ_POS(reader, num);
+	}
+	else {
+		if (reader->xrefs) {
+			entry = reader->xrefs[num].offset;
+		}
+		else {
+			// probing: read just this entry
+			if (reader->fread(reader->source, reader->xref_entries + 20 * num, sizeof probed, (char*)&probed) != sizeof probed) {
+				return FALSE;
+			}
+			// (the offset is followed by a space, which ends it)
+			entry = probed.offset;
+		}
+		off = strtoul(entry, NULL, 10);
+	}
 	// parse & verify the start of the object definition, which should be <num> <gen> obj:
 	unsigned long num2, gen2;
 	if (!token_ulong(reader, &off, &num2) ||
@@ -872,10 +1131,25 @@ static int xref_lookup(t_pdfrasreader* reader, unsigned num, unsigned gen, pduin
 static int object_skip(t_pdfrasreader* reader, pduint32 *poff);
 static int dictionary_lookup(t_pdfrasreader* reader, pduint32 off, const char* key, pduint32 *pvalpos);
 
-// Parse an indirect reference and return the resolved file offset in *pobjpos.
+// Parse an indirect reference, without looking it up, and return its object number in *pnum.
+// If successful returns TRUE (and advances *poff to point past the reference)
+// If not, returns FALSE and *poff is not changed.
+static int token_reference(t_pdfrasreader* reader, pduint32* poff, unsigned long *pnum)
+{
+	pduint32 off = *poff;
+	unsigned long gen;
+	if (token_ulong(reader, &off, pnum) && token_ulong(reader, &off, &gen) && token_eat(reader, &off, "R")) {
+		*poff = off;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// Parse an indirect reference and return the resolved file offset in *pobjpos,
+// and the object number in *pnum (if pnum is not NULL).
 // If successful returns TRUE (and advances *poff to point past the reference)
 // If not, returns FALSE, *poff is not changed and *pobjpos is undefined.
-static int parse_indirect_reference(t_pdfrasreader* reader, pduint32* poff, pduint32 *pobjpos)
+static int parse_indirect_reference_num(t_pdfrasreader* reader, pduint32* poff, unsigned long *pnum, pduint32 *pobjpos)
 {
 	pduint32 off = *poff;
 	unsigned long num, gen;
@@ -887,6 +1161,7 @@ static int parse_indirect_reference(t_pdfrasreader* reader, pduint32* poff, pdui
 		// and we already parsed it.
 		if (xref_lookup(reader, num, gen, pobjpos)) {
 			*poff = off;
+			if (pnum) *pnum = num;
 			return TRUE;
 		}
 		// invalid PDF - referenced object is not in cross-reference table
@@ -896,6 +1171,14 @@ static int parse_indirect_reference(t_pdfrasreader* reader, pduint32* poff, pdui
 	return FALSE;
 }
 
+// Parse an indirect reference and return the resolved file offset in *pobjpos.
+// If successful returns TRUE (and advances *poff to point past the reference)
+// If not, returns FALSE, *poff is not changed and *pobjpos is undefined.
+static int parse_indirect_reference(t_pdfrasreader* reader, pduint32* poff, pduint32 *pobjpos)
+{
+	return parse_indirect_reference_num(reader, poff, NULL, pobjpos);
+}
+
 // parse a direct OR indirect numeric object
 // if successful place it's value in *pdvalue, update *poff and return TRUE.
 // Otherwise set *pdvalue to 0, don't touch *poff and return FALSE.
@@ -964,19 +1247,13 @@ static int parse_dictionary(t_pdfrasreader* reader, pduint32 *poff)
 	return TRUE;
 }
 
-// Parse a dictionary or stream.
-// If successful, return TRUE and advance *poff over the object to the next token.
-// Otherwise return FALSE and leave *poff unchanged.
-// If a stream is found, set *pstream to the position of the stream data, and *plen to its length in bytes.
-// If a dictionary (not a stream) is found, *pstream and *plen are set to 0.
-// Note however that values are only returned through pstream or plen if those are non-NULL.
-static int parse_dictionary_or_stream(t_pdfrasreader* reader, pduint32 *poff, pduint32 *pstream, long* plen)
+// If the 'stream' keyword is at *poff, check the end-of-line after it,
+// advance *poff to the start of the stream data and return 1.
+// Return 0 if it isn't (leaving *poff unchanged), -1 (after reporting) if the
+// keyword is followed by something other than CRLF or LF.
+static int token_stream(t_pdfrasreader* reader, pduint32 *poff)
 {
 	pduint32 off = *poff;
-    if (!parse_dictionary(reader, &off)) {
-        // error already reported
-		return FALSE;
-	}
 	if (peekch(reader, off + 0) != 's' ||
 		peekch(reader, off + 1) != 't' ||
 		peekch(reader, off + 2) != 'r' ||
@@ -984,14 +1261,7 @@ static int parse_dictionary_or_stream(t_pdfrasreader* reader, pduint32 *poff, pd
 		peekch(reader, off + 4) != 'a' ||
 		peekch(reader, off + 5) != 'm' ||
 		!isspace(peekch(reader, off + 6))) {
-		// Valid dictionary, but not a stream.
-        // report stream pos & length as 0
-        // (if caller wants them)
-        if (pstream) *pstream = 0;
-        if (plen) *plen = 0;
-        // Update *poff to after dictionary
-		*poff = off;
-		return TRUE;
+		return 0;
 	}
 	off += 6;
 	// must be followed by exactly CRLF or LF
@@ -1000,15 +1270,46 @@ static int parse_dictionary_or_stream(t_pdfrasreader* reader, pduint32 *poff, pd
 		// CR must be followed by LF
 		if (nextch(reader, &off) != 0x0A) {
             compliance(reader, READ_STREAM_CRLF, off);
-			return FALSE;
+			return -1;
 		}
 	} else if (ch != 0x0A) {
 		// Alternative to CRLF is just LF
         compliance(reader, READ_STREAM_LINEBREAK, off);
-		return FALSE;
+		return -1;
 	}
 	// we're positioned at the LF, step over it.
-	off++;
+	*poff = off + 1;
+	return 1;
+}
+
+// Parse a dictionary or stream.
+// If successful, return TRUE and advance *poff over the object to the next token.
+// Otherwise return FALSE and leave *poff unchanged.
+// If a stream is found, set *pstream to the position of the stream data, and *plen to its length in bytes.
+// If a dictionary (not a stream) is found, *pstream and *plen are set to 0.
+// Note however that values are only returned through pstream or plen if those are non-NULL.
+static int parse_dictionary_or_stream(t_pdfrasreader* reader, pduint32 *poff, pduint32 *pstream, long* plen)
+{
+	pduint32 off = *poff;
+    if (!parse_dictionary(reader, &off)) {
+        // error already reported
+		return FALSE;
+	}
+	int found = token_stream(reader, &off);
+	if (found < 0) {
+		// error already reported
+		return FALSE;
+	}
+	if (!found) {
+		// Valid dictionary, but not a stream.
+        // report stream pos & length as 0
+        // (if caller wants them)
+        if (pstream) *pstream = 0;
+        if (plen) *plen = 0;
+        // Update *poff to after dictionary
+		*poff = off;
+		return TRUE;
+	}
 	pduint32 lenpos;
     // *poff is still start of dictionary
 	if (!dictionary_lookup(reader, *poff, "/Length", &lenpos)) {
@@ -1067,6 +1368,31 @@ static int parse_stream(t_pdfrasreader* reader, pduint32 *poff, pduint32 *pstrea
     return TRUE;
 }
 
+// Decrypt, in place, the len bytes of stream data that followed the 16-byte
+// initialization vector iv in an AESV3-encrypted stream, and strip the padding.
+// Return the length of the plaintext, or -1 if the data isn't validly encrypted
+// (which includes being encrypted with a different key).
+static long decrypt_data(t_pdfrasreader* reader, const pduint8* iv, pduint8* data, size_t len)
+{
+    pduint8 chain[PD_AES_BLOCK];
+    if (len == 0 || len % PD_AES_BLOCK != 0) {
+        return -1;
+    }
+    memcpy(chain, iv, PD_AES_BLOCK);
+    pd_aes_cbc_decrypt(&reader->aes, chain, data, data, len / PD_AES_BLOCK);
+    // the last block ends with n bytes of value n, 1 <= n <= 16
+    int pad = data[len - 1];
+    if (pad < 1 || pad > PD_AES_BLOCK) {
+        return -1;
+    }
+    for (size_t i = len - pad; i < len; i++) {
+        if (data[i] != pad) {
+            return -1;
+        }
+    }
+    return (long)(len - pad);
+}
+
 static int parse_array(t_pdfrasreader* reader, pduint32 *poff)
 {
 	skip_whitespace(reader, poff);
@@ -1254,9 +1580,34 @@ static int parse_calrgb_dictionary(t_pdfrasreader* reader, t_colorspace* pcs, pd
     return TRUE;
 }
 
+static void icc_profile_retain(ICCProfile* profile)
+{
+    if (profile) {
+        profile->refs++;
+    }
+}
+
+static void icc_profile_release(ICCProfile* profile)
+{
+    if (profile && --profile->refs == 0) {
+        free(profile);
+    }
+}
+
+// Check the header of an ICC profile: at least the 128-byte header, with the
+// profile's size in the first 4 bytes (big-endian) and the signature 'acsp' at 36.
+static int icc_profile_header_ok(const pduint8* data, size_t len)
+{
+    return len >= 128 &&
+        ((size_t)data[0] << 24 | (size_t)data[1] << 16 | (size_t)data[2] << 8 | data[3]) == len &&
+        0 == memcmp(data + 36, "acsp", 4);
+}
+
 // Parse an ICC Profile stream.
-// If successful, set *ppiccProfile to point to the loaded/decompressed profile,
-// advance *poff past the stream and return TRUE.
+// A stream that doesn't look like an ICC profile is reported as a warning
+// (READ_ICC_PROFILE), and used anyway.
+// If successful, set *ppiccProfile to a new profile holding the loaded/decompressed
+// data, with one reference, advance *poff past the stream and return TRUE.
 // Otherwise, report an appropriate compliance error
 // and return FALSE leaving *poff unmoved.
 static int parse_icc_profile(t_pdfrasreader* reader, pduint32 *poff, ICCProfile** ppiccProfile)
@@ -1269,18 +1620,101 @@ static int parse_icc_profile(t_pdfrasreader* reader, pduint32 *poff, ICCProfile*
         // compliance error already reported
         return FALSE;
     }
-    *ppiccProfile = (ICCProfile*)malloc((size_t)datalen);
-    if (!*ppiccProfile) {
+    ICCProfile* profile = (ICCProfile*)malloc(sizeof *profile + (size_t)datalen);
+    if (!profile) {
         memory_error(reader, __LINE__);
         return FALSE;
     }
-    // TODO: handle decompress/decrypt of Profile!
-    if (reader->fread(reader->source, datapos, datalen, (char*)*ppiccProfile) != datalen) {
+    profile->refs = 1;
+    profile->num = 0;
+    profile->pos = *poff;
+    profile->len = (size_t)datalen;
+    profile->data = (pduint8*)(profile + 1);
+    // TODO: handle decompress of Profile!
+    if (reader->fread(reader->source, datapos, datalen, (char*)profile->data) != datalen) {
         io_error(reader, READ_ICCPROFILE_READ, __LINE__);
-        free(*ppiccProfile); *ppiccProfile = NULL;
+        free(profile);
+        return FALSE;
+    }
+    if (reader->encrypted) {
+        // decrypt what follows the IV, then move it down over the IV
+        pduint8* data = profile->data;
+        long len = (datalen > PD_AES_BLOCK) ? decrypt_data(reader, data, data + PD_AES_BLOCK, datalen - PD_AES_BLOCK) : -1;
+        if (len < 0) {
+            compliance(reader, READ_DECRYPT, datapos);
+            free(profile);
+            return FALSE;
+        }
+        memmove(data, data + PD_AES_BLOCK, len);
+        profile->len = (size_t)len;
+    }
+    if (!icc_profile_header_ok(profile->data, profile->len)) {
+        warning(reader, READ_ICC_PROFILE, datapos);
+    }
+    *ppiccProfile = profile;
+    *poff = off;
+    return TRUE;
+}
+
+// Get the ICC profile at *poff - normally an indirect reference to the profile
+// stream - and advance *poff past it.
+// Profiles are cached by object number, so each is read only once, and all the
+// strips that refer to the same stream share it, which also makes their colorspaces
+// equal. *ppiccProfile belongs to the cache and is valid until the reader is closed,
+// use icc_profile_retain to keep it longer.
+// Return TRUE if successful, FALSE (after reporting) if not.
+static int get_icc_profile(t_pdfrasreader* reader, pduint32 *poff, ICCProfile** ppiccProfile)
+{
+    pduint32 off = *poff;
+    unsigned long num = 0;
+    if (token_reference(reader, &off, &num) && num != 0) {
+        for (int i = 0; i < reader->icc_count; i++) {
+            if (reader->icc_profiles[i]->num == num) {
+                *ppiccProfile = reader->icc_profiles[i];
+                *poff = off;
+                return TRUE;
+            }
+        }
+    }
+    // not read yet
+    off = *poff;
+    pduint32 pos = off;
+    if (!parse_indirect_reference_num(reader, &off, &num, &pos)) {
+        // a direct stream - not valid PDF, but read it anyway
+        num = 0;
+    }
+    ICCProfile* profile;
+    if (!parse_icc_profile(reader, &pos, &profile)) {
+        // already reported
         return FALSE;
     }
-    // TODO: validate that the data we read is actually an ICC Profile!
+    profile->num = num;
+    if (num == 0) {
+        off = pos;
+        // a direct stream can only be recognized by position
+        for (int i = 0; i < reader->icc_count; i++) {
+            if (reader->icc_profiles[i]->num == 0 && reader->icc_profiles[i]->pos == profile->pos) {
+                icc_profile_release(profile);
+                *ppiccProfile = reader->icc_profiles[i];
+                *poff = off;
+                return TRUE;
+            }
+        }
+    }
+    if (reader->icc_count == reader->icc_capacity) {
+        int capacity = reader->icc_capacity ? reader->icc_capacity * 2 : 4;
+        ICCProfile** profiles = (ICCProfile**)realloc(reader->icc_profiles, capacity * sizeof *profiles);
+        if (!profiles) {
+            icc_profile_release(profile);
+            memory_error(reader, __LINE__);
+            return FALSE;
+        }
+        reader->icc_profiles = profiles;
+        reader->icc_capacity = capacity;
+    }
+    // the cache keeps the new profile's reference
+    reader->icc_profiles[reader->icc_count++] = profile;
+    *ppiccProfile = profile;
     *poff = off;
     return TRUE;
 }
@@ -1322,14 +1756,7 @@ static int parse_color_space(t_pdfrasreader* reader, pduint32 *poff, t_colorspac
         }
         else if (token_eat(reader, poff, "/ICCBased")) {
             pcs->style = CS_ICCBASED;
-            pduint32 dict = *poff;
-            // could be an indirect reference
-            if (parse_indirect_reference(reader, poff, &dict)) {
-                if (!parse_icc_profile(reader, &dict, &pcs->piccProfile)) {
-                    return FALSE;
-                }
-            }
-            else if (!parse_icc_profile(reader, poff, &pcs->piccProfile)) {
+            if (!get_icc_profile(reader, poff, &pcs->piccProfile)) {
                 return FALSE;
             }
         }
@@ -1453,8 +1880,9 @@ static int object_skip(t_pdfrasreader* reader, pduint32 *poff)
 	return FALSE;
 }
 
-// Given a dictionary inline at pos, look up the specified key and return the file position of its value element.
-static int dictionary_lookup(t_pdfrasreader* reader, pduint32 off, const char* key, pduint32 *pvalpos)
+// Given a dictionary inline at pos, look up the specified key and return the file position
+// of its value element, without following it if it is an indirect reference.
+static int dictionary_find(t_pdfrasreader* reader, pduint32 off, const char* key, pduint32 *pvalpos)
 {
 	*pvalpos = 0;
 	if (!token_eat(reader, &off, "<<")) {
@@ -1465,18 +1893,6 @@ static int dictionary_lookup(t_pdfrasreader* reader, pduint32 off, const char* k
 		// does the key element match the key we're looking for?
 		if (token_eat(reader, &off, key)) {
 			// yes, bingo.
-			// check for indirect reference
-			unsigned long num, gen;
-			pduint32 p = off;
-			if (token_ulong(reader, &p, &num) && token_ulong(reader, &p, &gen) && token_eat(reader, &p, "R")) {
-				// indirect object!
-				// and we already parsed it.
-				if (!xref_lookup(reader, num, gen, &off)) {
-					// invalid PDF - referenced object is not in cross-reference table
-                    compliance(reader, READ_NO_SUCH_XREF, off);
-					return FALSE;
-				}
-			}
 			*pvalpos = off;
 			return TRUE;
 		} // otherwise skip over and ignore key
@@ -1495,6 +1911,40 @@ static int dictionary_lookup(t_pdfrasreader* reader, pduint32 off, const char* k
 	return FALSE;
 }
 
+// Given a dictionary inline at pos, look up the specified key and return the file position of its value element.
+// If the value is an indirect reference, *pnum receives the object number, otherwise *pnum is set to 0.
+static int dictionary_lookup_num(t_pdfrasreader* reader, pduint32 off, const char* key, unsigned long *pnum, pduint32 *pvalpos)
+{
+	*pnum = 0;
+	if (!dictionary_find(reader, off, key, &off)) {
+		*pvalpos = 0;
+		return FALSE;
+	}
+	// check for indirect reference
+	unsigned long num, gen;
+	pduint32 p = off;
+	if (token_ulong(reader, &p, &num) && token_ulong(reader, &p, &gen) && token_eat(reader, &p, "R")) {
+		// indirect object!
+		// and we already parsed it.
+		if (!xref_lookup(reader, num, gen, &off)) {
+			// invalid PDF - referenced object is not in cross-reference table
+            compliance(reader, READ_NO_SUCH_XREF, off);
+			*pvalpos = 0;
+			return FALSE;
+		}
+		*pnum = num;
+	}
+	*pvalpos = off;
+	return TRUE;
+}
+
+// Given a dictionary inline at pos, look up the specified key and return the file position of its value element.
+static int dictionary_lookup(t_pdfrasreader* reader, pduint32 off, const char* key, pduint32 *pvalpos)
+{
+	unsigned long num;
+	return dictionary_lookup_num(reader, off, key, &num, pvalpos);
+}
+
 // Parse the trailer dictionary.
 // TRUE if successful, FALSE otherwise
 static int read_trailer_dict(t_pdfrasreader* reader, pduint32 *poff)
@@ -1511,6 +1961,43 @@ static int read_trailer_dict(t_pdfrasreader* reader, pduint32 *poff)
     return TRUE;
 }
 
+// Validate xref entry e, which is at off in the file.
+// Return TRUE if valid, FALSE (after reporting) if not.
+static int validate_xref_entry(t_pdfrasreader* reader, pduint32 off, const t_xref_entry* entry, unsigned long e)
+{
+	char *offend, *genend;
+	pduint32 offset = strtoul(entry->offset, &offend, 10);
+	unsigned long gen = strtoul(entry->gen, &genend, 10);
+	// Note, we don't check for leading 0's on offset or gen.
+	if (offend != entry->gen ||
+		genend != entry->status ||
+		(entry->eol[0] != ' ' && entry->eol[0] != 0x0D) ||
+		(entry->eol[0] != 0x0D && entry->eol[1] != 0x0A) ||
+		entry->gen[0] != ' ' ||
+		entry->status[0] != ' ' ||
+		(entry->status[1] != 'n' && entry->status[1] != 'f')) {
+		// invalid xref table entry
+        compliance(reader, READ_XREF_ENTRY, off);
+        return FALSE;
+	}
+	if (e == 0) {
+		if (entry->status[1] != 'f' || gen != 65535) {
+			// object 0 must be free with gen=65535
+            compliance(reader, READ_XREF_ENTRY_ZERO, off);
+            return FALSE;
+		}
+	}
+	else {
+		if (gen != 0 && entry->status[1] != 'f') {
+			// PDF/raster restriction: in-use object generation must be 0
+			// (free entries can have gen != 0)
+            compliance(reader, READ_XREF_GEN0, off);
+            return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 // check an xref table for anything invalid and report the problem.
 // 'off' is the offset in the file of the first entry.
 // return TRUE if valid, FALSE otherwise.
@@ -1520,35 +2007,8 @@ static int validate_xref_table(t_pdfrasreader* reader, pduint32 off, t_xref_entr
 	unsigned long e;
 	// Sweep the xref table, validate entries.
 	for (e = 0; e < numxrefs; e++) {
-		char *offend, *genend;
-		pduint32 offset = strtoul(xrefs[e].offset, &offend, 10);
-		unsigned long gen = strtoul(xrefs[e].gen, &genend, 10);
-		// Note, we don't check for leading 0's on offset or gen.
-		if (offend != xrefs[e].gen ||
-			genend != xrefs[e].status ||
-			(xrefs[e].eol[0] != ' ' && xrefs[e].eol[0] != 0x0D) ||
-			(xrefs[e].eol[0] != 0x0D && xrefs[e].eol[1] != 0x0A) ||
-			xrefs[e].gen[0] != ' ' ||
-			xrefs[e].status[0] != ' ' ||
-			(xrefs[e].status[1] != 'n' && xrefs[e].status[1] != 'f')) {
-			// invalid xref table entry
-            compliance(reader, READ_XREF_ENTRY, off + e * 20);
-            return FALSE;
-		}
-		if (e == 0) {
-			if (xrefs[e].status[1] != 'f' || gen != 65535) {
-				// object 0 must be free with gen=65535
-                compliance(reader, READ_XREF_ENTRY_ZERO, off + e * 20);
-                return FALSE;
-			}
-		}
-		else {
-			if (gen != 0 && xrefs[e].status[1] != 'f') {
-				// PDF/raster restriction: in-use object generation must be 0
-				// (free entries can have gen != 0)
-                compliance(reader, READ_XREF_GEN0, off + e * 20);
-                return FALSE;
-			}
+		if (!validate_xref_entry(reader, off + e * 20, &xrefs[e], e)) {
+			return FALSE;
 		}
 	}
 	return TRUE;
@@ -1557,11 +2017,13 @@ static int validate_xref_table(t_pdfrasreader* reader, pduint32 off, t_xref_entr
 // Parse and load the xref table from given offset within the file.
 // Returns TRUE if successful, FALSE for any error.
 // All FALSE cases log a pertinent error.
-static int read_xref_table(t_pdfrasreader* reader, pduint32* poff)
+// Parse the header of the xref table at *poff, up to the first entry.
+// Set *pnumxrefs to the number of entries, and advance *poff to the first.
+// Return TRUE if all OK, FALSE (after reporting) if not.
+static int parse_xref_header(t_pdfrasreader* reader, pduint32* poff, unsigned long* pnumxrefs)
 {
 	pduint32 off = *poff;
 	unsigned long firstnum, numxrefs;
-	t_xref_entry* xrefs = NULL;
 	if (!token_eat(reader, &off, "xref")) {
 		// invalid xref table
         compliance(reader, READ_XREF, off);
@@ -1584,6 +2046,41 @@ static int read_xref_table(t_pdfrasreader* reader, pduint32* poff)
         compliance(reader, READ_XREF_NUMREFS, *poff);
 		return FALSE;
 	}
+	*pnumxrefs = numxrefs;
+	*poff = off;
+	return TRUE;
+}
+
+// Locate the xref table at *poff without reading it, for probing:
+// its entries will be read one at a time, as objects are looked up.
+// Advance *poff past the table. Return TRUE if all OK, FALSE (after reporting) if not.
+static int locate_xref_table(t_pdfrasreader* reader, pduint32* poff)
+{
+	pduint32 off = *poff;
+	unsigned long numxrefs;
+	if (!parse_xref_header(reader, &off, &numxrefs)) {
+		return FALSE;
+	}
+	if (off > reader->filesize || 20 * numxrefs > reader->filesize - off) {
+		// invalid PDF, the xref table is cut off
+        compliance(reader, READ_XREF_TABLE, off);
+		return FALSE;
+	}
+	reader->xref_entries = off;
+	reader->numxrefs = numxrefs;
+	*poff = off + 20 * numxrefs;
+	return TRUE;
+}
+
+static int read_xref_table(t_pdfrasreader* reader, pduint32* poff)
+{
+	pduint32 off = *poff;
+	unsigned long numxrefs;
+	t_xref_entry* xrefs = NULL;
+	if (!parse_xref_header(reader, &off, &numxrefs)) {
+		// already reported
+		return FALSE;
+	}
 	size_t xref_size = 20 * numxrefs;
 	xrefs = (t_xref_entry*)malloc(xref_size);
 	if (!xrefs) {
@@ -1614,16 +2111,15 @@ static int read_xref_table(t_pdfrasreader* reader, pduint32* poff)
 	return TRUE;
 }
 
-// Find all the pages in the page tree rooted at off, ppn points to next page index value.
-// Store each page's file position (indexed by page#) in the page table,
-// increment *ppn by the number of pages found.
-static int recursive_page_finder(t_pdfrasreader* reader, pduint32 off, pduint32* table, int *ppn)
+// Look at page tree node off: if it is a page (leaf) object, set *pisleaf
+// and report a count of 1. If it is an interior /Pages node, clear *pisleaf
+// and return its /Count. Return FALSE (after reporting) if it is neither.
+static int page_node_count(t_pdfrasreader* reader, pduint32 off, int* pisleaf, long* pcount)
 {
 	pduint32 p;
 	assert(reader);
-	assert(table);
-	assert(ppn);
-	assert(*ppn >= 0);
+	assert(pisleaf);
+	assert(pcount);
 
 	// look for the Type key
 	if (!dictionary_lookup(reader, off, "/Type", &p)) {
@@ -1633,15 +2129,8 @@ static int recursive_page_finder(t_pdfrasreader* reader, pduint32 off, pduint32*
 	}
 	// is it a page (leaf) node?
 	if (token_eat(reader, &p, "/Page")) {
-		// Found a page object!
-		if (*ppn >= reader->page_count) {
-			// invalid PDF: more page objects than expected in page tree
-            compliance(reader, READ_PAGES_EXTRA, p);
-			return FALSE;
-		}
-		// record page object's position, in the page table:
-		table[*ppn] = off;
-		*ppn += 1;					// increment the page counter
+		*pisleaf = TRUE;
+		*pcount = 1;
 		return TRUE;
 	}
 	// is the Type value right for a page tree node?
@@ -1650,70 +2139,153 @@ static int recursive_page_finder(t_pdfrasreader* reader, pduint32 off, pduint32*
         compliance(reader, READ_PAGE_TYPE2, off);
 		return FALSE;
 	}
-	pduint32 kids;
+	*pisleaf = FALSE;
+	if (!dictionary_lookup(reader, off, "/Count", &p) ||
+		!parse_long_value(reader, &p, pcount) ||
+		*pcount < 0) {
+		// invalid PDF: page tree node does not have valid /Count value
+        compliance(reader, READ_PAGES_COUNT, off);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+#define VISITED(reader,num) ((reader)->page_visited[(num) >> 3] & (1 << ((num) & 7)))
+
+// Abandon any page tree walk in progress, emptying the page stack.
+static void page_walk_reset(t_pdfrasreader* reader)
+{
+	while (reader->page_depth > 0) {
+		unsigned long num = reader->page_stack[--reader->page_depth].num;
+		reader->page_visited[num >> 3] &= ~(1 << (num & 7));
+	}
+}
+
+// Free the page tree walk (it is reallocated when next needed)
+static void free_page_walk(t_pdfrasreader* reader)
+{
+	if (reader->page_stack) {
+		page_walk_reset(reader);
+		free(reader->page_stack);
+		free(reader->page_visited);
+		reader->page_stack = NULL;
+		reader->page_visited = NULL;
+	}
+}
+
+// Push page tree node num (at position off) onto the page stack,
+// positioned at the start of its /Kids array.
+// The node holds count pages, starting at page index first.
+// Fails (after reporting) if that would make the walk too deep,
+// or if the node is already on the stack - meaning the page tree has a cycle.
+static int page_walk_push(t_pdfrasreader* reader, unsigned long num, pduint32 off, long first, long count)
+{
+	assert(num < reader->numxrefs);
+	if (reader->page_depth > reader->max_page_depth) {
+		// page tree is nested more deeply than we are willing to go
+		compliance(reader, READ_PAGE_TREE_DEPTH, off);
+		return FALSE;
+	}
+	if (VISITED(reader, num)) {
+		// invalid PDF: page tree node is its own ancestor
+		compliance(reader, READ_PAGE_TREE_CYCLE, off);
+		return FALSE;
+	}
+	pduint32 kids;
 	if (!dictionary_lookup(reader, off, "/Kids", &kids)) {
 		// invalid PDF: page tree node lacks a /Kids entry
         compliance(reader, READ_PAGE_KIDS, off);
 		return FALSE;
 	}
-	// Enumerate the kids adding their counts to *pcount
 	if (!token_eat(reader, &kids, "[")) {
         compliance(reader, READ_PAGE_KIDS_ARRAY, kids);
 		return FALSE;
 	}
-	pduint32 kid;
-	while (parse_indirect_reference(reader, &kids, &kid)) {
-		if (!recursive_page_finder(reader, kid, table, ppn)) {
-			// invalid PDF -
-            // (error already reported inside recursive_page_finder)
-			return FALSE;
-		}
-	}
-	if (!token_eat(reader, &kids, "]")) {
-		// invalid PDF, expected ']' at end of 'kids' array
-        compliance(reader, READ_PAGE_KIDS_END, kids);
-		return FALSE;
-	}
+	t_pagecursor* top = &reader->page_stack[reader->page_depth++];
+	top->num = num;
+	top->node = off;
+	top->first = first;
+	top->count = count;
+	top->kids = kids;
+	top->index = first;
+	reader->page_visited[num >> 3] |= 1 << (num & 7);
 	return TRUE;
-} // recursive_page_finder
+}
 
-// Build the page table by walking the page tree from root.
-// If successful, return TRUE: page table contains offset of each page object.
-// Otherwise return FALSE;
-static int build_page_table(t_pdfrasreader* reader, pduint32 root)
+// Locate page n by walking the page tree, using the /Count of each kid
+// to step over whole subtrees without visiting them.
+// The walk uses an explicit stack holding the path from the root to the
+// node being scanned. It is kept between calls, so a search for a later page
+// resumes the previous walk, backing out only as far as needed.
+// Page objects passed along the way are recorded in the page table.
+// Returns the file position of the page object, or 0 after reporting an error.
+static pduint32 find_page(t_pdfrasreader* reader, long n)
 {
 	assert(reader);
-	assert(NULL==reader->page_table);
-	assert(root > 0);
-	assert(reader->page_count >= 0);
-
-	// allocate a page table
-	pduint32* pages;
-	size_t ptsize = reader->page_count * sizeof *pages;
-	pages = (pduint32*)malloc(ptsize);
-	if (!pages) {
-		// internal failure, mmemory allocation
-        memory_error(reader, __LINE__);
-		return FALSE;
-	}
-	memset(pages, 0, ptsize);
+	assert(reader->page_table);
+	assert(reader->page_stack);
+	assert(n >= 0 && n < reader->page_count);
 
-	int pageno = 0;
-	if (!recursive_page_finder(reader, root, pages, &pageno)) {
-		// error (already logged)
-		free(pages);				// free the page table
-		return FALSE;
+	// back out of nodes that can't lead to page n
+	while (reader->page_depth > 0) {
+		t_pagecursor* top = &reader->page_stack[reader->page_depth - 1];
+		if (n >= top->index && n < top->first + top->count) {
+			break;
+		}
+		reader->page_depth--;
+		reader->page_visited[top->num >> 3] &= ~(1 << (top->num & 7));
 	}
-	if (pageno != reader->page_count) {
-		// invalid PDF: /Count in root page node is not correct
-		free(pages);				// free the page table
-        compliance(reader, READ_PAGE_COUNTS, root);
-		return FALSE;
+	if (reader->page_depth == 0 &&
+		!page_walk_push(reader, reader->page_root_num, reader->page_root, 0, reader->page_count)) {
+		// error already reported
+		return 0;
 	}
-	// keep the filled-in page table
-	reader->page_table = pages;
-	return TRUE;
-}
+	for (;;) {
+		t_pagecursor* top = &reader->page_stack[reader->page_depth - 1];
+		unsigned long num;
+		pduint32 kid;
+		int isleaf;
+		long kidcount;
+		if (!parse_indirect_reference_num(reader, &top->kids, &num, &kid)) {
+			if (!token_eat(reader, &top->kids, "]")) {
+				// invalid PDF, expected ']' at end of 'kids' array
+				compliance(reader, READ_PAGE_KIDS_END, top->kids);
+			}
+			else {
+				// invalid PDF: kids of this node hold fewer pages than its /Count
+				compliance(reader, READ_PAGE_COUNTS, top->node);
+			}
+			break;
+		}
+		if (!page_node_count(reader, kid, &isleaf, &kidcount)) {
+			// error already reported
+			break;
+		}
+		if (kidcount > top->first + top->count - top->index) {
+			// invalid PDF: more pages under this node than its /Count says
+            compliance(reader, READ_PAGES_EXTRA, kid);
+			break;
+		}
+		long index = top->index;
+		top->index += kidcount;
+		if (isleaf) {
+			// record page object's position, in the page table:
+			reader->page_table[index] = kid;
+			if (index == n) {
+				// found it.
+				return kid;
+			}
+		}
+		else if (n < index + kidcount && !page_walk_push(reader, num, kid, index, kidcount)) {
+			// page n is under this kid, but we can't go there.
+			break;
+		}
+	}
+	// something is wrong with the page tree (already reported)
+	// start over if asked again.
+	page_walk_reset(reader);
+	return 0;
+} // find_page
 
 static int validate_catalog(t_pdfrasreader* reader, pduint32 catpos)
 {
@@ -1731,12 +2303,14 @@ static int validate_catalog(t_pdfrasreader* reader, pduint32 catpos)
     return TRUE;
 }
 
+// Check the tailsize bytes at tail, which are the end of the file starting at
+// file position off: the PDF/raster tag, startxref and %%EOF.
+// Set reader->major and minor from the tag, and *pstartxref to the
+// file position of the startxref keyword.
 // Return TRUE if all OK, FALSE if some problem.
-static int parse_trailer(t_pdfrasreader* reader)
+static int parse_tail(t_pdfrasreader* reader, const char* tail, size_t tailsize, pduint32 tailpos, pduint32* pstartxref)
 {
-	char tail[TAILSIZE+1];
-	size_t tailsize = pdfras_read_tail(reader, tail, sizeof tail - 1);
-    pduint32 off = reader->filesize - tailsize;
+    pduint32 off = tailpos;
     const char* eof = memrstr(tail, tail+tailsize, "%%EOF");
     if (!eof) {
         // invalid PDF - %%EOF not found in tail of file.
@@ -1785,10 +2359,23 @@ static int parse_trailer(t_pdfrasreader* reader)
         return FALSE;
     }
     // go back to the whole tail thing for a sec...
-    off = reader->filesize - tailsize;
 	// Calculate the file position of the "startxref" keyword
-	// and make a note of it for a bit later.
-	pduint32 startxref_off = off += (startxref - tail);
+	*pstartxref = tailpos + (pduint32)(startxref - tail);
+	return TRUE;
+}
+
+// Return TRUE if all OK, FALSE if some problem.
+// Check the end of the file and the trailer, and find the catalog and the root of the page tree.
+// If probe isn't NULL the xref table is only located, not read, and probe gets a few extra facts.
+static int parse_trailer(t_pdfrasreader* reader, t_pdfrasread_probe* probe)
+{
+	char tail[TAILSIZE+1];
+	size_t tailsize = pdfras_read_tail(reader, tail, sizeof tail - 1);
+	pduint32 off;
+	if (!parse_tail(reader, tail, tailsize, reader->filesize - (pduint32)tailsize, &off)) {
+		// error already reported
+		return FALSE;
+	}
 	unsigned long xref_off;
 	if (!token_eat(reader, &off, "startxref") || !token_ulong(reader, &off, &xref_off)) {
 		// startxref not followed by unsigned int
@@ -1802,7 +2389,7 @@ static int parse_trailer(t_pdfrasreader* reader)
 	}
 	// go there and read the xref table
 	off = xref_off;
-	if (!read_xref_table(reader, &off)) {
+	if (probe ? !locate_xref_table(reader, &off) : !read_xref_table(reader, &off)) {
 		// xref table not found or not valid
 		return FALSE;
 	}
@@ -1818,6 +2405,19 @@ static int parse_trailer(t_pdfrasreader* reader)
         compliance(reader, READ_ROOT, off);
 		return FALSE;
 	}
+	// an encrypted document has an /Encrypt dictionary, see setup_decryption
+	if (!dictionary_lookup(reader, off, "/Encrypt", &reader->encrypt_pos)) {
+		reader->encrypt_pos = 0;
+	}
+	if (probe) {
+		probe->xref_pos = (pduint32)xref_off;
+		if (!dictionary_lookup(reader, off, "/Info", &probe->info_pos)) {
+			probe->info_pos = 0;
+		}
+		if (!dictionary_lookup(reader, catpos, "/Metadata", &probe->metadata_pos)) {
+			probe->metadata_pos = 0;
+		}
+	}
 	// check the Catalog
     if (!validate_catalog(reader, catpos)) {
         // any errors already logged.
@@ -1825,7 +2425,7 @@ static int parse_trailer(t_pdfrasreader* reader)
     }
 	// Find the root node of the page tree
 	pduint32 pages;
-	if (!dictionary_lookup(reader, catpos, "/Pages", &pages)) {
+	if (!dictionary_lookup_num(reader, catpos, "/Pages", &reader->page_root_num, &pages)) {
 		// invalid PDF: catalog must have a /Pages entry
         compliance(reader, READ_CAT_PAGES, catpos);
         return FALSE;
@@ -1838,24 +2438,178 @@ static int parse_trailer(t_pdfrasreader* reader)
         compliance(reader, READ_PAGES_COUNT, pages);
 		return FALSE;
 	}
-	// walk the page tree locating all the pages
-	if (!build_page_table(reader, pages)) {
-		// oops - something went wrong
-        // any errors were already logged.
+	// Note the root of the page tree, but don't walk it now:
+	// pages are located on demand by get_page_pos.
+	reader->page_root = pages;
+
+	return TRUE;
+}
+
+// The parts of an /Encrypt dictionary needed to find the file key
+typedef struct {
+	pduint8				O[48], U[48];		// owner & user password hashes, with their salts
+	pduint8				OE[32], UE[32];		// the file key, encrypted with each password
+	pduint8				Perms[16];			// the permissions, encrypted with the file key
+} t_security;
+
+// Look up key in the dictionary at off, and copy its string value - which must
+// be at least len bytes long - to buf. Return TRUE if successful.
+static int dictionary_lookup_string(t_pdfrasreader* reader, pduint32 off, const char* key, pduint8* buf, size_t len)
+{
+	pduint32 val;
+	size_t actual;
+	return dictionary_lookup(reader, off, key, &val) &&
+		parse_string_value(reader, &val, buf, len, &actual) &&
+		actual >= len;
+}
+
+// Read the /Encrypt dictionary at off into *psec.
+// The only security handler supported is the standard one, revision 6,
+// with streams encrypted by AES-256 (/V 5 /R 6, crypt filter method /AESV3).
+static int read_encrypt_dictionary(t_pdfrasreader* reader, pduint32 off, t_security* psec)
+{
+	pduint32 val, cf;
+	unsigned long v, r;
+	if (!dictionary_lookup(reader, off, "/Filter", &val) || !token_eat(reader, &val, "/Standard") ||
+		!dictionary_lookup(reader, off, "/V", &val) || !token_ulong(reader, &val, &v) || v != 5 ||
+		!dictionary_lookup(reader, off, "/R", &val) || !token_ulong(reader, &val, &r) || r != 6 ||
+		!dictionary_lookup(reader, off, "/StmF", &val) || !token_eat(reader, &val, "/StdCF") ||
+		!dictionary_lookup(reader, off, "/CF", &cf) || !dictionary_lookup(reader, cf, "/StdCF", &cf) ||
+		!dictionary_lookup(reader, cf, "/CFM", &val) || !token_eat(reader, &val, "/AESV3")) {
+		compliance(reader, READ_ENCRYPT_FILTER, off);
+		return FALSE;
+	}
+	if (!dictionary_lookup_string(reader, off, "/O", psec->O, sizeof psec->O) ||
+		!dictionary_lookup_string(reader, off, "/U", psec->U, sizeof psec->U) ||
+		!dictionary_lookup_string(reader, off, "/OE", psec->OE, sizeof psec->OE) ||
+		!dictionary_lookup_string(reader, off, "/UE", psec->UE, sizeof psec->UE) ||
+		!dictionary_lookup_string(reader, off, "/Perms", psec->Perms, sizeof psec->Perms)) {
+		compliance(reader, READ_ENCRYPT_DICT, off);
 		return FALSE;
 	}
+	return TRUE;
+}
+
+// Algorithm 2.A of PDF 2.0: if password is the user password or the owner
+// password, decrypt the file key into key and return TRUE.
+static int authenticate_password(const t_security* psec, const char* password, pduint8 key[32])
+{
+	const pduint8* pwd = (const pduint8*)password;
+	pduint32 pwdlen = (pduint32)strlen(password);
+	pduint8 hash[32], iv[PD_AES_BLOCK];
+	t_pdaeskey kek;
+	int ok = TRUE;
+	// only the first 127 bytes of a password count
+	if (pwdlen > 127) pwdlen = 127;
+	// /U and /O are hash + 8-byte validation salt + 8-byte key salt
+	pd_hash_password_r6(pwd, pwdlen, psec->U + 32, NULL, hash);
+	if (0 == memcmp(hash, psec->U, 32)) {
+		pd_hash_password_r6(pwd, pwdlen, psec->U + 40, NULL, hash);
+		pd_aes_set_key(&kek, hash, 256);
+		memset(iv, 0, sizeof iv);
+		pd_aes_cbc_decrypt(&kek, iv, psec->UE, key, 2);
+	}
+	else {
+		pd_hash_password_r6(pwd, pwdlen, psec->O + 32, psec->U, hash);
+		if (0 == memcmp(hash, psec->O, 32)) {
+			pd_hash_password_r6(pwd, pwdlen, psec->O + 40, psec->U, hash);
+			pd_aes_set_key(&kek, hash, 256);
+			memset(iv, 0, sizeof iv);
+			pd_aes_cbc_decrypt(&kek, iv, psec->OE, key, 2);
+		}
+		else {
+			ok = FALSE;
+		}
+	}
+	memset(hash, 0, sizeof hash);
+	memset(&kek, 0, sizeof kek);
+	return ok;
+}
+
+// Return TRUE if key decrypts /Perms to something that looks right
+static int check_file_key(const t_security* psec, const pduint8 key[32])
+{
+	t_pdaeskey aes;
+	pduint8 perms[PD_AES_BLOCK];
+	pd_aes_set_key(&aes, key, 256);
+	pd_aes_decrypt_block(&aes, psec->Perms, perms);
+	memset(&aes, 0, sizeof aes);
+	return perms[9] == 'a' && perms[10] == 'd' && perms[11] == 'b';
+}
 
+// If the document is encrypted, get its file key - key, or if key is NULL,
+// the key that password unlocks - and get ready to decrypt with it.
+// Return FALSE (after reporting why) if the document can't be decrypted.
+static int setup_decryption(t_pdfrasreader* reader, const char* password, const pduint8* key, size_t keylen)
+{
+	reader->encrypted = PD_FALSE;
+	if (!reader->encrypt_pos) {
+		// not encrypted
+		return TRUE;
+	}
+	t_security sec;
+	if (!read_encrypt_dictionary(reader, reader->encrypt_pos, &sec)) {
+		// error already reported
+		return FALSE;
+	}
+	int ok;
+	if (key) {
+		ok = (keylen == sizeof reader->file_key);
+		if (ok) {
+			memcpy(reader->file_key, key, keylen);
+		}
+	}
+	else {
+		ok = authenticate_password(&sec, password ? password : "", reader->file_key);
+	}
+	if (!ok || !check_file_key(&sec, reader->file_key)) {
+		memset(reader->file_key, 0, sizeof reader->file_key);
+		api_error(reader, READ_ENCRYPT_PASSWORD, reader->encrypt_pos);
+		return FALSE;
+	}
+	pd_aes_set_key(&reader->aes, reader->file_key, 256);
+	reader->encrypted = PD_TRUE;
 	return TRUE;
 }
 
 static pduint32 get_page_pos(t_pdfrasreader* reader, int n)
 {
 	assert(reader);
-	if (n < 0 || n >= pdfrasread_page_count(reader)) {
+	assert(reader->xrefs);
+	if (n < 0 || n >= reader->page_count) {
 		// invalid page number
 		return 0;
 	}
-	assert(reader->page_table);
+	if (!reader->page_table) {
+		// allocate an empty page table, filled in as pages are found
+		size_t ptsize = reader->page_count * sizeof *reader->page_table;
+		reader->page_table = (pduint32*)malloc(ptsize);
+		if (!reader->page_table) {
+			// internal failure, mmemory allocation
+			memory_error(reader, __LINE__);
+			return 0;
+		}
+		memset(reader->page_table, 0, ptsize);
+	}
+	if (!reader->page_stack) {
+		// allocate the page tree walk: a stack deep enough for the
+		// deepest walk allowed, and a bit per object for nodes on it.
+		reader->page_stack = (t_pagecursor*)malloc((reader->max_page_depth + 1) * sizeof *reader->page_stack);
+		reader->page_visited = (unsigned char*)calloc((reader->numxrefs + 7) / 8, 1);
+		if (!reader->page_stack || !reader->page_visited) {
+			free(reader->page_stack);
+			free(reader->page_visited);
+			reader->page_stack = NULL;
+			reader->page_visited = NULL;
+			memory_error(reader, __LINE__);
+			return 0;
+		}
+		reader->page_depth = 0;
+	}
+	if (!reader->page_table[n]) {
+		// haven't seen this page yet, go find it
+		return find_page(reader, n);
+	}
 	return reader->page_table[n];
 }
 
@@ -1940,6 +2694,9 @@ static RasterPixelFormat infer_pixel_format(t_colorspace cs)
     return format;
 }
 
+static int parse_strip_dict(t_pdfrasreader* reader, pduint32 strip, t_pdfstripinfo* pinfo);
+static int parse_strip_entries(t_pdfrasreader* reader, t_pdfstripinfo* pinfo);
+
 // return all the info about strip s on page p of an open file
 static int get_strip_info(t_pdfrasreader* reader, int p, int s, t_pdfstripinfo* pinfo)
 {
@@ -1957,13 +2714,21 @@ static int get_strip_info(t_pdfrasreader* reader, int p, int s, t_pdfstripinfo*
         api_error(reader, READ_API_NOT_OPEN, __LINE__);
         return FALSE;
     }
-    // clear info to all 0's
-    memset(pinfo, 0, sizeof *pinfo);
     // find the strip
-    if (!find_strip(reader, p, s, &pinfo->pos)) {
+    pduint32 pos;
+    if (!find_strip(reader, p, s, &pos)) {
         // no such strip - already reported appropriate error
         return FALSE;
     }
+    return parse_strip_dict(reader, pos, pinfo);
+} // get_strip_info
+
+// parse and check the strip (image XObject) at strip, and get its info
+static int parse_strip_dict(t_pdfrasreader* reader, pduint32 strip, t_pdfstripinfo* pinfo)
+{
+    // clear info to all 0's
+    memset(pinfo, 0, sizeof *pinfo);
+    pinfo->pos = strip;
     // Parse the strip stream and locate its data
     // Among other things, this finds and checks the /Length key
     pduint32 pos = pinfo->pos;
@@ -1974,6 +2739,22 @@ static int get_strip_info(t_pdfrasreader* reader, int p, int s, t_pdfstripinfo*
     }
     assert(pinfo->pos != 0);
     assert(pinfo->raw_size > 0);
+    pinfo->buffer_size = pinfo->raw_size;
+    if (reader->encrypted) {
+        // an initialization vector, then at least one block
+        if (pinfo->raw_size <= PD_AES_BLOCK || pinfo->raw_size % PD_AES_BLOCK != 0) {
+            compliance(reader, READ_DECRYPT, pinfo->pos);
+            return FALSE;
+        }
+        pinfo->buffer_size -= PD_AES_BLOCK;
+    }
+    return parse_strip_entries(reader, pinfo);
+} // parse_strip_dict
+
+// check the entries of the strip dictionary at pinfo->pos, and fill in
+// the rest of *pinfo from them
+static int parse_strip_entries(t_pdfrasreader* reader, t_pdfstripinfo* pinfo)
+{
     pduint32 val;
     // /Type entry is optional, but if present value must be /XObject   [ISO 32000 8.9.5]
     if (dictionary_lookup(reader, pinfo->pos, "/Type", &val) && !token_match(reader, val, "/XObject")) {
@@ -2023,39 +2804,35 @@ static int get_strip_info(t_pdfrasreader* reader, int p, int s, t_pdfstripinfo*
         compliance(reader, READ_STRIP_CS_BPC, pinfo->pos);
         return FALSE;
     }
+    // /Filter is optional, absent or null means uncompressed.
+    // Otherwise one /DCTDecode or /CCITTFaxDecode, by itself or in an array.
+    pinfo->compression = RASREAD_UNCOMPRESSED;
+    if (dictionary_lookup(reader, pinfo->pos, "/Filter", &val) && !token_eat(reader, &val, "null")) {
+        int inArray = token_eat(reader, &val, "[");
+        if (token_eat(reader, &val, "/DCTDecode")) {
+            pinfo->compression = RASREAD_JPEG;
+        }
+        else if (token_eat(reader, &val, "/CCITTFaxDecode")) {
+            pinfo->compression = RASREAD_CCITTG4;
+        }
+        else if (!inArray) {
+            pinfo->compression = RASREAD_COMPRESSION_NULL;
+        }
+        if (pinfo->compression == RASREAD_COMPRESSION_NULL || (inArray && !token_eat(reader, &val, "]"))) {
+            compliance(reader, READ_STRIP_FILTER, pinfo->pos);
+            return FALSE;
+        }
+    }
 
     return TRUE;
-} // get_strip_info
+} // parse_strip_entries
 
 // return all the info about page p of the open file.
-static int get_page_info(t_pdfrasreader* reader, int p, t_pdfpageinfo* pinfo)
+// Parse and check the page dictionary at page, filling in the page-level
+// parts of *pinfo, and find its /XObject dictionary, which is checked by
+// next_strip_entry. Return FALSE (after reporting) if the page is invalid.
+static int parse_page_dict(t_pdfrasreader* reader, pduint32 page, t_pdfpageinfo* pinfo, pduint32* pxobjects)
 {
-    // While this is not a public function, it is called by a bunch of trivial
-    // public functions - that's why it reports API errors.
-    if (!VALID(reader)) {
-        api_error(NULL, READ_API_BAD_READER, __LINE__);
-        return FALSE;
-	}
-    if (!pinfo) {
-        api_error(reader, READ_API_NULL_PARAM, __LINE__);
-        return FALSE;
-    }
-    if (!reader->bOpen) {
-        api_error(reader, READ_API_NOT_OPEN, __LINE__);
-        return FALSE;
-    }
-    // clear info to all 0's
-	memset(pinfo, 0, sizeof *pinfo);
-	// If we haven't 'opened' the file, do the initial stuff now
-	if (!reader->xrefs && !parse_trailer(reader)) {
-		return FALSE;
-	}
-	// look up the file position of the nth page object:
-	pduint32 page = get_page_pos(reader, p);
-	if (!page) {
-		// TODO: internal error
-		return FALSE;
-	}
 	pinfo->off = page;
 	pduint32 val;
 	if (!dictionary_lookup(reader, page, "/Type", &val) || !token_eat(reader, &val, "/Page")) {
@@ -2096,43 +2873,103 @@ static int get_page_info(t_pdfrasreader* reader, int p, t_pdfpageinfo* pinfo)
 		compliance(reader, READ_XOBJECT, resdict);
 		return FALSE;
 	}
-	// Traverse the XObject dictionary collecting strip info
-    pduint32 off = xobjects;
-	if (!token_eat(reader, &off, "<<")) {
+    *pxobjects = xobjects;
+	if (!token_eat(reader, pxobjects, "<<")) {
 		// invalid PDF: XObject dictionary doesn't start with '<<'
 		compliance(reader, READ_XOBJECT_DICT, xobjects);
 		return FALSE;
 	}
+    return TRUE;
+}
+
+// Parse the next entry of an /XObject dictionary, starting at *poff, which
+// must be a /strip<n> entry: set *pstripno to n and *pstrip to the position
+// of the strip, and advance *poff to the next entry.
+// If pstrip is NULL the strip isn't looked up, and pnum (if not NULL)
+// receives its object number.
+// Return 1 for an entry, 0 at the end of the dictionary,
+// -1 (after reporting) if the entry is invalid.
+static int next_strip_entry(t_pdfrasreader* reader, pduint32* poff, unsigned long* pstripno, unsigned long* pnum, pduint32* pstrip)
+{
+    pduint32 off = *poff;
+    if (token_eat(reader, &off, ">>")) {
+        *poff = off;
+        return 0;
+    }
+    pduint32 xobj_entry = off;
+    if (peekch(reader, off) != '/' ||
+        nextch(reader, &off) != 's' ||
+        nextch(reader, &off) != 't' ||
+        nextch(reader, &off) != 'r' ||
+        nextch(reader, &off) != 'i' ||
+        nextch(reader, &off) != 'p' ||
+        !isdigit(nextch(reader, &off))
+        ) {
+        // illegal entry in xobjects dictionary - only /strip<n> allowed
+        compliance(reader, READ_XOBJECT_ENTRY, xobj_entry);
+        return -1;
+    }
+    if (!token_ulong(reader, &off, pstripno)) {
+        // PDF/raster: strips must be named /strip0, /strip1, /strip2, etc.
+        compliance(reader, READ_XOBJECT_ENTRY, off);
+        return -1;
+    }
+    // value of the strip<n> entry must be indirect ref
+    unsigned long num;
+    if (pstrip ? !parse_indirect_reference_num(reader, &off, &num, pstrip) : !token_reference(reader, &off, &num)) {
+        // invalid PDF: strip entry in XObject dict isn't an indirect reference
+        compliance(reader, READ_STRIP_REF, off);
+        return -1;
+    }
+    if (pnum) *pnum = num;
+    *poff = off;
+    return 1;
+}
+
+static int get_page_info(t_pdfrasreader* reader, int p, t_pdfpageinfo* pinfo)
+{
+    // While this is not a public function, it is called by a bunch of trivial
+    // public functions - that's why it reports API errors.
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return FALSE;
+	}
+    if (!pinfo) {
+        api_error(reader, READ_API_NULL_PARAM, __LINE__);
+        return FALSE;
+    }
+    if (!reader->bOpen) {
+        api_error(reader, READ_API_NOT_OPEN, __LINE__);
+        return FALSE;
+    }
+    // clear info to all 0's
+	memset(pinfo, 0, sizeof *pinfo);
+	// If we haven't 'opened' the file, do the initial stuff now
+	if (!reader->xrefs && !parse_trailer(reader, NULL)) {
+		return FALSE;
+	}
+	// look up the file position of the nth page object:
+	pduint32 page = get_page_pos(reader, p);
+	if (!page) {
+		// TODO: internal error
+		return FALSE;
+	}
+    pduint32 off;
+    if (!parse_page_dict(reader, page, pinfo, &off)) {
+        // error already reported
+        return FALSE;
+    }
     // scan the /XObject dictionary once, validating entries
     // as /strip<n> and counting total entries
 	int nstrips;				// strip no
-    for (nstrips = 0; !token_eat(reader, &off, ">>"); nstrips++) {
-        pduint32 xobj_entry = off;
-        if (peekch(reader, off) != '/' ||
-            nextch(reader, &off) != 's' ||
-            nextch(reader, &off) != 't' ||
-            nextch(reader, &off) != 'r' ||
-            nextch(reader, &off) != 'i' ||
-            nextch(reader, &off) != 'p' ||
-            !isdigit(nextch(reader, &off))
-            ) {
-            // illegal entry in xobjects dictionary - only /strip<n> allowed
-            compliance(reader, READ_XOBJECT_ENTRY, xobj_entry);
-            return FALSE;
-        }
-        unsigned long stripno;
-        if (!token_ulong(reader, &off, &stripno)) {
-            // PDF/raster: strips must be named /strip0, /strip1, /strip2, etc.
-            compliance(reader, READ_XOBJECT_ENTRY, off);
-            return FALSE;
-        }
-        // value of the strip<n> entry must be indirect ref
-        pduint32 strip;
-        if (!parse_indirect_reference(reader, &off, &strip)) {
-            // invalid PDF: strip entry in XObject dict isn't an indirect reference
-            compliance(reader, READ_STRIP_REF, off);
-            return FALSE;
-        }
+    int more;
+    unsigned long stripno;
+    pduint32 strip;
+    for (nstrips = 0; (more = next_strip_entry(reader, &off, &stripno, NULL, &strip)) > 0; nstrips++) {
+    }
+    if (more < 0) {
+        // error already reported
+        return FALSE;
     }
     // then look up strips 0..nstrips-1 to make sure they are all present
     for (int stripno = 0; stripno < nstrips; stripno++) {
@@ -2165,7 +3002,7 @@ static int get_page_info(t_pdfrasreader* reader, int p, t_pdfpageinfo* pinfo)
         // page height is sum of strip heights
         pinfo->height += strip.height;
 		// max_strip_size is (surprise) the maximum of the strip sizes (in bytes)
-		pinfo->max_strip_size = ulmax(pinfo->max_strip_size, (unsigned long)strip.raw_size);
+		pinfo->max_strip_size = ulmax(pinfo->max_strip_size, (unsigned long)strip.buffer_size);
 		// found a valid strip, count it
 		pinfo->strip_count++;
 	} // for each strip
@@ -2175,12 +3012,6 @@ static int get_page_info(t_pdfrasreader* reader, int p, t_pdfpageinfo* pinfo)
 	return TRUE;
 }
 
-// internal function that just passes an error through the (settable) global error handler.
-static int call_global_error_handler(t_pdfrasreader* reader, int level, int code, pduint32 offset)
-{
-    return global_error_handler(reader, level, code, offset);
-}
-
 ///////////////////////////////////////////////////////////////////////
 // Top-Level Public Functions
 
@@ -2214,8 +3045,10 @@ t_pdfrasreader* pdfrasread_create(int apiLevel, pdfras_freader readfn, pdfras_fs
     reader->fread = readfn;
     reader->fsize = sizefn;
     reader->fclose = closefn;
-    reader->error_handler = call_global_error_handler;
+    // inherit whatever the global error handler is right now
+    reader->error_handler = get_global_error_handler();
     reader->page_count = -1;		// Unknown
+    reader->max_page_depth = DEFAULT_MAX_PAGE_TREE_DEPTH;
     assert(VALID(reader));
 	return reader;
 }
@@ -2224,6 +3057,9 @@ void pdfrasread_destroy(t_pdfrasreader* reader)
 {
     if (!VALID(reader)) {
         api_error(NULL, READ_API_BAD_READER, __LINE__);
+    } else if (ATOMIC_LOAD(&reader->cursors) != 0) {
+        // can't free the document out from under its cursors
+        api_error(reader, READ_API_CURSORS_OPEN, __LINE__);
     } else {
         // force closed if open
         pdfrasread_close(reader);
@@ -2250,7 +3086,7 @@ int pdfrasread_page_count(t_pdfrasreader* reader)
         return -1;
     }
     if (!reader->xrefs) {
-        if (!parse_trailer(reader)) {
+        if (!parse_trailer(reader, NULL)) {
             return -1;
         }
     }
@@ -2306,6 +3142,59 @@ int pdfrasread_page_rotation(t_pdfrasreader* reader, int n)
     return info.rotation;
 }
 
+const pduint8* pdfrasread_page_icc_profile(t_pdfrasreader* reader, int n, size_t* plen)
+{
+    t_pdfpageinfo info;
+    if (plen) {
+        *plen = 0;
+    }
+    if (!get_page_info(reader, n, &info) || info.cs.style != CS_ICCBASED || !info.cs.piccProfile) {
+        return NULL;
+    }
+    if (plen) {
+        *plen = info.cs.piccProfile->len;
+    }
+    return info.cs.piccProfile->data;
+}
+
+int pdfrasread_page_colorspace(t_pdfrasreader* reader, int n, t_pdfrasread_colorspace* pcs)
+{
+    t_pdfpageinfo info;
+    if (!pcs) {
+        api_error(reader, READ_API_NULL_PARAM, __LINE__);
+        return FALSE;
+    }
+    memset(pcs, 0, sizeof *pcs);
+    if (!get_page_info(reader, n, &info)) {
+        return FALSE;
+    }
+    switch (info.cs.style) {
+    case CS_DEVICEGRAY:     pcs->style = RASREAD_DEVICEGRAY; break;
+    case CS_CALGRAY:        pcs->style = RASREAD_CALGRAY; break;
+    case CS_DEVICERGB:      pcs->style = RASREAD_DEVICERGB; break;
+    case CS_CALRGB:         pcs->style = RASREAD_CALRGB; break;
+    case CS_ICCBASED:       pcs->style = RASREAD_ICCBASED; break;
+    default:                return FALSE;
+    }
+    memcpy(pcs->whitePoint, info.cs.whitePoint, sizeof pcs->whitePoint);
+    memcpy(pcs->blackPoint, info.cs.blackPoint, sizeof pcs->blackPoint);
+    // what the dictionary leaves out is 0, which isn't a valid gamma or matrix
+    pcs->gamma = (info.cs.gamma > 0) ? info.cs.gamma : 1.0;
+    int i;
+    for (i = 0; i < 9 && info.cs.matrix[i] == 0; i++);
+    if (i < 9) {
+        memcpy(pcs->matrix, info.cs.matrix, sizeof pcs->matrix);
+    }
+    else {
+        pcs->matrix[0] = pcs->matrix[4] = pcs->matrix[8] = 1.0;
+    }
+    if (info.cs.style == CS_ICCBASED && info.cs.piccProfile) {
+        pcs->iccProfile = info.cs.piccProfile->data;
+        pcs->iccProfileLen = info.cs.piccProfile->len;
+    }
+    return TRUE;
+}
+
 // Get the resolution in dpi of the raster image of page n
 double pdfrasread_page_horizontal_dpi(t_pdfrasreader* reader, int n)
 {
@@ -2356,33 +3245,1505 @@ size_t pdfrasread_read_raw_strip(t_pdfrasreader* reader, int p, int s, void* buf
         // error already reported.
         return 0;
     }
-    size_t length = strip.raw_size;
+    size_t length = strip.buffer_size;
     if (length > bufsize) {
         // invalid strip request, strip does not fit in buffer
         api_error(reader, READ_STRIP_BUFFER_SIZE, length);
         return 0;
     }
-    if (reader->fread(reader->source, strip.data_pos, length, buffer) != length) {
+    if (!reader->encrypted) {
+        if (reader->fread(reader->source, strip.data_pos, length, buffer) != length) {
+            // read error, unable to read all of strip data
+            io_error(reader, READ_STRIP_READ, s);
+            return 0;
+        }
+        return length;
+    }
+    // encrypted: read the IV, and the rest straight into buffer to decrypt it there
+    pduint8 iv[PD_AES_BLOCK];
+    if (reader->fread(reader->source, strip.data_pos, PD_AES_BLOCK, (char*)iv) != PD_AES_BLOCK ||
+        reader->fread(reader->source, strip.data_pos + PD_AES_BLOCK, length, buffer) != length) {
         // read error, unable to read all of strip data
         io_error(reader, READ_STRIP_READ, s);
         return 0;
     }
-    return length;
+    long plain = decrypt_data(reader, iv, (pduint8*)buffer, length);
+    if (plain < 0) {
+        compliance(reader, READ_DECRYPT, strip.pos);
+        return 0;
+    }
+    return (size_t)plain;
 }
 
-RasterCompression pdfrasread_strip_compression(t_pdfrasreader* reader, int p, int s)
+// One strip to be read by pdfrasread_read_raw_strips
+typedef struct {
+    pduint32            pos;                // file position of strip data
+    size_t              len;                // length of strip data (in the file)
+    pduint32            strip;              // position of the strip object
+    pduint8             iv[PD_AES_BLOCK];   // if encrypted, the first PD_AES_BLOCK bytes of the data
+    t_pdfrasread_strip_request* req;        // the request it came from
+} t_stripread;
+
+static int compare_stripreads(const void* a, const void* b)
 {
-    t_pdfstripinfo strip;
-    if (!get_strip_info(reader, p, s, &strip)) {
-        return RASREAD_COMPRESSION_NULL;
-    }
-    return strip.compression;
+    pduint32 pa = ((const t_stripread*)a)->pos;
+    pduint32 pb = ((const t_stripread*)b)->pos;
+    return (pa < pb) ? -1 : (pa > pb);
 }
 
-static const char* error_code_description(int code)
+// Read a run of strips, sorted by position and not overlapping, that lie
+// close enough together to fetch with one source call. Return TRUE if successful.
+// If the document is encrypted each strip's IV goes to its iv, and the rest
+// of its data to the caller's buffer.
+static int read_strip_run(t_pdfrasreader* reader, t_stripread* run, int n)
 {
-    switch (code) {
-    case READ_OK:                   return "OK";
+    pduint32 start = run[0].pos;
+    size_t span = run[n - 1].pos + run[n - 1].len - start;
+    size_t ivlen = reader->encrypted ? PD_AES_BLOCK : 0;
+    if (n == 1 && !ivlen) {
+        // nothing to merge, read straight into the caller's buffer
+        return reader->fread(reader->source, start, span, (char*)run[0].req->buffer) == span;
+    }
+    if (reader->freadv) {
+        // scatter the run into the callers' buffers, gaps into a scratch buffer
+        char gap[MAX_STRIP_GAP];
+        t_pdfrasread_iovec* iov = (t_pdfrasread_iovec*)malloc(3 * n * sizeof *iov);
+        if (!iov) {
+            memory_error(reader, __LINE__);
+            return FALSE;
+        }
+        int niov = 0;
+        pduint32 pos = start;
+        for (int i = 0; i < n; i++) {
+            if (run[i].pos > pos) {
+                iov[niov].base = gap;
+                iov[niov].len = run[i].pos - pos;
+                niov++;
+            }
+            if (ivlen) {
+                iov[niov].base = run[i].iv;
+                iov[niov].len = ivlen;
+                niov++;
+            }
+            iov[niov].base = run[i].req->buffer;
+            iov[niov].len = run[i].len - ivlen;
+            niov++;
+            pos = run[i].pos + run[i].len;
+        }
+        size_t got = reader->freadv(reader->source, start, iov, niov);
+        free(iov);
+        return got == span;
+    }
+    if (n == 1) {
+        // one encrypted strip: its IV, then the rest straight into the caller's buffer
+        return reader->fread(reader->source, start, ivlen, (char*)run[0].iv) == ivlen &&
+            reader->fread(reader->source, start + ivlen, span - ivlen, (char*)run[0].req->buffer) == span - ivlen;
+    }
+    // no vectored read: read the whole run into a temporary buffer
+    char* temp = (char*)malloc(span);
+    if (!temp) {
+        memory_error(reader, __LINE__);
+        return FALSE;
+    }
+    int ok = reader->fread(reader->source, start, span, temp) == span;
+    for (int i = 0; ok && i < n; i++) {
+        const char* data = temp + (run[i].pos - start);
+        memcpy(run[i].iv, data, ivlen);
+        memcpy(run[i].req->buffer, data + ivlen, run[i].len - ivlen);
+    }
+    free(temp);
+    return ok;
+}
+
+// Read the raw data of many strips, merging reads of strips that are close together.
+int pdfrasread_read_raw_strips(t_pdfrasreader* reader, t_pdfrasread_strip_request* reqs, int count)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return 0;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+    if (!reqs) {
+        api_error(reader, READ_API_NULL_PARAM, __LINE__);
+        return 0;
+    }
+    t_stripread* reads = (t_stripread*)malloc(count * sizeof *reads);
+    if (!reads) {
+        memory_error(reader, __LINE__);
+        return 0;
+    }
+    // locate all the strips
+    int nreads = 0;
+    for (int i = 0; i < count; i++) {
+        t_stripread* r = &reads[nreads];
+        t_pdfstripinfo strip;
+        reqs[i].size = 0;
+        if (!get_strip_info(reader, reqs[i].page, reqs[i].strip, &strip)) {
+            // error already reported.
+            continue;
+        }
+        if ((size_t)strip.buffer_size > reqs[i].bufsize) {
+            // invalid strip request, strip does not fit in buffer
+            api_error(reader, READ_STRIP_BUFFER_SIZE, strip.buffer_size);
+            continue;
+        }
+        r->pos = strip.data_pos;
+        r->len = strip.raw_size;
+        r->strip = strip.pos;
+        r->req = &reqs[i];
+        nreads++;
+    }
+    // in file order, read runs of strips with small gaps between them
+    qsort(reads, nreads, sizeof *reads, compare_stripreads);
+    int done = 0;
+    for (int first = 0; first < nreads; ) {
+        int n = 1;
+        pduint32 end = reads[first].pos + reads[first].len;
+        while (first + n < nreads &&
+            reads[first + n].pos >= end &&
+            reads[first + n].pos - end <= MAX_STRIP_GAP) {
+            end = reads[first + n].pos + reads[first + n].len;
+            n++;
+        }
+        if (read_strip_run(reader, &reads[first], n)) {
+            for (int i = first; i < first + n; i++) {
+                if (!reader->encrypted) {
+                    reads[i].req->size = reads[i].len;
+                    done++;
+                    continue;
+                }
+                long plain = decrypt_data(reader, reads[i].iv, (pduint8*)reads[i].req->buffer, reads[i].len - PD_AES_BLOCK);
+                if (plain < 0) {
+                    compliance(reader, READ_DECRYPT, reads[i].strip);
+                    continue;
+                }
+                reads[i].req->size = (size_t)plain;
+                done++;
+            }
+        }
+        else {
+            // read error, unable to read all of the strip data
+            io_error(reader, READ_STRIP_READ, reads[first].req->strip);
+        }
+        first += n;
+    }
+    free(reads);
+    return done;
+}
+
+RasterCompression pdfrasread_strip_compression(t_pdfrasreader* reader, int p, int s)
+{
+    t_pdfstripinfo strip;
+    if (!get_strip_info(reader, p, s, &strip)) {
+        return RASREAD_COMPRESSION_NULL;
+    }
+    return strip.compression;
+}
+
+int pdfrasread_strip_height(t_pdfrasreader* reader, int p, int s)
+{
+    t_pdfstripinfo strip;
+    if (!get_strip_info(reader, p, s, &strip)) {
+        return 0;
+    }
+    return (int)strip.height;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Validation
+
+// size of the blocks a validation reads and keeps, see cached_block
+#define CACHE_BLOCK_SIZE 4096
+// the most blocks kept at once (1 MB)
+#define CACHE_BLOCKS 256
+
+// One block of the source, kept while validating
+typedef struct {
+    pduint32            index;              // block number, its offset / CACHE_BLOCK_SIZE
+    size_t              len;                // bytes in it, less than CACHE_BLOCK_SIZE only at EOF
+    unsigned long       used;               // when it was last used, see t_countingsource.clock
+    char*               data;
+} t_cacheblock;
+
+// Wraps the source being validated or probed, to count the bytes read from it.
+// Validation also keeps the blocks it read last, see cached_block.
+typedef struct {
+    void*               source;
+    pdfras_freader      fread;
+    pdfras_fsizer       fsize;
+    pduint32            bytes_read;
+    int                 cache;              // TRUE to keep the blocks read
+    t_cacheblock*       blocks;             // blocks kept, in order of index (CACHE_BLOCKS allocated)
+    int                 nblocks;
+    unsigned long       clock;              // counts block lookups
+} t_countingsource;
+
+// Return block number index of the source, reading it if it isn't kept,
+// NULL if out of memory.
+// Following /Length and colorspace references, the page tree and so on, the reader
+// jumps back and forth through the file, but seldom far: with the last CACHE_BLOCKS
+// blocks kept, it doesn't read them again. When that many are kept, the one used
+// least recently makes room, so memory use doesn't grow with the file.
+static t_cacheblock* cached_block(t_countingsource* counter, pduint32 index)
+{
+    if (!counter->blocks) {
+        counter->blocks = (t_cacheblock*)malloc(CACHE_BLOCKS * sizeof *counter->blocks);
+        if (!counter->blocks) {
+            return NULL;
+        }
+    }
+    counter->clock++;
+    int lo = 0, hi = counter->nblocks;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (counter->blocks[mid].index < index) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo < counter->nblocks && counter->blocks[lo].index == index) {
+        counter->blocks[lo].used = counter->clock;
+        return &counter->blocks[lo];
+    }
+    char* data;
+    if (counter->nblocks == CACHE_BLOCKS) {
+        // reuse the least recently used block
+        int lru = 0;
+        for (int i = 1; i < counter->nblocks; i++) {
+            if (counter->blocks[i].used < counter->blocks[lru].used) {
+                lru = i;
+            }
+        }
+        data = counter->blocks[lru].data;
+        memmove(&counter->blocks[lru], &counter->blocks[lru + 1], (counter->nblocks - lru - 1) * sizeof *counter->blocks);
+        counter->nblocks--;
+        if (lru < lo) {
+            lo--;
+        }
+    }
+    else {
+        data = (char*)malloc(CACHE_BLOCK_SIZE);
+        if (!data) {
+            return NULL;
+        }
+    }
+    t_cacheblock* block = &counter->blocks[lo];
+    memmove(block + 1, block, (counter->nblocks - lo) * sizeof *block);
+    counter->nblocks++;
+    block->index = index;
+    block->used = counter->clock;
+    block->data = data;
+    block->len = counter->fread(counter->source, index * CACHE_BLOCK_SIZE, CACHE_BLOCK_SIZE, data);
+    counter->bytes_read += (pduint32)block->len;
+    return block;
+}
+
+static void free_cached_blocks(t_countingsource* counter)
+{
+    for (int i = 0; i < counter->nblocks; i++) {
+        free(counter->blocks[i].data);
+    }
+    free(counter->blocks);
+    counter->blocks = NULL;
+    counter->nblocks = 0;
+}
+
+static size_t counting_reader(void* source, pduint32 offset, size_t length, char* buffer)
+{
+    t_countingsource* counter = (t_countingsource*)source;
+    size_t done = 0;
+    while (counter->cache && done < length) {
+        pduint32 pos = offset + (pduint32)done;
+        t_cacheblock* block = cached_block(counter, pos / CACHE_BLOCK_SIZE);
+        if (!block) {
+            // out of memory, read the rest directly
+            break;
+        }
+        size_t i = pos % CACHE_BLOCK_SIZE;
+        if (i >= block->len) {
+            // EOF
+            return done;
+        }
+        size_t n = block->len - i < length - done ? block->len - i : length - done;
+        memcpy(buffer + done, block->data + i, n);
+        done += n;
+        if (block->len < CACHE_BLOCK_SIZE) {
+            return done;
+        }
+    }
+    if (done < length) {
+        size_t nread = counter->fread(counter->source, offset + (pduint32)done, length - done, buffer + done);
+        counter->bytes_read += (pduint32)nread;
+        done += nread;
+    }
+    return done;
+}
+
+static pduint32 counting_sizer(void* source)
+{
+    t_countingsource* counter = (t_countingsource*)source;
+    return counter->fsize(counter->source);
+}
+
+// error handler while validating: record the problem
+static int validation_error_handler(t_pdfrasreader* reader, int level, int code, pduint32 offset)
+{
+    t_pdfrasread_validation* result = reader->validation;
+    if (level == REPORTING_INFO) {
+        return 0;
+    }
+    // one bad token can set off several reports as the parse unwinds,
+    // early out only wants the first
+    if ((reader->validate_flags & RASREAD_VALIDATE_EARLY_OUT) && !result->valid) {
+        return 0;
+    }
+    if (result->count < RASREAD_MAX_VIOLATIONS) {
+        t_pdfrasread_violation* v = &result->violations[result->count];
+        v->level = level;
+        v->code = code;
+        v->offset = offset;
+    }
+    result->count++;
+    if (level != REPORTING_WARNING) {
+        result->valid = FALSE;
+    }
+    return 0;
+}
+
+// A page to check, see validate_document
+typedef struct {
+    pduint32            pos;                // position of the page object
+    int                 index;              // page number (from 0)
+} t_pagecheck;
+
+// A strip to check, see validate_document
+typedef struct {
+    pduint32            pos;                // position of the strip object
+    pduint32            page;               // position of the page it's on
+    int                 index;              // page number (from 0)
+    unsigned long       stripno;            // n, from its /strip<n> entry
+    int                 ok;                 // TRUE if parse_strip_dict liked it
+    t_pdfstripinfo      info;
+} t_stripcheck;
+
+static int compare_page_pos(const void* a, const void* b)
+{
+    pduint32 pa = ((const t_pagecheck*)a)->pos, pb = ((const t_pagecheck*)b)->pos;
+    return (pa > pb) - (pa < pb);
+}
+
+static int compare_strip_pos(const void* a, const void* b)
+{
+    pduint32 pa = ((const t_stripcheck*)a)->pos, pb = ((const t_stripcheck*)b)->pos;
+    return (pa > pb) - (pa < pb);
+}
+
+static int compare_strip_order(const void* a, const void* b)
+{
+    const t_stripcheck* sa = (const t_stripcheck*)a;
+    const t_stripcheck* sb = (const t_stripcheck*)b;
+    if (sa->index != sb->index) {
+        return sa->index < sb->index ? -1 : 1;
+    }
+    return (sa->stripno > sb->stripno) - (sa->stripno < sb->stripno);
+}
+
+// Check that the strips of one page, sorted by strip number, are numbered
+// 0..n-1 and go together: same width, pixel format and colorspace.
+static void validate_page_strips(t_pdfrasreader* reader, t_stripcheck* strips, int n)
+{
+    int s;
+    for (s = 0; s < n; s++) {
+        if (strips[s].stripno != (unsigned long)s) {
+            // a strip number is missing or used twice
+            compliance(reader, READ_STRIP_MISSING, strips[s].page);
+            return;
+        }
+    }
+    const t_stripcheck* first = NULL;
+    for (s = 0; s < n; s++) {
+        const t_pdfstripinfo* strip = &strips[s].info;
+        if (!strips[s].ok) {
+            // already reported
+            continue;
+        }
+        if (!first) {
+            first = &strips[s];
+        }
+        else if (first->info.width != strip->width) {
+            // all strips on a page must have the same width
+            compliance(reader, READ_STRIP_WIDTH_SAME, strip->pos);
+        }
+        else if (first->info.format != strip->format) {
+            // all strips on a page must have the same format
+            compliance(reader, READ_STRIP_FORMAT_SAME, strip->pos);
+        }
+        else if (!colorspace_equal(first->info.cs, strip->cs)) {
+            // all strips on a page must have equal colorspaces
+            compliance(reader, READ_STRIP_COLORSPACE_SAME, strip->pos);
+        }
+    }
+}
+
+static int add_strip_check(t_pdfrasreader* reader, t_stripcheck** pstrips, int* pcount, int* psize, const t_stripcheck* strip)
+{
+    if (*pcount == *psize) {
+        int size = *psize ? *psize * 2 : 64;
+        t_stripcheck* strips = (t_stripcheck*)realloc(*pstrips, size * sizeof *strips);
+        if (!strips) {
+            memory_error(reader, __LINE__);
+            return FALSE;
+        }
+        *pstrips = strips;
+        *psize = size;
+    }
+    (*pstrips)[(*pcount)++] = *strip;
+    return TRUE;
+}
+
+// The body of pdfrasread_validate, with reader set up to read the source
+// and record problems in result.
+static void validate_document(t_pdfrasreader* reader, int flags, t_pdfrasread_validation* result)
+{
+#define STOP (((flags) & RASREAD_VALIDATE_EARLY_OUT) && !result->valid)
+    char head[32 + 1];
+    size_t headsize = reader->fread(reader->source, 0, sizeof head - 1, head);
+    head[headsize] = 0;
+    if (!pdfras_recognize_pdf_header(head)) {
+        compliance(reader, READ_FILE_HEADER, 0);
+        if (STOP) return;
+    }
+    // trailer, xref table, catalog and root of the page tree
+    if (!parse_trailer(reader, NULL) || STOP) {
+        return;
+    }
+    if (reader->encrypt_pos) {
+        // the /Encrypt dictionary has to be right, even though we don't decrypt
+        t_security sec;
+        read_encrypt_dictionary(reader, reader->encrypt_pos, &sec);
+        memset(&sec, 0, sizeof sec);
+        if (STOP) return;
+    }
+    // walk the page tree once, finding all the pages
+    t_pagecheck* pages = NULL;
+    if (reader->page_count > 0) {
+        pages = (t_pagecheck*)malloc(reader->page_count * sizeof *pages);
+        if (!pages) {
+            memory_error(reader, __LINE__);
+            return;
+        }
+    }
+    int npages;
+    for (npages = 0; npages < reader->page_count; npages++) {
+        pages[npages].index = npages;
+        pages[npages].pos = get_page_pos(reader, npages);
+        if (!pages[npages].pos) {
+            // page tree is broken (already reported), check the pages found so far
+            break;
+        }
+    }
+    // check the pages in file order, each with its strips
+    t_stripcheck* strips = NULL;
+    int size = 0;
+    int ok = TRUE;
+    qsort(pages, npages, sizeof *pages, compare_page_pos);
+    for (int p = 0; ok && p < npages && !STOP; p++) {
+        t_pdfpageinfo pageinfo;
+        t_stripcheck strip;
+        pduint32 off;
+        int nstrips = 0;
+        memset(&pageinfo, 0, sizeof pageinfo);
+        memset(&strip, 0, sizeof strip);
+        result->pages++;
+        if (!parse_page_dict(reader, pages[p].pos, &pageinfo, &off)) {
+            // already reported
+            continue;
+        }
+        strip.page = pages[p].pos;
+        strip.index = pages[p].index;
+        while (ok && next_strip_entry(reader, &off, &strip.stripno, NULL, &strip.pos) > 0) {
+            ok = add_strip_check(reader, &strips, &nstrips, &size, &strip);
+        }
+        if (!ok) {
+            // out of memory, already reported
+            break;
+        }
+        // the page's strips, also in file order
+        qsort(strips, nstrips, sizeof *strips, compare_strip_pos);
+        for (int s = 0; s < nstrips && !STOP; s++) {
+            strips[s].ok = parse_strip_dict(reader, strips[s].pos, &strips[s].info);
+            result->strips++;
+        }
+        // and together
+        if (!STOP) {
+            qsort(strips, nstrips, sizeof *strips, compare_strip_order);
+            validate_page_strips(reader, strips, nstrips);
+        }
+    }
+    free(pages);
+    free(strips);
+#undef STOP
+}
+
+int pdfrasread_validate(t_pdfrasreader* reader, void* source, int flags, t_pdfrasread_validation* result)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return FALSE;
+    }
+    if (!result) {
+        api_error(reader, READ_API_NULL_PARAM, __LINE__);
+        return FALSE;
+    }
+    memset(result, 0, sizeof *result);
+    if (reader->bOpen) {
+        api_error(reader, READ_API_ALREADY_OPEN, __LINE__);
+        return FALSE;
+    }
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    result->valid = TRUE;
+
+    // read through a counter, and record problems instead of reporting them
+    t_countingsource counter;
+    counter.source = source;
+    counter.fread = reader->fread;
+    counter.fsize = reader->fsize;
+    counter.bytes_read = 0;
+    counter.cache = TRUE;
+    counter.blocks = NULL;
+    counter.nblocks = 0;
+    counter.clock = 0;
+    pdfras_err_handler handler = reader->error_handler;
+    reader->error_handler = validation_error_handler;
+    reader->validation = result;
+    reader->validate_flags = flags;
+    reader->fread = counting_reader;
+    reader->fsize = counting_sizer;
+    reader->source = &counter;
+    reader->filesize = counting_sizer(&counter);
+    reader->buffer.off = 0;
+    reader->buffer.len = 0;
+
+    validate_document(reader, flags, result);
+
+    // (the reader isn't open, so this just frees what validation loaded)
+    pdfrasread_close(reader);
+    reader->source = NULL;
+    reader->fread = counter.fread;
+    reader->fsize = counter.fsize;
+    reader->error_handler = handler;
+    reader->validation = NULL;
+    reader->validate_flags = 0;
+    reader->buffer.off = 0;
+    reader->buffer.len = 0;
+    free_cached_blocks(&counter);
+
+    result->bytes_read = counter.bytes_read;
+    timespec_get(&end, TIME_UTC);
+    result->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    return result->valid;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Probing
+
+int pdfrasread_probe(t_pdfrasreader* reader, void* source, t_pdfrasread_probe* info)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return FALSE;
+    }
+    if (!info) {
+        api_error(reader, READ_API_NULL_PARAM, __LINE__);
+        return FALSE;
+    }
+    memset(info, 0, sizeof *info);
+    if (reader->bOpen) {
+        api_error(reader, READ_API_ALREADY_OPEN, __LINE__);
+        return FALSE;
+    }
+    // read through a counter, see pdfrasread_validate
+    t_countingsource counter;
+    counter.source = source;
+    counter.fread = reader->fread;
+    counter.fsize = reader->fsize;
+    counter.bytes_read = 0;
+    // (a probe reads little, and nothing twice)
+    counter.cache = FALSE;
+    counter.blocks = NULL;
+    counter.nblocks = 0;
+    counter.clock = 0;
+    reader->fread = counting_reader;
+    reader->fsize = counting_sizer;
+    reader->source = &counter;
+    reader->filesize = counting_sizer(&counter);
+    reader->buffer.off = 0;
+    reader->buffer.len = 0;
+
+    int ok = parse_trailer(reader, info);
+    if (ok) {
+        info->major = reader->major;
+        info->minor = reader->minor;
+        info->page_count = reader->page_count;
+        info->encrypted = (reader->encrypt_pos != 0);
+        info->xref_count = reader->numxrefs;
+    }
+
+    // (the reader isn't open, so this just forgets what was found)
+    pdfrasread_close(reader);
+    reader->source = NULL;
+    reader->fread = counter.fread;
+    reader->fsize = counter.fsize;
+    reader->numxrefs = 0;
+    reader->buffer.off = 0;
+    reader->buffer.len = 0;
+
+    info->bytes_read = counter.bytes_read;
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Streaming
+
+// A streamed document is read through a window: the bytes from the start
+// of the object being parsed (the pin) to as far as has been read. The
+// window slides forward from one object to the next, and grows if an object
+// - normally a strip - doesn't fit. The lexer works on the window as if it
+// were the whole file. Objects that can be referred to later, like ICC
+// profiles, are copied out of the window and kept.
+#define STREAM_WINDOW_SIZE 65536
+
+// An object kept for later references to it
+typedef struct {
+    pduint32            off;                // position of the object
+    size_t              len;
+    char*               data;
+} t_keptobject;
+
+// The source of a streamed document, as the reader sees it
+typedef struct {
+    t_pdfrasreader*     reader;             // for reporting
+    void*               source;             // the caller's source
+    pdfras_freader      fread;              // and its read function
+    char*               data;               // the window, with a NUL after it
+    size_t              size;               // bytes allocated at data
+    pduint32            off;                // position of data[0]
+    size_t              len;                // bytes at data
+    pduint32            pin;                // nothing from here on is dropped
+    pdbool              eof;                // fread has nothing more (or out of memory)
+    t_keptobject*       kept;
+    int                 nkept;
+} t_streamwindow;
+
+// What has been found out about an object number, in reader->objchunks. Its value is
+// that of a number, the index of a page, the /Count of a page tree node, or the object
+// number of the catalog's /Pages.
+typedef enum { STREAMED_NONE, STREAMED_OTHER, STREAMED_NUMBER, STREAMED_STRIP, STREAMED_PAGE, STREAMED_PAGES, STREAMED_CATALOG } t_streamedkind;
+
+// A stream whose /Length is an object that hasn't been found yet
+typedef struct {
+    unsigned long       num;                // the /Length object
+    pduint32            length;             // where the data ended, which is what it must say
+    pduint32            dict;               // position of the stream
+} t_awaitedlength;
+
+// A strip waiting for its page
+typedef struct {
+    unsigned long       num;
+    t_pdfstripinfo      info;
+} t_pendingstrip;
+
+typedef struct {
+    t_streamwindow      w;
+    pdfras_strip_handler onstrip;
+    pdfras_page_handler onpage;
+    void*               cookie;
+    t_awaitedlength*    awaited;            // lengths still to come
+    int                 nawaited;
+    int                 awaitedsize;        // entries allocated at awaited
+    t_pendingstrip*     strips;             // strips found, not yet on a page
+    int                 nstrips;
+    int                 stripsize;          // entries allocated at strips
+    unsigned long*      pagestrips;         // object numbers of the strips of the page being read
+    int                 pagestripsize;      // entries allocated at pagestrips
+    int                 pages;              // pages found
+    int                 tree_pages;         // pages found listed in the page tree
+} t_streamstate;
+
+// Read more of the source into the window. If the window is full, first
+// drop what's before the pin, and grow the window if that doesn't free half.
+// Return FALSE at the end of the source.
+static int window_fill(t_streamwindow* w)
+{
+    if (w->eof) {
+        return FALSE;
+    }
+    if (w->len + 1 >= w->size) {
+        assert(w->pin >= w->off && w->pin <= w->off + w->len);
+        size_t drop = w->pin - w->off;
+        memmove(w->data, w->data + drop, w->len - drop);
+        w->off += (pduint32)drop;
+        w->len -= drop;
+        if (w->len + 1 > w->size / 2) {
+            char* data = (char*)realloc(w->data, w->size * 2);
+            if (!data) {
+                memory_error(w->reader, __LINE__);
+                w->eof = PD_TRUE;
+                return FALSE;
+            }
+            w->data = data;
+            w->size *= 2;
+        }
+    }
+    size_t nread = w->fread(w->source, w->off + (pduint32)w->len, w->size - 1 - w->len, w->data + w->len);
+    if (nread == 0) {
+        w->eof = PD_TRUE;
+        return FALSE;
+    }
+    w->len += nread;
+    w->data[w->len] = 0;
+    return TRUE;
+}
+
+// The reader's read function while streaming: reads from the window, filling
+// it as needed, or from a kept object. Anything else before the window is gone.
+static size_t window_reader(void* source, pduint32 offset, size_t length, char* buffer)
+{
+    t_streamwindow* w = (t_streamwindow*)source;
+    const char* data = NULL;
+    size_t avail = 0;
+    if (offset < w->off) {
+        for (int i = 0; i < w->nkept; i++) {
+            if (offset >= w->kept[i].off && offset < w->kept[i].off + w->kept[i].len) {
+                data = w->kept[i].data + (offset - w->kept[i].off);
+                avail = w->kept[i].off + w->kept[i].len - offset;
+                break;
+            }
+        }
+    }
+    else {
+        // a short read means end of file, so read all of it if possible
+        while (offset + length > w->off + w->len && window_fill(w)) {
+        }
+        if (offset >= w->off + w->len) {
+            return 0;
+        }
+        data = w->data + (offset - w->off);
+        avail = w->off + w->len - offset;
+    }
+    size_t n = MIN(length, avail);
+    if (n) {
+        memcpy(buffer, data, n);
+    }
+    return n;
+}
+
+// Keep a copy of the len bytes at off, which are in the window
+static int window_keep(t_streamwindow* w, pduint32 off, size_t len)
+{
+    assert(off >= w->off && off + len <= w->off + w->len);
+    t_keptobject* kept = (t_keptobject*)realloc(w->kept, (w->nkept + 1) * sizeof *kept);
+    if (!kept) {
+        memory_error(w->reader, __LINE__);
+        return FALSE;
+    }
+    w->kept = kept;
+    kept[w->nkept].data = (char*)malloc(len);
+    if (!kept[w->nkept].data) {
+        memory_error(w->reader, __LINE__);
+        return FALSE;
+    }
+    memcpy(kept[w->nkept].data, w->data + (off - w->off), len);
+    kept[w->nkept].off = off;
+    kept[w->nkept].len = len;
+    w->nkept++;
+    return TRUE;
+}
+
+// Find the end of the data of a stream that starts at datapos, when its
+// length isn't known yet: the endstream keyword, followed by endobj, after
+// an end-of-line which isn't part of the data. Return the length of the data,
+// or -1 if there's no endstream.
+static long find_endstream(t_pdfrasreader* reader, t_streamwindow* w, pduint32 datapos)
+{
+    pduint32 from = datapos;
+    while (TRUE) {
+        const char* p = memstr(w->data + (from - w->off), w->data + w->len, "endstream");
+        if (!p) {
+            // look again when there's more, starting far enough back
+            // to find the keyword if only part of it is here
+            from = MAX(from, w->off + (pduint32)w->len - MIN(w->len, 8));
+            if (!window_fill(w)) {
+                return -1;
+            }
+            continue;
+        }
+        pduint32 pos = w->off + (pduint32)(p - w->data);
+        pduint32 off = pos;
+        // the data could contain 'endstream' by chance, but not followed by endobj
+        if (token_eat(reader, &off, "endstream") && token_eat(reader, &off, "endobj")) {
+            // (reading ahead can move the window's data)
+            p = w->data + (pos - w->off);
+            if (pos > datapos && p[-1] == 0x0A) {
+                pos--; p--;
+            }
+            if (pos > datapos && p[-1] == 0x0D) {
+                pos--;
+            }
+            return (long)(pos - datapos);
+        }
+        from = pos + 1;
+    }
+}
+
+// Make sure reader->objchunks has an entry for object num. New entries
+// are not found yet, so xref_lookup won't find them.
+static int stream_grow_objects(t_pdfrasreader* reader, unsigned long num, pduint32 pos)
+{
+    if (num < reader->numxrefs) {
+        return TRUE;
+    }
+    if (num >= 8388607) {
+        // more objects than an xref table can have
+        compliance(reader, READ_XREF_NUMREFS, pos);
+        return FALSE;
+    }
+    unsigned long nchunks = reader->numxrefs / OBJ_CHUNK;
+    unsigned long n = num / OBJ_CHUNK + 1;
+    t_objchunk** chunks = (t_objchunk**)realloc(reader->objchunks, n * sizeof *chunks);
+    if (!chunks) {
+        memory_error(reader, __LINE__);
+        return FALSE;
+    }
+    reader->objchunks = chunks;
+    for (; nchunks < n; nchunks++) {
+        // (zero is STREAMED_NONE)
+        chunks[nchunks] = (t_objchunk*)calloc(1, sizeof *chunks[nchunks]);
+        if (!chunks[nchunks]) {
+            memory_error(reader, __LINE__);
+            return FALSE;
+        }
+        reader->numxrefs = (nchunks + 1) * OBJ_CHUNK;
+    }
+    return TRUE;
+}
+
+static int find_awaited_length(t_streamstate* st, unsigned long num)
+{
+    for (int i = 0; i < st->nawaited; i++) {
+        if (st->awaited[i].num == num) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Record that object num is defined at pos, so that it can be looked up
+static int stream_add_object(t_pdfrasreader* reader, unsigned long num, pduint32 pos)
+{
+    if (num == 0) {
+        // object 0 is always free
+        compliance(reader, READ_OBJ_DEF, pos);
+        return FALSE;
+    }
+    if (!stream_grow_objects(reader, num, pos)) {
+        return FALSE;
+    }
+    if (OBJ_KIND(reader, num) != STREAMED_NONE) {
+        // defined twice
+        compliance(reader, READ_OBJ_DEF, pos);
+        return FALSE;
+    }
+    OBJ_POS(reader, num) = pos;
+    OBJ_KIND(reader, num) = STREAMED_OTHER;
+    return TRUE;
+}
+
+// Found number object num: if it's the /Length of an earlier stream, check it
+static int stream_number(t_pdfrasreader* reader, t_streamstate* st, unsigned long num, unsigned long value)
+{
+    int i = find_awaited_length(st, num);
+    if (i >= 0) {
+        if (st->awaited[i].length != value) {
+            // the stream's data didn't end where its /Length says
+            compliance(reader, READ_STREAM_ENDSTREAM, st->awaited[i].dict);
+            return FALSE;
+        }
+        // it can't be waited for again
+        st->awaited[i] = st->awaited[--st->nawaited];
+    }
+    // (no stream can be that long: if a later one says it is, it's wrong)
+    if (value <= 0xFFFFFFFF) {
+        OBJ_KIND(reader, num) = STREAMED_NUMBER;
+        OBJ_VALUE(reader, num) = (pduint32)value;
+    }
+    return TRUE;
+}
+
+// Find the data of the stream whose dictionary is at dict: set *plength to its
+// length, and advance *poff (which is at the start of the data) past endstream.
+static int stream_data(t_pdfrasreader* reader, t_streamstate* st, pduint32 dict, long* plength, pduint32* poff)
+{
+    pduint32 datapos = *poff;
+    pduint32 val;
+    unsigned long length, lnum;
+    if (!dictionary_find(reader, dict, "/Length", &val)) {
+        // invalid stream: no /Length key in stream dictionary
+        compliance(reader, READ_STREAM_LENGTH, dict);
+        return FALSE;
+    }
+    if (token_reference(reader, &val, &lnum)) {
+        if (!stream_grow_objects(reader, lnum, val)) {
+            return FALSE;
+        }
+        if (OBJ_KIND(reader, lnum) == STREAMED_NUMBER) {
+            length = OBJ_VALUE(reader, lnum);
+        }
+        else if (OBJ_KIND(reader, lnum) != STREAMED_NONE) {
+            // length isn't a (non-negative) integer
+            compliance(reader, READ_STREAM_LENGTH_INT, val);
+            return FALSE;
+        }
+        else {
+            // The /Length comes later (the writer puts it after the stream), so
+            // the data ends at endstream: check that when the /Length is found.
+            long found = find_endstream(reader, &st->w, datapos);
+            int i = find_awaited_length(st, lnum);
+            if (found < 0 || (i >= 0 && st->awaited[i].length != (pduint32)found)) {
+                compliance(reader, READ_STREAM_ENDSTREAM, dict);
+                return FALSE;
+            }
+            if (i < 0) {
+                if (st->nawaited == st->awaitedsize) {
+                    int size = st->awaitedsize ? st->awaitedsize * 2 : 4;
+                    t_awaitedlength* awaited = (t_awaitedlength*)realloc(st->awaited, size * sizeof *awaited);
+                    if (!awaited) {
+                        memory_error(reader, __LINE__);
+                        return FALSE;
+                    }
+                    st->awaited = awaited;
+                    st->awaitedsize = size;
+                }
+                st->awaited[st->nawaited].num = lnum;
+                st->awaited[st->nawaited].length = (pduint32)found;
+                st->awaited[st->nawaited].dict = dict;
+                st->nawaited++;
+            }
+            length = (unsigned long)found;
+        }
+    }
+    else if (!token_ulong(reader, &val, &length)) {
+        // length isn't a (non-negative) integer
+        compliance(reader, READ_STREAM_LENGTH_INT, val);
+        return FALSE;
+    }
+    pduint32 off = datapos + (pduint32)length;
+    if (!token_eat(reader, &off, "endstream")) {
+        // invalid stream: 'endstream' not found where expected.
+        compliance(reader, READ_STREAM_ENDSTREAM, dict);
+        return FALSE;
+    }
+    *plength = (long)length;
+    *poff = off;
+    return TRUE;
+}
+
+// Found strip num, whose data is at datapos: check it, and hold it for its page
+static int stream_strip(t_pdfrasreader* reader, t_streamstate* st, unsigned long num, pduint32 dict, pduint32 datapos, long length)
+{
+    if (st->nstrips == st->stripsize) {
+        int size = st->stripsize ? st->stripsize * 2 : 16;
+        t_pendingstrip* strips = (t_pendingstrip*)realloc(st->strips, size * sizeof *strips);
+        if (!strips) {
+            memory_error(reader, __LINE__);
+            return FALSE;
+        }
+        st->strips = strips;
+        st->stripsize = size;
+    }
+    t_pendingstrip* strip = &st->strips[st->nstrips];
+    memset(strip, 0, sizeof *strip);
+    strip->num = num;
+    strip->info.pos = dict;
+    strip->info.data_pos = datapos;
+    strip->info.raw_size = length;
+    strip->info.buffer_size = length;
+    if (!parse_strip_entries(reader, &strip->info)) {
+        // already reported
+        return FALSE;
+    }
+    // the strip waits for its page, which may come after the profile cache has gone
+    icc_profile_retain(strip->info.cs.piccProfile);
+    st->nstrips++;
+    OBJ_KIND(reader, num) = STREAMED_STRIP;
+    return TRUE;
+}
+
+static int find_pending_strip(t_streamstate* st, unsigned long num)
+{
+    for (int i = 0; i < st->nstrips; i++) {
+        if (st->strips[i].num == num) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Found page num, whose dictionary is at dict: match it up with its
+// strips, which have been found already, and describe it in *page.
+static int stream_page(t_pdfrasreader* reader, t_streamstate* st, unsigned long num, pduint32 dict, t_pdfrasread_stream_page* page)
+{
+    t_pdfpageinfo pageinfo;
+    pduint32 off;
+    memset(&pageinfo, 0, sizeof pageinfo);
+    if (!parse_page_dict(reader, dict, &pageinfo, &off)) {
+        // already reported
+        return FALSE;
+    }
+    // count the /XObject entries, then put their object numbers in strip order
+    pduint32 entries = off;
+    unsigned long stripno, snum;
+    int nstrips, more;
+    for (nstrips = 0; (more = next_strip_entry(reader, &off, &stripno, &snum, NULL)) > 0; nstrips++) {
+    }
+    if (more < 0) {
+        // already reported
+        return FALSE;
+    }
+    if (nstrips > st->pagestripsize) {
+        unsigned long* pagestrips = (unsigned long*)realloc(st->pagestrips, nstrips * sizeof *pagestrips);
+        if (!pagestrips) {
+            memory_error(reader, __LINE__);
+            return FALSE;
+        }
+        st->pagestrips = pagestrips;
+        st->pagestripsize = nstrips;
+    }
+    for (int s = 0; s < nstrips; s++) {
+        st->pagestrips[s] = 0;
+    }
+    off = entries;
+    while (next_strip_entry(reader, &off, &stripno, &snum, NULL) > 0) {
+        if (stripno >= (unsigned long)nstrips || st->pagestrips[stripno]) {
+            // strips must be numbered 0..n-1
+            compliance(reader, READ_STRIP_MISSING, dict);
+            return FALSE;
+        }
+        st->pagestrips[stripno] = snum;
+    }
+    // check the strips, as get_page_info does
+    for (int s = 0; s < nstrips; s++) {
+        int i = find_pending_strip(st, st->pagestrips[s]);
+        if (i < 0) {
+            // the strips of a page must come before it
+            compliance(reader, READ_STREAM_ORDER, dict);
+            return FALSE;
+        }
+        t_pdfstripinfo* strip = &st->strips[i].info;
+        if (s == 0) {
+            pageinfo.width = strip->width;
+            pageinfo.format = strip->format;
+            pageinfo.cs = strip->cs;
+        }
+        else if (pageinfo.width != strip->width) {
+            // all strips on a page must have the same width
+            compliance(reader, READ_STRIP_WIDTH_SAME, strip->pos);
+            return FALSE;
+        }
+        else if (pageinfo.format != strip->format) {
+            // all strips on a page must have the same format
+            compliance(reader, READ_STRIP_FORMAT_SAME, strip->pos);
+            return FALSE;
+        }
+        else if (!colorspace_equal(pageinfo.cs, strip->cs)) {
+            // all strips on a page must have equal colorspaces
+            compliance(reader, READ_STRIP_COLORSPACE_SAME, strip->pos);
+            return FALSE;
+        }
+        pageinfo.height += strip->height;
+    }
+    // the page has its strips now
+    for (int s = 0; s < nstrips; s++) {
+        int i = find_pending_strip(st, st->pagestrips[s]);
+        icc_profile_release(st->strips[i].info.cs.piccProfile);
+        st->strips[i] = st->strips[--st->nstrips];
+    }
+    OBJ_KIND(reader, num) = STREAMED_PAGE;
+    OBJ_VALUE(reader, num) = (pduint32)st->pages;
+    page->page = st->pages++;
+    page->format = pageinfo.format;
+    page->width = (int)pageinfo.width;
+    page->height = (int)pageinfo.height;
+    page->rotation = (int)pageinfo.rotation;
+    page->xdpi = tweak_dpi(pageinfo.width * 72.0 / (pageinfo.MediaBox[2] - pageinfo.MediaBox[0]));
+    page->ydpi = tweak_dpi(pageinfo.height * 72.0 / (pageinfo.MediaBox[3] - pageinfo.MediaBox[1]));
+    page->strip_count = nstrips;
+    page->strips = st->pagestrips;
+    return TRUE;
+}
+
+// Found page tree node num: its pages must have been found, and be listed in
+// the order they were found. (Nodes below it were checked when they were found.)
+static int stream_page_node(t_pdfrasreader* reader, t_streamstate* st, unsigned long num, pduint32 dict)
+{
+    pduint32 val;
+    unsigned long count, kid;
+    if (!dictionary_find(reader, dict, "/Count", &val) || !token_ulong(reader, &val, &count)) {
+        // invalid PDF: page node does not have valid /Count value
+        compliance(reader, READ_PAGES_COUNT, dict);
+        return FALSE;
+    }
+    OBJ_KIND(reader, num) = STREAMED_PAGES;
+    OBJ_VALUE(reader, num) = (pduint32)MIN(count, 0xFFFFFFFF);
+    if (!dictionary_find(reader, dict, "/Kids", &val)) {
+        compliance(reader, READ_PAGE_KIDS, dict);
+        return FALSE;
+    }
+    if (!token_eat(reader, &val, "[")) {
+        compliance(reader, READ_PAGE_KIDS_ARRAY, val);
+        return FALSE;
+    }
+    while (token_reference(reader, &val, &kid)) {
+        int kind = (kid < reader->numxrefs) ? OBJ_KIND(reader, kid) : STREAMED_NONE;
+        if (kind == STREAMED_PAGES) {
+            continue;
+        }
+        if (kind != STREAMED_PAGE || OBJ_VALUE(reader, kid) != (pduint32)st->tree_pages) {
+            // a page that isn't here yet, or is out of order
+            compliance(reader, READ_STREAM_ORDER, val);
+            return FALSE;
+        }
+        st->tree_pages++;
+    }
+    if (!token_eat(reader, &val, "]")) {
+        compliance(reader, READ_PAGE_KIDS_END, val);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Parse object num, whose definition starts at objpos, from *poff (just after 'obj')
+// up to endobj, and act on what it is. Advance *poff past endobj.
+static int stream_object(t_pdfrasreader* reader, t_streamstate* st, unsigned long num, pduint32 objpos, pduint32* poff)
+{
+    t_streamwindow* w = &st->w;
+    t_pdfrasread_stream_page page;
+    pduint32 off = *poff;
+    pduint32 dict = off;
+    pduint32 datapos = 0;
+    pduint32 val;
+    long length = 0;
+    int keep = FALSE;
+    int found = 0;
+    if (token_match(reader, off, "<<")) {
+        if (!parse_dictionary(reader, &off)) {
+            // already reported
+            return FALSE;
+        }
+        datapos = off;
+        found = token_stream(reader, &datapos);
+        if (found < 0) {
+            // already reported
+            return FALSE;
+        }
+        if (found) {
+            off = datapos;
+            if (!stream_data(reader, st, dict, &length, &off)) {
+                return FALSE;
+            }
+            if (dictionary_find(reader, dict, "/Subtype", &val) && token_match(reader, val, "/Image")) {
+                if (!stream_strip(reader, st, num, dict, datapos, length)) {
+                    return FALSE;
+                }
+            }
+            else if (dictionary_find(reader, dict, "/N", &val)) {
+                // an ICC profile
+                keep = TRUE;
+            }
+        }
+        else if (dictionary_find(reader, dict, "/Type", &val) && token_match(reader, val, "/Page")) {
+            if (!stream_page(reader, st, num, dict, &page)) {
+                return FALSE;
+            }
+        }
+        else if (dictionary_find(reader, dict, "/Type", &val) && token_match(reader, val, "/Pages")) {
+            if (!stream_page_node(reader, st, num, dict)) {
+                return FALSE;
+            }
+        }
+        else if (dictionary_find(reader, dict, "/Type", &val) && token_match(reader, val, "/Catalog")) {
+            unsigned long pages;
+            if (!dictionary_find(reader, dict, "/Pages", &val) || !token_reference(reader, &val, &pages)) {
+                // invalid PDF: catalog must have a /Pages entry
+                compliance(reader, READ_CAT_PAGES, dict);
+                return FALSE;
+            }
+            OBJ_KIND(reader, num) = STREAMED_CATALOG;
+            OBJ_VALUE(reader, num) = (pduint32)MIN(pages, 0xFFFFFFFF);
+        }
+        else {
+            keep = TRUE;
+        }
+    }
+    else {
+        if (!object_skip(reader, &off)) {
+            // already reported
+            return FALSE;
+        }
+        unsigned long value;
+        pduint32 end = dict;
+        if (token_ulong(reader, &end, &value) && end == off) {
+            // a number, perhaps the /Length of an earlier stream
+            if (!stream_number(reader, st, num, value)) {
+                return FALSE;
+            }
+        }
+        else {
+            keep = TRUE;
+        }
+    }
+    if (!token_eat(reader, &off, "endobj")) {
+        compliance(reader, READ_OBJ_ENDOBJ, off);
+        return FALSE;
+    }
+    *poff = off;
+    if (keep && !window_keep(w, objpos, off - objpos)) {
+        return FALSE;
+    }
+    // pass on the strip or page
+    if (OBJ_KIND(reader, num) == STREAMED_STRIP && st->onstrip) {
+        const t_pdfstripinfo* info = &st->strips[st->nstrips - 1].info;
+        t_pdfrasread_stream_strip strip;
+        strip.num = num;
+        strip.format = info->format;
+        strip.compression = info->compression;
+        strip.width = (int)info->width;
+        strip.height = (int)info->height;
+        strip.data = w->data + (datapos - w->off);
+        strip.size = (size_t)length;
+        return st->onstrip(st->cookie, &strip);
+    }
+    if (OBJ_KIND(reader, num) == STREAMED_PAGE && st->onpage) {
+        return st->onpage(st->cookie, &page);
+    }
+    return TRUE;
+}
+
+// At the end of the objects: check the xref table at xrefpos, and the trailer,
+// against the objects found
+static int stream_end(t_pdfrasreader* reader, t_streamstate* st, pduint32 xrefpos)
+{
+    t_streamwindow* w = &st->w;
+    pduint32 off = xrefpos;
+    unsigned long numxrefs;
+    if (!parse_xref_header(reader, &off, &numxrefs)) {
+        // already reported
+        return FALSE;
+    }
+    // check the entries one at a time, as the window moves over them
+    for (unsigned long e = 0; e < MAX(numxrefs, reader->numxrefs); e++) {
+        pduint32 entrypos = off + 20 * (pduint32)e;
+        pduint32 listed = 0;
+        int inuse = FALSE;
+        if (e < numxrefs) {
+            t_xref_entry entry;
+            if (reader->fread(reader->source, entrypos, sizeof entry, (char*)&entry) != sizeof entry) {
+                // invalid PDF, the xref table is cut off
+                io_error(reader, READ_XREF_TABLE, __LINE__);
+                compliance(reader, READ_XREF_TABLE, off);
+                return FALSE;
+            }
+            if (!validate_xref_entry(reader, entrypos, &entry, e)) {
+                // already reported
+                return FALSE;
+            }
+            inuse = entry.status[1] == 'n';
+            listed = strtoul(entry.offset, NULL, 10);
+            w->pin = entrypos;
+        }
+        pduint32 found = (e > 0 && e < reader->numxrefs) ? OBJ_POS(reader, e) : 0;
+        if (found && !inuse) {
+            // invalid PDF - object is not in cross-reference table
+            compliance(reader, READ_NO_SUCH_XREF, found);
+            return FALSE;
+        }
+        if (inuse && (!found || found != listed)) {
+            // xref table entry doesn't point to the object
+            compliance(reader, READ_OBJ_DEF, entrypos);
+            return FALSE;
+        }
+    }
+    if (st->nawaited) {
+        // a stream's /Length never turned up
+        compliance(reader, READ_NO_SUCH_XREF, st->awaited[0].dict);
+        return FALSE;
+    }
+    off += 20 * (pduint32)numxrefs;
+    // keep the rest of the file in the window
+    w->pin = off;
+    pduint32 tailpos = off;
+    if (!token_eat(reader, &off, "trailer")) {
+        // PDF/raster restriction: trailer dictionary does not follow xref table.
+        compliance(reader, READ_TRAILER, off);
+        return FALSE;
+    }
+    pduint32 trailer = off;
+    pduint32 val;
+    unsigned long root;
+    if (!parse_dictionary(reader, &off)) {
+        // already reported
+        return FALSE;
+    }
+    if (!dictionary_find(reader, trailer, "/Root", &val) || !token_reference(reader, &val, &root)) {
+        // invalid PDF: trailer dictionary must contain /Root entry
+        compliance(reader, READ_ROOT, trailer);
+        return FALSE;
+    }
+    if (dictionary_find(reader, trailer, "/Encrypt", &val)) {
+        api_error(reader, READ_STREAM_ENCRYPTED, val);
+        return FALSE;
+    }
+    if (root >= reader->numxrefs || OBJ_KIND(reader, root) != STREAMED_CATALOG) {
+        compliance(reader, READ_CAT_TYPE, trailer);
+        return FALSE;
+    }
+    unsigned long pages = OBJ_VALUE(reader, root);
+    if (pages >= reader->numxrefs || OBJ_KIND(reader, pages) != STREAMED_PAGES) {
+        compliance(reader, READ_CAT_PAGES, trailer);
+        return FALSE;
+    }
+    if (OBJ_VALUE(reader, pages) != (pduint32)st->pages || st->tree_pages != st->pages) {
+        // the page tree doesn't have all the pages found
+        compliance(reader, READ_PAGE_COUNTS, trailer);
+        return FALSE;
+    }
+    // and the PDF/raster tag, startxref and %%EOF
+    while (window_fill(w)) {
+    }
+    pduint32 startxref;
+    if (!parse_tail(reader, w->data + (tailpos - w->off), w->off + w->len - tailpos, tailpos, &startxref)) {
+        // already reported
+        return FALSE;
+    }
+    unsigned long xref_off;
+    if (!token_eat(reader, &startxref, "startxref") || !token_ulong(reader, &startxref, &xref_off) || xref_off != xrefpos) {
+        // invalid PDF - offset to xref table is bogus
+        compliance(reader, READ_FILE_BAD_STARTXREF, startxref);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// The body of pdfrasread_stream, with reader set up to read through the window
+static int stream_document(t_pdfrasreader* reader, t_streamstate* st)
+{
+    t_streamwindow* w = &st->w;
+    // the header is on the first line, and a source can deliver it a few bytes at a time
+    while (w->len < 32 && window_fill(w)) {
+    }
+    if (w->len == 0 || !pdfras_recognize_pdf_header(w->data)) {
+        compliance(reader, READ_FILE_HEADER, 0);
+        return FALSE;
+    }
+    pduint32 off = 0;
+    while (TRUE) {
+        if (!skip_whitespace(reader, &off)) {
+            // the file ended before the xref table
+            compliance(reader, READ_XREF, off);
+            return FALSE;
+        }
+        // everything before this object can be dropped
+        w->pin = off;
+        if (token_match(reader, off, "xref")) {
+            return stream_end(reader, st, off);
+        }
+        pduint32 objpos = off;
+        unsigned long num, gen;
+        if (!token_ulong(reader, &off, &num) || !token_ulong(reader, &off, &gen) || !token_eat(reader, &off, "obj")) {
+            compliance(reader, READ_OBJ_DEF, objpos);
+            return FALSE;
+        }
+        if (gen != 0) {
+            compliance(reader, READ_GEN_ZERO, objpos);
+            return FALSE;
+        }
+        if (!stream_add_object(reader, num, objpos) ||
+            !stream_object(reader, st, num, objpos, &off)) {
+            // already reported, or a handler said stop
+            return FALSE;
+        }
+    }
+}
+
+int pdfrasread_stream(t_pdfrasreader* reader, void* source, pdfras_strip_handler onstrip, pdfras_page_handler onpage, void* cookie)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return FALSE;
+    }
+    if (reader->bOpen) {
+        api_error(reader, READ_API_ALREADY_OPEN, __LINE__);
+        return FALSE;
+    }
+    t_streamstate st;
+    memset(&st, 0, sizeof st);
+    st.onstrip = onstrip;
+    st.onpage = onpage;
+    st.cookie = cookie;
+    st.w.reader = reader;
+    st.w.source = source;
+    st.w.fread = reader->fread;
+    st.w.size = STREAM_WINDOW_SIZE;
+    st.w.data = (char*)malloc(st.w.size);
+    if (!st.w.data) {
+        memory_error(reader, __LINE__);
+        return FALSE;
+    }
+
+    // the reader reads the window
+    reader->fread = window_reader;
+    reader->source = &st.w;
+    reader->numxrefs = 0;
+    reader->buffer.off = 0;
+    reader->buffer.len = 0;
+
+    int ok = stream_document(reader, &st);
+
+    // (the reader isn't open, so this just frees what it read, like ICC profiles)
+    pdfrasread_close(reader);
+    for (unsigned long c = 0; c < reader->numxrefs / OBJ_CHUNK; c++) {
+        free(reader->objchunks[c]);
+    }
+    free(reader->objchunks);
+    reader->objchunks = NULL;
+    reader->numxrefs = 0;
+    reader->source = NULL;
+    reader->fread = st.w.fread;
+    reader->buffer.off = 0;
+    reader->buffer.len = 0;
+    for (int i = 0; i < st.nstrips; i++) {
+        icc_profile_release(st.strips[i].info.cs.piccProfile);
+    }
+    for (int i = 0; i < st.w.nkept; i++) {
+        free(st.w.kept[i].data);
+    }
+    free(st.strips);
+    free(st.pagestrips);
+    free(st.awaited);
+    free(st.w.kept);
+    free(st.w.data);
+    return ok;
+}
+
+static const char* error_code_description(int code)
+{
+    switch (code) {
+    case READ_OK:                   return "OK";
     case READ_API_BAD_READER:       return "an API function was called with an invalid reader";
     case READ_API_APILEVEL:         return "pdfrasread_create called with apiLevel < 1 or > what library supports.";
     case READ_API_NULL_PARAM:       return "function called with null parameter that can't be null.";
@@ -2435,11 +4796,28 @@ static const char* error_code_description(int code)
     case READ_ICC_PROFILE:          return "not a valid ICC Profile stream";
     case READ_ICCPROFILE_READ:      return "read error while reading ICC Profile data";
     case READ_COLORSPACE_ARRAY:     return "colorspace array syntax error - missing closing ']'?";
+    case READ_PAGE_TREE_DEPTH:      return "page tree is nested deeper than the reader's maximum page tree depth";
+    case READ_PAGE_TREE_CYCLE:      return "page tree contains a cycle: a /Pages node is its own ancestor";
+    case READ_API_CURSORS_OPEN:     return "reader can't be closed or destroyed while cursors share its document";
+    case READ_ENCRYPT_FILTER:       return "document is encrypted, but not with AES-256 (/Standard /V 5 /R 6 /AESV3)";
+    case READ_ENCRYPT_DICT:         return "/Encrypt dictionary lacks a valid /O, /U, /OE, /UE or /Perms entry";
+    case READ_ENCRYPT_PASSWORD:     return "password or file key does not open this encrypted document";
+    case READ_DECRYPT:              return "encrypted stream data has an invalid length or padding";
+    case READ_STRIP_FILTER:         return "strip /Filter must be absent, null, /DCTDecode or /CCITTFaxDecode";
+    case READ_FILE_HEADER:          return "file doesn't start with a %PDF-1.n header line";
+    case READ_OBJ_ENDOBJ:           return "object definition doesn't end with endobj";
+    case READ_STREAM_ORDER:         return "streaming: an object is needed before it appears in the file";
+    case READ_STREAM_ENCRYPTED:     return "streaming: encrypted documents can't be read as a stream";
     default:
         return "<no details>";
     }
 }
 
+const char* pdfrasread_error_description(int code)
+{
+    return error_code_description(code);
+}
+
 int pdfrasread_default_error_handler(t_pdfrasreader* reader, int level, int code, pduint32 offset)
 {
     const char* levelName[] = {
@@ -2474,7 +4852,7 @@ void pdfrasread_set_error_handler(t_pdfrasreader* reader, pdfras_err_handler err
         api_error(NULL, READ_API_BAD_READER, __LINE__);
     } else {
         if (!errhandler) {
-            errhandler = call_global_error_handler;
+            errhandler = get_global_error_handler();
         }
         reader->error_handler = errhandler;
     }
@@ -2485,14 +4863,34 @@ void pdfrasread_set_global_error_handler(pdfras_err_handler errhandler)
     if (!errhandler) {
         errhandler = pdfrasread_default_error_handler;
     }
-    global_error_handler = errhandler;
+    ATOMIC_STORE_PTR(&global_error_handler, errhandler);
 }
 
 pdfras_err_handler pdfrasread_get_global_error_handler(void)
 {
-    return global_error_handler;
+    return get_global_error_handler();
+}
+
+
+void pdfrasread_set_readv(t_pdfrasreader* reader, pdfras_freadv readvfn)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return;
+    }
+    reader->freadv = readvfn;
 }
 
+void pdfrasread_set_max_page_tree_depth(t_pdfrasreader* reader, int depth)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return;
+    }
+    // the page stack is sized by the maximum depth, so drop it.
+    free_page_walk(reader);
+    reader->max_page_depth = (depth > 0) ? depth : DEFAULT_MAX_PAGE_TREE_DEPTH;
+}
 
 void pdfrasread_get_highest_pdfr_version(t_pdfrasreader* reader, int* pmajor, int* pminor)
 {
@@ -2500,7 +4898,8 @@ void pdfrasread_get_highest_pdfr_version(t_pdfrasreader* reader, int* pmajor, in
     if (pminor) *pminor = RASREAD_MAX_MINOR;
 }
 
-int pdfrasread_open(t_pdfrasreader* reader, void* source)
+// Open source. If it is encrypted, decrypt it with key, or if key is NULL, password.
+static int open_source(t_pdfrasreader* reader, void* source, const char* password, const pduint8* key, size_t keylen)
 {
     if (!VALID(reader)) {
         api_error(NULL, READ_API_BAD_READER, __LINE__);
@@ -2514,9 +4913,11 @@ int pdfrasread_open(t_pdfrasreader* reader, void* source)
     assert(!reader->bOpen);
 	reader->source = source;
     reader->filesize = reader->fsize(reader->source);
-    if (!parse_trailer(reader)) {
-        // not a valid PDF/raster file
+    if (!parse_trailer(reader, NULL) || !setup_decryption(reader, password, key, keylen)) {
+        // not a valid PDF/raster file, or we can't decrypt it
 		reader->source = NULL;
+        free(reader->xrefs);
+        reader->xrefs = NULL;
 	}
 	else {
 		reader->bOpen = PD_TRUE;
@@ -2524,6 +4925,113 @@ int pdfrasread_open(t_pdfrasreader* reader, void* source)
 	return reader->bOpen;
 }
 
+int pdfrasread_open(t_pdfrasreader* reader, void* source)
+{
+    return open_source(reader, source, "", NULL, 0);
+}
+
+int pdfrasread_open_with_password(t_pdfrasreader* reader, void* source, const char* password)
+{
+    if (!password) {
+        api_error(VALID(reader) ? reader : NULL, READ_API_NULL_PARAM, __LINE__);
+        return FALSE;
+    }
+    return open_source(reader, source, password, NULL, 0);
+}
+
+int pdfrasread_open_with_key(t_pdfrasreader* reader, void* source, const pduint8* key, size_t keylen)
+{
+    if (!key) {
+        api_error(VALID(reader) ? reader : NULL, READ_API_NULL_PARAM, __LINE__);
+        return FALSE;
+    }
+    return open_source(reader, source, NULL, key, keylen);
+}
+
+int pdfrasread_is_encrypted(t_pdfrasreader* reader)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return FALSE;
+    }
+    return reader->bOpen && reader->encrypted;
+}
+
+size_t pdfrasread_file_key(t_pdfrasreader* reader, pduint8* key, size_t keysize)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return 0;
+    }
+    if (!reader->bOpen || !reader->encrypted || !key || keysize < sizeof reader->file_key) {
+        return 0;
+    }
+    memcpy(key, reader->file_key, sizeof reader->file_key);
+    return sizeof reader->file_key;
+}
+
+t_pdfrasreader* pdfrasread_create_cursor(t_pdfrasreader* reader)
+{
+    if (!VALID(reader)) {
+        api_error(NULL, READ_API_BAD_READER, __LINE__);
+        return NULL;
+    }
+    if (!reader->bOpen) {
+        api_error(reader, READ_API_NOT_OPEN, __LINE__);
+        return NULL;
+    }
+    // a cursor made from a cursor shares the same document
+    t_pdfrasreader* doc = reader->document ? reader->document : reader;
+    if (!ATOMIC_LOAD(&doc->pages_found)) {
+        // The first cursor finds every page - a walk of the whole page tree - so the
+        // shared page table never changes again. Until it has, doc has no cursors, so
+        // this can only be the thread using doc: later cursors, on any thread, see the
+        // flag set (after the table is filled in) and skip this.
+        assert(!reader->document);
+        for (long n = 0; n < doc->page_count; n++) {
+            if (!get_page_pos(doc, n)) {
+                // error already reported
+                return NULL;
+            }
+        }
+        ATOMIC_STORE(&doc->pages_found, 1);
+    }
+    t_pdfrasreader* cursor = (t_pdfrasreader*)malloc(sizeof(t_pdfrasreader));
+    if (!cursor) {
+        memory_error(reader, __LINE__);
+        return NULL;
+    }
+    memset(cursor, 0, sizeof *cursor);
+    cursor->sig = READER_SIGNATURE;
+    cursor->apiLevel = doc->apiLevel;
+    cursor->fread = doc->fread;
+    cursor->freadv = doc->freadv;
+    cursor->fsize = doc->fsize;
+    cursor->fclose = NULL;              // the source belongs to doc
+    cursor->error_handler = reader->error_handler;
+    cursor->source = doc->source;
+    cursor->filesize = doc->filesize;
+    cursor->major = doc->major;
+    cursor->minor = doc->minor;
+    // share the (now read-only) document index
+    cursor->numxrefs = doc->numxrefs;
+    cursor->xrefs = doc->xrefs;
+    cursor->page_count = doc->page_count;
+    cursor->page_root = doc->page_root;
+    cursor->page_root_num = doc->page_root_num;
+    cursor->page_table = doc->page_table;
+    cursor->max_page_depth = doc->max_page_depth;
+    cursor->encrypt_pos = doc->encrypt_pos;
+    cursor->encrypted = doc->encrypted;
+    memcpy(cursor->file_key, doc->file_key, sizeof cursor->file_key);
+    cursor->aes = doc->aes;
+    cursor->document = doc;
+    cursor->bOpen = PD_TRUE;
+    ATOMIC_INC(&doc->cursors);
+    assert(VALID(cursor));
+    return cursor;
+}
+
 void* pdfrasread_source(t_pdfrasreader* reader)
 {
     if (!VALID(reader)) {
@@ -2553,7 +5061,19 @@ int pdfrasread_close(t_pdfrasreader* reader)
     }
     // note, closing when reader is not open is valid, just a no-op.
     if (reader->bOpen) {
-        if (reader->fclose) {
+        if (reader->document) {
+            // a cursor: the document index belongs to the reader it came from
+            reader->xrefs = NULL;
+            reader->page_table = NULL;
+            ATOMIC_DEC(&reader->document->cursors);
+            reader->document = NULL;
+        }
+        else if (ATOMIC_LOAD(&reader->cursors) != 0) {
+            // cursors are still using this reader's document
+            api_error(reader, READ_API_CURSORS_OPEN, __LINE__);
+            return FALSE;
+        }
+        else if (reader->fclose) {
             reader->fclose(reader->source);
         }
         reader->bOpen = PD_FALSE;
@@ -2563,10 +5083,25 @@ int pdfrasread_close(t_pdfrasreader* reader)
         free(reader->page_table);
         reader->page_table = NULL;
     }
+    reader->pages_found = 0;
+    free_page_walk(reader);
     if (reader->xrefs) {
         free(reader->xrefs);
         reader->xrefs = NULL;
     }
+    reader->xref_entries = 0;
+    // release the cached ICC profiles
+    for (int i = 0; i < reader->icc_count; i++) {
+        icc_profile_release(reader->icc_profiles[i]);
+    }
+    free(reader->icc_profiles);
+    reader->icc_profiles = NULL;
+    reader->icc_count = reader->icc_capacity = 0;
+    // forget the file key
+    reader->encrypt_pos = 0;
+    reader->encrypted = PD_FALSE;
+    memset(reader->file_key, 0, sizeof reader->file_key);
+    memset(&reader->aes, 0, sizeof reader->aes);
     assert(reader->bOpen == PD_FALSE);
     return TRUE;
 }
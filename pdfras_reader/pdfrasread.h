@@ -4,6 +4,14 @@
 // that follow the PDF/raster format.
 // It does not use or depend on files, or depend on any
 // platform services related to files, directories or streams.
+//
+// Thread safety:
+// Independent readers can be used at the same time from different threads.
+// A reader keeps all its state in its t_pdfrasreader, so
+// one reader must not be used by two threads at the same time.
+// To read one document from several threads, give each thread its own
+// cursor - see pdfrasread_create_cursor.
+// The global error handler can be set and read from any thread at any time.
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,6 +36,16 @@ typedef enum {
 	RASREAD_RGB48,				// 48-bit per pixel, sRGB (under discussion)
 } RasterPixelFormat;
 
+// Colorspaces
+typedef enum {
+	RASREAD_COLORSPACE_NULL,	// null value
+	RASREAD_DEVICEGRAY,			// /DeviceGray (bitonal only)
+	RASREAD_CALGRAY,			// /CalGray
+	RASREAD_DEVICERGB,			// /DeviceRGB
+	RASREAD_CALRGB,				// /CalRGB
+	RASREAD_ICCBASED,			// /ICCBased
+} RasterColorspace;
+
 // Compression Modes
 typedef enum {
 	RASREAD_COMPRESSION_NULL,	// null value
@@ -51,8 +69,23 @@ typedef enum {
 typedef struct t_pdfrasreader t_pdfrasreader;
 
 // function template: read length bytes into buffer, starting at offset in source.
+// Every read gives its offset: a reader never relies on a 'current position' of the source.
+// If cursors are used (see pdfrasread_create_cursor) this function will be called
+// from several threads at once with the same source, so it must not move a shared
+// file position either - use a positional read like pread.
 typedef size_t (*pdfras_freader)(void *source, pduint32 offset, size_t length, char *buffer);
 
+// A buffer for a vectored read, see pdfras_freadv
+typedef struct {
+    void*               base;
+    size_t              len;
+} t_pdfrasread_iovec;
+
+// function template (optional): read the iovcnt buffers of iov in order, from consecutive
+// bytes of source starting at offset - like preadv. Return the total number of bytes read.
+// The same rules apply as for pdfras_freader.
+typedef size_t (*pdfras_freadv)(void *source, pduint32 offset, const t_pdfrasread_iovec* iov, int iovcnt);
+
 // function template: return the size of a source
 typedef pduint32 (*pdfras_fsizer)(void* source);
 
@@ -79,7 +112,10 @@ const char* pdfrasread_lib_version(void);
 
 // Set the global error handler for this library.
 // There is just one shared global error handler for each instance of the library.
-// By default, all errors are passed to the global error handler.
+// Each reader starts with the global error handler that is set when
+// the reader is created: changing the global error handler later
+// does not affect existing readers. Errors that aren't associated with a
+// valid reader always go to the current global error handler.
 //
 // Passing errhandler = NULL is valid, and restores the default error handler.
 // See: pdfrasread_default_error_handler below.
@@ -96,7 +132,8 @@ pdfras_err_handler pdfrasread_get_global_error_handler(void);
 // Attach an error-handler to a PDF/raster reader.
 // Note the first parameter is a t_pdfrasreader*, not a void* source like the readfn and closefn.
 //
-// Passing errhandler = NULL is valid, and restores the default error handler.
+// Passing errhandler = NULL is valid, and sets the reader's handler to
+// the current global error handler.
 //
 // The handler SHOULD RETURN 0 even though the return value is currently ignored.
 void pdfrasread_set_error_handler(t_pdfrasreader* reader, pdfras_err_handler errhandler);
@@ -105,6 +142,19 @@ void pdfrasread_set_error_handler(t_pdfrasreader* reader, pdfras_err_handler err
 // It prints to stderr a somewhat descriptive 1-line message that starts with 
 int pdfrasread_default_error_handler(t_pdfrasreader* reader, int level, int code, pduint32 offset);
 
+// Return a short description (in English) of a ReadErrorCode
+const char* pdfrasread_error_description(int code);
+
+// Give the reader a vectored read function for its source (optional).
+// pdfrasread_read_raw_strips uses it to read several strips with one call.
+// Passing readvfn = NULL removes it.
+void pdfrasread_set_readv(t_pdfrasreader* reader, pdfras_freadv readvfn);
+
+// Set the deepest page tree node (counting the root as depth 0) that the reader will visit.
+// Deeper page trees are reported as a compliance error, READ_PAGE_TREE_DEPTH.
+// Passing depth <= 0 restores the default, which is 64.
+void pdfrasread_set_max_page_tree_depth(t_pdfrasreader* reader, int depth);
+
 // Set *pmajor and *pminor to the highest PDF/raster version this library supports/understands.
 // Note: The library will refuse to process a file with a higher major version.
 // Note: The library will try to read any file with an equal or lower major version.
@@ -120,6 +170,28 @@ void pdfrasread_get_highest_pdfr_version(t_pdfrasreader* reader, int* pmajor, in
 // and passed to the readfn and closefn of the reader.
 int pdfrasread_open(t_pdfrasreader* reader, void* source);
 
+// Open an encrypted PDF/raster source for reading, like pdfrasread_open.
+// Documents encrypted with AES-256 by the standard security handler (/V 5 /R 6) are supported:
+// password must be the document's user password or its owner password
+// (UTF-8, of which only the first 127 bytes count).
+// Strip data read from an encrypted document is decrypted in place, in the caller's buffer.
+// pdfrasread_open is the same as this, with an empty password.
+// Works just like pdfrasread_open for a document that isn't encrypted.
+int pdfrasread_open_with_password(t_pdfrasreader* reader, void* source, const char* password);
+
+// Open an encrypted PDF/raster source for reading, given the file key of the document,
+// which for AES-256 is 32 bytes. Useful when one document is opened more than once,
+// as finding the key from a password is slow by design - see pdfrasread_file_key.
+// Works just like pdfrasread_open for a document that isn't encrypted.
+int pdfrasread_open_with_key(t_pdfrasreader* reader, void* source, const pduint8* key, size_t keylen);
+
+// Return TRUE if reader is open on an encrypted document, FALSE otherwise.
+int pdfrasread_is_encrypted(t_pdfrasreader* reader);
+
+// If reader is open on an encrypted document, copy its file key to key and return
+// the size of the key. Returns 0 if not, or if the key doesn't fit in keysize bytes.
+size_t pdfrasread_file_key(t_pdfrasreader* reader, pduint8* key, size_t keysize);
+
 // Check if a source passes a quick validation as a PDF/raster stream.
 // Returns TRUE if the source looks like something this library can parse.
 // (i.e. looks like PDF/raster with an acceptable major version number.)
@@ -133,6 +205,23 @@ int pdfrasread_open(t_pdfrasreader* reader, void* source);
 // the specific m.n is above what this library is compiled for.
 int pdfrasread_recognize_source(t_pdfrasreader* reader, void* source, int* pmajor, int* pminor);
 
+// Create a cursor on the document that reader has open.
+// A cursor is a lightweight reader: it shares the document index (cross-reference
+// table and page table) of reader, which is built once and then never changes,
+// but has its own I/O buffer and error handler (initially the same as reader's).
+// All the reading functions work on a cursor, and cursors on one document can be
+// used on different threads at the same time - including the thread using reader.
+// The source's readfn must support that, see pdfras_freader.
+// Creating the first cursor finds every page in the document, which means walking
+// the whole page tree (and reading every page tree node), so that must be done on the
+// thread that is using reader. It is done once per open document: later cursors, from
+// reader or from another cursor, on any thread, cost no more than an allocation.
+// A cursor made from a cursor shares the same document.
+// Close or destroy a cursor like any other reader - that doesn't close the source.
+// reader can't be closed or destroyed until all its cursors have been closed (or destroyed).
+// Returns NULL if reader is not open or if there is a problem with the document's page tree.
+t_pdfrasreader* pdfrasread_create_cursor(t_pdfrasreader* reader);
+
 // Return TRUE if reader has a PDF/raster stream open,
 // return FALSE otherwise.
 int pdfrasread_is_open(t_pdfrasreader* reader);
@@ -177,23 +266,198 @@ double pdfrasread_page_vertical_dpi(t_pdfrasreader* reader, int n);
 // Returns 0 in case of error.
 int pdfrasread_page_rotation(t_pdfrasreader* reader, int n);
 
+// Return the ICC profile of page n - the data of its /ICCBased colorspace stream -
+// and set *plen (if plen isn't NULL) to its size in bytes.
+// Returns NULL, with *plen = 0, if the page's colorspace isn't ICC-based, or in case of error.
+// The profile belongs to the reader: it is read once, shared by all the strips and pages
+// that use it, and valid until the reader is closed.
+const pduint8* pdfrasread_page_icc_profile(t_pdfrasreader* reader, int n, size_t* plen);
+
+// The colorspace of a page, see pdfrasread_page_colorspace
+typedef struct {
+    RasterColorspace    style;
+    double              whitePoint[3];      // /WhitePoint (CALGRAY and CALRGB)
+    double              blackPoint[3];      // /BlackPoint (CALGRAY and CALRGB), [ 0 0 0 ] if not given
+    double              gamma;              // /Gamma (CALGRAY and CALRGB), 1 if not given
+    double              matrix[9];          // /Matrix (CALRGB), the identity if not given
+    const pduint8*      iccProfile;         // the profile (ICCBASED only), as pdfrasread_page_icc_profile
+    size_t              iccProfileLen;
+} t_pdfrasread_colorspace;
+
+// Describe the colorspace of page n in *pcs.
+// Returns TRUE if successful, FALSE (with pcs->style = RASREAD_COLORSPACE_NULL) in case of error.
+int pdfrasread_page_colorspace(t_pdfrasreader* reader, int n, t_pdfrasread_colorspace* pcs);
+
 // Strip-level access
 
 // Return the number of strips in page p
 int pdfrasread_strip_count(t_pdfrasreader* reader, int p);
 
 // Return the maximum raw (compressed) strip size on page p
+// (the size of buffer pdfrasread_read_raw_strip needs for any strip on the page)
 size_t pdfrasread_max_strip_size(t_pdfrasreader* reader, int p);
 
 // Read the raw (compressed) data of strip s on page p into buffer
 // Returns the actual number of bytes read.
 // Note that if the the strip is larger than bufsize, no data is read and
 // the return value will be 0.
+// If the document is encrypted, the data is decrypted, and the value returned
+// is the size of the decrypted data.
 size_t pdfrasread_read_raw_strip(t_pdfrasreader* reader, int p, int s, void* buffer, size_t bufsize);
 
+// One strip for pdfrasread_read_raw_strips to read
+typedef struct {
+    int                 page;               // page index (from 0)
+    int                 strip;              // strip index on that page (from 0)
+    void*               buffer;             // where to put the raw (compressed) strip data
+    size_t              bufsize;            // size of buffer
+    size_t              size;               // set to the number of bytes read, 0 on error
+} t_pdfrasread_strip_request;
+
+// Read the raw (compressed) data of many strips, like calling pdfrasread_read_raw_strip
+// for each of the count requests, but with fewer calls to the source:
+// strips are read in file order, and strips with only a small gap between them are read
+// together, with one call to the reader's readv function (see pdfrasread_set_readv) or
+// if it doesn't have one, with one call to its read function.
+// The strips of a page are usually stored one after another, so typically
+// all the strips of a page are read with a single call.
+// Returns the number of requests that were read successfully.
+int pdfrasread_read_raw_strips(t_pdfrasreader* reader, t_pdfrasread_strip_request* reqs, int count);
+
 // Return the compression format of strip s on page p
 RasterCompression pdfrasread_strip_compression(t_pdfrasreader* reader, int p, int s);
 
+// Return the height in rows of strip s on page p, 0 in case of error
+int pdfrasread_strip_height(t_pdfrasreader* reader, int p, int s);
+
+// Validation
+
+// pdfrasread_validate flags
+#define RASREAD_VALIDATE_EARLY_OUT  1       // stop at the first violation
+
+// the most violations pdfrasread_validate records
+#define RASREAD_MAX_VIOLATIONS      64
+
+// One problem found by pdfrasread_validate
+typedef struct {
+    int                 level;              // REPORTING_COMPLIANCE, REPORTING_WARNING etc.
+    int                 code;               // ReadErrorCode
+    pduint32            offset;             // where in the file
+} t_pdfrasread_violation;
+
+// What pdfrasread_validate found
+typedef struct {
+    int                 valid;              // TRUE if there were no violations (warnings are allowed)
+    int                 count;              // number of violations and warnings found
+    t_pdfrasread_violation violations[RASREAD_MAX_VIOLATIONS]; // the first RASREAD_MAX_VIOLATIONS of them, in the order found
+    int                 pages;              // pages checked
+    int                 strips;             // strips checked
+    pduint32            bytes_read;         // bytes read from the source
+    double              seconds;            // time taken
+} t_pdfrasread_validation;
+
+// Check that source is a valid PDF/raster file, and put the findings in *result.
+// The header, trailer and xref table are checked, the page tree is walked, and
+// each page dictionary is checked once, in file order, followed by the dictionaries
+// of its strips, which are then checked against each other.
+// This isn't a single pass through the file - the page tree, indirect /Length
+// values, colorspaces and so on are looked up where they are - but the last 1 MB
+// read is kept, so looking back doesn't read the file again: for a file up to
+// that size result->bytes_read is at most its size. Beyond the xref table and a
+// few bytes per page, memory use doesn't grow with the file.
+// Problems are recorded in *result, and not reported to the error handler.
+// Problems with a page or strip don't stop the check - all of them are found,
+// unless flags includes RASREAD_VALIDATE_EARLY_OUT - but a problem with the
+// trailer, xref table or page tree ends it (after the pages found so far).
+// Strip data is not read, so an encrypted file can be checked without its password.
+// reader must not be open, and is not left open. source is not closed.
+// Returns result->valid.
+int pdfrasread_validate(t_pdfrasreader* reader, void* source, int flags, t_pdfrasread_validation* result);
+
+// Probing
+
+// What pdfrasread_probe found
+typedef struct {
+    int                 major, minor;       // PDF/raster version, from the %PDF-raster- tag
+    long                page_count;         // /Count of the root of the page tree
+    int                 encrypted;          // TRUE if the trailer has an /Encrypt entry
+    pduint32            xref_pos;           // position of the xref table
+    unsigned long       xref_count;         // number of entries in the xref table
+    pduint32            info_pos;           // position of the document information dictionary (trailer /Info), 0 if none
+    pduint32            metadata_pos;       // position of the dictionary of the XMP metadata stream (catalog /Metadata), 0 if none
+    pduint32            bytes_read;         // bytes read from the source
+} t_pdfrasread_probe;
+
+// Find out the page count and a few other facts about the PDF/raster file at
+// source, reading as little as possible: the tail of the file, the trailer, the
+// catalog, the root of the page tree and the xref entries of those - a few KB,
+// however large the file. The xref table isn't loaded, and the page tree isn't walked.
+// Positions are of the contents of the object, just after 'obj'.
+// Only what is read is checked, so a file that can be probed may not open. An
+// encrypted file can be probed without its password.
+// reader must not be open, and is not left open. source is not closed.
+// Returns TRUE if successful, FALSE (after reporting) if not.
+int pdfrasread_probe(t_pdfrasreader* reader, void* source, t_pdfrasread_probe* info);
+
+// Streaming
+
+// A strip found by pdfrasread_stream
+typedef struct {
+    unsigned long       num;                // object number of the strip
+    RasterPixelFormat   format;
+    RasterCompression   compression;
+    int                 width;
+    int                 height;             // rows in this strip
+    const void*         data;               // the raw (compressed) strip data, valid during the call only
+    size_t              size;               // bytes at data
+} t_pdfrasread_stream_strip;
+
+// A page found by pdfrasread_stream
+typedef struct {
+    int                 page;               // page index (from 0)
+    RasterPixelFormat   format;
+    int                 width;
+    int                 height;
+    int                 rotation;           // clockwise, degrees
+    double              xdpi, ydpi;
+    int                 strip_count;
+    const unsigned long* strips;            // object numbers of strips 0..strip_count-1, valid during the call only
+} t_pdfrasread_stream_page;
+
+// function templates: handle a strip or a page found by pdfrasread_stream.
+// Return TRUE to carry on, FALSE to stop.
+typedef int (*pdfras_strip_handler)(void* cookie, const t_pdfrasread_stream_strip* strip);
+typedef int (*pdfras_page_handler)(void* cookie, const t_pdfrasread_stream_page* page);
+
+// Read the PDF/raster document at source once, front to back, without seeking - for
+// a source that can't seek, like a pipe or an upload that is still arriving.
+// The reader's readfn is called with consecutive offsets (each read starts where
+// the last one ended) and its sizefn is not called.
+// Objects are parsed as they arrive. Each strip is passed to onstrip, with its data,
+// and each page to onpage, as soon as they have been read. Pages are numbered in the
+// order they appear in the file. The strips of a page come before the page, and onpage
+// gives their object numbers. At the end, the xref table and trailer are checked against
+// the objects found.
+// Memory use is bounded by the largest object, which is normally a strip, plus 9 bytes
+// for each object number, kept to the end to check the xref table against - so that
+// part does grow with the file, by 9 MB for every million objects. Also kept are strips
+// until their page, and copies of the objects that a later object can refer to and that
+// aren't strips, pages, page tree nodes or numbers, such as ICC profiles.
+// Objects must be in the order the PDF/raster writer produces: a page after its strips,
+// the page tree after its pages, and any other object that is referred to (except a
+// stream /Length) before the reference - READ_STREAM_ORDER if not.
+// Encrypted documents can't be streamed (READ_STREAM_ENCRYPTED), and that is only known
+// from the trailer, at the end of the file: PDF declares encryption there and nowhere
+// else. By then the strips - still encrypted - and pages have been passed on.
+// So nothing passed to onstrip or onpage is known to be good until pdfrasread_stream
+// returns TRUE: if it returns FALSE, for this or any other reason, whatever was made
+// of the strips and pages must be discarded.
+// onstrip and onpage can be NULL.
+// reader must not be open, and is not left open. source is not closed.
+// Returns TRUE if the whole document was read and is valid, FALSE if there was a
+// problem (reported to the error handler) or a handler returned FALSE.
+int pdfrasread_stream(t_pdfrasreader* reader, void* source, pdfras_strip_handler onstrip, pdfras_page_handler onpage, void* cookie);
+
 // detailed error codes
 // TODO: assign hard codes to all, so they can't change accidentally
 // and so people can look 'em up.
@@ -295,6 +559,18 @@ typedef enum {
     READ_ICC_PROFILE,               // not a valid ICC Profile stream
     READ_ICCPROFILE_READ,           // read error while reading ICC Profile data
     READ_COLORSPACE_ARRAY,          // colorspace array syntax error - missing closing ']'?
+    READ_PAGE_TREE_DEPTH,           // page tree is nested deeper than the reader's maximum page tree depth
+    READ_PAGE_TREE_CYCLE,           // page tree contains a cycle: a /Pages node is its own ancestor
+    READ_API_CURSORS_OPEN,          // reader can't be closed or destroyed while cursors share its document
+    READ_ENCRYPT_FILTER,            // document is encrypted, but not with AES-256 (/Standard /V 5 /R 6 /AESV3)
+    READ_ENCRYPT_DICT,              // /Encrypt dictionary lacks a valid /O, /U, /OE, /UE or /Perms entry
+    READ_ENCRYPT_PASSWORD,          // password or file key does not open this encrypted document
+    READ_DECRYPT,                   // encrypted stream data has an invalid length or padding
+    READ_STRIP_FILTER,              // strip /Filter must be absent, null, /DCTDecode or /CCITTFaxDecode
+    READ_FILE_HEADER,               // file doesn't start with a %PDF-1.n header line
+    READ_OBJ_ENDOBJ,                // object definition doesn't end with endobj
+    READ_STREAM_ORDER,              // streaming: an object is needed before it appears in the file
+    READ_STREAM_ENCRYPTED,          // streaming: encrypted documents can't be read as a stream
     READ_ERROR_CODE_COUNT
 } ReadErrorCode;
 
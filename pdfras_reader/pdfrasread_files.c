@@ -2,15 +2,84 @@
 #include <string.h>
 #include <ctype.h>
 #include "PdfPlatform.h"
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
 
 // Some private helper functions
+
+// Read at an explicit offset without using or moving the FILE's position,
+// so cursors on different threads can read the same file at once.
 static size_t file_reader(void *source, pduint32 offset, size_t length, char *buffer)
 {
     FILE* f = (FILE*)source;
-    if (0 != fseek(f, offset, SEEK_SET)) {
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+    OVERLAPPED ov;
+    DWORD nread = 0;
+    memset(&ov, 0, sizeof ov);
+    ov.Offset = offset;
+    if (!ReadFile(h, buffer, (DWORD)length, &nread, &ov)) {
+        // includes trying to read at EOF
+        return 0;
+    }
+    return nread;
+#else
+    ssize_t nread = pread(fileno(f), buffer, length, offset);
+    if (nread < 0) {
         return 0;
     }
-    return fread(buffer, sizeof(pduint8), length, f);
+    return (size_t)nread;
+#endif
+}
+
+// Vectored version of file_reader
+static size_t file_readerv(void *source, pduint32 offset, const t_pdfrasread_iovec* iov, int iovcnt)
+{
+    size_t total = 0;
+#ifdef _WIN32
+    for (int i = 0; i < iovcnt; i++) {
+        size_t nread = file_reader(source, offset + (pduint32)total, iov[i].len, (char*)iov[i].base);
+        total += nread;
+        if (nread != iov[i].len) {
+            break;
+        }
+    }
+#else
+    FILE* f = (FILE*)source;
+    struct iovec v[64];
+    // preadv takes a limited number of buffers at once
+    for (int i = 0; i < iovcnt; i += 64) {
+        int n = (iovcnt - i < 64) ? iovcnt - i : 64;
+        size_t want = 0;
+        for (int j = 0; j < n; j++) {
+            v[j].iov_base = iov[i + j].base;
+            v[j].iov_len = iov[i + j].len;
+            want += iov[i + j].len;
+        }
+        ssize_t nread = preadv(fileno(f), v, n, offset + total);
+        if (nread < 0) {
+            break;
+        }
+        total += (size_t)nread;
+        if ((size_t)nread != want) {
+            break;
+        }
+    }
+#endif
+    return total;
+}
+
+// Read the next bytes of a file that may not be seekable.
+// pdfrasread_stream reads from one offset to the next, so the offset isn't needed.
+static size_t file_streamer(void *source, pduint32 offset, size_t length, char *buffer)
+{
+    (void)offset;
+    return fread(buffer, 1, length, (FILE*)source);
 }
 
 static pduint32 file_sizer(void* source)
@@ -90,6 +159,7 @@ t_pdfrasreader* pdfrasread_open_file(int apiLevel, FILE* f)
 {
 	t_pdfrasreader* reader = pdfrasread_create(apiLevel, &file_reader, &file_sizer, &file_closer);
 	if (reader) {
+		pdfrasread_set_readv(reader, &file_readerv);
 		if (!pdfrasread_open(reader, f)) {
 			pdfrasread_destroy(reader);
 			reader = NULL;
@@ -112,3 +182,67 @@ t_pdfrasreader* pdfrasread_open_filename(int apiLevel, const char* fn)
 	}
 	return reader;
 }
+
+int pdfrasread_validate_file(FILE* f, int flags, t_pdfrasread_validation* result)
+{
+	int valid = FALSE;
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &file_reader, &file_sizer, NULL);
+	if (reader) {
+		valid = pdfrasread_validate(reader, f, flags, result);
+		pdfrasread_destroy(reader);
+	}
+	return valid;
+}
+
+int pdfrasread_validate_filename(const char* fn, int flags, t_pdfrasread_validation* result)
+{
+	int valid = FALSE;
+	FILE* f = fopen(fn, "rb");
+	if (result) {
+		// in case the file can't be opened
+		memset(result, 0, sizeof *result);
+	}
+	if (f) {
+		valid = pdfrasread_validate_file(f, flags, result);
+		fclose(f);
+	}
+	return valid;
+}
+
+int pdfrasread_probe_file(FILE* f, t_pdfrasread_probe* info)
+{
+	int ok = FALSE;
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &file_reader, &file_sizer, NULL);
+	if (reader) {
+		ok = pdfrasread_probe(reader, f, info);
+		pdfrasread_destroy(reader);
+	}
+	return ok;
+}
+
+int pdfrasread_probe_filename(const char* fn, t_pdfrasread_probe* info)
+{
+	int ok = FALSE;
+	FILE* f = fopen(fn, "rb");
+	if (info) {
+		// in case the file can't be opened
+		memset(info, 0, sizeof *info);
+	}
+	if (f) {
+		ok = pdfrasread_probe_file(f, info);
+		fclose(f);
+	}
+	return ok;
+}
+
+int pdfrasread_stream_file(FILE* f, pdfras_strip_handler onstrip, pdfras_page_handler onpage, void* cookie)
+{
+	int ok = FALSE;
+	// (the sizer is never called)
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &file_streamer, &file_sizer, NULL);
+	if (reader) {
+		ok = pdfrasread_stream(reader, f, onstrip, onpage, cookie);
+		pdfrasread_destroy(reader);
+	}
+	return ok;
+}
@@ -26,6 +26,18 @@ t_pdfrasreader* pdfrasread_open_file(int apiLevel, FILE* f);
 // create a PDF/raster reader and use it to open a named file
 t_pdfrasreader* pdfrasread_open_filename(int apiLevel, const char* fn);
 
+// validate a file, see pdfrasread_validate. Does NOT close f.
+int pdfrasread_validate_file(FILE* f, int flags, t_pdfrasread_validation* result);
+int pdfrasread_validate_filename(const char* fn, int flags, t_pdfrasread_validation* result);
+
+// probe a file, see pdfrasread_probe. Does NOT close f.
+int pdfrasread_probe_file(FILE* f, t_pdfrasread_probe* info);
+int pdfrasread_probe_filename(const char* fn, t_pdfrasread_probe* info);
+
+// read a file as a stream, see pdfrasread_stream. f can be a pipe, like stdin.
+// Does NOT close f.
+int pdfrasread_stream_file(FILE* f, pdfras_strip_handler onstrip, pdfras_page_handler onpage, void* cookie);
+
 #ifdef __cplusplus
 }
 #endif
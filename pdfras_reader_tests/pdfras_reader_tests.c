@@ -4,12 +4,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <math.h>
 #include "pdfrasread_files.h"
 #ifdef WIN32
 #include <direct.h>
+#include <windows.h>
+#include <process.h>
 #define getcwd(buff,thing) _getcwd(buff,thing)
+typedef HANDLE t_thread;
+#define THREAD_PROC unsigned __stdcall
 #else
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+typedef pthread_t t_thread;
+#define THREAD_PROC void*
 #endif
 
 #include "test_support.h"
@@ -177,6 +187,7 @@ void page_info_tests()
 	ASSERT(300.0 == pdfrasread_page_horizontal_dpi(reader, 1));
 	ASSERT(300.0 == pdfrasread_page_vertical_dpi(reader, 1));
     ASSERT(33450 == pdfrasread_max_strip_size(reader, 1));
+    ASSERT(RASREAD_CCITTG4 == pdfrasread_strip_compression(reader, 1, 0));
 
 	ASSERT(RASREAD_GRAY8 == pdfrasread_page_format(reader, 2));
     ASSERT(8 == pdfrasread_page_bits_per_component(reader, 2));
@@ -186,6 +197,7 @@ void page_info_tests()
     ASSERT(2.0 == pdfrasread_page_horizontal_dpi(reader, 2));
     ASSERT(2.0 == pdfrasread_page_vertical_dpi(reader, 2));
     ASSERT(88 == pdfrasread_max_strip_size(reader, 2));
+    ASSERT(RASREAD_UNCOMPRESSED == pdfrasread_strip_compression(reader, 2, 0));
 
 	ASSERT(RASREAD_GRAY8 == pdfrasread_page_format(reader, 3));
     ASSERT(8 == pdfrasread_page_bits_per_component(reader, 3));
@@ -195,6 +207,7 @@ void page_info_tests()
 	ASSERT(100.0 == pdfrasread_page_horizontal_dpi(reader, 3));
 	ASSERT(100.0 == pdfrasread_page_vertical_dpi(reader, 3));
     ASSERT(116969 == pdfrasread_max_strip_size(reader, 3));
+    ASSERT(RASREAD_JPEG == pdfrasread_strip_compression(reader, 3, 0));
 
 	ASSERT(RASREAD_GRAY16 == pdfrasread_page_format(reader, 4));
     ASSERT(16 == pdfrasread_page_bits_per_component(reader, 4));
@@ -252,14 +265,14 @@ void strip_data_tests()
 	pduint8* rawstrip = (pduint8*)malloc(max_size);
 	ASSERT(rawstrip != NULL);
 	for (int s = 0; s < strips; s++) {
-		//int h = pdfrasread_strip_height(reader, p, s);
-		//ASSERT(h > 0);
-		//total_height += h;
+		int h = pdfrasread_strip_height(reader, p, s);
+		ASSERT(h > 0);
+		total_height += h;
 		ASSERT(total_height <= page_height);
 		size_t rcvd = pdfrasread_read_raw_strip(reader, p, s, rawstrip, max_size);
 		ASSERT(rcvd <= max_size);
 	}
-	//ASSERT(total_height == page_height);
+	ASSERT(total_height == page_height);
 	free(rawstrip);
 	printf("done\n");
 } // strip_data_tests
@@ -315,6 +328,1153 @@ void error_tests()
     printf("done\n");
 } // error_tests
 
+// Write an 8 x 8 gray strip to f as object num, and record where it is in offsets[num]
+static void write_gray_strip(FILE* f, long num, long* offsets)
+{
+	offsets[num] = ftell(f);
+	fprintf(f, "%ld 0 obj\n<< /Type /XObject /Subtype /Image /Width 8 /Height 8 /BitsPerComponent 8 /ColorSpace /DeviceGray /Length 64 >>\nstream\n", num);
+	for (int i = 0; i < 64; i++) fputc(i * 4, f);
+	fprintf(f, "\nendstream\nendobj\n");
+}
+
+// Write a synthetic PDF/raster file with npages pages, each holding a single
+// 8 x 8 gray strip. The page tree is balanced with the given fan-out
+// (use a fanout >= npages for a flat tree: a single /Pages node).
+// Page n has a /MediaBox width of 72 + n points so individual pages can be told apart.
+// The pages share one strip, unless strip_per_page, when each page has its own,
+// just before it (as pdfrasread_stream needs).
+static int write_page_tree(const char* fn, long npages, long fanout, int strip_per_page)
+{
+	FILE* f = fopen(fn, "wb");
+	if (!f) {
+		return 0;
+	}
+	// count the nodes at each level of the page tree, level 0 being the pages
+	// themselves and the last level being the root.
+	long levels[64];
+	int nlevels = 1;
+	levels[0] = npages;
+	do {
+		long n = (levels[nlevels - 1] + fanout - 1) / fanout;
+		levels[nlevels++] = n ? n : 1;
+	} while (levels[nlevels - 1] > 1);
+	// object number of node i at level k is base[k]+i: 1 is the catalog,
+	// 2 the root, 3 the shared strip, then the pages, then interior nodes.
+	long base[64];
+	long total = 4;
+	for (int k = 0; k < nlevels - 1; k++) {
+		base[k] = total;
+		total += levels[k];
+	}
+	base[nlevels - 1] = 2;
+	// the strip of page i, if it has its own, is object stripbase+i
+	long stripbase = total;
+	if (strip_per_page) {
+		total += npages;
+	}
+	long* offsets = (long*)malloc(total * sizeof *offsets);
+	if (!offsets) {
+		fclose(f);
+		return 0;
+	}
+	fprintf(f, "%%PDF-1.4\n%%\xE2\xE3\xCF\xD3\n");
+	offsets[1] = ftell(f);
+	fprintf(f, "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+	if (!strip_per_page) {
+		write_gray_strip(f, 3, offsets);
+	}
+	else {
+		// object 3 isn't used
+		offsets[3] = 0;
+	}
+	for (int k = 0; k < nlevels; k++) {
+		for (long i = 0; i < levels[k]; i++) {
+			long num = base[k] + i;
+			long strip = strip_per_page ? stripbase + i : 3;
+			if (k == 0 && strip_per_page) {
+				write_gray_strip(f, strip, offsets);
+			}
+			offsets[num] = ftell(f);
+			fprintf(f, "%ld 0 obj\n<< ", num);
+			if (k == 0) {
+				fprintf(f, "/Type /Page /MediaBox [0 0 %ld 72] /Resources << /XObject << /strip0 %ld 0 R >> >>", 72 + i, strip);
+			}
+			else {
+				long first = i * fanout;
+				long last = first + fanout < levels[k - 1] ? first + fanout : levels[k - 1];
+				// each node's /Count is the number of pages beneath it
+				long span = 1;
+				for (int j = 0; j < k; j++) span *= fanout;
+				long count = (i + 1) * span < npages ? span : npages - i * span;
+				fprintf(f, "/Type /Pages /Count %ld /Kids [", count);
+				for (long c = first; c < last; c++) {
+					fprintf(f, " %ld 0 R", base[k - 1] + c);
+				}
+				fprintf(f, " ]");
+			}
+			if (k + 1 < nlevels) {
+				fprintf(f, " /Parent %ld 0 R", base[k + 1] + i / fanout);
+			}
+			fprintf(f, " >>\nendobj\n");
+		}
+	}
+	long xref = ftell(f);
+	fprintf(f, "xref\n0 %ld\n0000000000 65535 f\r\n", total);
+	for (long num = 1; num < total; num++) {
+		if (offsets[num]) {
+			fprintf(f, "%010ld 00000 n\r\n", offsets[num]);
+		}
+		else {
+			fprintf(f, "0000000000 00001 f\r\n");
+		}
+	}
+	fprintf(f, "trailer\n<< /Size %ld /Root 1 0 R\n%%PDF-raster-1.0\n>>\nstartxref\n%ld\n%%%%EOF\n", total, xref);
+	free(offsets);
+	return 0 == fclose(f);
+}
+
+static int write_page_tree_file(const char* fn, long npages, long fanout)
+{
+	return write_page_tree(fn, npages, fanout, FALSE);
+}
+
+// check that page p of a file from write_page_tree_file is the right page
+static int page_tree_page_ok(t_pdfrasreader* reader, int p)
+{
+	double dpi = pdfrasread_page_horizontal_dpi(reader, p);
+	return pdfrasread_page_width(reader, p) == 8 && fabs(dpi - 8 * 72.0 / (72 + p)) < 1e-3;
+}
+
+void page_tree_tests()
+{
+	printf("-- page tree --\n");
+	// flat tree, then balanced trees of various shapes
+	const long fanouts[] = { 1000, 2, 3, 32 };
+	for (int t = 0; t < sizeof fanouts / sizeof fanouts[0]; t++) {
+		ASSERT(write_page_tree_file("pagetree.pdf", 1000, fanouts[t]));
+		t_pdfrasreader* reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "pagetree.pdf");
+		ASSERT(reader != NULL);
+		if (!reader) continue;
+		ASSERT(1000 == pdfrasread_page_count(reader));
+		// out-of-order access, then sequential, then backwards
+		ASSERT(page_tree_page_ok(reader, 999));
+		ASSERT(page_tree_page_ok(reader, 500));
+		int ok = 1;
+		for (int p = 0; p < 1000; p++) {
+			ok = ok && page_tree_page_ok(reader, p);
+		}
+		for (int p = 999; p >= 0; p -= 7) {
+			ok = ok && page_tree_page_ok(reader, p);
+		}
+		ASSERT(ok);
+		ASSERT(0 == pdfrasread_page_width(reader, 1000));
+		pdfrasread_destroy(reader);
+	}
+	remove("pagetree.pdf");
+	printf("done\n");
+} // page_tree_tests
+
+// Write a PDF/raster file whose objects 1..nobjs have the given bodies.
+// Object 1 must be the catalog.
+static int write_objects_file(const char* fn, const char* objs[], int nobjs)
+{
+	FILE* f = fopen(fn, "wb");
+	if (!f) {
+		return 0;
+	}
+	long offsets[256];
+	if (nobjs >= 256) {
+		fclose(f);
+		return 0;
+	}
+	fprintf(f, "%%PDF-1.4\n%%\xE2\xE3\xCF\xD3\n");
+	for (int i = 0; i < nobjs; i++) {
+		offsets[i] = ftell(f);
+		fprintf(f, "%d 0 obj\n%s\nendobj\n", i + 1, objs[i]);
+	}
+	long xref = ftell(f);
+	fprintf(f, "xref\n0 %d\n0000000000 65535 f\r\n", nobjs + 1);
+	for (int i = 0; i < nobjs; i++) {
+		fprintf(f, "%010ld 00000 n\r\n", offsets[i]);
+	}
+	fprintf(f, "trailer\n<< /Size %d /Root 1 0 R\n%%PDF-raster-1.0\n>>\nstartxref\n%ld\n%%%%EOF\n", nobjs + 1, xref);
+	return 0 == fclose(f);
+}
+
+static int last_compliance_code;
+
+static int record_compliance_errors(t_pdfrasreader* reader, int level, int code, pduint32 offset)
+{
+    if (level == REPORTING_COMPLIANCE) {
+        last_compliance_code = code;
+        return 0;
+    }
+    return pdfrasread_default_error_handler(reader, level, code, offset);
+}
+
+void page_tree_error_tests()
+{
+	printf("-- page tree errors --\n");
+	// a /Pages node that is its own kid
+	const char* loop[] = {
+		"<< /Type /Catalog /Pages 2 0 R >>",
+		"<< /Type /Pages /Count 1 /Kids [ 3 0 R ] >>",
+		"<< /Type /Pages /Count 1 /Kids [ 3 0 R ] >>",
+	};
+	ASSERT(write_objects_file("pagetree.pdf", loop, 3));
+	pdfrasread_set_global_error_handler(record_compliance_errors);
+	t_pdfrasreader* reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "pagetree.pdf");
+	ASSERT(reader != NULL);
+	if (reader) {
+		ASSERT(1 == pdfrasread_page_count(reader));
+		last_compliance_code = READ_OK;
+		ASSERT(0 == pdfrasread_page_width(reader, 0));
+		ASSERT(READ_PAGE_TREE_CYCLE == last_compliance_code);
+		// and again, the failed walk must not leave anything behind
+		last_compliance_code = READ_OK;
+		ASSERT(0 == pdfrasread_page_width(reader, 0));
+		ASSERT(READ_PAGE_TREE_CYCLE == last_compliance_code);
+		pdfrasread_destroy(reader);
+	}
+	// a chain of 100 /Pages nodes, each with one kid, ending in a page
+	static char chain[102][128];
+	const char* objs[103];
+	objs[0] = "<< /Type /Catalog /Pages 2 0 R >>";
+	for (int i = 0; i < 100; i++) {
+		sprintf(chain[i], "<< /Type /Pages /Count 1 /Kids [ %d 0 R ] >>", i + 3);
+		objs[i + 1] = chain[i];
+	}
+	objs[101] = "<< /Type /Page /MediaBox [0 0 72 72] /Resources << /XObject << /strip0 103 0 R >> >> >>";
+	objs[102] = "<< /Type /XObject /Subtype /Image /Width 8 /Height 1 /BitsPerComponent 8 /ColorSpace /DeviceGray /Length 8 >>\nstream\n01234567\nendstream";
+	ASSERT(write_objects_file("pagetree.pdf", objs, 103));
+	reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "pagetree.pdf");
+	ASSERT(reader != NULL);
+	if (reader) {
+		// too deep for the default limit
+		last_compliance_code = READ_OK;
+		ASSERT(0 == pdfrasread_page_width(reader, 0));
+		ASSERT(READ_PAGE_TREE_DEPTH == last_compliance_code);
+		// the deepest node is at depth 99 (the root is at 0)
+		pdfrasread_set_max_page_tree_depth(reader, 98);
+		last_compliance_code = READ_OK;
+		ASSERT(0 == pdfrasread_page_width(reader, 0));
+		ASSERT(READ_PAGE_TREE_DEPTH == last_compliance_code);
+		pdfrasread_set_max_page_tree_depth(reader, 99);
+		last_compliance_code = READ_OK;
+		ASSERT(8 == pdfrasread_page_width(reader, 0));
+		ASSERT(READ_OK == last_compliance_code);
+		pdfrasread_destroy(reader);
+	}
+	pdfrasread_set_global_error_handler(NULL);
+	remove("pagetree.pdf");
+	printf("done\n");
+} // page_tree_error_tests
+
+// Start a thread running proc(arg). Return 0 if that fails.
+static int start_thread(t_thread* pt, THREAD_PROC (*proc)(void*), void* arg)
+{
+#ifdef WIN32
+	*pt = (HANDLE)_beginthreadex(NULL, 0, proc, arg, 0, NULL);
+	return *pt != 0;
+#else
+	return 0 == pthread_create(pt, NULL, proc, arg);
+#endif
+}
+
+static void join_thread(t_thread t)
+{
+#ifdef WIN32
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+#else
+	pthread_join(t, NULL);
+#endif
+}
+
+#define STRESS_THREADS 32
+
+typedef struct {
+	const char*		filename;
+	int				pages;			// expected page count, -1 = should not open
+} t_corpus_file;
+
+static const t_corpus_file corpus[] = {
+	{ "sample all formats.pdf", 7 },
+	{ "valid1.pdf", 1 },
+	{ "bitonal badgamma.pdf", 1 },
+	{ "bad_trailer1.pdf", -1 },
+	{ "badxref1.pdf", -1 },
+	{ "arrayjunk.pdf", -1 },
+};
+
+typedef struct {
+	int				id;
+	unsigned		failures;		// written only by the worker thread
+} t_stress;
+
+static int quiet_error_handler(t_pdfrasreader* reader, int level, int code, pduint32 offset)
+{
+	return 0;
+}
+
+static int other_quiet_error_handler(t_pdfrasreader* reader, int level, int code, pduint32 offset)
+{
+	return 0;
+}
+
+// Open and read every file in the corpus, a few times over, checking results.
+// Failures are counted in the worker's own t_stress, because ASSERT isn't thread-safe.
+static THREAD_PROC stress_worker(void* arg)
+{
+	t_stress* ps = (t_stress*)arg;
+	for (int rep = 0; rep < 8; rep++) {
+		for (int i = 0; i < sizeof corpus / sizeof corpus[0]; i++) {
+			t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &freader, &fsizer, &fcloser);
+			if (!reader) {
+				ps->failures++;
+				continue;
+			}
+			// half the readers get their own handler, the rest inherit the (changing) global handler
+			if (ps->id & 1) {
+				pdfrasread_set_error_handler(reader, quiet_error_handler);
+			}
+			FILE* f = fopen(corpus[i].filename, "rb");
+			if (!f) {
+				ps->failures++;
+			}
+			else if (!pdfrasread_open(reader, f)) {
+				fclose(f);
+				if (corpus[i].pages >= 0) ps->failures++;
+			}
+			else {
+				int pages = pdfrasread_page_count(reader);
+				if (pages != corpus[i].pages) ps->failures++;
+				for (int p = 0; p < pages; p++) {
+					size_t max_size = pdfrasread_max_strip_size(reader, p);
+					char* strip = (char*)malloc(max_size);
+					int strips = pdfrasread_strip_count(reader, p);
+					if (!strip || strips < 1 || pdfrasread_page_width(reader, p) <= 0) ps->failures++;
+					for (int s = 0; strip && s < strips; s++) {
+						if (0 == pdfrasread_read_raw_strip(reader, p, s, strip, max_size)) ps->failures++;
+					}
+					free(strip);
+				}
+				// out of range pages report an API error through this reader's handler
+				if (0 != pdfrasread_page_width(reader, pages)) ps->failures++;
+			}
+			pdfrasread_destroy(reader);
+		}
+		// errors with no reader go to the global handler
+		if (-1 != pdfrasread_page_count(NULL)) ps->failures++;
+	}
+	return 0;
+}
+
+// Open the test corpus from many threads at once, while the global error handler
+// is being changed, and check that each thread gets the right answers.
+void thread_stress_tests()
+{
+	printf("-- thread stress tests --\n");
+	t_stress stress[STRESS_THREADS];
+	t_thread threads[STRESS_THREADS];
+	int started = 0;
+	pdfrasread_set_global_error_handler(quiet_error_handler);
+	for (int i = 0; i < STRESS_THREADS; i++) {
+		stress[i].id = i;
+		stress[i].failures = 0;
+		if (start_thread(&threads[i], stress_worker, &stress[i])) {
+			started++;
+		}
+	}
+	ASSERT(started == STRESS_THREADS);
+	// swap the global error handler back and forth while the workers run
+	for (int i = 0; i < 20000; i++) {
+		pdfrasread_set_global_error_handler((i & 1) ? quiet_error_handler : other_quiet_error_handler);
+		pdfras_err_handler h = pdfrasread_get_global_error_handler();
+		ASSERT(h == quiet_error_handler || h == other_quiet_error_handler);
+	}
+	unsigned failures = 0;
+	for (int i = 0; i < started; i++) {
+		join_thread(threads[i]);
+		failures += stress[i].failures;
+	}
+	ASSERT(failures == 0);
+	pdfrasread_set_global_error_handler(NULL);
+	printf("done\n");
+} // thread_stress_tests
+
+static int api_error_code;
+
+static int record_api_errors(t_pdfrasreader* reader, int level, int code, pduint32 offset)
+{
+	if (level == REPORTING_API) {
+		api_error_code = code;
+		return 0;
+	}
+	return pdfrasread_default_error_handler(reader, level, code, offset);
+}
+
+#define CURSOR_THREADS 8
+
+typedef struct {
+	t_pdfrasreader*	cursor;
+	unsigned		failures;		// written only by the worker thread
+} t_cursor_work;
+
+// read every page and strip of a write_page_tree_file file through one cursor
+static THREAD_PROC cursor_worker(void* arg)
+{
+	t_cursor_work* pw = (t_cursor_work*)arg;
+	int pages = pdfrasread_page_count(pw->cursor);
+	char strip[64];
+	for (int rep = 0; rep < 4; rep++) {
+		for (int p = 0; p < pages; p++) {
+			if (!page_tree_page_ok(pw->cursor, p)) pw->failures++;
+			if (64 != pdfrasread_read_raw_strip(pw->cursor, p, 0, strip, sizeof strip)) pw->failures++;
+			else if (strip[1] != 4 || strip[63] != (char)(63 * 4)) pw->failures++;
+		}
+	}
+	return 0;
+}
+
+void cursor_tests()
+{
+	printf("-- cursor tests --\n");
+	t_pdfrasreader* reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "sample all formats.pdf");
+	ASSERT(reader != NULL);
+	t_pdfrasreader* cursor = pdfrasread_create_cursor(reader);
+	ASSERT(cursor != NULL);
+	ASSERT(pdfrasread_is_open(cursor));
+	ASSERT(pdfrasread_source(cursor) == pdfrasread_source(reader));
+	ASSERT(7 == pdfrasread_page_count(cursor));
+	for (int p = 0; p < 7; p++) {
+		ASSERT(pdfrasread_page_width(cursor, p) == pdfrasread_page_width(reader, p));
+		ASSERT(pdfrasread_page_height(cursor, p) == pdfrasread_page_height(reader, p));
+		ASSERT(pdfrasread_strip_count(cursor, p) == pdfrasread_strip_count(reader, p));
+	}
+	// cursor of a cursor
+	t_pdfrasreader* cursor2 = pdfrasread_create_cursor(cursor);
+	ASSERT(cursor2 != NULL);
+	ASSERT(2521 == pdfrasread_page_width(cursor2, 1));
+	// can't close the reader while its cursors are open
+	pdfrasread_set_error_handler(reader, record_api_errors);
+	api_error_code = READ_OK;
+	ASSERT(FALSE == pdfrasread_close(reader));
+	ASSERT(READ_API_CURSORS_OPEN == api_error_code);
+	ASSERT(pdfrasread_is_open(reader));
+	// closing the cursors leaves the reader open
+	ASSERT(pdfrasread_close(cursor));
+	ASSERT(!pdfrasread_is_open(cursor));
+	pdfrasread_destroy(cursor);
+	pdfrasread_destroy(cursor2);
+	ASSERT(850 == pdfrasread_page_width(reader, 0));
+	ASSERT(pdfrasread_close(reader));
+	pdfrasread_destroy(reader);
+
+	// many cursors on many threads
+	ASSERT(write_page_tree_file("pagetree.pdf", 2000, 16));
+	reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "pagetree.pdf");
+	ASSERT(reader != NULL);
+	t_cursor_work work[CURSOR_THREADS];
+	t_thread threads[CURSOR_THREADS];
+	int started = 0;
+	for (int i = 0; i < CURSOR_THREADS; i++) {
+		work[i].cursor = pdfrasread_create_cursor(reader);
+		work[i].failures = 0;
+		ASSERT(work[i].cursor != NULL);
+		if (work[i].cursor && start_thread(&threads[i], cursor_worker, &work[i])) {
+			started++;
+		}
+	}
+	ASSERT(started == CURSOR_THREADS);
+	// and the reader itself, on this thread
+	t_cursor_work mine = { reader, 0 };
+	cursor_worker(&mine);
+	ASSERT(mine.failures == 0);
+	for (int i = 0; i < started; i++) {
+		join_thread(threads[i]);
+		ASSERT(work[i].failures == 0);
+		pdfrasread_destroy(work[i].cursor);
+	}
+	pdfrasread_destroy(reader);
+	remove("pagetree.pdf");
+	printf("done\n");
+} // cursor_tests
+
+static unsigned read_calls, readv_calls;
+
+// counts reads of strip data - the reader's parsing reads are always 1023 bytes long.
+static size_t counting_freader(void *source, pduint32 offset, size_t length, char *buffer)
+{
+	if (length != 1023) read_calls++;
+	return freader(source, offset, length, buffer);
+}
+
+static size_t counting_freadv(void *source, pduint32 offset, const t_pdfrasread_iovec* iov, int iovcnt)
+{
+	size_t total = 0;
+	readv_calls++;
+	for (int i = 0; i < iovcnt; i++) {
+		size_t n = freader(source, offset + (pduint32)total, iov[i].len, (char*)iov[i].base);
+		total += n;
+		if (n != iov[i].len) break;
+	}
+	return total;
+}
+
+// read every strip in a file with pdfrasread_read_raw_strips and
+// check it against what pdfrasread_read_raw_strip reads.
+static void check_vectored_reads(const char* fn, int use_readv)
+{
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &counting_freader, &fsizer, &fcloser);
+	ASSERT(reader != NULL);
+	if (use_readv) {
+		pdfrasread_set_readv(reader, counting_freadv);
+	}
+	FILE* f = fopen(fn, "rb");
+	ASSERT(f != NULL);
+	ASSERT(pdfrasread_open(reader, f));
+	int pages = pdfrasread_page_count(reader);
+	int total = 0;
+	for (int p = 0; p < pages; p++) {
+		total += pdfrasread_strip_count(reader, p);
+	}
+	t_pdfrasread_strip_request* reqs = (t_pdfrasread_strip_request*)malloc(total * sizeof *reqs);
+	ASSERT(reqs != NULL);
+	// ask for them last page first, to check they get sorted
+	int n = 0;
+	for (int p = pages - 1; p >= 0; p--) {
+		size_t max_size = pdfrasread_max_strip_size(reader, p);
+		for (int s = 0; s < pdfrasread_strip_count(reader, p); s++, n++) {
+			reqs[n].page = p;
+			reqs[n].strip = s;
+			reqs[n].buffer = malloc(max_size);
+			reqs[n].bufsize = max_size;
+		}
+	}
+	read_calls = readv_calls = 0;
+	ASSERT(total == pdfrasread_read_raw_strips(reader, reqs, total));
+	unsigned batch_reads = read_calls, batch_readvs = readv_calls;
+	ASSERT(batch_reads + batch_readvs < (unsigned)total);
+	ASSERT(use_readv || batch_readvs == 0);
+	read_calls = readv_calls = 0;
+	int ok = 1;
+	for (n = 0; n < total; n++) {
+		char* one = (char*)malloc(reqs[n].bufsize);
+		size_t size = pdfrasread_read_raw_strip(reader, reqs[n].page, reqs[n].strip, one, reqs[n].bufsize);
+		ok = ok && size > 0 && size == reqs[n].size && 0 == memcmp(one, reqs[n].buffer, size);
+		free(one);
+		free(reqs[n].buffer);
+	}
+	ASSERT(ok);
+	printf("%s: %d strips, %u data reads batched (%u readv), %u one at a time\n",
+		fn, total, batch_reads + batch_readvs, batch_readvs, read_calls);
+	free(reqs);
+	pdfrasread_destroy(reader);
+}
+
+void vectored_read_tests()
+{
+	printf("-- vectored strip reads --\n");
+	check_vectored_reads("sample all formats.pdf", FALSE);
+	check_vectored_reads("sample all formats.pdf", TRUE);
+	// a request that can't be satisfied doesn't stop the others
+	t_pdfrasreader* reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "sample all formats.pdf");
+	ASSERT(reader != NULL);
+	char small[16], big[200000];
+	t_pdfrasread_strip_request reqs[3] = {
+		{ 3, 0, big, sizeof big },
+		{ 0, 0, small, sizeof small },	// too small
+		{ 2, 0, big + 150000, 50000 },
+	};
+	pdfrasread_set_error_handler(reader, record_api_errors);
+	api_error_code = READ_OK;
+	ASSERT(2 == pdfrasread_read_raw_strips(reader, reqs, 3));
+	ASSERT(READ_STRIP_BUFFER_SIZE == api_error_code);
+	ASSERT(reqs[0].size == 116969);
+	ASSERT(reqs[1].size == 0);
+	ASSERT(reqs[2].size == 88);
+	pdfrasread_destroy(reader);
+	printf("done\n");
+} // vectored_read_tests
+
+// encrypted.pdf and encrypted_nopassword.pdf were written by pdfras_writer, encrypted with
+// AES-256: user password "user" (none for encrypted_nopassword.pdf), owner password "owner".
+// Page 0 is 64 x 30 GRAY8 in 3 strips, page 1 is 16 x 4 RGB24 with an ICC profile in 1 strip.
+// Byte i of strip s is (s * strip size + i) * 7.
+static int encrypted_strip_ok(const pduint8* data, size_t len, int p, int s)
+{
+	size_t expected = (p == 0) ? 640 : 192;
+	if (len != expected) return 0;
+	for (size_t i = 0; i < len; i++) {
+		if (data[i] != (pduint8)((s * len + i) * 7)) return 0;
+	}
+	return 1;
+}
+
+// check every strip of encrypted.pdf or encrypted_nopassword.pdf decrypts correctly
+static void check_encrypted_strips(t_pdfrasreader* reader)
+{
+	ASSERT(pdfrasread_is_encrypted(reader));
+	ASSERT(2 == pdfrasread_page_count(reader));
+	ASSERT(RASREAD_GRAY8 == pdfrasread_page_format(reader, 0));
+	ASSERT(RASREAD_RGB24 == pdfrasread_page_format(reader, 1));
+	ASSERT(3 == pdfrasread_strip_count(reader, 0));
+	ASSERT(1 == pdfrasread_strip_count(reader, 1));
+	pduint8 buf[1024];
+	int ok = 1;
+	for (int p = 0; p < 2; p++) {
+		// room for the padded data, which is at least a byte longer
+		ok = ok && pdfrasread_max_strip_size(reader, p) > (p == 0 ? 640u : 192u);
+		for (int s = 0; s < pdfrasread_strip_count(reader, p); s++) {
+			size_t len = pdfrasread_read_raw_strip(reader, p, s, buf, sizeof buf);
+			ok = ok && encrypted_strip_ok(buf, len, p, s);
+		}
+	}
+	ASSERT(ok);
+}
+
+void encryption_tests()
+{
+	printf("-- encrypted files --\n");
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &freader, &fsizer, &fcloser);
+	ASSERT(reader != NULL);
+	pdfrasread_set_error_handler(reader, record_api_errors);
+	FILE* f = fopen("encrypted.pdf", "rb");
+	ASSERT(f != NULL);
+	// it can't be opened without a password, or with the wrong one
+	api_error_code = READ_OK;
+	ASSERT(!pdfrasread_open(reader, f));
+	ASSERT(READ_ENCRYPT_PASSWORD == api_error_code);
+	api_error_code = READ_OK;
+	ASSERT(!pdfrasread_open_with_password(reader, f, "wrong"));
+	ASSERT(READ_ENCRYPT_PASSWORD == api_error_code);
+	ASSERT(!pdfrasread_is_open(reader));
+	// the user password opens it
+	ASSERT(pdfrasread_open_with_password(reader, f, "user"));
+	check_encrypted_strips(reader);
+	pduint8 key[32], key2[32];
+	ASSERT(0 == pdfrasread_file_key(reader, key, sizeof key - 1));
+	ASSERT(32 == pdfrasread_file_key(reader, key, sizeof key));
+	// so does a cursor
+	t_pdfrasreader* cursor = pdfrasread_create_cursor(reader);
+	ASSERT(cursor != NULL);
+	if (cursor) {
+		check_encrypted_strips(cursor);
+		pdfrasread_destroy(cursor);
+	}
+	ASSERT(pdfrasread_close(reader));
+	ASSERT(!pdfrasread_is_encrypted(reader));
+	// and the owner password, which unlocks the same file key
+	ASSERT(pdfrasread_open_with_password(reader, fopen("encrypted.pdf", "rb"), "owner"));
+	ASSERT(32 == pdfrasread_file_key(reader, key2, sizeof key2));
+	ASSERT(0 == memcmp(key, key2, sizeof key));
+	ASSERT(pdfrasread_close(reader));
+	// and the file key itself, but not a different one
+	f = fopen("encrypted.pdf", "rb");
+	key2[0] ^= 1;
+	api_error_code = READ_OK;
+	ASSERT(!pdfrasread_open_with_key(reader, f, key2, sizeof key2));
+	ASSERT(READ_ENCRYPT_PASSWORD == api_error_code);
+	ASSERT(!pdfrasread_open_with_key(reader, f, key, sizeof key - 1));
+	ASSERT(pdfrasread_open_with_key(reader, f, key, sizeof key));
+	check_encrypted_strips(reader);
+	ASSERT(pdfrasread_close(reader));
+	// a document without a user password opens like any other
+	ASSERT(pdfrasread_open(reader, fopen("encrypted_nopassword.pdf", "rb")));
+	check_encrypted_strips(reader);
+	ASSERT(pdfrasread_close(reader));
+	// and a password or key is ignored for a document that isn't encrypted
+	ASSERT(pdfrasread_open_with_password(reader, fopen("valid1.pdf", "rb"), "user"));
+	ASSERT(!pdfrasread_is_encrypted(reader));
+	ASSERT(0 == pdfrasread_file_key(reader, key2, sizeof key2));
+	ASSERT(pdfrasread_close(reader));
+	ASSERT(pdfrasread_open_with_key(reader, fopen("valid1.pdf", "rb"), key, sizeof key));
+	ASSERT(1 == pdfrasread_page_count(reader));
+	pdfrasread_destroy(reader);
+	// batched strip reads decrypt too
+	check_vectored_reads("encrypted_nopassword.pdf", FALSE);
+	check_vectored_reads("encrypted_nopassword.pdf", TRUE);
+	printf("done\n");
+} // encryption_tests
+
+// peak memory use of this process so far in KB, 0 if we can't tell
+static long peak_memory_kb()
+{
+#ifdef WIN32
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;		// bytes
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+void validation_tests()
+{
+	printf("-- validation --\n");
+	t_pdfrasread_validation result;
+	ASSERT(pdfrasread_validate_filename("valid1.pdf", 0, &result));
+	ASSERT(result.valid);
+	ASSERT(result.count == 0);
+	ASSERT(result.pages == 1);
+	ASSERT(result.strips == 1);
+	ASSERT(result.bytes_read > 0);
+	ASSERT(pdfrasread_validate_filename("sample all formats.pdf", 0, &result));
+	ASSERT(result.valid);
+	ASSERT(result.pages == 7);
+	// its sRGB profile is a proper ICC profile
+	ASSERT(result.count == 0);
+	// pdfras_writer's test profile in encrypted_nopassword.pdf isn't, which is only a warning
+	ASSERT(pdfrasread_validate_filename("encrypted_nopassword.pdf", 0, &result));
+	ASSERT(result.valid);
+	ASSERT(result.count == 1);
+	ASSERT(result.violations[0].level == REPORTING_WARNING);
+	ASSERT(result.violations[0].code == READ_ICC_PROFILE);
+	// broken files are reported, with what is wrong and where
+	ASSERT(!pdfrasread_validate_filename("arrayjunk.pdf", 0, &result));
+	ASSERT(!result.valid);
+	ASSERT(result.count >= 2);
+	ASSERT(result.violations[0].level == REPORTING_COMPLIANCE);
+	ASSERT(result.violations[0].offset > 0);
+	// early out stops at the first one
+	ASSERT(!pdfrasread_validate_filename("arrayjunk.pdf", RASREAD_VALIDATE_EARLY_OUT, &result));
+	ASSERT(result.count == 1);
+	ASSERT(!pdfrasread_validate_filename("missing_eofcomment.pdf", 0, &result));
+	ASSERT(result.violations[0].code == READ_FILE_EOF_MARKER);
+	ASSERT(!pdfrasread_validate_filename("nosuchfile.pdf", 0, &result));
+	ASSERT(result.count == 0);
+	// a reader used for validation is left as it was
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &freader, &fsizer, &fcloser);
+	ASSERT(reader != NULL);
+	FILE* f = fopen("valid1.pdf", "rb");
+	ASSERT(f != NULL);
+	ASSERT(pdfrasread_validate(reader, f, 0, &result));
+	ASSERT(!pdfrasread_is_open(reader));
+	ASSERT(pdfrasread_open(reader, f));
+	ASSERT(pdfrasread_page_count(reader) == 1);
+	ASSERT(pdfrasread_close(reader));
+	pdfrasread_destroy(reader);
+	ASSERT(strlen(pdfrasread_error_description(READ_FILE_EOF_MARKER)) > 0);
+	// no part of a file is read twice, whatever order its objects are in
+	ASSERT(write_page_tree_file("pagetree.pdf", 1000, 32));
+	const char* files[] = { "valid1.pdf", "encrypted.pdf", "sample all formats.pdf", "pagetree.pdf" };
+	for (int i = 0; i < sizeof files / sizeof files[0]; i++) {
+		f = fopen(files[i], "rb");
+		ASSERT(f != NULL);
+		if (!f) continue;
+		pduint32 size = fsizer(f);
+		fclose(f);
+		pdfrasread_validate_filename(files[i], 0, &result);
+		ASSERT(result.bytes_read > 0 && result.bytes_read <= size);
+	}
+	remove("pagetree.pdf");
+	// memory doesn't grow with the file: 200,000 pages, with every 4 KB of
+	// the file read
+	ASSERT(write_page_tree_file("pagetree.pdf", 200000, 32));
+	f = fopen("pagetree.pdf", "rb");
+	ASSERT(f != NULL);
+	long size = f ? (long)fsizer(f) : 0;
+	if (f) fclose(f);
+	long before = peak_memory_kb();
+	ASSERT(pdfrasread_validate_filename("pagetree.pdf", 0, &result));
+	ASSERT(200000 == result.pages);
+	long grew = peak_memory_kb() - before;
+	printf("validated %ld KB file, peak memory grew %ld KB\n", size / 1024, grew);
+	ASSERT(grew < size / 1024 / 3);
+	remove("pagetree.pdf");
+	printf("done\n");
+} // validation_tests
+
+void probe_tests()
+{
+	printf("-- probing --\n");
+	t_pdfrasread_probe info;
+	ASSERT(pdfrasread_probe_filename("valid1.pdf", &info));
+	ASSERT(info.page_count == 1);
+	ASSERT(info.major == 1);
+	ASSERT(!info.encrypted);
+	ASSERT(info.info_pos > 0);
+	ASSERT(info.metadata_pos == 0);
+	ASSERT(info.xref_pos > info.info_pos);
+	ASSERT(pdfrasread_probe_filename("sample all formats.pdf", &info));
+	ASSERT(info.page_count == 7);
+	ASSERT(info.metadata_pos > 0);
+	// encrypted files can be probed without a password
+	ASSERT(pdfrasread_probe_filename("encrypted.pdf", &info));
+	ASSERT(info.page_count == 2);
+	ASSERT(info.encrypted);
+	ASSERT(!pdfrasread_probe_filename("bad_trailer1.pdf", &info));
+	ASSERT(!pdfrasread_probe_filename("missing_eofcomment.pdf", &info));
+	ASSERT(!pdfrasread_probe_filename("nosuchfile.pdf", &info));
+	ASSERT(info.page_count == 0);
+	// only a few KB are read, however big the file
+	ASSERT(write_page_tree_file("pagetree.pdf", 20000, 32));
+	ASSERT(pdfrasread_probe_filename("pagetree.pdf", &info));
+	ASSERT(info.page_count == 20000);
+	ASSERT(info.xref_count > 20000);
+	ASSERT(info.bytes_read < 8192);
+	remove("pagetree.pdf");
+	// a reader used for probing can be opened afterwards
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &freader, &fsizer, &fcloser);
+	ASSERT(reader != NULL);
+	FILE* f = fopen("sample all formats.pdf", "rb");
+	ASSERT(f != NULL);
+	ASSERT(pdfrasread_probe(reader, f, &info));
+	ASSERT(!pdfrasread_is_open(reader));
+	ASSERT(pdfrasread_open(reader, f));
+	ASSERT(pdfrasread_page_count(reader) == 7);
+	ASSERT(pdfrasread_page_width(reader, 6) > 0);
+	pdfrasread_destroy(reader);
+	printf("done\n");
+} // probe_tests
+
+void icc_profile_tests()
+{
+	printf("-- ICC profiles --\n");
+	t_pdfrasreader* reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "sample all formats.pdf");
+	ASSERT(reader != NULL);
+	size_t len = 1;
+	// the bitonal and gray pages aren't ICC-based
+	ASSERT(NULL == pdfrasread_page_icc_profile(reader, 0, &len));
+	ASSERT(0 == len);
+	ASSERT(NULL == pdfrasread_page_icc_profile(reader, 3, NULL));
+	// the two RGB pages refer to the same profile, which is read once
+	size_t icclen = 0;
+	const pduint8* icc = pdfrasread_page_icc_profile(reader, 5, &icclen);
+	ASSERT(icc != NULL && icclen > 0);
+	size_t len2 = 0;
+	ASSERT(icc == pdfrasread_page_icc_profile(reader, 6, &len2));
+	ASSERT(len2 == icclen);
+	ASSERT(icc == pdfrasread_page_icc_profile(reader, 5, NULL));
+	// page that doesn't exist:
+	len = 1;
+	ASSERT(NULL == pdfrasread_page_icc_profile(reader, 7, &len));
+	ASSERT(0 == len);
+	// a cursor reads its own copy
+	t_pdfrasreader* cursor = pdfrasread_create_cursor(reader);
+	ASSERT(cursor != NULL);
+	if (cursor) {
+		const pduint8* icc2 = pdfrasread_page_icc_profile(cursor, 6, &len2);
+		ASSERT(icc2 != NULL && icc2 != icc);
+		ASSERT(len2 == icclen && 0 == memcmp(icc, icc2, icclen));
+		pdfrasread_destroy(cursor);
+	}
+	pdfrasread_destroy(reader);
+	// in an encrypted file the profile is decrypted: pdfras_writer's test profile
+	// in encrypted.pdf is 300 bytes counting up from 0
+	reader = pdfrasread_create(RASREAD_API_LEVEL, &freader, &fsizer, &fcloser);
+	ASSERT(reader != NULL);
+	ASSERT(pdfrasread_open_with_password(reader, fopen("encrypted.pdf", "rb"), "user"));
+	ASSERT(NULL == pdfrasread_page_icc_profile(reader, 0, NULL));
+	icc = pdfrasread_page_icc_profile(reader, 1, &len);
+	ASSERT(icc != NULL && 300 == len);
+	int counting = (icc != NULL);
+	for (size_t i = 0; counting && i < len; i++) {
+		counting = icc[i] == (pduint8)i;
+	}
+	ASSERT(counting);
+	pdfrasread_destroy(reader);
+	printf("done\n");
+} // icc_profile_tests
+
+void colorspace_tests()
+{
+	printf("-- colorspaces --\n");
+	t_pdfrasreader* reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "sample all formats.pdf");
+	ASSERT(reader != NULL);
+	t_pdfrasread_colorspace cs;
+	ASSERT(!pdfrasread_page_colorspace(reader, 0, NULL));
+	// pdfras_writer's bitonal and gray pages are /CalGray with its one set of parameters
+	ASSERT(pdfrasread_page_colorspace(reader, 0, &cs));
+	ASSERT(RASREAD_CALGRAY == cs.style);
+	ASSERT(2.2 == cs.gamma);
+	ASSERT(1.0 == cs.whitePoint[0] && 1.0 == cs.whitePoint[1] && 1.0 == cs.whitePoint[2]);
+	ASSERT(0.0 == cs.blackPoint[0] && 0.0 == cs.blackPoint[1] && 0.0 == cs.blackPoint[2]);
+	ASSERT(NULL == cs.iccProfile && 0 == cs.iccProfileLen);
+	ASSERT(pdfrasread_page_colorspace(reader, 3, &cs));
+	ASSERT(RASREAD_CALGRAY == cs.style);
+	// the RGB pages are ICC-based, the profile is pdfrasread_page_icc_profile's
+	ASSERT(pdfrasread_page_colorspace(reader, 5, &cs));
+	ASSERT(RASREAD_ICCBASED == cs.style);
+	size_t len = 0;
+	ASSERT(cs.iccProfile != NULL && cs.iccProfile == pdfrasread_page_icc_profile(reader, 5, &len));
+	ASSERT(cs.iccProfileLen == len);
+	// page that doesn't exist:
+	ASSERT(!pdfrasread_page_colorspace(reader, 7, &cs));
+	ASSERT(RASREAD_COLORSPACE_NULL == cs.style);
+	pdfrasread_destroy(reader);
+	printf("done\n");
+} // colorspace_tests
+
+// A source that can only be read front to back, a few bytes at a time
+typedef struct {
+	FILE*		f;
+	pduint32	next;			// offset of the next read
+	int			out_of_order;	// reads that didn't start at next
+} t_sequential;
+
+static size_t sequential_reader(void *source, pduint32 offset, size_t length, char *buffer)
+{
+	t_sequential* seq = (t_sequential*)source;
+	if (offset != seq->next) {
+		seq->out_of_order++;
+		return 0;
+	}
+	size_t n = fread(buffer, 1, length < 7 ? length : 7, seq->f);
+	seq->next += (pduint32)n;
+	return n;
+}
+
+static pduint32 sequential_sizer(void* source)
+{
+	(void)source;
+	ASSERT(0);			// never called
+	return 0;
+}
+
+typedef struct {
+	t_pdfrasreader*	reader;			// the same file, opened normally
+	int				pages;
+	int				strips;
+	int				mismatches;
+	int				stop_at;		// page to stop at, -1 for none
+	unsigned long	nums[16];		// object numbers of the strips not yet claimed by a page
+	void*			data[16];
+	size_t			size[16];
+	int				pending;
+} t_streamcheck;
+
+static int check_stream_strip(void* cookie, const t_pdfrasread_stream_strip* strip)
+{
+	t_streamcheck* chk = (t_streamcheck*)cookie;
+	chk->strips++;
+	if (chk->pending == 16 || strip->size == 0) {
+		chk->mismatches++;
+		return FALSE;
+	}
+	chk->nums[chk->pending] = strip->num;
+	chk->data[chk->pending] = malloc(strip->size);
+	memcpy(chk->data[chk->pending], strip->data, strip->size);
+	chk->size[chk->pending++] = strip->size;
+	return TRUE;
+}
+
+static int check_stream_page(void* cookie, const t_pdfrasread_stream_page* page)
+{
+	t_streamcheck* chk = (t_streamcheck*)cookie;
+	t_pdfrasreader* reader = chk->reader;
+	int p = page->page;
+	if (p != chk->pages++ ||
+		page->format != pdfrasread_page_format(reader, p) ||
+		page->width != pdfrasread_page_width(reader, p) ||
+		page->height != pdfrasread_page_height(reader, p) ||
+		page->rotation != pdfrasread_page_rotation(reader, p) ||
+		page->xdpi != pdfrasread_page_horizontal_dpi(reader, p) ||
+		page->strip_count != pdfrasread_strip_count(reader, p)) {
+		chk->mismatches++;
+		return FALSE;
+	}
+	// each strip of the page has been seen, with the data the reader reads
+	size_t bufsize = pdfrasread_max_strip_size(reader, p);
+	char* buf = (char*)malloc(bufsize);
+	for (int s = 0; s < page->strip_count; s++) {
+		size_t len = pdfrasread_read_raw_strip(reader, p, s, buf, bufsize);
+		int i = 0;
+		while (i < chk->pending && chk->nums[i] != page->strips[s]) i++;
+		if (i == chk->pending || len != chk->size[i] || 0 != memcmp(buf, chk->data[i], len)) {
+			chk->mismatches++;
+			continue;
+		}
+		free(chk->data[i]);
+		chk->pending--;
+		chk->nums[i] = chk->nums[chk->pending];
+		chk->data[i] = chk->data[chk->pending];
+		chk->size[i] = chk->size[chk->pending];
+	}
+	free(buf);
+	return p != chk->stop_at;
+}
+
+// stream fn, checking what is found against the reader, and return pdfrasread_stream's result
+static int check_stream(const char* fn, t_streamcheck* chk, int stop_at)
+{
+	memset(chk, 0, sizeof *chk);
+	chk->stop_at = stop_at;
+	chk->reader = pdfrasread_open_filename(RASREAD_API_LEVEL, fn);
+	t_sequential seq = { fopen(fn, "rb"), 0, 0 };
+	ASSERT(seq.f != NULL);
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &sequential_reader, &sequential_sizer, NULL);
+	ASSERT(reader != NULL);
+	pdfrasread_set_error_handler(reader, record_api_errors);
+	api_error_code = READ_OK;
+	int ok = pdfrasread_stream(reader, &seq, check_stream_strip, check_stream_page, chk);
+	ASSERT(seq.out_of_order == 0);
+	ASSERT(!pdfrasread_is_open(reader));
+	pdfrasread_destroy(reader);
+	fclose(seq.f);
+	while (chk->pending) {
+		free(chk->data[--chk->pending]);
+	}
+	if (chk->reader) {
+		pdfrasread_destroy(chk->reader);
+	}
+	return ok;
+}
+
+void stream_tests()
+{
+	printf("-- streaming --\n");
+	t_streamcheck chk;
+	ASSERT(check_stream("valid1.pdf", &chk, -1));
+	ASSERT(chk.pages == 1);
+	ASSERT(chk.strips == 1);
+	ASSERT(chk.mismatches == 0);
+	ASSERT(check_stream("sample all formats.pdf", &chk, -1));
+	ASSERT(chk.pages == 7);
+	ASSERT(chk.mismatches == 0);
+	ASSERT(api_error_code == READ_OK);
+	// a handler can stop it
+	ASSERT(!check_stream("sample all formats.pdf", &chk, 2));
+	ASSERT(chk.pages == 3);
+	ASSERT(chk.mismatches == 0);
+	// broken files are found
+	ASSERT(!check_stream("arrayjunk.pdf", &chk, -1));
+	ASSERT(!check_stream("missing_eofcomment.pdf", &chk, -1));
+	// an encrypted file is only known at the end, after its strips
+	// have been passed on as they are - encrypted - so they must be discarded
+	ASSERT(!check_stream("encrypted_nopassword.pdf", &chk, -1));
+	ASSERT(api_error_code == READ_STREAM_ENCRYPTED);
+	ASSERT(chk.strips > 0);
+	ASSERT(chk.mismatches == chk.strips);
+	// the same, from a FILE that is read with fread only
+	FILE* f = fopen("sample all formats.pdf", "rb");
+	ASSERT(f != NULL);
+	ASSERT(pdfrasread_stream_file(f, NULL, NULL, NULL));
+	fclose(f);
+	// a reader used for streaming can be opened afterwards
+	t_pdfrasreader* reader = pdfrasread_create(RASREAD_API_LEVEL, &freader, &fsizer, &fcloser);
+	ASSERT(reader != NULL);
+	f = fopen("valid1.pdf", "rb");
+	ASSERT(f != NULL);
+	ASSERT(pdfrasread_stream(reader, f, NULL, NULL, NULL));
+	ASSERT(!pdfrasread_is_open(reader));
+	rewind(f);
+	ASSERT(pdfrasread_open(reader, f));
+	ASSERT(pdfrasread_page_count(reader) == 1);
+	pdfrasread_destroy(reader);
+	// memory grows by a few bytes per object, not with the file: 200,000
+	// pages, each with its own strip
+	ASSERT(write_page_tree("pagetree.pdf", 200000, 32, TRUE));
+	f = fopen("pagetree.pdf", "rb");
+	ASSERT(f != NULL);
+	long size = f ? (long)fsizer(f) : 0;
+	if (f) rewind(f);
+	long before = peak_memory_kb();
+	ASSERT(f && pdfrasread_stream_file(f, NULL, NULL, NULL));
+	long grew = peak_memory_kb() - before;
+	if (f) fclose(f);
+	printf("streamed %ld KB file, peak memory grew %ld KB\n", size / 1024, grew);
+	ASSERT(grew < size / 1024 / 8);
+	remove("pagetree.pdf");
+	printf("done\n");
+} // stream_tests
+
+static double elapsed_ms(clock_t start)
+{
+	return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+// Time how long it takes to open a large file and get to its first page,
+// compared to visiting every page.
+void open_latency_benchmark()
+{
+	printf("-- open latency benchmark --\n");
+	const long npages = 50000;
+	const long fanouts[] = { npages, 32 };
+	for (int t = 0; t < sizeof fanouts / sizeof fanouts[0]; t++) {
+		ASSERT(write_page_tree_file("pagetree.pdf", npages, fanouts[t]));
+		clock_t start = clock();
+		t_pdfrasreader* reader = pdfrasread_open_filename(RASREAD_API_LEVEL, "pagetree.pdf");
+		ASSERT(reader != NULL);
+		if (!reader) continue;
+		ASSERT(npages == pdfrasread_page_count(reader));
+		double open_ms = elapsed_ms(start);
+		ASSERT(8 == pdfrasread_page_width(reader, 0));
+		double first_ms = elapsed_ms(start);
+		ASSERT(8 == pdfrasread_page_width(reader, npages - 1));
+		double last_ms = elapsed_ms(start);
+		int ok = 1;
+		for (int p = 0; p < npages; p++) {
+			ok = ok && (8 == pdfrasread_page_width(reader, p));
+		}
+		ASSERT(ok);
+		double all_ms = elapsed_ms(start);
+		pdfrasread_destroy(reader);
+		printf("%ld pages, fan-out %ld: open %.1f ms, page 0 %.1f ms, last page %.1f ms, all pages %.1f ms\n",
+			npages, fanouts[t], open_ms, first_ms, last_ms, all_ms);
+	}
+	remove("pagetree.pdf");
+	printf("done\n");
+} // open_latency_benchmark
+
+// Get the page counts of a directory of large files, by opening each
+// (pdfrasread_page_count_filename) and by probing it (pdfrasread_probe_filename).
+void probe_benchmark()
+{
+	printf("-- probe benchmark --\n");
+	const long sizes[] = { 1000, 10000, 50000, 100000, 200000 };
+	const int nfiles = sizeof sizes / sizeof sizes[0];
+	char fn[64];
+	long total_bytes = 0;
+	for (int i = 0; i < nfiles; i++) {
+		sprintf(fn, "probe%d.pdf", i);
+		ASSERT(write_page_tree_file(fn, sizes[i], 32));
+		FILE* f = fopen(fn, "rb");
+		if (f) {
+			fseek(f, 0, SEEK_END);
+			total_bytes += ftell(f);
+			fclose(f);
+		}
+	}
+	const int rounds = 5;
+	int ok = 1;
+	clock_t start = clock();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < nfiles; i++) {
+			sprintf(fn, "probe%d.pdf", i);
+			ok = ok && sizes[i] == pdfrasread_page_count_filename(fn);
+		}
+	}
+	double open_ms = elapsed_ms(start);
+	ASSERT(ok);
+	unsigned long bytes_read = 0;
+	start = clock();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < nfiles; i++) {
+			t_pdfrasread_probe info;
+			sprintf(fn, "probe%d.pdf", i);
+			ok = ok && pdfrasread_probe_filename(fn, &info) && sizes[i] == info.page_count;
+			bytes_read += info.bytes_read;
+		}
+	}
+	double probe_ms = elapsed_ms(start);
+	ASSERT(ok);
+	for (int i = 0; i < nfiles; i++) {
+		sprintf(fn, "probe%d.pdf", i);
+		remove(fn);
+	}
+	printf("%d files, %ld bytes: page count by open %.2f ms/file, by probe %.3f ms/file, %lu bytes read/file\n",
+		nfiles, total_bytes, open_ms / (rounds * nfiles), probe_ms / (rounds * nfiles), bytes_read / (rounds * nfiles));
+	printf("done\n");
+} // probe_benchmark
+
 
 int main(int argc, char* argv[])
 {
@@ -330,6 +1490,24 @@ int main(int argc, char* argv[])
 	page_info_tests();
 	strip_data_tests();
     error_tests();
+    page_tree_tests();
+    page_tree_error_tests();
+    thread_stress_tests();
+    cursor_tests();
+    vectored_read_tests();
+    encryption_tests();
+    validation_tests();
+    stream_tests();
+    probe_tests();
+    icc_profile_tests();
+    colorspace_tests();
+    // the benchmarks only measure, and take a while: run them with --bench
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "--bench")) {
+            open_latency_benchmark();
+            probe_benchmark();
+        }
+    }
 
 	unsigned fails = get_number_of_failures();
 
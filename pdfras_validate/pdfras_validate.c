@@ -0,0 +1,94 @@
+// pdfras_validate.c : check PDF/raster files with pdfrasread_validate.
+//
+// usage: pdfras_validate [-e] [-q] file...
+// Reports every violation found in each file, with how long the check took
+// and how much of the file it read. The exit code is 0 if all the files are
+// valid, 1 if any is not, 2 for a usage error.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pdfrasread_files.h"
+
+static const char* level_name(int level)
+{
+	switch (level) {
+	case REPORTING_WARNING:		return "warning";
+	case REPORTING_COMPLIANCE:	return "compliance";
+	case REPORTING_API:			return "api";
+	case REPORTING_MEMORY:		return "memory";
+	case REPORTING_IO:			return "i/o";
+	case REPORTING_LIMIT:		return "limit";
+	case REPORTING_INTERNAL:	return "internal";
+	default:					return "other";
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: pdfras_validate [-e] [-q] file...\n"
+		"Check that files are valid PDF/raster.\n"
+		"  -e   stop checking each file at its first violation\n"
+		"  -q   don't list the violations, just say if each file is valid\n");
+}
+
+int main(int argc, char* argv[])
+{
+	int flags = 0;
+	int quiet = 0;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-e") == 0) {
+			flags |= RASREAD_VALIDATE_EARLY_OUT;
+		}
+		else if (strcmp(argv[i], "-q") == 0) {
+			quiet = 1;
+		}
+		else {
+			usage();
+			return 2;
+		}
+	}
+	if (i == argc) {
+		usage();
+		return 2;
+	}
+
+	int files = 0, invalid = 0;
+	double seconds = 0, bytes = 0;
+	for (; i < argc; i++) {
+		t_pdfrasread_validation result;
+		FILE* f = fopen(argv[i], "rb");
+		if (!f) {
+			fprintf(stderr, "pdfras_validate: can't open %s\n", argv[i]);
+			invalid++;
+			continue;
+		}
+		pdfrasread_validate_file(f, flags, &result);
+		fclose(f);
+		files++;
+		seconds += result.seconds;
+		bytes += result.bytes_read;
+		if (!result.valid) {
+			invalid++;
+		}
+		printf("%s: %s, %d pages, %d strips, %lu bytes read, %.3f ms\n", argv[i],
+			result.valid ? "valid" : "INVALID", result.pages, result.strips,
+			(unsigned long)result.bytes_read, result.seconds * 1000.0);
+		if (!quiet) {
+			for (int v = 0; v < result.count && v < RASREAD_MAX_VIOLATIONS; v++) {
+				const t_pdfrasread_violation* viol = &result.violations[v];
+				printf("  %-10s offset +%06lu, code %d: %s\n", level_name(viol->level),
+					(unsigned long)viol->offset, viol->code, pdfrasread_error_description(viol->code));
+			}
+			if (result.count > RASREAD_MAX_VIOLATIONS) {
+				printf("  ... and %d more\n", result.count - RASREAD_MAX_VIOLATIONS);
+			}
+		}
+	}
+	if (files > 1) {
+		printf("%d files, %d invalid, %.3f ms, %.0f bytes read\n", files, invalid, seconds * 1000.0, bytes);
+	}
+	return invalid ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _H_PdfAES
+#define _H_PdfAES
+#pragma once
+
+// AES block cipher (FIPS-197), as used by PDF's AESV2 and AESV3 crypt filters.
+// Uses the AES-NI instructions when the processor has them, otherwise a
+// portable table-driven implementation.
+
+#include "PdfPlatform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PD_AES_BLOCK 16
+
+typedef struct {
+	int			rounds;					// 10 for AES-128, 14 for AES-256
+	pdbool		hw;						// use the AES instructions, as chosen by pd_aes_set_key
+	pduint8		enc[15 * PD_AES_BLOCK];	// encryption round keys
+	pduint8		dec[15 * PD_AES_BLOCK];	// decryption round keys (equivalent inverse cipher)
+} t_pdaeskey;
+
+// Expand a 128- or 256-bit key (keybits = 128 or 256).
+// This also decides whether the key is used with the AES instructions, so a
+// key can be shared between threads once it is set.
+extern void pd_aes_set_key(t_pdaeskey *key, const pduint8 *k, int keybits);
+
+// Encrypt or decrypt one 16-byte block. in and out may be the same.
+extern void pd_aes_encrypt_block(const t_pdaeskey *key, const pduint8 *in, pduint8 *out);
+extern void pd_aes_decrypt_block(const t_pdaeskey *key, const pduint8 *in, pduint8 *out);
+
+// CBC-mode encrypt or decrypt nblocks 16-byte blocks from in to out, which
+// may be the same. iv holds the chaining value, and is updated so that
+// the next call carries on where this one left off.
+extern void pd_aes_cbc_encrypt(const t_pdaeskey *key, pduint8 *iv, const pduint8 *in, pduint8 *out, size_t nblocks);
+extern void pd_aes_cbc_decrypt(const t_pdaeskey *key, pduint8 *iv, const pduint8 *in, pduint8 *out, size_t nblocks);
+
+// True if this processor has the AES instructions
+extern pdbool pd_aes_hw_available(void);
+
+// Turn use of the AES instructions on or off (if they are available) for
+// keys set from now on, returns the previous setting. For tests and benchmarks
+// only: this is not thread-safe, so don't call it while other threads might be
+// setting keys.
+extern pdbool pd_aes_use_hw(pdbool enable);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
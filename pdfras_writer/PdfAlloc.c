@@ -1,38 +1,87 @@
+
 #include "PdfAlloc.h"
 #include <assert.h>
 
 struct _t_heapelem;
+struct _t_slab;
+
+// Arena mode: small blocks are bump-allocated out of large slabs obtained
+// from the platform, and freed small blocks are kept on per-size-class
+// free lists for reuse.  Slabs are only returned to the platform in bulk,
+// by pd_pool_clean or pd_alloc_free_pool.
+// Blocks bigger than ARENA_MAX_BLOCK go straight to the platform as in
+// the plain (non-arena) pool.
+#define ARENA_GRANULE			16
+#define ARENA_MAX_BLOCK			512
+#define ARENA_CLASSES			(ARENA_MAX_BLOCK / ARENA_GRANULE + 1)
+#define ARENA_DEFAULT_SLAB		65536
 
 typedef struct t_pdmempool {
 	t_OS *os;
 	struct _t_heapelem	*first;		// ptr to first block in use by this pool (or NULL if none)
 	pduint32 alloc_count;			// count of allocated-and-not-yet-freed blocks in this pool
 	size_t	alloc_bytes;			// total bytes currently allocated to blocks in this pool (excluding overhead)
+	// arena mode only:
+	pdbool	arena;					// true if small blocks are carved from slabs
+	size_t	slab_size;				// bytes requested from the platform per slab
+	struct _t_slab *slabs;			// list of slabs owned by this pool (most recent first)
+	struct _t_slab *spare;			// emptied slabs kept by pd_pool_reset, used before new ones
+	pduint8	*bump;					// next free byte in the current slab
+	pduint8	*limit;					// end of the current slab
+	struct _t_heapelem *freelist[ARENA_CLASSES];	// freed small blocks, by size class
 } t_pdmempool;
 
 typedef struct _t_heapelem
 {
 	t_pdmempool *pool;			// owning pool
 	struct _t_heapelem	*prev;
-	struct _t_heapelem	*next;
+	struct _t_heapelem	*next;	// (arena) link in free list while on it
 	size_t size;
+	size_t sizeclass;			// 0 = platform block on the pool list, else arena size class + 1
 #if PDDEBUG
 	char *location;				// hint about where/who allocated.
 #endif
 	//pduint8 data[0];
 } t_heapelem;
 
+typedef struct _t_slab
+{
+	struct _t_slab *next;
+	size_t size;				// usable bytes following this header
+	// Pad the header so slab data starts on an ARENA_GRANULE boundary.
+	pduint8 pad[ARENA_GRANULE - (2 * sizeof(void*)) % ARENA_GRANULE];
+} t_slab;
+
 extern t_pdmempool *pd_alloc_new_pool(t_OS *os)
 {
-	t_pdmempool *pool = 0; 
+	t_pdmempool *pool = 0;
 	if (!os) return 0;
 
 	pool = (t_pdmempool*)os->alloc(sizeof(t_pdmempool));
 	if (!pool) return NULL;
+	os->memset(pool, 0, sizeof(t_pdmempool));
 	pool->os = os;
 	pool->alloc_count = 0;
 	pool->alloc_bytes = 0;
 	pool->first = NULL;
+	pool->arena = PD_FALSE;
+	return pool;
+}
+
+extern t_pdmempool *pd_alloc_new_arena_pool(t_OS *os, size_t slab_size)
+{
+	t_pdmempool *pool = pd_alloc_new_pool(os);
+	if (pool) {
+		if (slab_size == 0) {
+			slab_size = ARENA_DEFAULT_SLAB;
+		}
+		// a slab must hold at least one block of the largest size class
+		if (slab_size < sizeof(t_heapelem) + ARENA_MAX_BLOCK) {
+			slab_size = sizeof(t_heapelem) + ARENA_MAX_BLOCK;
+		}
+		pool->arena = PD_TRUE;
+		pool->slab_size = slab_size;
+	}
 	return pool;
 }
 
@@ -64,23 +113,67 @@ t_pdmempool *pd_get_pool(void *ptr)
 	return elem->pool;
 }
 
+// Carve a header + block of size class k out of the current slab,
+// starting a new slab if the current one is exhausted.
+static t_heapelem *arena_carve(t_pdmempool *pool, size_t k)
+{
+	size_t need = sizeof(t_heapelem) + k * ARENA_GRANULE;
+	// keep every header granule-aligned
+	need = (need + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1);
+	if (pool->bump == NULL || (size_t)(pool->limit - pool->bump) < need) {
+		t_slab *slab = pool->spare;
+		if (slab) {
+			pool->spare = slab->next;
+		}
+		else {
+			slab = (t_slab *)pool->os->alloc(sizeof(t_slab) + pool->slab_size);
+			if (!slab) return NULL;
+			slab->size = pool->slab_size;
+		}
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		pool->bump = (pduint8 *)(slab + 1);
+		pool->limit = pool->bump + slab->size;
+	}
+	t_heapelem *elem = (t_heapelem *)pool->bump;
+	pool->bump += need;
+	return elem;
+}
+
 void *__pd_alloc(t_pdmempool *pool, size_t bytes, char *loc)
 {
 
 	if (!pool) return NULL;
-	size_t totalBytes = bytes + sizeof(t_heapelem);
-	t_heapelem *elem = (t_heapelem*)pool->os->alloc(totalBytes);
-	if (!elem) return 0;
+	t_heapelem *elem;
+	if (pool->arena && bytes <= ARENA_MAX_BLOCK) {
+		size_t k = (bytes + ARENA_GRANULE - 1) / ARENA_GRANULE;
+		elem = pool->freelist[k];
+		if (elem) {
+			pool->freelist[k] = elem->next;
+		}
+		else {
+			elem = arena_carve(pool, k);
+			if (!elem) return 0;
+		}
+		elem->prev = elem->next = 0;
+		elem->sizeclass = k + 1;
+	}
+	else {
+		size_t totalBytes = bytes + sizeof(t_heapelem);
+		elem = (t_heapelem*)pool->os->alloc(totalBytes);
+		if (!elem) return 0;
+		elem->sizeclass = 0;
+		// hook the new block into the pool list
+		elem->prev = pool->first;
+		if (elem->prev) {
+			elem->prev->next = elem;
+		}
+		elem->next = 0;
+		pool->first = elem;
+	}
 
 	elem->size = bytes;
 	elem->pool = pool;
-	// hook the new block into the pool list
-	elem->prev = pool->first;
-	if (elem->prev) {
-		elem->prev->next = elem;
-	}
-	elem->next = 0;
-	pool->first = elem;
 
 	// track blocks and bytes allocated to this pool:
 	pool->alloc_count++;
@@ -102,6 +195,17 @@ void __pd_free(void *ptr, pdbool validate)
 		int offset = sizeof(t_heapelem);	// offsetof(t_heapelem, data);
 		t_heapelem *elem = (t_heapelem *)(((pduint8 *)ptr) - offset);
 		t_pdmempool *pool = elem->pool;
+		if (elem->sizeclass) {
+			// arena block: park it on its size-class free list.
+			// Not zeroed here - __pd_alloc zeroes it on reuse.
+			size_t k = elem->sizeclass - 1;
+			assert(pool->arena && k < ARENA_CLASSES);
+			pool->alloc_bytes -= elem->size;
+			pool->alloc_count--;
+			elem->next = pool->freelist[k];
+			pool->freelist[k] = elem;
+			return;
+		}
 		if (validate)
 		{
 #if PDDEBUG
@@ -145,16 +249,67 @@ size_t pd_get_block_size(void* block)
 	}
 }
 
+pdbool pd_is_arena_pool(t_pdmempool* pool)
+{
+	return pool ? pool->arena : PD_FALSE;
+}
+
+static void free_slabs(t_pdmempool* pool, t_slab *slab)
+{
+	while (slab) {
+		t_slab *next = slab->next;
+		pool->os->free(slab);
+		slab = next;
+	}
+}
+
+// Free all the blocks in a pool. An arena pool either frees its slabs
+// or, if keep_slabs, moves them to its spare list.
+static void pool_empty(t_pdmempool* pool, pdbool keep_slabs)
+{
+	while (pool->first) {
+		void* block = (pduint8*)(pool->first) + sizeof(t_heapelem);
+		__pd_free(block, 0);
+	}
+	if (pool->arena) {
+		// dropping the slabs in bulk takes every
+		// arena block (free or not) with them.
+		if (keep_slabs) {
+			t_slab *slab = pool->slabs;
+			while (slab) {
+				t_slab *next = slab->next;
+				slab->next = pool->spare;
+				pool->spare = slab;
+				slab = next;
+			}
+		}
+		else {
+			free_slabs(pool, pool->slabs);
+			free_slabs(pool, pool->spare);
+			pool->spare = NULL;
+		}
+		pool->slabs = NULL;
+		pool->bump = pool->limit = NULL;
+		pool->os->memset(pool->freelist, 0, sizeof pool->freelist);
+		pool->alloc_count = 0;
+		pool->alloc_bytes = 0;
+	}
+	assert(pool->first == NULL);
+	assert(pool->alloc_count == 0);
+	assert(pool->alloc_bytes == 0);
+}
+
 void pd_pool_clean(t_pdmempool* pool)
 {
 	if (pool) {
-		while (pool->first) {
-			void* block = (pduint8*)(pool->first) + sizeof(t_heapelem);
-			__pd_free(block, 0);
-		}
-		assert(pool->first == NULL);
-		assert(pool->alloc_count == 0);
-		assert(pool->alloc_bytes == 0);
+		pool_empty(pool, PD_FALSE);
+	}
+}
+
+void pd_pool_reset(t_pdmempool* pool)
+{
+	if (pool) {
+		pool_empty(pool, PD_TRUE);
 	}
 }
 
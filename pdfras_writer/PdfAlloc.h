@@ -14,6 +14,16 @@ typedef struct t_pdmempool t_pdmempool;
 // memory from the underlying 'os' platform.
 extern struct t_pdmempool *pd_alloc_new_pool(t_OS *os);
 
+// Create and return an allocation pool in arena mode.
+// Small blocks are bump-allocated from slabs of slab_size bytes (0 = default),
+// freed small blocks are recycled through size-class free lists, and the
+// slabs themselves go back to 'os' only in pd_pool_clean or pd_alloc_free_pool.
+// Otherwise behaves exactly like a pool from pd_alloc_new_pool.
+extern struct t_pdmempool *pd_alloc_new_arena_pool(t_OS *os, size_t slab_size);
+
+// Return true if pool was created by pd_alloc_new_arena_pool.
+extern pdbool pd_is_arena_pool(t_pdmempool* pool);
+
 // Return a memory block to a pool.
 // ptr = a pointer previously returned by __pd_alloc and not since freed.
 // Or NULL, which is ignored.
@@ -32,6 +42,11 @@ extern size_t pd_get_block_size(void* block);
 // Same effect as calling pd_free on every outstanding block in the pool.
 extern void pd_pool_clean(t_pdmempool* pool);
 
+// Frees all the blocks in a pool, like pd_pool_clean, except that an
+// arena pool keeps its slabs and reuses them for later allocations.
+// For a pool that is filled and emptied over and over.
+extern void pd_pool_reset(t_pdmempool* pool);
+
 // (internal) Allocate a block of memory in/from an allocation pool.
 // allocsys = allocation pool to allocate from/in.
 // nb = number of bytes (at least) to allocate
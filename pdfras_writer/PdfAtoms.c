@@ -7,16 +7,38 @@
 #include <memory.h>
 #include <assert.h>
 
+// An atom table is an open-addressed hash table of interned names.
+// Each entry keeps the hash of its name so probing rarely has to
+// compare strings, and expanding the table never rehashes a name.
+// The names themselves are packed into large chunks owned by the
+// table, which are released in bulk by pd_atom_table_free.
+// Every table is pre-seeded with the standard atoms, so interning
+// e.g. "Type" returns PDA_Type.
+
+#define NAME_CHUNK_SIZE 4096
+
+typedef struct {
+	t_pdatom atom;				// NULL if this entry is empty
+	pduint32 hash;
+} t_atomentry;
+
+typedef struct t_namechunk {
+	struct t_namechunk *next;
+	pduint32 used;				// bytes used in this chunk
+	pduint32 size;				// bytes of name storage following this header
+} t_namechunk;
+
 typedef struct t_pdatomtable {
-	// number of elements this table can currently hold
+	// number of entries in the table (a power of 2)
 	pduint32 capacity;
-	// number of elements currently stored in this table
+	// number of atoms in the table, including the standard atoms
 	pduint32 elements;
 	// array of capacity entries.
-	t_pdatom *buckets;
+	t_atomentry *buckets;
+	// storage for interned names, current chunk first
+	t_namechunk *names;
 } t_pdatomtable;
 
-
 // Standard Atoms
 char *__ATOM_UNDEFINED_ATOM = "<undefined>";
 char *__ATOM_Type = "Type";
@@ -84,21 +106,260 @@ char *__ATOM_N = "N";
 char *__ATOM_ASCIIHexDecode = "ASCIIHexDecode";
 char* __ATOM_CalRGB = "CalRGB";
 char* __ATOM_Matrix = "Matrix";
+char* __ATOM_Encrypt = "Encrypt";
+char* __ATOM_Standard = "Standard";
+char* __ATOM_V = "V";
+char* __ATOM_R = "R";
+char* __ATOM_CF = "CF";
+char* __ATOM_StdCF = "StdCF";
+char* __ATOM_CFM = "CFM";
+char* __ATOM_AESV3 = "AESV3";
+char* __ATOM_AuthEvent = "AuthEvent";
+char* __ATOM_DocOpen = "DocOpen";
+char* __ATOM_StmF = "StmF";
+char* __ATOM_StrF = "StrF";
+char* __ATOM_O = "O";
+char* __ATOM_U = "U";
+char* __ATOM_OE = "OE";
+char* __ATOM_UE = "UE";
+char* __ATOM_P = "P";
+char* __ATOM_Perms = "Perms";
+char* __ATOM_Version = "Version";
+char* __ATOM_Extensions = "Extensions";
+char* __ATOM_ADBE = "ADBE";
+char* __ATOM_BaseVersion = "BaseVersion";
+char* __ATOM_ExtensionLevel = "ExtensionLevel";
+char* __ATOM_AcroForm = "AcroForm";
+char* __ATOM_Fields = "Fields";
+char* __ATOM_SigFlags = "SigFlags";
+char* __ATOM_Annots = "Annots";
+char* __ATOM_Annot = "Annot";
+char* __ATOM_Widget = "Widget";
+char* __ATOM_FT = "FT";
+char* __ATOM_Sig = "Sig";
+char* __ATOM_T = "T";
+char* __ATOM_Rect = "Rect";
+char* __ATOM_F = "F";
+char* __ATOM_M = "M";
+char* __ATOM_SubFilter = "SubFilter";
+
+
+static char **standard_atoms[] = {
+	&__ATOM_Type,
+	&__ATOM_Pages,
+	&__ATOM_Size,
+	&__ATOM_Root,
+	&__ATOM_Info,
+	&__ATOM_ID,
+	&__ATOM_Catalog,
+	&__ATOM_Parent,
+	&__ATOM_Kids,
+	&__ATOM_Count,
+	&__ATOM_Page,
+	&__ATOM_Resources,
+	&__ATOM_MediaBox,
+	&__ATOM_CropBox,
+	&__ATOM_Contents,
+	&__ATOM_Rotate,
+	&__ATOM_Length,
+	&__ATOM_Filter,
+	&__ATOM_DecodeParms,
+	&__ATOM_Subtype,
+	&__ATOM_Width,
+	&__ATOM_Height,
+	&__ATOM_BitsPerComponent,
+	&__ATOM_ColorSpace,
+	&__ATOM_Image,
+	&__ATOM_XObject,
+	&__ATOM_Title,
+	&__ATOM_Subject,
+	&__ATOM_Author,
+	&__ATOM_Keywords,
+	&__ATOM_Creator,
+	&__ATOM_Producer,
+	&__ATOM_None,
+	&__ATOM_FlateDecode,
+	&__ATOM_CCITTFaxDecode,
+	&__ATOM_DCTDecode,
+	&__ATOM_JBIG2Decode,
+	&__ATOM_JPXDecode,
+	&__ATOM_K,
+	&__ATOM_Columns,
+	&__ATOM_Rows,
+	&__ATOM_BlackIs1,
+	&__ATOM_DeviceGray,
+	&__ATOM_DeviceRGB,
+	&__ATOM_DeviceCMYK,
+	&__ATOM_Indexed,
+	&__ATOM_ICCBased,
+	&__ATOM_PieceInfo,
+	&__ATOM_LastModified,
+	&__ATOM_Private,
+	&__ATOM_PDFRaster,
+	&__ATOM_PhysicalPageNumber,
+	&__ATOM_FrontSide,
+	&__ATOM_CreationDate,
+	&__ATOM_ModDate,
+	&__ATOM_Metadata,
+	&__ATOM_XML,
+	&__ATOM_CalGray,
+	&__ATOM_BlackPoint,
+	&__ATOM_WhitePoint,
+	&__ATOM_Gamma,
+	&__ATOM_N,
+	&__ATOM_ASCIIHexDecode,
+	&__ATOM_CalRGB,
+	&__ATOM_Matrix,
+	&__ATOM_Encrypt,
+	&__ATOM_Standard,
+	&__ATOM_V,
+	&__ATOM_R,
+	&__ATOM_CF,
+	&__ATOM_StdCF,
+	&__ATOM_CFM,
+	&__ATOM_AESV3,
+	&__ATOM_AuthEvent,
+	&__ATOM_DocOpen,
+	&__ATOM_StmF,
+	&__ATOM_StrF,
+	&__ATOM_O,
+	&__ATOM_U,
+	&__ATOM_OE,
+	&__ATOM_UE,
+	&__ATOM_P,
+	&__ATOM_Perms,
+	&__ATOM_Version,
+	&__ATOM_Extensions,
+	&__ATOM_ADBE,
+	&__ATOM_BaseVersion,
+	&__ATOM_ExtensionLevel,
+	&__ATOM_AcroForm,
+	&__ATOM_Fields,
+	&__ATOM_SigFlags,
+	&__ATOM_Annots,
+	&__ATOM_Annot,
+	&__ATOM_Widget,
+	&__ATOM_FT,
+	&__ATOM_Sig,
+	&__ATOM_T,
+	&__ATOM_Rect,
+	&__ATOM_F,
+	&__ATOM_M,
+	&__ATOM_SubFilter,
+};
 
+#define STANDARD_ATOM_COUNT (sizeof(standard_atoms) / sizeof(standard_atoms[0]))
 
 const char *pd_atom_name(t_pdatom atom)
 {
 	return (const char*)atom;
 }
 
+// FNV-1a hash of a name
+static pduint32 hash_name(const char* name)
+{
+	pduint32 h = 2166136261U;
+	while (*name) {
+		h ^= (pduint8)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+// Find the entry for name (with hash h) or the empty entry where
+// it belongs. Relies on the table never being full.
+static t_atomentry* find_entry(t_pdatomtable *atoms, const char* name, pduint32 h)
+{
+	pduint32 mask = atoms->capacity - 1;
+	pduint32 i = h & mask;
+	for (;;) {
+		t_atomentry *e = &atoms->buckets[i];
+		if (e->atom == NULL) {
+			return e;
+		}
+		if (e->hash == h && 0 == pd_strcmp(pd_atom_name(e->atom), name)) {
+			return e;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+// Allocate & return an empty bucket array of given capacity
+static t_atomentry* new_buckets(t_pdmempool* pool, pduint32 cap)
+{
+	// pd_alloc zeroes the block, so every entry starts out empty
+	return (t_atomentry*)pd_alloc(pool, cap * sizeof(t_atomentry));
+}
+
+static pdbool expand_atom_table(t_pdatomtable* atoms)
+{
+	pduint32 oldCap = atoms->capacity;
+	pduint32 newCap = oldCap * 2;
+	t_atomentry* oldBuckets = atoms->buckets;
+	t_atomentry* newBuckets = new_buckets(pd_get_pool(atoms), newCap);
+	if (!newBuckets) {
+		return PD_FALSE;
+	}
+	atoms->buckets = newBuckets;
+	atoms->capacity = newCap;
+	pduint32 i;
+	for (i = 0; i < oldCap; i++) {
+		if (oldBuckets[i].atom) {
+			*find_entry(atoms, pd_atom_name(oldBuckets[i].atom), oldBuckets[i].hash) = oldBuckets[i];
+		}
+	}
+	pd_free(oldBuckets);
+	return PD_TRUE;
+}
+
+// Copy a name into the table's name storage, return the copy.
+static char* store_name(t_pdatomtable* atoms, const char* name)
+{
+	pduint32 len = (pduint32)pdstrlen(name) + 1;
+	t_namechunk *chunk = atoms->names;
+	if (!chunk || chunk->size - chunk->used < len) {
+		pduint32 size = (len > NAME_CHUNK_SIZE) ? len : NAME_CHUNK_SIZE;
+		chunk = (t_namechunk*)pd_alloc_same_pool(atoms, sizeof(t_namechunk) + size);
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->size = size;
+		chunk->used = 0;
+		chunk->next = atoms->names;
+		atoms->names = chunk;
+	}
+	char *copy = (char*)(chunk + 1) + chunk->used;
+	memcpy(copy, name, len);
+	chunk->used += len;
+	return copy;
+}
+
 extern t_pdatomtable* pd_atom_table_new(t_pdmempool* pool, int initialCap)
 {
 	t_pdatomtable* table = (t_pdatomtable*)pd_alloc(pool, sizeof(t_pdatomtable));
 	if (table) {
+		// room for the standard atoms plus initialCap more,
+		// with the table at most 3/4 full.
+		pduint32 need = (pduint32)(STANDARD_ATOM_COUNT + (initialCap > 0 ? initialCap : 0));
+		pduint32 cap = 2;
+		while (cap * 3 < need * 4) {
+			cap *= 2;
+		}
 		table->elements = 0;
-		table->buckets = (t_pdatom*)pd_alloc(pool, initialCap * sizeof(table->buckets[0]));
+		table->names = NULL;
+		table->buckets = new_buckets(pool, cap);
 		if (table->buckets) {
-			table->capacity = initialCap;
+			table->capacity = cap;
+			unsigned i;
+			for (i = 0; i < STANDARD_ATOM_COUNT; i++) {
+				const char* name = *standard_atoms[i];
+				pduint32 h = hash_name(name);
+				t_atomentry *e = find_entry(table, name, h);
+				assert(e->atom == NULL);
+				e->atom = (t_pdatom)name;
+				e->hash = h;
+				table->elements++;
+			}
 			return table;
 		}
 		pd_free(table); table = NULL;
@@ -109,9 +370,11 @@ extern t_pdatomtable* pd_atom_table_new(t_pdmempool* pool, int initialCap)
 extern void pd_atom_table_free(t_pdatomtable* atoms)
 {
 	if (atoms) {
-		unsigned i;
-		for (i = 0; i < atoms->elements; i++) {
-			pd_free(atoms->buckets[i]);
+		t_namechunk *chunk = atoms->names;
+		while (chunk) {
+			t_namechunk *next = chunk->next;
+			pd_free(chunk);
+			chunk = next;
 		}
 		pd_free(atoms->buckets);
 		pd_free(atoms);
@@ -120,52 +383,31 @@ extern void pd_atom_table_free(t_pdatomtable* atoms)
 
 int pd_atom_table_count(t_pdatomtable* atoms)
 {
-	return atoms ? atoms->elements : 0;
-}
-
-// Search atomtable for atom with given name.
-// Returns the bucket index of the matching entry if found, otherwise
-static int search_atom_table(t_pdatomtable *atoms, const char* name)
-{
-	int i;
-	for (i = 0; i < (int)atoms->elements; i++) {
-		if (0 == pd_strcmp(pd_atom_name(atoms->buckets[i]), name)) {
-			return i;
-		}
-	}
-	return -1;
-}
-
-static pdbool expand_atom_table(t_pdatomtable* atoms)
-{
-	pduint32 newCap = atoms->capacity * 2;
-	t_pdatom* newBuckets = (t_pdatom*)pd_alloc_same_pool(atoms, newCap * sizeof(atoms->buckets[0]));
-	if (!newBuckets) {
-		return PD_FALSE;
-	}
-	memcpy(newBuckets, atoms->buckets, atoms->elements * sizeof(atoms->buckets[0]));
-	pd_free(atoms->buckets);
-	atoms->buckets = newBuckets;
-	atoms->capacity = newCap;
-	return PD_TRUE;
+	return atoms ? (int)(atoms->elements - STANDARD_ATOM_COUNT) : 0;
 }
 
 t_pdatom pd_atom_intern(t_pdatomtable* atoms, const char* name)
 {
-	int index = search_atom_table(atoms, name);
-	if (index < 0) {
+	pduint32 h = hash_name(name);
+	t_atomentry *e = find_entry(atoms, name, h);
+	if (e->atom == NULL) {
 		// not found, add to table
-		if (atoms->elements == atoms->capacity) {
-			// table is full, (try to) expand it
+		if ((atoms->elements + 1) * 4 > atoms->capacity * 3) {
+			// table is getting full, (try to) expand it
 			if (!expand_atom_table(atoms)) {
 				// Failed. What can we do?
 				// Maybe return an error atom?
 				return (t_pdatom)NULL;
 			}
+			e = find_entry(atoms, name, h);
+		}
+		char *copy = store_name(atoms, name);
+		if (!copy) {
+			return (t_pdatom)NULL;
 		}
-		assert(atoms->elements < atoms->capacity);
-		index = atoms->elements++;
-		atoms->buckets[index] = pd_strdup(pd_get_pool(atoms), name);
+		e->atom = (t_pdatom)copy;
+		e->hash = h;
+		atoms->elements++;
 	}
-	return atoms->buckets[index];
+	return e->atom;
 }
@@ -13,14 +13,19 @@ typedef struct t_pdatomtable t_pdatomtable;
 
 extern const char *pd_atom_name(t_pdatom atom);
 
+// Return the atom with the given name, adding it to the table if needed.
+// Standard names return the standard atom, e.g. "Type" => PDA_Type.
 extern t_pdatom pd_atom_intern(t_pdatomtable *atoms, const char* name);
 
+// Create an atom table with room for about initialCap atoms before it
+// has to grow. The table is pre-seeded with the standard atoms.
 extern t_pdatomtable* pd_atom_table_new(t_pdmempool* pool, int initialCap);
 
 // Free an atom table, including all interned atoms.
 extern void pd_atom_table_free(t_pdatomtable* atoms);
 
-// Return the number of distinct entries (atoms) in an atom table.
+// Return the number of distinct entries (atoms) in an atom table,
+// not counting the pre-seeded standard atoms.
 extern int pd_atom_table_count(t_pdatomtable* atoms);
 
 #ifdef __cplusplus
@@ -1,18 +1,71 @@
 #include "PdfContentsGenerator.h"
+#include "PdfAtoms.h"
 #include "PdfDatasink.h"
 #include "PdfStreaming.h"
 
+#include <string.h>
+
+// The generator formats the whole content stream into one growable
+// buffer, which is handed to the sink in a single put when the
+// content-generating function returns. The buffer is kept between
+// runs, so a generator that is reused settles at its largest size.
 typedef struct t_pdcontents_gen {
 	f_gen gen;
 	void *gencookie;
 	t_datasink *sink;
-	t_pdoutstream *os;
+	t_pdoutstream *os;		// for the odd value we let pd_write_value format
+	char *buf;				// content formatted so far
+	pduint32 len;			// chars in buf
+	pduint32 cap;			// allocated size of buf
+	pdbool failed;			// couldn't grow buf, content is truncated
 }t_pdcontents_gen;
 
+// Make room for at least n more chars in the buffer
+static pdbool gen_reserve(t_pdcontents_gen *gen, pduint32 n)
+{
+	if (gen->failed) {
+		return PD_FALSE;
+	}
+	if (gen->cap - gen->len < n) {
+		pduint32 newcap = gen->cap ? gen->cap * 2 : 1024;
+		while (newcap - gen->len < n) {
+			newcap *= 2;
+		}
+		char *newbuf = (char *)pd_alloc_same_pool(gen, newcap);
+		if (!newbuf) {
+			gen->failed = PD_TRUE;
+			return PD_FALSE;
+		}
+		if (gen->len) {
+			memcpy(newbuf, gen->buf, gen->len);
+		}
+		pd_free(gen->buf);
+		gen->buf = newbuf;
+		gen->cap = newcap;
+	}
+	return PD_TRUE;
+}
+
+static void gen_puts(t_pdcontents_gen *gen, const char *s, pduint32 n)
+{
+	if (gen_reserve(gen, n)) {
+		memcpy(gen->buf + gen->len, s, n);
+		gen->len += n;
+	}
+}
+
+// append ' ' followed by a real number
+static void gen_putreal(t_pdcontents_gen *gen, pddouble x)
+{
+	if (gen_reserve(gen, 1 + PD_REAL_MAXLEN)) {
+		gen->buf[gen->len++] = ' ';
+		gen->len += pd_format_real(x, gen->buf + gen->len);
+	}
+}
+
 static int gen_write_out(const pduint8 *data, pduint32 offset, pduint32 length, void *cookie)
 {
-	t_pdcontents_gen *generator = (t_pdcontents_gen *)cookie;
-	pd_datasink_put(generator->sink, data, offset, length);
+	gen_puts((t_pdcontents_gen *)cookie, (const char *)data + offset, length);
 	return length;
 }
 
@@ -34,81 +87,103 @@ void pd_contents_gen_free(t_pdcontents_gen *gen)
 {
 	if (!gen) return;
 	pd_outstream_free(gen->os);
+	pd_free(gen->buf);
 	pd_free(gen);
 }
 
+void pd_contents_gen_reserve(t_pdcontents_gen *gen, pduint32 bytes)
+{
+	if (gen && bytes > gen->len) {
+		gen_reserve(gen, bytes - gen->len);
+	}
+}
+
 void pd_contents_generate(t_datasink *sink, void *gencookie)
 {
 	t_pdcontents_gen *gen = (t_pdcontents_gen *)gencookie;
 	// plug in the sink
 	gen->sink = sink;
+	gen->len = 0;
+	gen->failed = PD_FALSE;
 	// invoke the content-generating function
 	gen->gen(gen, gen->gencookie);
+	// and deliver what it generated
+	if (gen->len) {
+		pd_datasink_put(sink, gen->buf, 0, gen->len);
+	}
 }
 
 void pd_gen_moveto(t_pdcontents_gen *gen, pddouble x, pddouble y)
 {
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, x);
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, y);
-	pd_puts(gen->os, " m");
+	gen_putreal(gen, x);
+	gen_putreal(gen, y);
+	gen_puts(gen, " m", 2);
 }
 
 void pd_gen_lineto(t_pdcontents_gen *gen, pddouble x, pddouble y)
 {
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, x);
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, y);
-	pd_puts(gen->os, " l");
+	gen_putreal(gen, x);
+	gen_putreal(gen, y);
+	gen_puts(gen, " l", 2);
 }
 
 void pd_gen_closepath(t_pdcontents_gen *gen)
 {
-	pd_puts(gen->os, " h");
+	gen_puts(gen, " h", 2);
 }
 
 void pd_gen_stroke(t_pdcontents_gen *gen)
 {
-	pd_puts(gen->os, " S");
+	gen_puts(gen, " S", 2);
 }
 
 void pd_gen_fill(t_pdcontents_gen *gen, pdbool evenodd)
 {
-	pd_puts(gen->os, evenodd ? " f*" : " f");
+	if (evenodd) {
+		gen_puts(gen, " f*", 3);
+	}
+	else {
+		gen_puts(gen, " f", 2);
+	}
 }
 
 void pd_gen_gsave(t_pdcontents_gen *gen)
 {
-	pd_puts(gen->os, " q");
+	gen_puts(gen, " q", 2);
 }
 
 void pd_gen_grestore(t_pdcontents_gen *gen)
 {
-	pd_puts(gen->os, " Q");
+	gen_puts(gen, " Q", 2);
 }
 
 void pd_gen_concatmatrix(t_pdcontents_gen *gen, pddouble a, pddouble b, pddouble c, pddouble d, pddouble e, pddouble f)
 {
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, a);
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, b);
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, c);
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, d);
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, e);
-	pd_putc(gen->os, ' ');
-	pd_putfloat(gen->os, f);
-	pd_puts(gen->os, " cm");
+	gen_putreal(gen, a);
+	gen_putreal(gen, b);
+	gen_putreal(gen, c);
+	gen_putreal(gen, d);
+	gen_putreal(gen, e);
+	gen_putreal(gen, f);
+	gen_puts(gen, " cm", 3);
 }
 
 void pd_gen_xobject(t_pdcontents_gen *gen, t_pdatom xobjectatom)
 {
-	pd_putc(gen->os, ' ');
-	pd_write_value(gen->os, pdatomvalue(xobjectatom));
-	pd_puts(gen->os, " Do");
+	const char *name = pd_atom_name(xobjectatom);
+	pduint32 n = 0;
+	// names like "strip12" need no escaping, copy them straight in.
+	while (name[n] > ' ' && name[n] <= '~' && name[n] != '#' && name[n] != '%' && name[n] != '/') {
+		n++;
+	}
+	if (name[n] == 0 && gen_reserve(gen, n + 2)) {
+		gen->buf[gen->len++] = ' ';
+		gen->buf[gen->len++] = '/';
+		gen_puts(gen, name, n);
+	}
+	else {
+		gen_puts(gen, " ", 1);
+		pd_write_value(gen->os, pdatomvalue(xobjectatom));
+	}
+	gen_puts(gen, " Do", 3);
 }
@@ -17,7 +17,12 @@ extern t_pdcontents_gen *pd_contents_gen_new(t_pdmempool *pool, f_gen gen, void
 // Free a contents generator
 extern void pd_contents_gen_free(t_pdcontents_gen *gen);
 
+// Make sure a contents generator can format at least this many bytes
+// of content without having to grow its buffer.
+extern void pd_contents_gen_reserve(t_pdcontents_gen *gen, pduint32 bytes);
+
 // Activate a contents-generator to output its contents to a datasink.
+// The content is formatted into a buffer, then put to the sink in one piece.
 extern void pd_contents_generate(t_datasink *sink, void *gen);
 
 // Helper functions for generating PDF content stream operators.
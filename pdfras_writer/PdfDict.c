@@ -82,7 +82,7 @@ t_pdvalue pd_dict_put(t_pdvalue dict, t_pdatom key, t_pdvalue value)
 {
 	DEREFERENCE(dict);
 	if (!IS_DICT(dict) || !dict.value.dictvalue) return pderrvalue();
-	pd_hashatomtovalue_put(dict.value.dictvalue->elems, key, value);
+	if (!pd_hashatomtovalue_put(dict.value.dictvalue->elems, key, value)) return pderrvalue();
 	return dict;
 }
 
@@ -2,37 +2,178 @@
 #include "PdfStandardAtoms.h"
 #include "PdfStrings.h"
 
-#define kSomeReasonableInitialSize 10
+#define kSomeReasonableInitialSize 16
+
+// Open addressing with linear probing and Robin Hood insertion: an entry
+// that is further from its home bucket takes the slot of one that is closer
+// to home, which keeps probe sequences short and lets a lookup for a
+// missing key stop as soon as it passes where the key would have been.
+// Capacity is always a power of 2, and the home bucket of a key is
+// the top bits of its hash (Fibonacci hashing).
+// The keys are also kept in the order they were added, which is the order
+// pd_hashatomtovalue_foreach visits them: atoms are pointers, and visiting
+// in bucket order would write dictionaries in a different order each run.
 
 typedef struct {
 	t_pdvalue value;
 	t_pdatom key;
+	pduint32 hash;			// hash_atom(key), saves recomputing it while probing
 } t_bucket;
 
 typedef struct t_pdhashatomtovalue {
-	// number of elements this table can currently hold
+	// number of elements this table can currently hold (a power of 2)
 	pduint32 capacity;
+	// 32 - log2(capacity): home bucket = hash >> shift
+	pduint32 shift;
 	// number of elements currently stored in this table
 	pduint32 elements;
 	// array of capacity (key,value) pairs. Unused entries have key=PDA_UNDEFINED_ATOM
 	t_bucket *buckets;
+	// array of capacity keys, the first 'elements' in the order they were added
+	t_pdatom *order;
 } t_pdhashatomtovalue;
 
+// Hash an atom (a pointer). Heap pointers share their low bits, so fold
+// in the high bits, then multiply by 2^32/phi, which mixes everything
+// into the top bits - the ones we use.
+static pduint32 hash_atom(t_pdatom key)
+{
+	size_t h = (size_t)key;
+	h ^= h >> (sizeof(size_t) * 4);
+	return (pduint32)h * 2654435769U;
+}
+
+// Distance of bucket i from the home bucket of the key stored in it.
+static pduint32 probe_distance(t_pdhashatomtovalue *table, pduint32 i)
+{
+	return (i - (table->buckets[i].hash >> table->shift)) & (table->capacity - 1);
+}
 
-// Initialize hash table to have capacity for size entries
-static void init_table(t_pdhashatomtovalue *hash, pduint32 size)
+// Smallest power of 2 >= n (and at least 2).
+static pduint32 round_up_capacity(pduint32 n)
 {
-	hash->buckets = (t_bucket*)pd_alloc_same_pool(hash, sizeof(t_bucket) * size);
-	if (hash->buckets) {
+	pduint32 cap = 2;
+	while (cap < n) {
+		cap <<= 1;
+	}
+	return cap;
+}
+
+// Set capacity & shift for a power-of-2 capacity
+static void set_capacity(t_pdhashatomtovalue *table, pduint32 cap)
+{
+	table->capacity = cap;
+	table->shift = 32;
+	while (cap > 1) {
+		cap >>= 1;
+		table->shift--;
+	}
+}
+
+// Allocate & clear an array of size buckets.
+static t_bucket *new_buckets(t_pdhashatomtovalue *hash, pduint32 size)
+{
+	t_bucket *buckets = (t_bucket*)pd_alloc_same_pool(hash, sizeof(t_bucket) * size);
+	if (buckets) {
 		pduint32 i;
-		hash->capacity = size;
-		hash->elements = 0;
 		for (i = 0; i < size; i++)
 		{
-			hash->buckets[i].key = PDA_UNDEFINED_ATOM;
-			hash->buckets[i].value.value.intvalue = 0;
+			buckets[i].key = PDA_UNDEFINED_ATOM;
+		}
+	}
+	return buckets;
+}
+
+// Insert a key known not to be in the table, into a table known to have room.
+static void insert_new(t_pdhashatomtovalue *table, t_pdatom key, pduint32 h, t_pdvalue value)
+{
+	pduint32 mask = table->capacity - 1;
+	pduint32 i = h >> table->shift;
+	pduint32 dist = 0;
+	t_bucket entry;
+	entry.key = key;
+	entry.hash = h;
+	entry.value = value;
+	for (;;) {
+		t_bucket *b = &table->buckets[i];
+		if (b->key == PDA_UNDEFINED_ATOM) {
+			*b = entry;
+			break;
+		}
+		pduint32 bdist = probe_distance(table, i);
+		if (bdist < dist) {
+			// Robin Hood: take the slot, carry on inserting the evicted entry
+			t_bucket evicted = *b;
+			*b = entry;
+			entry = evicted;
+			dist = bdist;
+		}
+		i = (i + 1) & mask;
+		dist++;
+	}
+	table->elements++;
+}
+
+// Add a key known not to be in the table, into a table known to have room.
+static void add_new(t_pdhashatomtovalue *table, t_pdatom key, pduint32 h, t_pdvalue value)
+{
+	table->order[table->elements] = key;
+	insert_new(table, key, h, value);
+}
+
+// Search hashtable for entry with key and return its bucket index, or -1 if not found.
+// Keys are compared using '==', so they must be identical (same address) not just string-equal.
+static pdint32 find(t_pdhashatomtovalue *table, t_pdatom key, pduint32 h)
+{
+	pduint32 mask = table->capacity - 1;
+	pduint32 i = h >> table->shift;
+	pduint32 dist;
+	for (dist = 0; dist < table->capacity; dist++)
+	{
+		t_pdatom k = table->buckets[i].key;
+		if (k == key) {
+			return (pdint32)i;
+		}
+		// an empty slot, or an entry closer to home than we are,
+		// means the key would have been placed before here.
+		if (k == PDA_UNDEFINED_ATOM || probe_distance(table, i) < dist) {
+			break;
 		}
+		i = (i + 1) & mask;
 	}
+	return -1;
+}
+
+// Move every entry into a new bucket array of the given size.
+// On failure the table is left as it was.
+static pdbool rehash_table(t_pdhashatomtovalue *table, pduint32 newcap)
+{
+	t_bucket *oldbuckets = table->buckets;
+	pduint32 i, oldcap = table->capacity;
+	t_bucket *buckets = new_buckets(table, newcap);
+	t_pdatom *order = (t_pdatom*)pd_alloc_same_pool(table, sizeof(t_pdatom) * newcap);
+	if (!buckets || !order) {
+		pd_free(buckets);
+		pd_free(order);
+		return PD_FALSE;
+	}
+	for (i = 0; i < table->elements; i++)
+	{
+		order[i] = table->order[i];
+	}
+	pd_free(table->order);
+	table->order = order;
+	table->buckets = buckets;
+	set_capacity(table, newcap);
+	table->elements = 0;
+	for (i = 0; i < oldcap; i++)
+	{
+		if (oldbuckets[i].key != PDA_UNDEFINED_ATOM) {
+			insert_new(table, oldbuckets[i].key, oldbuckets[i].hash, oldbuckets[i].value);
+		}
+	}
+	pd_free(oldbuckets);
+	return PD_TRUE;
 }
 
 
@@ -42,8 +183,17 @@ t_pdhashatomtovalue *pd_hashatomtovalue_new(t_pdmempool *pool, pduint32 initialC
 	if (pool) {
 		hash = (t_pdhashatomtovalue*)pd_alloc(pool, sizeof(t_pdhashatomtovalue));
 		if (hash) {
+			pduint32 cap = round_up_capacity(initialCap == 0 ? kSomeReasonableInitialSize : initialCap);
 			hash->elements = 0;
-			init_table(hash, initialCap == 0 ? kSomeReasonableInitialSize : initialCap);
+			hash->buckets = new_buckets(hash, cap);
+			hash->order = (t_pdatom*)pd_alloc(pool, sizeof(t_pdatom) * cap);
+			if (!hash->buckets || !hash->order) {
+				pd_free(hash->buckets);
+				pd_free(hash->order);
+				pd_free(hash);
+				return NULL;
+			}
+			set_capacity(hash, cap);
 		}
 	}
 	return hash;
@@ -53,6 +203,7 @@ void pd_hashatomtovalue_free(t_pdhashatomtovalue *table)
 {
 	if (table) {
 		pd_free(table->buckets);
+		pd_free(table->order);
 		pd_free(table);
 	}
 }
@@ -73,84 +224,39 @@ int __pd_hashatomtovalue_capacity(t_pdhashatomtovalue *table)
 	return 0;
 }
 
-// Search hashtable for entry with key and return bucket index.
-// Keys are compared using '==', so they must be identical (same address) not just string-equal.
-// Returns the bucket index of the matching entry if found, otherwise
-// returns the bucket index where that key should be inserted.
-// Because hashtables are expanded before they fill up, there is always a
-// valid index for insertion.
-static pdint32 hash(t_pdhashatomtovalue *table, t_pdatom key)
-{
-	pduint32 count;
-	pdint32 i = (pdint32)key % table->capacity;
-	for (count = 0; count < table->capacity; count++)
-	{
-		if (table->buckets[i].key == key) {
-			return i;								// match, return index of existing table entry
-		}
-		if (table->buckets[i].key == PDA_UNDEFINED_ATOM)
-		{
-			return i;								// no match, return next unused entry in table
-		}
-		i = (i + 1) % table->capacity;
-	}
-	return i; // won't happen
-}
-
-static void rehash_table(t_bucket *buckets, int n, t_pdhashatomtovalue *table)
-{
-	while (n-- > 0)
-	{
-		if (buckets->key != PDA_UNDEFINED_ATOM)
-			pd_hashatomtovalue_put(table, buckets->key, buckets->value);
-		buckets++;
-	}
-}
-
-void pd_hashatomtovalue_put(t_pdhashatomtovalue *table, t_pdatom key, t_pdvalue value)
+pdbool pd_hashatomtovalue_put(t_pdhashatomtovalue *table, t_pdatom key, t_pdvalue value)
 {
 	if (table && key != PDA_UNDEFINED_ATOM) {
-		// Look up key in table.
-		// NB Returns the correct free index, if key is new 
-		int index = hash(table, key);
-		// If we're adding a new entry and the table is too full...
-		if (table->buckets[index].key != key && table->elements > (table->capacity * 3) / 4)
-		{
-			// Enlarge the table to keep it from filling up.
-			//
-			int oldlimit = table->capacity;
-			t_bucket *oldbuckets = table->buckets;
-			// resize the table:
-			init_table(table, (oldlimit * 5) / 2); /* reasonable ? */
-			// rehash the entries modulo the new size
-			rehash_table(oldbuckets, oldlimit, table);
-			pd_free(oldbuckets);
-			// try again (tail recursion!)
-			pd_hashatomtovalue_put(table, key, value);
+		pduint32 h = hash_atom(key);
+		pdint32 index = find(table, key, h);
+		if (index >= 0) {
+			// replace previous value
+			table->buckets[index].value = value;
+			return PD_TRUE;
 		}
-		else {
-			if (table->buckets[index].key == PDA_UNDEFINED_ATOM) {
-				// new active entry
-				table->elements++;
+		// If the new entry would make the table more than 3/4 full, double it.
+		if ((table->elements + 1) * 4 > table->capacity * 3) {
+			if (!rehash_table(table, table->capacity * 2)) {
+				// out of memory: the entry can't be added
+				return PD_FALSE;
 			}
-			// set, or replace, (key,value) pair:
-			table->buckets[index].key = key;
-			table->buckets[index].value = value;
 		}
+		add_new(table, key, h, value);
 	}
+	return PD_TRUE;
 }
 
 t_pdvalue pd_hashatomtovalue_get(t_pdhashatomtovalue *table, t_pdatom key, pdbool *success)
 {
-	int index;
+	pdint32 index;
 	if (!table) return pderrvalue();
 	if (key == PDA_UNDEFINED_ATOM) {
 		*success = 0;
 		return pderrvalue();
 	}
 
-	index = hash(table, key);
-	*success = table->buckets[index].key == key;
+	index = find(table, key, hash_atom(key));
+	*success = (index >= 0);
 	return (*success) ? table->buckets[index].value : pderrvalue();
 }
 
@@ -165,13 +271,12 @@ void pd_hashatomtovalue_foreach(t_pdhashatomtovalue *table, f_pdhashatomtovalue_
 {
 	if (table && iter) {
 		pduint32 i;
-		for (i = 0; i < table->capacity; i++)
+		for (i = 0; i < table->elements; i++)
 		{
-			if (table->buckets[i].key != PDA_UNDEFINED_ATOM)
-			{
-				if (!iter(table->buckets[i].key, table->buckets[i].value, cookie))
-					break;
-			}
+			t_pdatom key = table->order[i];
+			pdint32 index = find(table, key, hash_atom(key));
+			if (!iter(key, table->buckets[index].value, cookie))
+				break;
 		}
 	}
 }
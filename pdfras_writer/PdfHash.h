@@ -9,6 +9,7 @@
 /* typedef struct t_pdhashatomtovalue t_pdhashatomtovalue; */
 
 // Allocate a new hashtable in pool, with room (initially) for initialCap entries.
+// The capacity is rounded up to a power of 2; 0 means a reasonable default.
 extern t_pdhashatomtovalue *pd_hashatomtovalue_new(t_pdmempool *pool, pduint32 initialCap);
 
 // Release a hashtable.
@@ -21,7 +22,9 @@ extern int pd_hashatomtovalue_count(t_pdhashatomtovalue *table);
 
 // Associate key => value in hashtable - replace previous mapping for key if any.
 // Has no effect if table is NULL or key is PDA_UNDEFINED_ATOM
-extern void pd_hashatomtovalue_put(t_pdhashatomtovalue *table, t_pdatom key, t_pdvalue value);
+// Returns PD_FALSE if the table had to grow and couldn't (out of memory),
+// in which case the key is not added, otherwise PD_TRUE.
+extern pdbool pd_hashatomtovalue_put(t_pdhashatomtovalue *table, t_pdatom key, t_pdvalue value);
 
 // look up a key in a hashtable.
 // returns the value associated with the key if found, and sets *success to true (PD_TRUE).
@@ -33,7 +36,8 @@ extern pdbool pd_hashatomtovalue_contains(t_pdhashatomtovalue *table, t_pdatom k
 
 typedef pdbool(*f_pdhashatomtovalue_iterator)(t_pdatom atom, t_pdvalue value, void *cookie);
 
-// Call iter(key, value, cookie) with each key,value pair in a hash table.
+// Call iter(key, value, cookie) with each key,value pair in a hash table,
+// in the order the keys were first added.
 // Continue as long as iter returns non-zero, stop if iter returns 0.
 // Has no effect if table OR iter are NULL.
 extern void pd_hashatomtovalue_foreach(t_pdhashatomtovalue *table, f_pdhashatomtovalue_iterator iter, void *cookie);
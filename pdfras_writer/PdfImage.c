@@ -35,9 +35,9 @@ t_pdvalue pd_image_new(t_pdmempool *alloc, t_pdxref *xref, f_on_datasink_ready r
 	pd_dict_put(image, PDA_Width, width);
 	pd_dict_put(image, PDA_Height, height);
 	pd_dict_put(image, PDA_BitsPerComponent, bitspercomponent);
-	filter = pd_array_new(alloc, 1);
 	if (comp != kCompNone)
 	{
+		filter = pd_array_new(alloc, 1);
 		pd_array_add(filter, pdatomvalue(ToCompressionAtom(comp)));
 		pd_dict_put(image, PDA_Filter, pdarrayvalue(filter));
 		filterparms = pd_array_new(alloc, 1);
@@ -1,3 +1,11 @@
+#ifdef WIN32
+// for rand_s
+#define _CRT_RAND_S
+#include <stdlib.h>
+#else
+#include <stdio.h>
+#endif
+
 #include "PdfOS.h"
 
 extern pdint32 pdstrlen(const char *s)
@@ -19,17 +27,13 @@ extern char *pditoa(pdint32 i, char* dst)
 		char *s = dst;
 		char *p = dst;
 		int neg = i < 0;
-		if (neg) i = -i;
-		if (i < 0) {
-			// there is one value that can't be negated...
-			*s++ = '8';
-			i = 214748364;
-		}
+		// negate unsigned: -i overflows for the most negative pdint32
+		pduint32 u = neg ? 0u - (pduint32)i : (pduint32)i;
 		do
 		{
-			*s++ = (i % 10) + '0';
-			i /= 10;
-		} while (i > 0);
+			*s++ = (u % 10) + '0';
+			u /= 10;
+		} while (u > 0);
 		if (neg) {
 			*s++ = '-';
 		}
@@ -42,3 +46,28 @@ extern char *pditoa(pdint32 i, char* dst)
 	}
 	return dst;
 }
+
+extern pdbool pdrandom(void *buf, size_t n)
+{
+	pduint8 *p = (pduint8 *)buf;
+#ifdef WIN32
+	while (n) {
+		unsigned int r, i;
+		if (rand_s(&r) != 0) {
+			return PD_FALSE;
+		}
+		for (i = 0; i < sizeof r && n; i++, n--) {
+			*p++ = (pduint8)(r >> (8 * i));
+		}
+	}
+	return PD_TRUE;
+#else
+	FILE *f = fopen("/dev/urandom", "rb");
+	if (!f) {
+		return PD_FALSE;
+	}
+	size_t got = fread(p, 1, n, f);
+	fclose(f);
+	return got == n ? PD_TRUE : PD_FALSE;
+#endif
+}
@@ -62,6 +62,10 @@ extern pdint32 pdstrlen(const char *s);
 // Can write up to 12 chars (counting the trailing NUL) at dst.
 extern char *pditoa(pdint32 i, char* dst);
 
+// fill buf with n bytes from the platform's cryptographic random number
+// generator. Returns PD_FALSE if there isn't one, or it failed.
+extern pdbool pdrandom(void *buf, size_t n);
+
 // use this macro to suppress "unreferenced formal parameter" warnings
 #define UNUSED_FORMAL(x) ((void)(x))
 
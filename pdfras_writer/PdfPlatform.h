@@ -13,6 +13,7 @@ typedef short pdint16;
 typedef unsigned short pduint16;
 typedef long pdint32;
 typedef unsigned long pduint32;
+typedef unsigned __int64 pduint64;
 typedef float pdfloat32;
 typedef double pddouble;
 typedef pduint32 pdbool;
@@ -41,6 +42,7 @@ typedef int16_t pdint16;
 typedef uint16_t pduint16;
 typedef int32_t pdint32;
 typedef uint32_t pduint32;
+typedef uint64_t pduint64;
 
 typedef float pdfloat32;
 typedef double pddouble;
@@ -1,6 +1,7 @@
 // PdfRaster.c - functions to write PDF/raster
 //
 #include <assert.h>
+#include <string.h>
 
 #include "PdfRaster.h"
 #include "PdfDict.h"
@@ -12,10 +13,18 @@
 #include "PdfStandardObjects.h"
 #include "PdfImage.h"
 #include "PdfArray.h"
+#include "PdfContentsGenerator.h"
+#include "PdfSecurityHandler.h"
 
+// What we remember about strip N while its page is being written
+typedef struct {
+	t_pdatom			name;				// "stripN" atom, interned once per document
+	int					height;				// pixel height of strip N on the current page
+} t_stripslot;
 
 typedef struct t_pdfrasencoder {
-	t_pdmempool*		pool;
+	t_pdmempool*		pool;				// the encoder, and what it keeps from one document to the next
+	t_pdmempool*		docpool;			// the current document's objects
 	int					apiLevel;			// caller's specified API level.
 	t_pdoutstream*		stm;				// output PDF stream
 	void *				writercookie;
@@ -26,8 +35,18 @@ typedef struct t_pdfrasencoder {
 	t_pdvalue			catalog;
 	t_pdvalue			info;
 	t_pdvalue			trailer;
+	t_pdpagetree*		pagetree;			// page tree, written as it grows
+	pduint32			headerEnd;			// output position just after the PDF header
+	int					digests;			// PDFRAS_DIGEST_ bits: digests of the output to compute
+	// reserved signature, if any
+	t_pdvalue			sigField;			// signature field (and widget annotation), or null
+	pdbool				sigFieldPlaced;		// the field is in a page's /Annots
+	pdfr_signature_handler sigHandler;		// told where the signature is, at the end
+	void*				sigCookie;
 	// optional document objects
 	t_pdvalue			rgbColorspace;		// current colorspace for RGB images
+	pduint8*			rgbProfile;			// its ICC profile (our copy), NULL if it has none or it's sRGB
+	size_t				rgbProfileLen;
 	pdbool				bitonalUncal;		// use uncalibrated /DeviceGray for bitonal images
 	// page parameters, apply to subsequently started pages
     int                 next_page_rotation;
@@ -39,6 +58,12 @@ typedef struct t_pdfrasencoder {
     // current page object
 	t_pdvalue			currentPage;
     int					strips;				// number of strips on current page
+	t_stripslot*		stripSlots;			// one per strip on the current page (at least)
+	int					stripSlotCount;		// number of entries allocated in stripSlots
+	t_pdcontents_gen*	contentsGen;		// generates the content stream of each page
+	t_pdvalue			openStrip;			// strip being written by pdfr_encoder_write_strip_data, or null
+	pduint32			openStripStart;		// output position of the open strip's data
+	int					openStripRows;		// height of the open strip
     int					height;				// total pixel height of current page
 
     // page parameters, established at start of page or when first strip
@@ -55,6 +80,64 @@ typedef struct t_pdfrasencoder {
 } t_pdfrasencoder;
 
 
+static void content_generator(t_pdcontents_gen *gen, void *cookie);
+
+// translate PDFRAS_DIGEST_ bits to PD_DIGEST_ bits
+static int stream_digests(int digests)
+{
+	return ((digests & PDFRAS_DIGEST_MD5) ? PD_DIGEST_MD5 : 0) |
+		((digests & PDFRAS_DIGEST_SHA256) ? PD_DIGEST_SHA256 : 0);
+}
+
+// Set up the encoder for a new document, and write the PDF header.
+// Everything document-specific is allocated from enc->docpool.
+static void start_document(t_pdfrasencoder *enc)
+{
+	t_pdmempool *pool = enc->docpool;
+
+	enc->next_page_rotation = 0;						// default page rotation
+	enc->next_page_xdpi = enc->next_page_ydpi = 300;    // default resolution
+	enc->next_page_compression = PDFRAS_UNCOMPRESSED;	// default compression for next page
+	enc->next_page_pixelFormat = PDFRAS_BITONAL;		// default pixel format
+	enc->phys_pageno = -1;			    // unspecified
+	enc->page_front = -1;			    // unspecified
+	enc->bitonalUncal = PD_FALSE;
+	enc->rgbColorspace = pdnullvalue();
+	enc->rgbProfile = NULL;
+	enc->rgbProfileLen = 0;
+	enc->currentPage = pdnullvalue();
+	enc->openStrip = pdnullvalue();
+	enc->colorspace = pdnullvalue();
+	enc->sigField = pdnullvalue();
+	enc->sigFieldPlaced = PD_FALSE;
+	enc->sigHandler = NULL;
+	enc->strips = 0;
+	enc->height = 0;
+
+	// empty cross-reference table:
+	enc->xref = pd_xref_new(pool);
+	// initial document catalog:
+	enc->catalog = pd_catalog_new(pool, enc->xref);
+	// and the balanced page tree that hangs off it
+	enc->pagetree = pd_pagetree_new(pool, enc->xref, enc->stm, enc->catalog);
+
+	// create 'info' dictionary
+	enc->info = pd_info_new(pool, enc->xref);
+	// and trailer dictionary
+	enc->trailer = pd_trailer_new(pool, enc->xref, enc->catalog, enc->info);
+	// default Producer
+	pd_dict_put(enc->info, PDA_Producer, pdcstrvalue(pool, "PdfRaster encoder " PDFRAS_LIBRARY_VERSION));
+	// record creation date & time:
+	time(&enc->creationDate);
+	pd_dict_put(enc->info, PDA_CreationDate, pd_make_time_string(pool, enc->creationDate));
+	// we don't modify PDF so there is no ModDate
+
+	// Start the output digests and write the PDF header:
+	pd_outstream_set_digests(enc->stm, stream_digests(enc->digests));
+	pd_write_pdf_header(enc->stm, "1.4");
+	enc->headerEnd = pd_outstream_pos(enc->stm);
+}
+
 t_pdfrasencoder* pdfr_encoder_create(int apiLevel, t_OS *os)
 {
 	struct t_pdmempool *pool;
@@ -71,7 +154,7 @@ t_pdfrasencoder* pdfr_encoder_create(int apiLevel, t_OS *os)
 	}
 	assert(os);
 	// create a memory management pool for the internal use of this encoder.
-	pool = pd_alloc_new_pool(os);
+	pool = pd_alloc_new_arena_pool(os, 0);
 	assert(pool);
 
 	t_pdfrasencoder *enc = (t_pdfrasencoder *)pd_alloc(pool, sizeof(t_pdfrasencoder));
@@ -80,64 +163,44 @@ t_pdfrasencoder* pdfr_encoder_create(int apiLevel, t_OS *os)
 		enc->pool = pool;						// associated allocation pool
 		enc->apiLevel = apiLevel;				// level of this API assumed by caller
 		enc->stm = pd_outstream_new(pool, os);	// our PDF-output stream abstraction
-
-		enc->next_page_rotation = 0;						// default page rotation
-		enc->next_page_xdpi = enc->next_page_ydpi = 300;    // default resolution
-		enc->next_page_compression = PDFRAS_UNCOMPRESSED;	// default compression for next page
-		enc->next_page_pixelFormat = PDFRAS_BITONAL;		// default pixel format
-        enc->phys_pageno = -1;			    // unspecified
-        enc->page_front = -1;			    // unspecified
+		enc->digests = PDFRAS_DIGEST_MD5;		// MD5 of the output, for the file ID
 
 		// initial atom table
 		enc->atoms = pd_atom_table_new(pool, 128);
-		// empty cross-reference table:
-		enc->xref = pd_xref_new(pool);
-		// initial document catalog:
-		enc->catalog = pd_catalog_new(pool, enc->xref);
-
-		// create 'info' dictionary
-		enc->info = pd_info_new(pool, enc->xref);
-		// and trailer dictionary
-		enc->trailer = pd_trailer_new(pool, enc->xref, enc->catalog, enc->info);
-		// default Producer
-		pd_dict_put(enc->info, PDA_Producer, pdcstrvalue(pool, "PdfRaster encoder " PDFRAS_LIBRARY_VERSION));
-		// record creation date & time:
-		time(&enc->creationDate);
-		pd_dict_put(enc->info, PDA_CreationDate, pd_make_time_string(pool, enc->creationDate));
-		// we don't modify PDF so there is no ModDate
-
-		assert(IS_NULL(enc->rgbColorspace));
-		assert(IS_NULL(enc->currentPage));
-
-		// Write the PDF header:
-		pd_write_pdf_header(enc->stm, "1.4");
+		// one content generator, reused for every page
+		enc->contentsGen = pd_contents_gen_new(pool, content_generator, enc);
+		// and a separate pool for the objects of each document
+		enc->docpool = pd_alloc_new_arena_pool(os, 0);
+		assert(enc->docpool);
+
+		start_document(enc);
 	}
 	return enc;
 }
 
 void pdfr_encoder_set_creator(t_pdfrasencoder *enc, const char* creator)
 {
-	pd_dict_put(enc->info, PDA_Creator, pdcstrvalue(enc->pool, creator));
+	pd_dict_put(enc->info, PDA_Creator, pdcstrvalue(enc->docpool, creator));
 }
 
 void pdfr_encoder_set_author(t_pdfrasencoder *enc, const char* author)
 {
-	pd_dict_put(enc->info, PDA_Author, pdcstrvalue(enc->pool, author));
+	pd_dict_put(enc->info, PDA_Author, pdcstrvalue(enc->docpool, author));
 }
 
 void pdfr_encoder_set_title(t_pdfrasencoder *enc, const char* title)
 {
-	pd_dict_put(enc->info, PDA_Title, pdcstrvalue(enc->pool, title));
+	pd_dict_put(enc->info, PDA_Title, pdcstrvalue(enc->docpool, title));
 }
 
 void pdfr_encoder_set_subject(t_pdfrasencoder *enc, const char* subject)
 {
-	pd_dict_put(enc->info, PDA_Subject, pdcstrvalue(enc->pool, subject));
+	pd_dict_put(enc->info, PDA_Subject, pdcstrvalue(enc->docpool, subject));
 }
 
 void pdfr_encoder_set_keywords(t_pdfrasencoder *enc, const char* keywords)
 {
-	pd_dict_put(enc->info, PDA_Keywords, pdcstrvalue(enc->pool, keywords));
+	pd_dict_put(enc->info, PDA_Keywords, pdcstrvalue(enc->docpool, keywords));
 }
 
 void f_write_string(t_datasink *sink, void *eventcookie)
@@ -153,7 +216,7 @@ void pdfr_encoder_get_creation_date(t_pdfrasencoder *enc, time_t *t)
 
 void pdfr_encoder_write_document_xmp(t_pdfrasencoder *enc, const char* xmpdata)
 {
-	t_pdvalue xmpstm = pd_metadata_new(enc->pool, enc->xref, f_write_string, (void*)xmpdata);
+	t_pdvalue xmpstm = pd_metadata_new(enc->docpool, enc->xref, f_write_string, (void*)xmpdata);
 	// flush the metadata stream to output immediately
 	pd_write_reference_declaration(enc->stm, xmpstm);
 	pd_dict_put(enc->catalog, PDA_Metadata, xmpstm);
@@ -161,12 +224,108 @@ void pdfr_encoder_write_document_xmp(t_pdfrasencoder *enc, const char* xmpdata)
 
 void pdfr_encoder_write_page_xmp(t_pdfrasencoder *enc, const char* xmpdata)
 {
-	t_pdvalue xmpstm = pd_metadata_new(enc->pool, enc->xref, f_write_string, (void*)xmpdata);
+	t_pdvalue xmpstm = pd_metadata_new(enc->docpool, enc->xref, f_write_string, (void*)xmpdata);
 	// flush the metadata stream to output immediately
 	pd_write_reference_declaration(enc->stm, xmpstm);
 	pd_dict_put(enc->currentPage, PDA_Metadata, xmpstm);
 }
 
+int pdfr_encoder_set_encryption(t_pdfrasencoder* enc, const char* user_password, const char* owner_password, int permissions)
+{
+	if (pd_outstream_pos(enc->stm) != enc->headerEnd || pd_outstream_get_encrypter(enc->stm)) {
+		// something has been written in the clear already
+		return -1;
+	}
+	t_pdencrypter *crypter = pd_encrypt_new_aes256(enc->docpool, user_password, owner_password, permissions);
+	if (!crypter) {
+		return -1;
+	}
+	pd_dict_put(enc->trailer, PDA_Encrypt, pd_encrypt_dictionary(crypter, enc->docpool));
+	// AES-256 is PDF 2.0, or Adobe extension level 8 to PDF 1.7
+	t_pdvalue adbe = pd_dict_new(enc->docpool, 2);
+	pd_dict_put(adbe, PDA_BaseVersion, pdatomvalue(pd_atom_intern(enc->atoms, "1.7")));
+	pd_dict_put(adbe, PDA_ExtensionLevel, pdintvalue(8));
+	t_pdvalue extensions = pd_dict_new(enc->docpool, 1);
+	pd_dict_put(extensions, PDA_ADBE, adbe);
+	pd_dict_put(enc->catalog, PDA_Extensions, extensions);
+	pd_dict_put(enc->catalog, PDA_Version, pdatomvalue(pd_atom_intern(enc->atoms, "1.7")));
+	pd_outstream_set_encrypter(enc->stm, crypter);
+	return 0;
+}
+
+int pdfr_encoder_set_digests(t_pdfrasencoder* enc, int digests)
+{
+	if (!pd_outstream_set_digests(enc->stm, stream_digests(digests))) {
+		// output has been written that a new digest didn't see
+		return -1;
+	}
+	enc->digests = digests;
+	return 0;
+}
+
+int pdfr_encoder_get_md5(t_pdfrasencoder* enc, pduint8 digest[16])
+{
+	return pd_outstream_md5(enc->stm, digest) ? 0 : -1;
+}
+
+int pdfr_encoder_get_sha256(t_pdfrasencoder* enc, pduint8 digest[32])
+{
+	return pd_outstream_sha256(enc->stm, digest) ? 0 : -1;
+}
+
+// Put the signature field, if there is one, on the current page
+static void place_signature_field(t_pdfrasencoder* enc)
+{
+	if (!IS_NULL(enc->sigField) && !enc->sigFieldPlaced && !IS_NULL(enc->currentPage)) {
+		t_pdarray *annots = pd_array_new(enc->docpool, 1);
+		pd_array_add(annots, enc->sigField);
+		pd_dict_put(enc->currentPage, PDA_Annots, pdarrayvalue(annots));
+		enc->sigFieldPlaced = PD_TRUE;
+	}
+}
+
+int pdfr_encoder_reserve_signature(t_pdfrasencoder* enc, size_t maxlen, pdfr_signature_handler handler, void* cookie)
+{
+	if (!IS_NULL(enc->sigField)) {
+		return -1;
+	}
+	t_pdmempool *pool = enc->docpool;
+	// the signature dictionary, finished off by pd_write_endofdocument
+	t_pdvalue sig = pd_dict_new(pool, 4);
+	pd_dict_put(sig, PDA_Type, pdatomvalue(PDA_Sig));
+	pd_dict_put(sig, PDA_Filter, pdatomvalue(pd_atom_intern(enc->atoms, "Adobe.PPKLite")));
+	pd_dict_put(sig, PDA_SubFilter, pdatomvalue(pd_atom_intern(enc->atoms, "adbe.pkcs7.detached")));
+	pd_dict_put(sig, PDA_M, pd_make_time_string(pool, enc->creationDate));
+	t_pdvalue sigref = pd_xref_makereference(enc->xref, sig);
+	pd_outstream_reserve_signature(enc->stm, sigref, (pduint32)maxlen);
+	// an invisible signature field, merged with its widget annotation
+	t_pdvalue field = pd_dict_new(pool, 8);
+	pd_dict_put(field, PDA_Type, pdatomvalue(PDA_Annot));
+	pd_dict_put(field, PDA_Subtype, pdatomvalue(PDA_Widget));
+	pd_dict_put(field, PDA_FT, pdatomvalue(PDA_Sig));
+	pd_dict_put(field, PDA_T, pdcstrvalue(pool, "Signature1"));
+	t_pdarray *rect = pd_array_new(pool, 4);
+	int i;
+	for (i = 0; i < 4; i++) {
+		pd_array_add(rect, pdintvalue(0));
+	}
+	pd_dict_put(field, PDA_Rect, pdarrayvalue(rect));
+	pd_dict_put(field, PDA_F, pdintvalue(132));			// Print + Locked
+	pd_dict_put(field, PDA_V, sigref);
+	enc->sigField = pd_xref_makereference(enc->xref, field);
+	// and the form it belongs to
+	t_pdarray *fields = pd_array_new(pool, 1);
+	pd_array_add(fields, enc->sigField);
+	t_pdvalue form = pd_dict_new(pool, 2);
+	pd_dict_put(form, PDA_Fields, pdarrayvalue(fields));
+	pd_dict_put(form, PDA_SigFlags, pdintvalue(3));		// SignaturesExist + AppendOnly
+	pd_dict_put(enc->catalog, PDA_AcroForm, form);
+	enc->sigHandler = handler;
+	enc->sigCookie = cookie;
+	place_signature_field(enc);
+	return 0;
+}
+
 void pdfr_encoder_set_resolution(t_pdfrasencoder *enc, double xdpi, double ydpi)
 {
 	enc->next_page_xdpi = xdpi;
@@ -207,19 +366,33 @@ int pdfr_encoder_set_bitonal_uncalibrated(t_pdfrasencoder* enc, int uncal)
 void pdfr_encoder_define_calrgb_colorspace(t_pdfrasencoder* enc, double gamma[3], double black[3], double white[3], double matrix[9])
 {
     enc->rgbColorspace =
-        pd_make_calrgb_colorspace(enc->pool, gamma, black, white, matrix);
+        pd_make_calrgb_colorspace(enc->docpool, gamma, black, white, matrix);
+    enc->rgbProfile = NULL;
 }
 
 void pdfr_encoder_define_rgb_icc_colorspace(t_pdfrasencoder* enc, const pduint8 *profile, size_t len)
 {
     if (!profile) {
-        enc->rgbColorspace = pd_make_srgb_colorspace(enc->pool, enc->xref);
+        enc->rgbColorspace = pd_make_srgb_colorspace(enc->docpool, enc->xref);
+        enc->rgbProfile = NULL;
+    }
+    else if (enc->rgbProfile && enc->rgbProfileLen == len && memcmp(enc->rgbProfile, profile, len) == 0) {
+        // the same profile again: keep the colorspace, so the profile is written once
     }
     else {
+        // the profile is written when the first image uses it,
+        // the caller's copy may be gone by then
+        pduint8* copy = (pduint8*)pd_alloc(enc->docpool, len);
+        if (!copy) {
+            return;
+        }
+        memcpy(copy, profile, len);
         // define the calibrated (ICCBased) colorspace that should
         // be used on RGB images (if they aren't marked DeviceRGB)
         enc->rgbColorspace =
-            pd_make_iccbased_rgb_colorspace(enc->pool, enc->xref, profile, len);
+            pd_make_iccbased_rgb_colorspace(enc->docpool, enc->xref, copy, len);
+        enc->rgbProfile = copy;
+        enc->rgbProfileLen = len;
     }
 }
 
@@ -240,9 +413,10 @@ int pdfr_encoder_start_page(t_pdfrasencoder* enc, int width)
 
 	double W = width / enc->xdpi * 72.0;
 	// Start a new page (of unknown height)
-	enc->currentPage = pd_page_new_simple(enc->pool, enc->xref, enc->catalog, W, 0);
+	enc->currentPage = pd_page_new_simple(enc->docpool, enc->xref, enc->catalog, W, 0);
 	assert(IS_REFERENCE(enc->currentPage));
     assert(IS_DICT(pd_reference_get_value(enc->currentPage)));
+	place_signature_field(enc);
 
 	return 0;
 }
@@ -259,14 +433,19 @@ void pdfr_encoder_set_page_front(t_pdfrasencoder* enc, int frontness)
 
 
 typedef struct {
-	const pduint8* data;
-	size_t count;
+	const t_pdfrasiovec* segs;
+	int nsegs;
 } t_stripinfo;
 
 static void onimagedataready(t_datasink *sink, void *eventcookie)
 {
 	t_stripinfo* pinfo = (t_stripinfo*)eventcookie;
-	pd_datasink_put(sink, pinfo->data, 0, pinfo->count);
+	int i;
+	for (i = 0; i < pinfo->nsegs; i++) {
+		if (pinfo->segs[i].len) {
+			pd_datasink_put(sink, pinfo->segs[i].data, 0, pinfo->segs[i].len);
+		}
+	}
 }
 
 t_pdvalue pdfr_encoder_get_rgb_colorspace(t_pdfrasencoder* enc)
@@ -291,7 +470,7 @@ t_pdvalue pdfr_encoder_get_calgray_colorspace(t_pdfrasencoder* enc)
 	double white[3] = { 1.0, 1.0, 1.0 };
 	// "The Gamma  entry shall be present in the CalGray colour space dictionary with a value of 2.2."
 	double gamma = 2.2;
-	return pd_make_calgray_colorspace(enc->pool, gamma, black, white);
+	return pd_make_calgray_colorspace(enc->docpool, gamma, black, white);
 }
 
 t_pdvalue pdfr_encoder_get_colorspace(t_pdfrasencoder* enc)
@@ -328,14 +507,57 @@ static void start_strip_zero(t_pdfrasencoder* enc)
     enc->colorspace = pdfr_encoder_get_colorspace(enc);
 }
 
+// Return the slot for strip n of the current page, growing the
+// slot table if necessary. The slot's name is filled in on first use.
+static t_stripslot *strip_slot(t_pdfrasencoder* enc, int n)
+{
+	if (n >= enc->stripSlotCount) {
+		int newCount = enc->stripSlotCount ? enc->stripSlotCount * 2 : 16;
+		while (newCount <= n) {
+			newCount *= 2;
+		}
+		t_stripslot *slots = (t_stripslot *)pd_alloc(enc->pool, newCount * sizeof(t_stripslot));
+		if (!slots) {
+			return NULL;
+		}
+		if (enc->stripSlots) {
+			memcpy(slots, enc->stripSlots, enc->stripSlotCount * sizeof(t_stripslot));
+			pd_free(enc->stripSlots);
+		}
+		enc->stripSlots = slots;
+		enc->stripSlotCount = newCount;
+	}
+	t_stripslot *slot = &enc->stripSlots[n];
+	if (!slot->name) {
+		char stripname[5+12] = "strip";
+		pditoa(n, stripname + 5);
+		// turn strip name into an atom
+		slot->name = pd_atom_intern(enc->atoms, stripname);
+	}
+	return slot;
+}
+
 int pdfr_encoder_write_strip(t_pdfrasencoder* enc, int rows, const pduint8 *buf, size_t len)
+{
+	t_pdfrasiovec seg;
+	seg.data = buf;
+	seg.len = len;
+	return pdfr_encoder_write_strip_v(enc, rows, &seg, 1);
+}
+
+// Create the image for the next strip of the current page, and add it
+// to the page. Returns a reference to the (unwritten) image, or an error value.
+static t_pdvalue new_strip_image(t_pdfrasencoder* enc, int rows, f_on_datasink_ready ready, void *cookie)
 {
     if (enc->strips == 0) {
         // first strip on this page, all strips on page
         // must have same format, compression and colorspace.
         start_strip_zero(enc);
     }
-	char stripname[5+12] = "strip";
+	t_stripslot *slot = strip_slot(enc, enc->strips);
+	if (!slot) {
+		return pderrvalue();
+	}
 
 	e_ImageCompression comp = kCompNone;
 	switch (enc->compression) {
@@ -360,21 +582,32 @@ int pdfr_encoder_write_strip(t_pdfrasencoder* enc, int rows, const pduint8 *buf,
 	default:
 		break;
 	} // switch
-	t_stripinfo stripinfo;
-	stripinfo.data = buf;
-	stripinfo.count = len;
-	t_pdvalue image = pd_image_new_simple(enc->pool, enc->xref, onimagedataready, &stripinfo,
+	t_pdvalue image = pd_image_new_simple(enc->docpool, enc->xref, ready, cookie,
 		enc->width, rows, bitsPerComponent,
 		comp,
 		kCCIITTG4, PD_FALSE,			// ignored unless compression is CCITT
 		enc->colorspace);
 	// get a reference to this (strip) image
 	t_pdvalue imageref = pd_xref_makereference(enc->xref, image);
-	pditoa(enc->strips, stripname + 5);
-	// turn strip name into an atom
-	t_pdatom strip = pd_atom_intern(enc->atoms, stripname);
 	// add the image to the resources of the current page, with the given name
-	pd_page_add_image(enc->currentPage, strip, imageref);
+	pd_page_add_image(enc->currentPage, slot->name, imageref);
+	slot->height = rows;
+	return imageref;
+}
+
+int pdfr_encoder_write_strip_v(t_pdfrasencoder* enc, int rows, const t_pdfrasiovec *segs, int nsegs)
+{
+	if (!IS_NULL(enc->openStrip)) {
+		// finish the open strip first
+		return -1;
+	}
+	t_stripinfo stripinfo;
+	stripinfo.segs = segs;
+	stripinfo.nsegs = nsegs;
+	t_pdvalue imageref = new_strip_image(enc, rows, onimagedataready, &stripinfo);
+	if (IS_ERR(imageref)) {
+		return -1;
+	}
 	// flush the image stream
 	pd_write_reference_declaration(enc->stm, imageref);
 	// adjust total page height:
@@ -385,6 +618,47 @@ int pdfr_encoder_write_strip(t_pdfrasencoder* enc, int rows, const pduint8 *buf,
 	return 0;
 }
 
+int pdfr_encoder_begin_strip(t_pdfrasencoder* enc, int rows)
+{
+	if (!IS_NULL(enc->openStrip)) {
+		return -1;
+	}
+	t_pdvalue imageref = new_strip_image(enc, rows, NULL, NULL);
+	if (IS_ERR(imageref)) {
+		return -1;
+	}
+	// write the image dictionary, the data follows as it arrives
+	enc->openStripStart = pd_write_stream_begin(enc->stm, imageref);
+	enc->openStrip = imageref;
+	enc->openStripRows = rows;
+	return 0;
+}
+
+int pdfr_encoder_write_strip_data(t_pdfrasencoder* enc, const pduint8 *data, size_t len)
+{
+	if (IS_NULL(enc->openStrip)) {
+		return -1;
+	}
+	if (len) {
+		pd_write_stream_data(enc->stm, data, 0, (pduint32)len);
+	}
+	return 0;
+}
+
+int pdfr_encoder_end_strip(t_pdfrasencoder* enc)
+{
+	if (IS_NULL(enc->openStrip)) {
+		return -1;
+	}
+	pd_write_stream_end(enc->stm, enc->openStrip, enc->openStripStart);
+	enc->openStrip = pdnullvalue();
+	// adjust total page height:
+	enc->height += enc->openStripRows;
+	// increment strip count:
+	enc->strips++;
+	return 0;
+}
+
 int pdfr_encoder_get_page_height(t_pdfrasencoder* enc)
 {
 	return enc->height;
@@ -402,23 +676,15 @@ static void content_generator(t_pdcontents_gen *gen, void *cookie)
 	double tx = 0;
 	// vertical offset starts at top of page
 	double ty = H;
-	pdbool succ;
-	t_pdvalue res = pd_dict_get(enc->currentPage, PDA_Resources, &succ);
-	t_pdvalue xobj = pd_dict_get(res, PDA_XObject, &succ);
+	// roughly " q W 0 0 SH 0 Y cm /stripN Do Q" per strip
+	pd_contents_gen_reserve(gen, enc->strips * 64);
 	for (int n = 0; n < enc->strips; n++) {
-		char stripNname[5+12] = "strip";
-		pditoa(n, stripNname + 5);
-		// turn strip name into an atom
-		t_pdatom stripNatom = pd_atom_intern(enc->atoms, stripNname);
-		// find the strip Image resource
-		t_pdvalue img = pd_dict_get(xobj, stripNatom, &succ);
-		// get its /Height
-		t_pdvalue striph = pd_dict_get(img, PDA_Height, &succ);
+		t_stripslot *slot = &enc->stripSlots[n];
 		// calculate height in Points
-		double SH = striph.value.intvalue * 72.0 / enc->ydpi;
+		double SH = slot->height * 72.0 / enc->ydpi;
 		pd_gen_gsave(gen);
 		pd_gen_concatmatrix(gen, W, 0, 0, SH, tx, ty-SH);
-		pd_gen_xobject(gen, stripNatom);
+		pd_gen_xobject(gen, slot->name);
 		pd_gen_grestore(gen);
 		ty -= SH;
 	}
@@ -439,31 +705,83 @@ static void update_media_box(t_pdfrasencoder* enc, t_pdvalue page)
 static void write_page_metadata(t_pdfrasencoder* enc)
 {
 	if (enc->page_front >= 0 || enc->phys_pageno >= 0) {
-		t_pdvalue modTime = pd_make_now_string(enc->pool);
-		t_pdvalue privDict = pd_dict_new(enc->pool, 2);
+		time_t now;
+		time(&now);
+		// two copies, so page objects never share a string
+		t_pdvalue modTime = pd_make_time_string(enc->docpool, now);
+		t_pdvalue privDict = pd_dict_new(enc->docpool, 2);
 		if (enc->phys_pageno >= 0) {
 			pd_dict_put(privDict, PDA_PhysicalPageNumber, pdintvalue(enc->phys_pageno));
 		}
 		if (enc->page_front >= 0) {
 			pd_dict_put(privDict, PDA_FrontSide, pdboolvalue(enc->page_front == 1));
 		}
-		t_pdvalue appDataDict = pd_dict_new(enc->pool, 2);
+		t_pdvalue appDataDict = pd_dict_new(enc->docpool, 2);
 		pd_dict_put(appDataDict, PDA_LastModified, modTime);
 		pd_dict_put(appDataDict, PDA_Private, privDict);
-		t_pdvalue pieceInfo = pd_dict_new(enc->pool, 2);
+		t_pdvalue pieceInfo = pd_dict_new(enc->docpool, 2);
 		pd_dict_put(pieceInfo, PDA_PDFRaster, appDataDict);
 		pd_dict_put(enc->currentPage, PDA_PieceInfo, pieceInfo);
-		pd_dict_put(enc->currentPage, PDA_LastModified, modTime);
+		pd_dict_put(enc->currentPage, PDA_LastModified, pd_make_time_string(enc->docpool, now));
+	}
+}
+
+// Free a page-level stream that has been written, along with its
+// /Length object (which is written now, if it hasn't been already).
+static void release_stream(t_pdfrasencoder* enc, t_pdvalue ref)
+{
+	if (IS_REFERENCE(ref)) {
+		pdbool succ;
+		t_pdvalue stream = pd_reference_get_value(ref);
+		t_pdvalue length = pd_dict_get(stream, PDA_Length, &succ);
+		if (IS_REFERENCE(length)) {
+			pd_write_reference_declaration(enc->stm, length);
+			pd_reference_release(&length);
+		}
+		// a strip's colorspace is shared with the other strips on the page
+		if (pd_dict_contains(stream, PDA_ColorSpace)) {
+			pd_dict_put(stream, PDA_ColorSpace, pdnullvalue());
+		}
+		pd_value_free_deep(&stream);
+		pd_reference_release(&ref);
+	}
+}
+
+static pdbool release_strip(t_pdatom key, t_pdvalue value, void *cookie)
+{
+	(void)key;
+	release_stream((t_pdfrasencoder*)cookie, value);
+	return PD_TRUE;
+}
+
+// Once the current page has been written, give back everything it used
+// except the page's own reference, which the page tree (/Kids) still needs.
+// The xref table keeps the file positions of all the page's objects.
+static void release_page_objects(t_pdfrasencoder* enc)
+{
+	pdbool succ;
+	t_pdvalue page = pd_reference_get_value(enc->currentPage);
+	t_pdvalue res = pd_dict_get(page, PDA_Resources, &succ);
+	pd_dict_foreach(pd_dict_get(res, PDA_XObject, &succ), release_strip, enc);
+	release_stream(enc, pd_dict_get(page, PDA_Contents, &succ));
+	release_stream(enc, pd_dict_get(page, PDA_Metadata, &succ));
+	// the colorspace is per-page, unless it's the document's RGB colorspace
+	if (!pd_value_eq(enc->colorspace, enc->rgbColorspace)) {
+		pd_value_free_deep(&enc->colorspace);
 	}
+	enc->colorspace = pdnullvalue();
+	pd_reference_retire(enc->currentPage);
+	pd_value_free_deep(&page);
 }
 
 int pdfr_encoder_end_page(t_pdfrasencoder* enc)
 {
+	if (!IS_NULL(enc->openStrip)) {
+		pdfr_encoder_end_strip(enc);
+	}
 	if (!IS_NULL(enc->currentPage)) {
-		// create a content generator
-		t_pdcontents_gen *gen = pd_contents_gen_new(enc->pool, content_generator, enc);
 		// create contents object (stream)
-		t_pdvalue contents = pd_xref_makereference(enc->xref, pd_contents_new(enc->pool, enc->xref, gen));
+		t_pdvalue contents = pd_xref_makereference(enc->xref, pd_contents_new(enc->docpool, enc->xref, enc->contentsGen));
 		// flush (write) the contents stream
 		pd_write_reference_declaration(enc->stm, contents);
 		// add the contents to the current page
@@ -475,10 +793,14 @@ int pdfr_encoder_end_page(t_pdfrasencoder* enc)
 		}
 		// metadata - add to page if any is specified
 		write_page_metadata(enc);
+		// the page tree decides which /Pages node is the parent
+		pd_dict_put(enc->currentPage, PDA_Parent, pd_pagetree_parent(enc->pagetree));
 		// flush (write) the current page
 		pd_write_reference_declaration(enc->stm, enc->currentPage);
-		// add the current page to the catalog (page tree)
-		pd_catalog_add_page(enc->catalog, enc->currentPage);
+		// keep only what the xref table and page tree need
+		release_page_objects(enc);
+		// add the current page to the page tree
+		pd_pagetree_add_page(enc->pagetree, enc->currentPage);
 		// done with current page:
 		enc->currentPage = pdnullvalue();
 	}
@@ -492,17 +814,9 @@ int pdfr_encoder_page_count(t_pdfrasencoder* enc)
 {
 	int pageCount = -1;
 	if (enc) {
-		pdbool succ;
-		t_pdvalue pagesdict = pd_dict_get(enc->catalog, PDA_Pages, &succ);
-		assert(succ);
-		if (succ) {
-			t_pdvalue count = pd_dict_get(pagesdict, PDA_Count, &succ);
-			assert(succ);
-			assert(IS_INT(count));
-			pageCount = count.value.intvalue;
-			if (!IS_NULL(enc->currentPage)) {
-				pageCount++;
-			}
+		pageCount = pd_pagetree_count(enc->pagetree);
+		if (!IS_NULL(enc->currentPage)) {
+			pageCount++;
 		}
 	}
 	return pageCount;
@@ -513,6 +827,11 @@ long pdfr_encoder_bytes_written(t_pdfrasencoder* enc)
 	return pd_outstream_pos(enc->stm);
 }
 
+t_pdmempool* pdfr_encoder_get_pool(t_pdfrasencoder* enc)
+{
+	return enc ? enc->docpool : NULL;
+}
+
 static int pdfr_sig_handler(t_pdoutstream *stm, void* cookie, PdfOutputEventCode eventid)
 {
     pd_puts(stm, "%PDF-raster-" PDFRASTER_SPEC_VERSION "\n");
@@ -524,20 +843,45 @@ void pdfr_encoder_end_document(t_pdfrasencoder* enc)
 {
     t_pdoutstream* stm = enc->stm;
 	pdfr_encoder_end_page(enc);
+	// write out what's left of the page tree
+	pd_pagetree_finish(enc->pagetree);
 	// remember to write our PDF/raster signature marker
     pd_outstream_set_event_handler(stm, PDF_EVENT_BEFORE_STARTXREF, pdfr_sig_handler, NULL);
 	pd_write_endofdocument(stm, enc->xref, enc->catalog, enc->info, enc->trailer);
+	// tell the signer where to sign
+	t_pdsignature_layout layout;
+	if (enc->sigHandler && pd_outstream_get_signature(stm, &layout)) {
+		t_pdfrassignature sig;
+		int i;
+		for (i = 0; i < 4; i++) {
+			sig.byteRange[i] = layout.byterange[i];
+		}
+		sig.contentsOffset = layout.contents_pos;
+		sig.contentsLength = layout.contents_len;
+		enc->sigHandler(enc, &sig, enc->sigCookie);
+	}
 
 	// Note: we leave all the final data structures intact in case the client
 	// has questions, like 'how many pages did we write?' or 'how big was the output file?'.
 }
 
+void pdfr_encoder_reset(t_pdfrasencoder* enc, void *writercookie)
+{
+	if (enc) {
+		// drop the old document wholesale, keeping the pool's slabs
+		pd_pool_reset(enc->docpool);
+		pd_outstream_restart(enc->stm, writercookie);
+		start_document(enc);
+	}
+}
+
 void pdfr_encoder_destroy(t_pdfrasencoder* enc)
 {
 	if (enc) {
-		// free everything in the pool associated
-		// with this encoder. Including the pool
+		// free everything in the pools associated
+		// with this encoder. Including the pools
 		// and the encoder struct.
+		pd_alloc_free_pool(enc->docpool);
 		struct t_pdmempool *pool = enc->pool;
 		pd_alloc_free_pool(pool);
 	}
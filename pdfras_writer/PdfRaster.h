@@ -95,6 +95,68 @@ void pdfr_encoder_write_page_xmp(t_pdfrasencoder *enc, const char* xmpdata);
 // Attach XMP metadata to the document.
 void pdfr_encoder_write_document_xmp(t_pdfrasencoder *enc, const char* xmpdata);
 
+// Permission flags for pdfr_encoder_set_encryption: what a user who opens
+// an encrypted document with the user password is allowed to do.
+// (These are bits 3-12 of /P in the PDF encryption dictionary)
+#define PDFRAS_PERM_PRINT		(1 << 2)	// print, at low resolution unless PRINT_HIGH is also set
+#define PDFRAS_PERM_MODIFY		(1 << 3)	// change the document
+#define PDFRAS_PERM_COPY		(1 << 4)	// copy or extract text and graphics
+#define PDFRAS_PERM_ANNOTATE	(1 << 5)	// add or modify annotations, fill in forms
+#define PDFRAS_PERM_FILL_FORMS	(1 << 8)	// fill in existing form fields
+#define PDFRAS_PERM_ASSEMBLE	(1 << 10)	// insert, rotate or delete pages
+#define PDFRAS_PERM_PRINT_HIGH	(1 << 11)	// print at full quality
+#define PDFRAS_PERM_ALL			0xF3C		// all of the above
+
+// Encrypt the document with AES-256, using the PDF 2.0 standard security
+// handler. All strings and streams written from now on are encrypted.
+// user_password is needed to open the document, NULL or "" means anyone can.
+// owner_password gives full access, NULL means the same as the user password.
+// permissions: PDFRAS_PERM_ flags, what the user password allows.
+// Must be called before anything but the PDF header has been written -
+// before the first page and before pdfr_encoder_write_document_xmp.
+// Returns 0 if OK, -1 if it's too late or the platform can't provide
+// random numbers.
+int pdfr_encoder_set_encryption(t_pdfrasencoder* enc, const char* user_password, const char* owner_password, int permissions);
+
+// Digests the encoder can compute of its output as it writes it
+#define PDFRAS_DIGEST_MD5		1
+#define PDFRAS_DIGEST_SHA256	2
+
+// Choose which digests (PDFRAS_DIGEST_ bits, 0 for none) of the output
+// the encoder computes. The default is PDFRAS_DIGEST_MD5, which is also
+// used as the document's file /ID. The setting carries over to the next
+// document after pdfr_encoder_reset.
+// Turning a digest on must be done before anything but the PDF header
+// has been written, like pdfr_encoder_set_encryption.
+// Returns 0 if OK, -1 if it's too late.
+int pdfr_encoder_set_digests(t_pdfrasencoder* enc, int digests);
+
+// Get the MD5 (16 bytes) or SHA-256 (32 bytes) digest of the output.
+// After pdfr_encoder_end_document that is the digest of the whole file.
+// Returns 0 if OK, -1 if the encoder isn't computing that digest.
+int pdfr_encoder_get_md5(t_pdfrasencoder* enc, pduint8 digest[16]);
+int pdfr_encoder_get_sha256(t_pdfrasencoder* enc, pduint8 digest[32]);
+
+// Where the signature reserved by pdfr_encoder_reserve_signature is in the output
+typedef struct {
+	long	byteRange[4];		// the /ByteRange: offset and length of the bytes to sign before /Contents, and after it
+	long	contentsOffset;		// offset of the first hex digit of /Contents
+	long	contentsLength;		// number of hex digits reserved, 2 per byte of signature
+} t_pdfrassignature;
+
+typedef void (*pdfr_signature_handler)(t_pdfrasencoder* enc, const t_pdfrassignature* sig, void* cookie);
+
+// Reserve room for a detached (adbe.pkcs7.detached) signature of up to
+// maxlen bytes, DER-encoded. An invisible signature field is added to the
+// current page, or the next page started if none is open, and the signature
+// dictionary is written at the very end of the document, with its /ByteRange
+// already filled in and /Contents all '0's.
+// After pdfr_encoder_end_document has written the last byte, handler is
+// called with where those are: sign the bytes of the two /ByteRange spans,
+// then write the signature in hex over the start of /Contents.
+// Returns 0 if OK, -1 if a signature has already been reserved.
+int pdfr_encoder_reserve_signature(t_pdfrasencoder* enc, size_t maxlen, pdfr_signature_handler handler, void* cookie);
+
 // Set the viewing angle for subsequent pages.
 // The angle is a rotation clockwise in degrees and must be a multiple of 90.
 // The viewing angle is initially 0.
@@ -123,6 +185,8 @@ int pdfr_encoder_set_bitonal_uncalibrated(t_pdfrasencoder* enc, int uncal);
 // (By default, RGB images are assumed to be sRGB)
 // profile must point to a valid ICC color profile of len bytes.
 // (the profile is not validated but is used verbatim)
+// The encoder keeps a copy of the profile, and defining the same profile
+// again keeps the current colorspace, so the profile is written once.
 // If profile is NULL, the standard sRGB profile is selected and the len value is ignored.
 void pdfr_encoder_define_rgb_icc_colorspace(t_pdfrasencoder* enc, const pduint8 *profile, size_t len);
 
@@ -166,6 +230,37 @@ void pdfr_encoder_set_page_front(t_pdfrasencoder* enc, int frontness);
 // K = -1, EndOfLine=false, EncodedByteAlign=false, BlackIs1=false
 int pdfr_encoder_write_strip(t_pdfrasencoder* enc, int rows, const pduint8 *buf, size_t len);
 
+// One piece of a strip's data, for pdfr_encoder_write_strip_v
+typedef struct {
+	const pduint8*	data;
+	size_t			len;
+} t_pdfrasiovec;
+
+// Append a strip to the current page, with the strip data given as
+// nsegs segments (gather-write): the strip is the bytes of segs[0],
+// followed by the bytes of segs[1], and so on.
+// Otherwise exactly like pdfr_encoder_write_strip.
+// Each segment is written straight to the output, the segments are
+// never copied into one buffer. Rows may span segments.
+// Zero-length segments are allowed, and ignored.
+int pdfr_encoder_write_strip_v(t_pdfrasencoder* enc, int rows, const t_pdfrasiovec *segs, int nsegs);
+
+// Write a strip to the current page incrementally, without having all
+// of its data in memory at once:
+//   pdfr_encoder_begin_strip(enc, rows);
+//   pdfr_encoder_write_strip_data(enc, data, len);		// any number of times
+//   pdfr_encoder_end_strip(enc);
+// rows is the height of the strip and must be known at the start, because
+// PDF/raster requires an inline /Height and the output is written in order.
+// The data passed to pdfr_encoder_write_strip_data is appended to the strip
+// as-is, with the same requirements as for pdfr_encoder_write_strip.
+// Only one strip can be open at a time; while it is open the other strip
+// writing calls fail. pdfr_encoder_end_page ends an open strip.
+// All return 0 on success, -1 on failure (e.g. no open strip).
+int pdfr_encoder_begin_strip(t_pdfrasencoder* enc, int rows);
+int pdfr_encoder_write_strip_data(t_pdfrasencoder* enc, const pduint8 *data, size_t len);
+int pdfr_encoder_end_strip(t_pdfrasencoder* enc);
+
 // get the height (so far) in rows(pixels) of the current page.
 // equals the sum of the row-counts of strips written to the current page.
 int pdfr_encoder_get_page_height(t_pdfrasencoder* enc);
@@ -185,6 +280,19 @@ void pdfr_encoder_end_document(t_pdfrasencoder* enc);
 // Returns the number of bytes written to the document
 long pdfr_encoder_bytes_written(t_pdfrasencoder* enc);
 
+// Returns the allocation pool that holds the current document's data.
+// Useful for watching memory use with pd_get_bytes_in_use.
+t_pdmempool* pdfr_encoder_get_pool(t_pdfrasencoder* enc);
+
+// Get the encoder ready to write a new document to writercookie,
+// as if it had just been created with that as os->writeoutcookie.
+// Everything belonging to the previous document is dropped in one go,
+// finished or not, but the encoder keeps its warmed-up memory, atoms
+// and content buffer, so a batch of small documents is written much
+// faster this way than by destroying and re-creating the encoder.
+// Page properties return to their defaults, as after pdfr_encoder_create.
+void pdfr_encoder_reset(t_pdfrasencoder* enc, void *writercookie);
+
 // Destroy a raster PDF encoder, releasing all associated resources.
 // Do not use the enc pointer after this, it is invalid.
 void pdfr_encoder_destroy(t_pdfrasencoder* enc);
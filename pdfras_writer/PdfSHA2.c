@@ -0,0 +1,318 @@
+// PdfSHA2.c - SHA-256, SHA-384 and SHA-512
+//
+#include "PdfSHA2.h"
+#include "PdfAES.h"
+
+#include <string.h>
+
+#ifdef _MSC_VER
+#define PD_U64(x) x##ui64
+#else
+#define PD_U64(x) x##ULL
+#endif
+
+static const pduint32 k256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const pduint64 k512[80] = {
+	PD_U64(0x428a2f98d728ae22), PD_U64(0x7137449123ef65cd), PD_U64(0xb5c0fbcfec4d3b2f), PD_U64(0xe9b5dba58189dbbc),
+	PD_U64(0x3956c25bf348b538), PD_U64(0x59f111f1b605d019), PD_U64(0x923f82a4af194f9b), PD_U64(0xab1c5ed5da6d8118),
+	PD_U64(0xd807aa98a3030242), PD_U64(0x12835b0145706fbe), PD_U64(0x243185be4ee4b28c), PD_U64(0x550c7dc3d5ffb4e2),
+	PD_U64(0x72be5d74f27b896f), PD_U64(0x80deb1fe3b1696b1), PD_U64(0x9bdc06a725c71235), PD_U64(0xc19bf174cf692694),
+	PD_U64(0xe49b69c19ef14ad2), PD_U64(0xefbe4786384f25e3), PD_U64(0x0fc19dc68b8cd5b5), PD_U64(0x240ca1cc77ac9c65),
+	PD_U64(0x2de92c6f592b0275), PD_U64(0x4a7484aa6ea6e483), PD_U64(0x5cb0a9dcbd41fbd4), PD_U64(0x76f988da831153b5),
+	PD_U64(0x983e5152ee66dfab), PD_U64(0xa831c66d2db43210), PD_U64(0xb00327c898fb213f), PD_U64(0xbf597fc7beef0ee4),
+	PD_U64(0xc6e00bf33da88fc2), PD_U64(0xd5a79147930aa725), PD_U64(0x06ca6351e003826f), PD_U64(0x142929670a0e6e70),
+	PD_U64(0x27b70a8546d22ffc), PD_U64(0x2e1b21385c26c926), PD_U64(0x4d2c6dfc5ac42aed), PD_U64(0x53380d139d95b3df),
+	PD_U64(0x650a73548baf63de), PD_U64(0x766a0abb3c77b2a8), PD_U64(0x81c2c92e47edaee6), PD_U64(0x92722c851482353b),
+	PD_U64(0xa2bfe8a14cf10364), PD_U64(0xa81a664bbc423001), PD_U64(0xc24b8b70d0f89791), PD_U64(0xc76c51a30654be30),
+	PD_U64(0xd192e819d6ef5218), PD_U64(0xd69906245565a910), PD_U64(0xf40e35855771202a), PD_U64(0x106aa07032bbd1b8),
+	PD_U64(0x19a4c116b8d2d0c8), PD_U64(0x1e376c085141ab53), PD_U64(0x2748774cdf8eeb99), PD_U64(0x34b0bcb5e19b48a8),
+	PD_U64(0x391c0cb3c5c95a63), PD_U64(0x4ed8aa4ae3418acb), PD_U64(0x5b9cca4f7763e373), PD_U64(0x682e6ff3d6b2b8a3),
+	PD_U64(0x748f82ee5defb2fc), PD_U64(0x78a5636f43172f60), PD_U64(0x84c87814a1f0ab72), PD_U64(0x8cc702081a6439ec),
+	PD_U64(0x90befffa23631e28), PD_U64(0xa4506cebde82bde9), PD_U64(0xbef9a3f7b2c67915), PD_U64(0xc67178f2e372532b),
+	PD_U64(0xca273eceea26619c), PD_U64(0xd186b8c721c0c207), PD_U64(0xeada7dd6cde0eb1e), PD_U64(0xf57d4f7fee6ed178),
+	PD_U64(0x06f067aa72176fba), PD_U64(0x0a637dc5a2c898a6), PD_U64(0x113f9804bef90dae), PD_U64(0x1b710b35131c471b),
+	PD_U64(0x28db77f523047d84), PD_U64(0x32caab7b40c72493), PD_U64(0x3c9ebe0a15c9bebc), PD_U64(0x431d67c49c100d4c),
+	PD_U64(0x4cc5d4becb3e42b6), PD_U64(0x597f299cfc657e2a), PD_U64(0x5fcb6fab3ad6faec), PD_U64(0x6c44198c4a475817),
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+static void sha256_block(pduint32 *h, const pduint8 *p)
+{
+	pduint32 w[64];
+	pduint32 a, b, c, d, e, f, g, hh;
+	int i;
+	for (i = 0; i < 16; i++, p += 4) {
+		w[i] = ((pduint32)p[0] << 24) | ((pduint32)p[1] << 16) | ((pduint32)p[2] << 8) | p[3];
+	}
+	for (; i < 64; i++) {
+		pduint32 s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		pduint32 s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+	for (i = 0; i < 64; i++) {
+		pduint32 t1 = hh + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + CH(e, f, g) + k256[i] + w[i];
+		pduint32 t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + MAJ(a, b, c);
+		hh = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+static void sha512_block(pduint64 *h, const pduint8 *p)
+{
+	pduint64 w[80];
+	pduint64 a, b, c, d, e, f, g, hh;
+	int i, j;
+	for (i = 0; i < 16; i++, p += 8) {
+		pduint64 v = 0;
+		for (j = 0; j < 8; j++) {
+			v = (v << 8) | p[j];
+		}
+		w[i] = v;
+	}
+	for (; i < 80; i++) {
+		pduint64 s0 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+		pduint64 s1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+	for (i = 0; i < 80; i++) {
+		pduint64 t1 = hh + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41)) + CH(e, f, g) + k512[i] + w[i];
+		pduint64 t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39)) + MAJ(a, b, c);
+		hh = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+void pd_sha256_init(t_pdsha256 *ctx)
+{
+	static const pduint32 init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	memcpy(ctx->h, init, sizeof init);
+	ctx->len = 0;
+}
+
+void pd_sha256_update(t_pdsha256 *ctx, const void *data, size_t len)
+{
+	const pduint8 *p = (const pduint8 *)data;
+	size_t used = (size_t)(ctx->len & 63);
+	if (len == 0) {
+		return;
+	}
+	ctx->len += len;
+	if (used) {
+		size_t n = 64 - used;
+		if (n > len) n = len;
+		memcpy(ctx->buf + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 64) {
+			return;
+		}
+		sha256_block(ctx->h, ctx->buf);
+	}
+	for (; len >= 64; len -= 64, p += 64) {
+		sha256_block(ctx->h, p);
+	}
+	memcpy(ctx->buf, p, len);
+}
+
+void pd_sha256_final(t_pdsha256 *ctx, pduint8 *digest)
+{
+	pduint64 bits = ctx->len * 8;
+	size_t used = (size_t)(ctx->len & 63);
+	int i;
+	// append 0x80, zero-fill, and the bit length in the last 8 bytes
+	ctx->buf[used++] = 0x80;
+	if (used > 56) {
+		memset(ctx->buf + used, 0, 64 - used);
+		sha256_block(ctx->h, ctx->buf);
+		used = 0;
+	}
+	memset(ctx->buf + used, 0, 56 - used);
+	for (i = 0; i < 8; i++) {
+		ctx->buf[63 - i] = (pduint8)(bits >> (8 * i));
+	}
+	sha256_block(ctx->h, ctx->buf);
+	for (i = 0; i < 8; i++) {
+		digest[4 * i] = (pduint8)(ctx->h[i] >> 24);
+		digest[4 * i + 1] = (pduint8)(ctx->h[i] >> 16);
+		digest[4 * i + 2] = (pduint8)(ctx->h[i] >> 8);
+		digest[4 * i + 3] = (pduint8)ctx->h[i];
+	}
+}
+
+void pd_sha384_init(t_pdsha512 *ctx)
+{
+	static const pduint64 init[8] = {
+		PD_U64(0xcbbb9d5dc1059ed8), PD_U64(0x629a292a367cd507), PD_U64(0x9159015a3070dd17), PD_U64(0x152fecd8f70e5939),
+		PD_U64(0x67332667ffc00b31), PD_U64(0x8eb44a8768581511), PD_U64(0xdb0c2e0d64f98fa7), PD_U64(0x47b5481dbefa4fa4),
+	};
+	memcpy(ctx->h, init, sizeof init);
+	ctx->len = 0;
+	ctx->size = PD_SHA384_SIZE;
+}
+
+void pd_sha512_init(t_pdsha512 *ctx)
+{
+	static const pduint64 init[8] = {
+		PD_U64(0x6a09e667f3bcc908), PD_U64(0xbb67ae8584caa73b), PD_U64(0x3c6ef372fe94f82b), PD_U64(0xa54ff53a5f1d36f1),
+		PD_U64(0x510e527fade682d1), PD_U64(0x9b05688c2b3e6c1f), PD_U64(0x1f83d9abfb41bd6b), PD_U64(0x5be0cd19137e2179),
+	};
+	memcpy(ctx->h, init, sizeof init);
+	ctx->len = 0;
+	ctx->size = PD_SHA512_SIZE;
+}
+
+void pd_sha512_update(t_pdsha512 *ctx, const void *data, size_t len)
+{
+	const pduint8 *p = (const pduint8 *)data;
+	size_t used = (size_t)(ctx->len & 127);
+	if (len == 0) {
+		return;
+	}
+	ctx->len += len;
+	if (used) {
+		size_t n = 128 - used;
+		if (n > len) n = len;
+		memcpy(ctx->buf + used, p, n);
+		p += n;
+		len -= n;
+		if (used + n < 128) {
+			return;
+		}
+		sha512_block(ctx->h, ctx->buf);
+	}
+	for (; len >= 128; len -= 128, p += 128) {
+		sha512_block(ctx->h, p);
+	}
+	memcpy(ctx->buf, p, len);
+}
+
+void pd_sha512_final(t_pdsha512 *ctx, pduint8 *digest)
+{
+	pduint64 bits = ctx->len * 8;
+	size_t used = (size_t)(ctx->len & 127);
+	int i;
+	// the length field is 16 bytes, of which we only fill the low 8
+	ctx->buf[used++] = 0x80;
+	if (used > 112) {
+		memset(ctx->buf + used, 0, 128 - used);
+		sha512_block(ctx->h, ctx->buf);
+		used = 0;
+	}
+	memset(ctx->buf + used, 0, 120 - used);
+	for (i = 0; i < 8; i++) {
+		ctx->buf[127 - i] = (pduint8)(bits >> (8 * i));
+	}
+	sha512_block(ctx->h, ctx->buf);
+	for (i = 0; i < ctx->size; i++) {
+		digest[i] = (pduint8)(ctx->h[i / 8] >> (56 - 8 * (i % 8)));
+	}
+}
+
+void pd_sha256(const void *data, size_t len, pduint8 *digest)
+{
+	t_pdsha256 ctx;
+	pd_sha256_init(&ctx);
+	pd_sha256_update(&ctx, data, len);
+	pd_sha256_final(&ctx, digest);
+}
+
+void pd_sha384(const void *data, size_t len, pduint8 *digest)
+{
+	t_pdsha512 ctx;
+	pd_sha384_init(&ctx);
+	pd_sha512_update(&ctx, data, len);
+	pd_sha512_final(&ctx, digest);
+}
+
+void pd_sha512(const void *data, size_t len, pduint8 *digest)
+{
+	t_pdsha512 ctx;
+	pd_sha512_init(&ctx);
+	pd_sha512_update(&ctx, data, len);
+	pd_sha512_final(&ctx, digest);
+}
+
+void pd_hash_password_r6(const pduint8 *pwd, pduint32 pwdlen, const pduint8 *salt, const pduint8 *udata, pduint8 *hash)
+{
+	pduint8 K[PD_SHA512_SIZE];
+	pduint32 klen = PD_SHA256_SIZE;
+	pduint32 ulen = udata ? 48 : 0;
+	// 64 repetitions of password + K + udata, the longest being 127 + 64 + 48 bytes
+	pduint8 K1[64 * (127 + PD_SHA512_SIZE + 48)];
+	pduint8 *E = K1;			// encrypted in place
+	t_pdsha256 sha;
+	t_pdaeskey aes;
+	int round;
+
+	pd_sha256_init(&sha);
+	pd_sha256_update(&sha, pwd, pwdlen);
+	pd_sha256_update(&sha, salt, 8);
+	pd_sha256_update(&sha, udata, ulen);
+	pd_sha256_final(&sha, K);
+
+	for (round = 0; ; round++) {
+		pduint32 seqlen = pwdlen + klen + ulen;
+		pduint32 i, sum = 0;
+		memcpy(K1, pwd, pwdlen);
+		memcpy(K1 + pwdlen, K, klen);
+		if (ulen) {
+			memcpy(K1 + pwdlen + klen, udata, ulen);
+		}
+		for (i = 1; i < 64; i++) {
+			memcpy(K1 + i * seqlen, K1, seqlen);
+		}
+		// AES-128 CBC, keyed by the first 16 bytes of K with the next 16 as IV
+		pduint8 iv[PD_AES_BLOCK];
+		memcpy(iv, K + 16, PD_AES_BLOCK);
+		pd_aes_set_key(&aes, K, 128);
+		pd_aes_cbc_encrypt(&aes, iv, K1, E, 64 * seqlen / PD_AES_BLOCK);
+		// the first 16 bytes of E, as a number mod 3, pick the next hash
+		for (i = 0; i < 16; i++) {
+			sum += E[i];
+		}
+		switch (sum % 3) {
+		case 0:
+			pd_sha256(E, 64 * seqlen, K);
+			klen = PD_SHA256_SIZE;
+			break;
+		case 1:
+			pd_sha384(E, 64 * seqlen, K);
+			klen = PD_SHA384_SIZE;
+			break;
+		default:
+			pd_sha512(E, 64 * seqlen, K);
+			klen = PD_SHA512_SIZE;
+			break;
+		}
+		// at least 64 rounds, then stop once the last byte of E
+		// is no more than the number of rounds done - 32
+		if (round >= 63 && E[64 * seqlen - 1] <= round - 31) {
+			break;
+		}
+	}
+	memcpy(hash, K, 32);
+}
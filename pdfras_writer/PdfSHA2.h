@@ -0,0 +1,56 @@
+#ifndef _H_PdfSHA2
+#define _H_PdfSHA2
+#pragma once
+
+// SHA-256, SHA-384 and SHA-512 message digests (FIPS 180-4),
+// as used by the PDF 2.0 standard security handler.
+
+#include "PdfPlatform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PD_SHA256_SIZE 32
+#define PD_SHA384_SIZE 48
+#define PD_SHA512_SIZE 64
+
+typedef struct {
+	pduint32	h[8];				// hash state
+	pduint64	len;				// bytes hashed so far
+	pduint8		buf[64];			// partial block
+} t_pdsha256;
+
+// SHA-384 is SHA-512 with different initial values, cut short
+typedef struct {
+	pduint64	h[8];
+	pduint64	len;
+	pduint8		buf[128];
+	int			size;				// digest size, PD_SHA384_SIZE or PD_SHA512_SIZE
+} t_pdsha512;
+
+extern void pd_sha256_init(t_pdsha256 *ctx);
+extern void pd_sha256_update(t_pdsha256 *ctx, const void *data, size_t len);
+// Finish the digest and write its PD_SHA256_SIZE bytes to digest
+extern void pd_sha256_final(t_pdsha256 *ctx, pduint8 *digest);
+
+extern void pd_sha384_init(t_pdsha512 *ctx);
+extern void pd_sha512_init(t_pdsha512 *ctx);
+extern void pd_sha512_update(t_pdsha512 *ctx, const void *data, size_t len);
+// Finish a SHA-384 or SHA-512 digest and write its ctx->size bytes to digest
+extern void pd_sha512_final(t_pdsha512 *ctx, pduint8 *digest);
+
+// One-call digests
+extern void pd_sha256(const void *data, size_t len, pduint8 *digest);
+extern void pd_sha384(const void *data, size_t len, pduint8 *digest);
+extern void pd_sha512(const void *data, size_t len, pduint8 *digest);
+
+// Algorithm 2.B of PDF 2.0: the 32-byte hash of a password (at most 127 bytes)
+// with an 8-byte salt, and for the owner password the 48-byte /U value as udata.
+// udata is NULL for the user password.
+extern void pd_hash_password_r6(const pduint8 *pwd, pduint32 pwdlen, const pduint8 *salt, const pduint8 *udata, pduint8 *hash);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,42 +1,233 @@
 #include "PdfSecurityHandler.h"
 #include "PdfAlloc.h"
+#include "PdfAES.h"
+#include "PdfSHA2.h"
+#include "PdfDict.h"
+#include "PdfString.h"
+#include "PdfStandardAtoms.h"
+
+#include <string.h>
+
+// CBC state of a string or stream being encrypted
+typedef struct {
+	pduint8		iv[PD_AES_BLOCK];		// chaining value
+	pduint8		partial[PD_AES_BLOCK];	// plaintext not yet making up a whole block
+	pduint32	npartial;
+} t_cbcstate;
 
 typedef struct t_pdencrypter {
-	void*		cookie;			// data specific to a particular class of encrypter
 	pduint32	onr, gen;		// number & generation of current object
+	pdint32		P;				// permission flags
+	pduint8		O[48], U[48];	// owner & user password hashes, with their salts
+	pduint8		OE[32], UE[32];	// the file key, encrypted with each password
+	pduint8		Perms[16];		// the permissions, encrypted with the file key
+	t_pdaeskey	key;			// the file key, expanded
+	t_cbcstate	stream;			// state of the stream being encrypted
+	t_pdaeskey	rngkey;			// random number generator: AES-256 in counter mode
+	pduint8		rngctr[PD_AES_BLOCK];
 } t_pdencrypter;
 
-t_pdencrypter* pd_encrypt_new(t_pdmempool* pool, void *cookie)
+// Generate n random bytes
+static void random_bytes(t_pdencrypter *crypter, pduint8 *out, pduint32 n)
+{
+	while (n) {
+		pduint8 block[PD_AES_BLOCK];
+		int i;
+		pd_aes_encrypt_block(&crypter->rngkey, crypter->rngctr, block);
+		// step the counter
+		for (i = PD_AES_BLOCK - 1; i >= 0 && ++crypter->rngctr[i] == 0; i--) {
+		}
+		pduint32 m = n < PD_AES_BLOCK ? n : PD_AES_BLOCK;
+		memcpy(out, block, m);
+		out += m;
+		n -= m;
+	}
+}
+
+static pduint32 password_length(const char *pwd)
+{
+	pduint32 len = pwd ? (pduint32)pdstrlen(pwd) : 0;
+	return len > 127 ? 127 : len;
+}
+
+// Encrypt the 32-byte file key with AES-256, no IV, for /OE or /UE
+static void wrap_file_key(const pduint8 *filekey, const pduint8 *kek, pduint8 *out)
+{
+	t_pdaeskey aes;
+	pduint8 iv[PD_AES_BLOCK] = { 0 };
+	pd_aes_set_key(&aes, kek, 256);
+	pd_aes_cbc_encrypt(&aes, iv, filekey, out, 2);
+}
+
+t_pdencrypter* pd_encrypt_new_aes256(t_pdmempool* pool, const char* user_password, const char* owner_password, pdint32 perms)
 {
+	pduint8 seed[32 + PD_AES_BLOCK];
+	if (!pdrandom(seed, sizeof seed)) {
+		return NULL;
+	}
 	t_pdencrypter* crypter = (t_pdencrypter*)pd_alloc(pool, sizeof(t_pdencrypter));
 	if (crypter) {
-		crypter->cookie = cookie;
+		pduint8 filekey[32], hash[32];
+		pduint8 salts[16];
+		pd_aes_set_key(&crypter->rngkey, seed, 256);
+		memcpy(crypter->rngctr, seed + 32, PD_AES_BLOCK);
+		random_bytes(crypter, filekey, sizeof filekey);
+		pd_aes_set_key(&crypter->key, filekey, 256);
+
+		if (!owner_password) {
+			owner_password = user_password;
+		}
+		const pduint8 *upwd = (const pduint8 *)(user_password ? user_password : "");
+		const pduint8 *opwd = (const pduint8 *)(owner_password ? owner_password : "");
+		pduint32 ulen = password_length(user_password);
+		pduint32 olen = password_length(owner_password);
+
+		// U = hash(user password, validation salt) + validation salt + key salt
+		random_bytes(crypter, salts, sizeof salts);
+		pd_hash_password_r6(upwd, ulen, salts, NULL, crypter->U);
+		memcpy(crypter->U + 32, salts, 16);
+		pd_hash_password_r6(upwd, ulen, salts + 8, NULL, hash);
+		wrap_file_key(filekey, hash, crypter->UE);
+
+		// O is the same for the owner password, also hashing U
+		random_bytes(crypter, salts, sizeof salts);
+		pd_hash_password_r6(opwd, olen, salts, crypter->U, crypter->O);
+		memcpy(crypter->O + 32, salts, 16);
+		pd_hash_password_r6(opwd, olen, salts + 8, crypter->U, hash);
+		wrap_file_key(filekey, hash, crypter->OE);
+
+		// bits 7-8 and 13-32 must be 1, bits 1-2 must be 0.
+		crypter->P = (pdint32)(((pduint32)perms | 0xFFFFF0C0u) & ~3u);
+		pduint8 *p = crypter->Perms;
+		p[0] = (pduint8)crypter->P;
+		p[1] = (pduint8)(crypter->P >> 8);
+		p[2] = (pduint8)(crypter->P >> 16);
+		p[3] = (pduint8)(crypter->P >> 24);
+		p[4] = p[5] = p[6] = p[7] = 0xFF;
+		p[8] = 'T';					// metadata is encrypted
+		p[9] = 'a';
+		p[10] = 'd';
+		p[11] = 'b';
+		random_bytes(crypter, p + 12, 4);
+		pd_aes_encrypt_block(&crypter->key, p, p);
+
+		memset(filekey, 0, sizeof filekey);
+		memset(hash, 0, sizeof hash);
 	}
+	memset(seed, 0, sizeof seed);
 	return crypter;
 }
 
 void pd_encrypt_free(t_pdencrypter* crypter)
 {
-	pd_free(crypter);
+	if (crypter) {
+		memset(crypter, 0, sizeof *crypter);
+		pd_free(crypter);
+	}
+}
+
+t_pdvalue pd_encrypt_dictionary(t_pdencrypter *crypter, t_pdmempool *pool)
+{
+	t_pdvalue stdcf = pd_dict_new(pool, 3);
+	pd_dict_put(stdcf, PDA_CFM, pdatomvalue(PDA_AESV3));
+	pd_dict_put(stdcf, PDA_AuthEvent, pdatomvalue(PDA_DocOpen));
+	pd_dict_put(stdcf, PDA_Length, pdintvalue(32));
+	t_pdvalue cf = pd_dict_new(pool, 1);
+	pd_dict_put(cf, PDA_StdCF, stdcf);
+
+	t_pdvalue dict = pd_dict_new(pool, 14);
+	pd_dict_put(dict, PDA_Filter, pdatomvalue(PDA_Standard));
+	pd_dict_put(dict, PDA_V, pdintvalue(5));
+	pd_dict_put(dict, PDA_R, pdintvalue(6));
+	pd_dict_put(dict, PDA_Length, pdintvalue(256));
+	pd_dict_put(dict, PDA_CF, cf);
+	pd_dict_put(dict, PDA_StmF, pdatomvalue(PDA_StdCF));
+	pd_dict_put(dict, PDA_StrF, pdatomvalue(PDA_StdCF));
+	pd_dict_put(dict, PDA_O, pdstringvalue(pd_string_new_binary(pool, 48, crypter->O)));
+	pd_dict_put(dict, PDA_U, pdstringvalue(pd_string_new_binary(pool, 48, crypter->U)));
+	pd_dict_put(dict, PDA_OE, pdstringvalue(pd_string_new_binary(pool, 32, crypter->OE)));
+	pd_dict_put(dict, PDA_UE, pdstringvalue(pd_string_new_binary(pool, 32, crypter->UE)));
+	pd_dict_put(dict, PDA_P, pdintvalue(crypter->P));
+	pd_dict_put(dict, PDA_Perms, pdstringvalue(pd_string_new_binary(pool, 16, crypter->Perms)));
+	return dict;
 }
 
 void pd_encrypt_start_object(t_pdencrypter *crypter, pduint32 onr, pduint32 gen)
 {
+	// AESV3 uses the file key as-is for every object
 	crypter->onr = onr;
 	crypter->gen = gen;
 }
 
-pduint32 pd_encrypted_size(t_pdencrypter *crypter, pduint32 n)\
+pduint32 pd_encrypted_size(t_pdencrypter *crypter, pduint32 n)
 {
-	// for our supported encryptions, output size = input size.
-	return n;
+	(void)crypter;
+	// IV, then the data padded up to the next whole block
+	return PD_AES_BLOCK + (n / PD_AES_BLOCK + 1) * PD_AES_BLOCK;
 }
 
-void pd_encrypt_data(t_pdencrypter *crypter, pduint8 *outbuf, const pduint8* data, pduint32 n)
+static pduint32 cbc_begin(t_pdencrypter *crypter, t_cbcstate *st, pduint8 *outbuf)
+{
+	random_bytes(crypter, st->iv, PD_AES_BLOCK);
+	st->npartial = 0;
+	memcpy(outbuf, st->iv, PD_AES_BLOCK);
+	return PD_AES_BLOCK;
+}
+
+static pduint32 cbc_data(t_pdencrypter *crypter, t_cbcstate *st, pduint8 *outbuf, const pduint8* data, pduint32 n)
 {
-	pduint32 i;
-	for (i = 0; i < n; i++) {
-		outbuf[i] = '$';		// TODO: real encryption...
+	pduint32 out = 0;
+	if (st->npartial) {
+		pduint32 m = PD_AES_BLOCK - st->npartial;
+		if (m > n) m = n;
+		memcpy(st->partial + st->npartial, data, m);
+		st->npartial += m;
+		data += m;
+		n -= m;
+		if (st->npartial < PD_AES_BLOCK) {
+			return 0;
+		}
+		pd_aes_cbc_encrypt(&crypter->key, st->iv, st->partial, outbuf, 1);
+		out = PD_AES_BLOCK;
+		st->npartial = 0;
 	}
+	pduint32 nblocks = n / PD_AES_BLOCK;
+	pd_aes_cbc_encrypt(&crypter->key, st->iv, data, outbuf + out, nblocks);
+	out += nblocks * PD_AES_BLOCK;
+	st->npartial = n - nblocks * PD_AES_BLOCK;
+	memcpy(st->partial, data + nblocks * PD_AES_BLOCK, st->npartial);
+	return out;
 }
 
+static pduint32 cbc_end(t_pdencrypter *crypter, t_cbcstate *st, pduint8 *outbuf)
+{
+	// PKCS#5 padding: 1 to 16 bytes, each holding the pad length
+	pduint8 pad = (pduint8)(PD_AES_BLOCK - st->npartial);
+	memset(st->partial + st->npartial, pad, pad);
+	pd_aes_cbc_encrypt(&crypter->key, st->iv, st->partial, outbuf, 1);
+	st->npartial = 0;
+	return PD_AES_BLOCK;
+}
+
+void pd_encrypt_data(t_pdencrypter *crypter, pduint8 *outbuf, const pduint8* data, pduint32 n)
+{
+	t_cbcstate st;
+	pduint32 out = cbc_begin(crypter, &st, outbuf);
+	out += cbc_data(crypter, &st, outbuf + out, data, n);
+	cbc_end(crypter, &st, outbuf + out);
+}
+
+pduint32 pd_encrypt_stream_begin(t_pdencrypter *crypter, pduint8 *outbuf)
+{
+	return cbc_begin(crypter, &crypter->stream, outbuf);
+}
+
+pduint32 pd_encrypt_stream_data(t_pdencrypter *crypter, pduint8 *outbuf, const pduint8* data, pduint32 n)
+{
+	return cbc_data(crypter, &crypter->stream, outbuf, data, n);
+}
+
+pduint32 pd_encrypt_stream_end(t_pdencrypter *crypter, pduint8 *outbuf)
+{
+	return cbc_end(crypter, &crypter->stream, outbuf);
+}
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "PdfOS.h"
+#include "PdfValues.h"
 
 typedef struct t_pdencrypter t_pdencrypter;
 
@@ -13,6 +14,20 @@ typedef struct t_pdencrypter t_pdencrypter;
 // * Encrypting n bytes of data
 // * Writing (or providing) all the encryption metadata
 
+// Create an encrypter for the PDF 2.0 standard security handler
+// (/V 5 /R 6), which encrypts all strings and streams with AES-256.
+// Passwords are UTF-8, at most 127 bytes are used. NULL means no password.
+// A NULL owner_password is taken to be the same as the user password.
+// perms are the /P permission flags (see PDF 2.0, Table 22).
+// Returns NULL if the platform can't supply random numbers for the key.
+extern t_pdencrypter* pd_encrypt_new_aes256(t_pdmempool* pool, const char* user_password, const char* owner_password, pdint32 perms);
+
+extern void pd_encrypt_free(t_pdencrypter* crypter);
+
+// Create the /Encrypt dictionary that describes this encryption,
+// to be written (unencrypted) in the trailer.
+extern t_pdvalue pd_encrypt_dictionary(t_pdencrypter *crypter, t_pdmempool *pool);
+
 // initialize for encryption of an object.
 // The object, or it's first indirect parent, is indirect object <onr, genr>.
 extern void pd_encrypt_start_object(t_pdencrypter *crypter, pduint32 onr, pduint32 genr);
@@ -20,7 +35,19 @@ extern void pd_encrypt_start_object(t_pdencrypter *crypter, pduint32 onr, pduint
 // calculate the encrypted size of n bytes of plain data
 extern pduint32 pd_encrypted_size(t_pdencrypter *crypter, pduint32 n);
 
-// encrypt n bytes of data
+// encrypt n bytes of data, into pd_encrypted_size(crypter, n) bytes at outbuf
 extern void pd_encrypt_data(t_pdencrypter *crypter, pduint8 *outbuf, const pduint8* data, pduint32 n);
 
+// Encrypt stream data as it is written, in three steps:
+// begin writes the start of the encrypted data (the AES IV), and returns
+// the number of bytes written to outbuf, at most PD_ENCRYPT_SLACK.
+extern pduint32 pd_encrypt_stream_begin(t_pdencrypter *crypter, pduint8 *outbuf);
+// data encrypts the next n bytes of the stream. Up to n+PD_ENCRYPT_SLACK
+// bytes are written to outbuf, and the number written is returned.
+extern pduint32 pd_encrypt_stream_data(t_pdencrypter *crypter, pduint8 *outbuf, const pduint8* data, pduint32 n);
+// end writes whatever is left, at most PD_ENCRYPT_SLACK bytes.
+extern pduint32 pd_encrypt_stream_end(t_pdencrypter *crypter, pduint8 *outbuf);
+
+#define PD_ENCRYPT_SLACK 16
+
 #endif
@@ -76,6 +76,42 @@ extern "C" {
 #define PDA_ASCIIHexDecode	((t_pdatom)__ATOM_ASCIIHexDecode)
 #define PDA_CalRGB ((t_pdatom)__ATOM_CalRGB)
 #define PDA_Matrix ((t_pdatom)__ATOM_Matrix)
+#define PDA_Encrypt ((t_pdatom)__ATOM_Encrypt)
+#define PDA_Standard ((t_pdatom)__ATOM_Standard)
+#define PDA_V ((t_pdatom)__ATOM_V)
+#define PDA_R ((t_pdatom)__ATOM_R)
+#define PDA_CF ((t_pdatom)__ATOM_CF)
+#define PDA_StdCF ((t_pdatom)__ATOM_StdCF)
+#define PDA_CFM ((t_pdatom)__ATOM_CFM)
+#define PDA_AESV3 ((t_pdatom)__ATOM_AESV3)
+#define PDA_AuthEvent ((t_pdatom)__ATOM_AuthEvent)
+#define PDA_DocOpen ((t_pdatom)__ATOM_DocOpen)
+#define PDA_StmF ((t_pdatom)__ATOM_StmF)
+#define PDA_StrF ((t_pdatom)__ATOM_StrF)
+#define PDA_O ((t_pdatom)__ATOM_O)
+#define PDA_U ((t_pdatom)__ATOM_U)
+#define PDA_OE ((t_pdatom)__ATOM_OE)
+#define PDA_UE ((t_pdatom)__ATOM_UE)
+#define PDA_P ((t_pdatom)__ATOM_P)
+#define PDA_Perms ((t_pdatom)__ATOM_Perms)
+#define PDA_Version ((t_pdatom)__ATOM_Version)
+#define PDA_Extensions ((t_pdatom)__ATOM_Extensions)
+#define PDA_ADBE ((t_pdatom)__ATOM_ADBE)
+#define PDA_BaseVersion ((t_pdatom)__ATOM_BaseVersion)
+#define PDA_ExtensionLevel ((t_pdatom)__ATOM_ExtensionLevel)
+#define PDA_AcroForm ((t_pdatom)__ATOM_AcroForm)
+#define PDA_Fields ((t_pdatom)__ATOM_Fields)
+#define PDA_SigFlags ((t_pdatom)__ATOM_SigFlags)
+#define PDA_Annots ((t_pdatom)__ATOM_Annots)
+#define PDA_Annot ((t_pdatom)__ATOM_Annot)
+#define PDA_Widget ((t_pdatom)__ATOM_Widget)
+#define PDA_FT ((t_pdatom)__ATOM_FT)
+#define PDA_Sig ((t_pdatom)__ATOM_Sig)
+#define PDA_T ((t_pdatom)__ATOM_T)
+#define PDA_Rect ((t_pdatom)__ATOM_Rect)
+#define PDA_F ((t_pdatom)__ATOM_F)
+#define PDA_M ((t_pdatom)__ATOM_M)
+#define PDA_SubFilter ((t_pdatom)__ATOM_SubFilter)
 
 extern char* __ATOM_UNDEFINED_ATOM;
 extern char* __ATOM_Type;
@@ -143,6 +179,42 @@ extern char* __ATOM_N;
 extern char* __ATOM_ASCIIHexDecode;
 extern char* __ATOM_CalRGB;
 extern char* __ATOM_Matrix;
+extern char* __ATOM_Encrypt;
+extern char* __ATOM_Standard;
+extern char* __ATOM_V;
+extern char* __ATOM_R;
+extern char* __ATOM_CF;
+extern char* __ATOM_StdCF;
+extern char* __ATOM_CFM;
+extern char* __ATOM_AESV3;
+extern char* __ATOM_AuthEvent;
+extern char* __ATOM_DocOpen;
+extern char* __ATOM_StmF;
+extern char* __ATOM_StrF;
+extern char* __ATOM_O;
+extern char* __ATOM_U;
+extern char* __ATOM_OE;
+extern char* __ATOM_UE;
+extern char* __ATOM_P;
+extern char* __ATOM_Perms;
+extern char* __ATOM_Version;
+extern char* __ATOM_Extensions;
+extern char* __ATOM_ADBE;
+extern char* __ATOM_BaseVersion;
+extern char* __ATOM_ExtensionLevel;
+extern char* __ATOM_AcroForm;
+extern char* __ATOM_Fields;
+extern char* __ATOM_SigFlags;
+extern char* __ATOM_Annots;
+extern char* __ATOM_Annot;
+extern char* __ATOM_Widget;
+extern char* __ATOM_FT;
+extern char* __ATOM_Sig;
+extern char* __ATOM_T;
+extern char* __ATOM_Rect;
+extern char* __ATOM_F;
+extern char* __ATOM_M;
+extern char* __ATOM_SubFilter;
 
 #ifdef __cplusplus
 }
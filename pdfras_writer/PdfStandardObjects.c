@@ -185,13 +185,16 @@ t_pdvalue pd_generate_file_id(t_pdmempool *alloc, t_pdvalue info)
 	// get the 16-byte MD5 digest:
 	unsigned char digest[16];
 	MD5_Final(digest, &md5);
+	return pd_file_id_new(alloc, digest);
+}
+
+t_pdvalue pd_file_id_new(t_pdmempool *alloc, const pduint8 *digest)
+{
 	// make a 2-element array
 	t_pdarray *file_id = pd_array_new(alloc, 2);
 	// containing the hash as a binary string, twice
-	pd_array_add(file_id, pdstringvalue(pd_string_new_binary(alloc, sizeof digest, digest)));
-	pd_array_add(file_id, pdstringvalue(pd_string_new_binary(alloc, sizeof digest, digest)));
-	// TODO: don't encrypt the ID array!
-	//pd_dont_encrypt(file_id);
+	pd_array_add(file_id, pdstringvalue(pd_string_new_binary(alloc, 16, digest)));
+	pd_array_add(file_id, pdstringvalue(pd_string_new_binary(alloc, 16, digest)));
 	return pdarrayvalue(file_id);
 }
 
@@ -239,6 +242,160 @@ void pd_catalog_add_page(t_pdvalue catalog, t_pdvalue page)
 	pd_dict_put(pagesdict, PDA_Count, pdintvalue(count.value.intvalue + 1));
 }
 
+// Deepest tree we can build: PD_PAGETREE_FANOUT^PAGETREE_MAX_LEVELS pages
+#define PAGETREE_MAX_LEVELS 8
+
+typedef struct t_pdpagetree {
+	t_pdxref *xref;
+	t_pdoutstream *stm;
+	t_pdvalue catalog;
+	// levels[0] is the node pages are being added to, levels[1] its parent, and so on.
+	// A null entry means no node is open at that level (yet).
+	t_pdvalue levels[PAGETREE_MAX_LEVELS];
+	int top;					// highest level in use
+	pdint32 count;				// total pages added
+	pdbool finished;
+} t_pdpagetree;
+
+static t_pdvalue pagetree_node_new(t_pdpagetree *tree)
+{
+	t_pdmempool *pool = pd_get_pool(tree);
+	t_pdvalue node = pd_dict_new(pool, 4);
+	pd_dict_put(node, PDA_Type, pdatomvalue(PDA_Pages));
+	pd_dict_put(node, PDA_Kids, pdarrayvalue(pd_array_new(pool, PD_PAGETREE_FANOUT)));
+	pd_dict_put(node, PDA_Count, pdintvalue(0));
+	return pd_xref_makereference(tree->xref, node);
+}
+
+// Return the open node at a level, creating it if need be.
+static t_pdvalue pagetree_node(t_pdpagetree *tree, int level)
+{
+	if (IS_NULL(tree->levels[level])) {
+		tree->levels[level] = pagetree_node_new(tree);
+		if (level > tree->top) {
+			tree->top = level;
+		}
+	}
+	return tree->levels[level];
+}
+
+static t_pdarray *pagetree_kids(t_pdvalue node)
+{
+	pdbool succ;
+	t_pdvalue kids = pd_dict_get(node, PDA_Kids, &succ);
+	assert(IS_ARRAY(kids));
+	return kids.value.arrvalue;
+}
+
+static pdint32 pagetree_node_count(t_pdvalue node)
+{
+	pdbool succ;
+	t_pdvalue count = pd_dict_get(node, PDA_Count, &succ);
+	assert(IS_INT(count));
+	return count.value.intvalue;
+}
+
+static void pagetree_add_kid(t_pdvalue node, t_pdvalue kid, pdint32 count)
+{
+	pd_array_add(pagetree_kids(node), kid);
+	pd_dict_put(node, PDA_Count, pdintvalue(pagetree_node_count(node) + count));
+}
+
+// Write a node, then free it and release its kids' references.
+// The node's own reference survives, retired, for its parent's /Kids.
+static void pagetree_write_node(t_pdpagetree *tree, t_pdvalue node)
+{
+	pd_write_reference_declaration(tree->stm, node);
+	t_pdarray *kids = pagetree_kids(node);
+	pduint32 i, n = pd_array_count(kids);
+	for (i = 0; i < n; i++) {
+		t_pdvalue kid = pd_array_get(kids, i);
+		pd_write_reference_declaration(tree->stm, kid);
+		pd_reference_release(&kid);
+	}
+	t_pdvalue dict = pd_reference_get_value(node);
+	pd_reference_retire(node);
+	pd_value_free_deep(&dict);
+}
+
+static void pagetree_flush(t_pdpagetree *tree, int level);
+
+// Make sure the open node at level (if any) can take another kid.
+static void pagetree_make_room(t_pdpagetree *tree, int level)
+{
+	t_pdvalue node = tree->levels[level];
+	if (!IS_NULL(node) && pd_array_count(pagetree_kids(node)) >= PD_PAGETREE_FANOUT) {
+		pagetree_flush(tree, level);
+	}
+}
+
+// Close the open node at level: give it a parent, write it out
+// and add it to the parent's kids.
+static void pagetree_flush(t_pdpagetree *tree, int level)
+{
+	t_pdvalue node = tree->levels[level];
+	assert(level + 1 < PAGETREE_MAX_LEVELS);
+	pagetree_make_room(tree, level + 1);
+	t_pdvalue parent = pagetree_node(tree, level + 1);
+	pdint32 count = pagetree_node_count(node);
+	pd_dict_put(node, PDA_Parent, parent);
+	pagetree_write_node(tree, node);
+	pagetree_add_kid(parent, node, count);
+	tree->levels[level] = pdnullvalue();
+}
+
+t_pdpagetree *pd_pagetree_new(t_pdmempool *alloc, t_pdxref *xref, t_pdoutstream *stm, t_pdvalue catalog)
+{
+	pdbool succ;
+	t_pdpagetree *tree = (t_pdpagetree *)pd_alloc(alloc, sizeof(t_pdpagetree));
+	if (tree) {
+		tree->xref = xref;
+		tree->stm = stm;
+		tree->catalog = catalog;
+		// the catalog's (empty) /Pages node is the first leaf node
+		tree->levels[0] = pd_dict_get(catalog, PDA_Pages, &succ);
+		assert(IS_REFERENCE(tree->levels[0]));
+		tree->top = 0;
+	}
+	return tree;
+}
+
+t_pdvalue pd_pagetree_parent(t_pdpagetree *tree)
+{
+	assert(!tree->finished);
+	pagetree_make_room(tree, 0);
+	return pagetree_node(tree, 0);
+}
+
+void pd_pagetree_add_page(t_pdpagetree *tree, t_pdvalue page)
+{
+	pagetree_add_kid(pd_pagetree_parent(tree), page, 1);
+	tree->count++;
+}
+
+pdint32 pd_pagetree_count(t_pdpagetree *tree)
+{
+	return tree ? tree->count : 0;
+}
+
+void pd_pagetree_finish(t_pdpagetree *tree)
+{
+	if (tree && !tree->finished) {
+		int level;
+		// fold the open nodes into their parents, bottom up.
+		// (flushing can grow the tree, so re-check top each time)
+		for (level = 0; level < tree->top; level++) {
+			if (!IS_NULL(tree->levels[level])) {
+				pagetree_flush(tree, level);
+			}
+		}
+		t_pdvalue root = pagetree_node(tree, tree->top);
+		pagetree_write_node(tree, root);
+		pd_dict_put(tree->catalog, PDA_Pages, root);
+		tree->finished = PD_TRUE;
+	}
+}
+
 t_pdvalue pd_contents_new(t_pdmempool *pool, t_pdxref *xref, t_pdcontents_gen *gen)
 {
 	t_pdvalue contents = stream_new(pool, xref, 0, pd_contents_generate, gen);
@@ -12,12 +12,43 @@ extern t_pdvalue pd_catalog_new(t_pdmempool *alloc, t_pdxref *xref);
 extern t_pdvalue pd_info_new(t_pdmempool *alloc, t_pdxref *xref);
 extern t_pdvalue pd_trailer_new(t_pdmempool *alloc, t_pdxref *xref, t_pdvalue catalog, t_pdvalue info);
 t_pdvalue pd_generate_file_id(t_pdmempool *alloc, t_pdvalue info);
+// Make a file /ID array from a 16-byte digest
+extern t_pdvalue pd_file_id_new(t_pdmempool *alloc, const pduint8 *digest);
 
 extern t_pdvalue pd_page_new_simple(t_pdmempool *alloc, t_pdxref *xref, t_pdvalue catalog, double width, double height);
 
 // Append a page to the page catalog
 extern void pd_catalog_add_page(t_pdvalue catalog, t_pdvalue page);
 
+// Balanced page tree, built and written out as pages are added.
+// Each /Pages node holds at most PD_PAGETREE_FANOUT kids, and is written
+// (and freed) as soon as it is full and another page arrives, so only
+// one partly-filled node per tree level is ever held in memory.
+#define PD_PAGETREE_FANOUT 32
+
+typedef struct t_pdpagetree t_pdpagetree;
+
+// Create a page tree for a catalog made by pd_catalog_new.
+// Nodes are written to stm as they fill up.
+extern t_pdpagetree *pd_pagetree_new(t_pdmempool *alloc, t_pdxref *xref, t_pdoutstream *stm, t_pdvalue catalog);
+
+// Return the /Pages node that the next page added will belong to,
+// i.e. the value for the next page's /Parent entry.
+extern t_pdvalue pd_pagetree_parent(t_pdpagetree *tree);
+
+// Append a page to the tree, as a kid of pd_pagetree_parent(tree).
+// The tree takes over the page reference: it is released once the
+// page's parent node has been written, so the page itself must have
+// been written (or be written by then) and its value freed by the caller.
+extern void pd_pagetree_add_page(t_pdpagetree *tree, t_pdvalue page);
+
+// Return the number of pages added to the tree.
+extern pdint32 pd_pagetree_count(t_pdpagetree *tree);
+
+// Write out the remaining nodes and make the root of the tree
+// the /Pages entry of the catalog. Adding pages after this is an error.
+extern void pd_pagetree_finish(t_pdpagetree *tree);
+
 extern t_pdvalue pd_contents_new(t_pdmempool *alloc, t_pdxref *xref, t_pdcontents_gen *gen);
 extern void pd_page_add_image(t_pdvalue page, t_pdatom imageatom, t_pdvalue image);
 
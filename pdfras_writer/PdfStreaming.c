@@ -8,12 +8,28 @@
 #include "PdfStreaming.h"
 #include "PdfString.h"
 #include "PdfXrefTable.h"
+#include "PdfSecurityHandler.h"
+#include "PdfSHA2.h"
+#include "md5.h"
+
+#include <string.h>
+#include <assert.h>
 
 typedef struct t_pdoutstream {
 	fOutputWriter writer;
 	t_pdencrypter *encrypter;
 	void *writercookie;
 	pduint32 pos;
+	int digests;					// PD_DIGEST_ bits: which running digests we keep
+	MD5_CTX md5;
+	t_pdsha256 sha256;
+	char header[32];				// what pd_write_pdf_header wrote, if it fits
+	pduint32 headerlen;
+	pdbool sigreserved;				// write sigref as a signature dictionary
+	pdbool sigwritten;				// ...and it has been, as described by siglayout
+	t_pdvalue sigref;
+	pduint32 sigmax;				// bytes of signature to make room for
+	t_pdsignature_layout siglayout;
     fOutStreamEventHandler eventHandler[PDF_OUTPUT_EVENT_COUNT];
     void* eventCookie[PDF_OUTPUT_EVENT_COUNT];
 } t_pdoutstream;
@@ -57,6 +73,24 @@ void pd_outstream_free(t_pdoutstream *stm)
 	pd_free(stm);			// doesn't mind NULLs
 }
 
+void pd_outstream_restart(t_pdoutstream *stm, void *writercookie)
+{
+	if (stm) {
+		stm->writercookie = writercookie;
+		stm->pos = 0;
+		stm->encrypter = NULL;
+		stm->digests = 0;
+		stm->headerlen = 0;
+		stm->sigreserved = stm->sigwritten = PD_FALSE;
+		stm->sigref = pdnullvalue();
+		pduint32 i;
+		for (i = 0; i < PDF_OUTPUT_EVENT_COUNT; i++) {
+			stm->eventHandler[i] = NULL;
+			stm->eventCookie[i] = NULL;
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Encryption
 
@@ -91,11 +125,81 @@ t_pdstring* pd_encrypt_string(t_pdoutstream *stm, t_pdstring *str)
 	return encstr;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Running digests
+
+static void digest_bytes(t_pdoutstream *stm, const pduint8 *data, pduint32 len)
+{
+	if (stm->digests & PD_DIGEST_MD5) {
+		MD5_Update(&stm->md5, data, len);
+	}
+	if (stm->digests & PD_DIGEST_SHA256) {
+		pd_sha256_update(&stm->sha256, data, len);
+	}
+}
+
+pdbool pd_outstream_set_digests(t_pdoutstream *stm, int digests)
+{
+	if (!stm) {
+		return PD_FALSE;
+	}
+	int starting = digests & ~stm->digests;
+	if (starting) {
+		// a new digest has to see every byte of the stream: possible
+		// at the start, or after just the header, which we kept a copy of.
+		if (stm->pos != 0 && (stm->headerlen == 0 || stm->pos != stm->headerlen)) {
+			return PD_FALSE;
+		}
+		if (starting & PD_DIGEST_MD5) {
+			MD5_Init(&stm->md5);
+		}
+		if (starting & PD_DIGEST_SHA256) {
+			pd_sha256_init(&stm->sha256);
+		}
+		// replay the header into just the new digests
+		int keep = stm->digests;
+		stm->digests = starting;
+		digest_bytes(stm, (const pduint8*)stm->header, stm->pos);
+		stm->digests = keep;
+	}
+	stm->digests = digests;
+	return PD_TRUE;
+}
+
+int pd_outstream_get_digests(t_pdoutstream *stm)
+{
+	return stm ? stm->digests : 0;
+}
+
+pdbool pd_outstream_md5(t_pdoutstream *stm, pduint8 *digest)
+{
+	if (!stm || !(stm->digests & PD_DIGEST_MD5)) {
+		return PD_FALSE;
+	}
+	// finish a copy, so the running digest can keep going
+	MD5_CTX md5 = stm->md5;
+	MD5_Final(digest, &md5);
+	return PD_TRUE;
+}
+
+pdbool pd_outstream_sha256(t_pdoutstream *stm, pduint8 *digest)
+{
+	if (!stm || !(stm->digests & PD_DIGEST_SHA256)) {
+		return PD_FALSE;
+	}
+	t_pdsha256 sha256 = stm->sha256;
+	pd_sha256_final(&sha256, digest);
+	return PD_TRUE;
+}
+
 void pd_putc(t_pdoutstream *stm, char c)
 {
 	if (stm) {
 		pduint8 buf[1];
 		buf[0] = (pduint8)c;
+		if (stm->digests) {
+			digest_bytes(stm, buf, 1);
+		}
 		stm->pos += stm->writer(buf, 0, 1, stm->writercookie);	// data, offset, length, cookie
 	}
 }
@@ -103,6 +207,9 @@ void pd_putc(t_pdoutstream *stm, char c)
 void pd_putn(t_pdoutstream *stm, const void* s, pduint32 offset, pduint32 len)
 {
 	if (stm) {
+		if (stm->digests) {
+			digest_bytes(stm, (const pduint8*)s + offset, len);
+		}
 		stm->pos += stm->writer((pduint8*)s, offset, len, stm->writercookie);
 	}
 }
@@ -129,62 +236,173 @@ void pd_putint(t_pdoutstream *stm, pdint32 i)
 	pd_puts(stm, pditoa(i, num));
 }
 
-void pd_putfloat(t_pdoutstream *stm, pddouble n)
+// exact powers of 10 representable as doubles
+static const double pow10tab[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Format n (> 0, finite) into the end of buf, return start of the text.
+// Values >= 10^18 don't fit the integer path: render them the slow way,
+// digit by digit - they are integral anyway, with noise digits below
+// the 16th or so.
+static char *format_huge(char *end, pddouble n)
+{
+	char *p = end;
+	double w = pow10tab[18];
+	int digits = 19;
+	while (w * 10 <= n) { w *= 10; digits++; }
+	p -= digits;
+	char *q = p;
+	do {
+		int d = (int)floor(n / w);
+		d = (d < 0) ? 0 : (d > 9) ? 9 : d;
+		*q++ = (char)('0' + d);
+		n -= d * w;
+		w /= 10;
+	} while (--digits);
+	return p;
+}
+
+// Relative error bound of n * 10^frac done in steps of 10^22, at most 16 of
+// them for any double, each off by half an ulp or less: 2^-45 leaves room.
+#define NEAR_HALF (1.0 / 35184372088832.0)
+
+// n (> 0) * 10^frac, rounded half up to an integer, rounding only once.
+// Rounding the product to a double first, then that to an integer, can
+// land a digit off: 1.1077289334999999e-05 * 1e14 is 1107728933.4999999 but
+// the nearest double is 1107728933.5.
+// hi + lo is the product, hi the nearest double and lo the rest - fma gives
+// the error of a product exactly. Exact for one step (frac <= 22), to about
+// 2^-100 for the tiny values that take more.
+static pduint64 round_scaled_exact(pddouble n, int frac)
+{
+	double hi = n, lo = 0.0;
+	int k = frac;
+	do {
+		int step = (k > 22) ? 22 : k;
+		double p10 = pow10tab[step];
+		double prod = hi * p10;
+		double err = fma(hi, p10, -prod) + lo * p10;
+		hi = prod + err;
+		lo = err - (hi - prod);
+		k -= step;
+	} while (k > 0);
+	double whole = floor(hi);
+	double below = hi - whole;			// exact, in [0,1)
+	pduint64 m = (pduint64)whole;
+	if (below == 0.0) {
+		// hi is whole, and lo can be a whole number or more (beyond 2^53):
+		// move the whole part of lo into m, leaving the fraction in [0,1]
+		double lowhole = floor(lo);
+		if (lowhole < 0) m -= (pduint64)-lowhole;
+		else m += (pduint64)lowhole;
+		lo -= lowhole;
+	}
+	// round half up on the fraction, below + lo
+	if (below - 0.5 >= -lo) m++;
+	return m;
+}
+
+// Render n right-to-left, ending at end, return the start of the text.
+// There must be room for PD_REAL_MAXLEN chars before end.
+static char *render_real(pddouble n, char *end)
 {
-	// one weakness: with numbers > 10^16, you get noise digits
-	// in the lower digits of the integer part.
+	char *p;
 	if (pdisnan(n)) {
-		pd_puts(stm, "nan");
+		p = end - 3;
+		memcpy(p, "nan", 3);
 	}
 	else if (n == 0.0) {
-		pd_putc(stm, '0');
+		p = end - 1;
+		*p = '0';
 	}
 	else if (pdisinf(n)) {
-		if (n < 0) { pd_putc(stm, '-'); }
-		pd_puts(stm, "inf");
+		p = end - 3;
+		memcpy(p, "inf", 3);
+		if (n < 0) *--p = '-';
 	}
 	else {
-		if (n < 0) {
-			pd_putc(stm, '-');
-			n = -n;
-		}
-		// the least integer that has REAL_PRECISION digits:
-		double nprec = pow(10, REAL_PRECISION-1);
-		int decPt = 1, digits = 1;
-		// compute w, the place-value of the leading digit
-		double w = 1.0;
-		while (w * 10 <= n) { w *= 10; decPt++; digits++; }
-		// if n is fractional, shift it up until we find first non-zero digit:
-		while (n < 1.0) { n *= 10; w *= 10; digits++; }
-		// shift up more digits  from fractional part (if any) to bring
-		// integer part of n to REAL_PRECISION digits:
-		while (n < nprec && floor(n) != n) { n *= 10; w *= 10; digits++; }
-		if (floor(n) != n && decPt == digits) {
-			// would print as integer but isn't an integer,
-			// make sure we print a fractional part to 'suggest' this:
-			n *= 10; w *= 10; digits++;
+		pdbool neg = (n < 0);
+		if (neg) n = -n;
+		if (n >= pow10tab[18]) {
+			p = format_huge(end, n);
 		}
-		// round that last digit to nearest.
-		// Note, no effect if n is exact at this point
-		n = floor(n + 0.5);
-		if (w * 10 <= n) {
-			// whoops, rare case where rounding adds a leading digit 1
-			w *= 10; decPt++; digits++;
+		else {
+			// e = decimal exponent of the leading digit
+			int e = 0;
+			double t = n;
+			if (n < 1.0) {
+				while (t < 1.0) { t *= 10; e--; }
+			}
+			else {
+				while (pow10tab[e + 1] <= n) e++;
+			}
+			// Scale n to an integer m with REAL_PRECISION significant
+			// digits, or if the integer part alone has that many, with
+			// all of it plus one fractional digit when n isn't integral.
+			int frac;				// number of fractional digits in m
+			pdbool integral = (floor(n) == n);
+			if (e + 1 >= REAL_PRECISION) {
+				frac = integral ? 0 : 1;
+			}
+			else {
+				frac = REAL_PRECISION - 1 - e;
+			}
+			double scaled = n;
+			int k = frac;
+			while (k > 22) { scaled *= pow10tab[22]; k -= 22; }
+			scaled *= pow10tab[k];
+			// round to nearest (may carry into a new leading digit)
+			pduint64 m;
+			double below = scaled - floor(scaled);
+			if (fabs(below - 0.5) > scaled * NEAR_HALF) {
+				// scaled is off the product by less than this, so
+				// both round to the same integer
+				m = (pduint64)floor(scaled + 0.5);
+			}
+			else {
+				m = round_scaled_exact(n, frac);
+			}
+			// drop trailing fractional zeros, but keep one
+			// fractional digit to show that n is not an integer
+			int keep = integral ? 0 : 1;
+			while (frac > keep && m % 10 == 0) { m /= 10; frac--; }
+			p = end;
+			if (frac > 0) {
+				int i;
+				for (i = 0; i < frac; i++) {
+					*--p = (char)('0' + (int)(m % 10));
+					m /= 10;
+				}
+				*--p = '.';
+			}
+			do {
+				*--p = (char)('0' + (int)(m % 10));
+				m /= 10;
+			} while (m);
 		}
-		// now, finally, render n as a sequence of digits possibly
-		// including a decimal point
-		// (one weakness: with numbers > 10^16, you may get noise digits
-		// in the lower digits of the integer part.)
-		do {
-			if (decPt-- == 0) pd_putc(stm, '.');
-			int d = (int)floor(n / w);
-			d = (d < 0) ? 0 : (d > 9) ? 9 : d;
-			pd_putc(stm, (char)('0' + d));
-			n -= d * w;
-			if (n == 0 && decPt < 0) break;
-			w /= 10;
-		} while (--digits);
+		if (neg) *--p = '-';
 	}
+	return p;
+}
+
+pduint32 pd_format_real(pddouble n, char *buf)
+{
+	char tmp[PD_REAL_MAXLEN];
+	char *end = tmp + sizeof(tmp);
+	char *p = render_real(n, end);
+	memcpy(buf, p, end - p);
+	return (pduint32)(end - p);
+}
+
+void pd_putfloat(t_pdoutstream *stm, pddouble n)
+{
+	// format into a buffer, then write it out in one go.
+	char tmp[PD_REAL_MAXLEN];
+	char *end = tmp + sizeof(tmp);
+	char *p = render_real(n, end);
+	pd_putn(stm, p, 0, (pduint32)(end - p));
 }
 
 pduint32 pd_outstream_pos(t_pdoutstream *stm)
@@ -235,10 +453,32 @@ static pdbool itemwriter(t_pdatom key, t_pdvalue value, void *cookie)
 static pdbool stm_sink_put(const pduint8 *buffer, pduint32 offset, pduint32 len, void *cookie)
 {
 	t_pdoutstream *outstm = (t_pdoutstream *)cookie;
-	pd_putn(outstm, buffer, offset, len);
+	pd_write_stream_data(outstm, buffer, offset, len);
 	return PD_TRUE;
 }
 
+// bytes of stream data encrypted per write
+#define ENCRYPT_CHUNK 8192
+
+void pd_write_stream_data(t_pdoutstream *stm, const void *data, pduint32 offset, pduint32 len)
+{
+	if (!stm) return;
+	if (!stm->encrypter) {
+		pd_putn(stm, data, offset, len);
+		return;
+	}
+	// encrypt a chunk at a time through a buffer on the stack
+	pduint8 buf[ENCRYPT_CHUNK + PD_ENCRYPT_SLACK];
+	const pduint8 *p = (const pduint8 *)data + offset;
+	while (len) {
+		pduint32 n = len < ENCRYPT_CHUNK ? len : ENCRYPT_CHUNK;
+		pduint32 m = pd_encrypt_stream_data(stm->encrypter, buf, p, n);
+		pd_putn(stm, buf, 0, m);
+		p += n;
+		len -= n;
+	}
+}
+
 void stm_sink_free(void *cookie)
 {
 	(void)cookie;
@@ -259,39 +499,69 @@ static void stream_resolve_length(t_pdvalue stream, pduint32 len)
 	}
 }
 
-static void writestreambody(t_pdoutstream *os, t_pdvalue dict)
+// Write the 'stream' keyword that starts stream data,
+// return the position of the first byte of data.
+static pduint32 beginstreambody(t_pdoutstream *os)
+{
+	pd_puts(os, "\r\nstream\r\n");
+	pduint32 startpos = pd_outstream_pos(os);
+	if (pd_stream_is_encrypted(os)) {
+		pduint8 buf[PD_ENCRYPT_SLACK];
+		pd_putn(os, buf, 0, pd_encrypt_stream_begin(os->encrypter, buf));
+	}
+	return startpos;
+}
+
+// Write the 'endstream' keyword after stream data that started at startpos
+static void endstreambody(t_pdoutstream *os, t_pdvalue dict, pduint32 startpos)
 {
-	// TODO: if stream has encryption,
-	// encrypt stream body before/during output.
-	// After any filters.
+	if (pd_stream_is_encrypted(os)) {
+		pduint8 buf[PD_ENCRYPT_SLACK];
+		pd_putn(os, buf, 0, pd_encrypt_stream_end(os->encrypter, buf));
+	}
+	pduint32 finalpos = pd_outstream_pos(os);
+	// write the ending keyword after the stream data.
+	pd_puts(os, "\r\nendstream\r\n");
+	// If there's an indirect /Length entry in the Stream dictionary, resolve it
+	stream_resolve_length(dict, finalpos - startpos);
+}
 
+static void writestreambody(t_pdoutstream *os, t_pdvalue dict)
+{
 	// create a datasink wrapper around the Stream and the outstream
 	t_datasink *sink = stream_datasink_new(os);
 	if (sink) {
-		pd_puts(os, "\r\nstream\r\n");
         // record start of stream data
-        pduint32 startpos = pd_outstream_pos(os);
+		pduint32 startpos = beginstreambody(os);
         // Call the Stream's content generator to write its contents
 		// to the sink (which writes it to the outstream):
 		stream_write_data(dict, sink);
-		pduint32 finalpos = pd_outstream_pos(os);
-		// write the ending keyword after the stream data.
-		pd_puts(os, "\r\nendstream\r\n");
-		// If there's an indirect /Length entry in the Stream dictionary, resolve it
-		stream_resolve_length(dict, finalpos - startpos);
+		endstreambody(os, dict, startpos);
 		pd_datasink_free(sink);
 	}
 }
 
+// Write just the dictionary part of a dict (or stream)
+static void writedictentries(t_pdoutstream *os, t_pdvalue dict)
+{
+	if (pd_stream_is_encrypted(os) && pd_dict_is_stream(dict)) {
+		// A /Length given in advance is the length before encryption
+		pdbool succ;
+		t_pdvalue len = pd_dict_get(dict, PDA_Length, &succ);
+		if (succ && IS_INT(len)) {
+			pd_dict_put(dict, PDA_Length, pdintvalue(pd_encrypted_size(os->encrypter, len.value.intvalue)));
+		}
+	}
+	pd_puts(os, "<<");
+	pd_dict_foreach(dict, itemwriter, os);
+	// close the dictionary
+	pd_puts(os, " >>");
+}
+
 static void writedict(t_pdoutstream *os, t_pdvalue dict)
 {
-	// TODO: tricky: don't encrypt the /Encrypt dictionary.
-	// How? Put an encryption-suppression flag on the dictionary?
 	if (IS_DICT(dict)) {
-		pd_puts(os, "<<");
-		pd_dict_foreach(dict, itemwriter, os);
-		// close the dictionary
-		pd_puts(os, " >>");
+		writedictentries(os, dict);
 		// If it's also a stream, append the stream<data>endstream
 		if (pd_dict_is_stream(dict))
 		{
@@ -363,7 +633,7 @@ static void writestring(t_pdoutstream *stm, t_pdstring *str)
 {
 	// If stream has encryption,
 	// encrypt string contents before writing.
-	// EXCEPT... the strings in the file /ID are never encrypted.
+	// (Except in the trailer, see pd_write_endofdocument)
 	if (pd_stream_is_encrypted(stm)) {
 		// encrypt the string and write it
 		t_pdstring* encstr = pd_encrypt_string(stm, str);
@@ -425,6 +695,34 @@ void pd_write_reference_declaration(t_pdoutstream *stm, t_pdvalue ref)
 	}
 }
 
+pduint32 pd_write_stream_begin(t_pdoutstream *stm, t_pdvalue ref)
+{
+	pduint32 startpos = 0;
+	if (stm && IS_REFERENCE(ref) && !pd_reference_is_written(ref)) {
+		t_pdvalue stream = pd_reference_get_value(ref);
+		assert(pd_dict_is_stream(stream));
+		pduint32 onr = pd_reference_object_number(ref);
+		pd_reference_set_position(ref, pd_outstream_pos(stm));
+		pd_putint(stm, onr);
+		pd_puts(stm, " 0 obj\n");
+		if (pd_stream_is_encrypted(stm)) {
+			pd_encrypt_start_object(stm->encrypter, onr, 0);
+		}
+		writedictentries(stm, stream);
+		startpos = beginstreambody(stm);
+	}
+	return startpos;
+}
+
+void pd_write_stream_end(t_pdoutstream *stm, t_pdvalue ref, pduint32 startpos)
+{
+	if (stm && IS_REFERENCE(ref) && !pd_reference_is_written(ref)) {
+		endstreambody(stm, pd_reference_get_value(ref), startpos);
+		pd_puts(stm, "\nendobj\n");
+		pd_reference_mark_written(ref);
+	}
+}
+
 void pd_write_pdf_header(t_pdoutstream *stm, char *version)
 {
     // the conventional 2nd line comment that marks the
@@ -433,6 +731,17 @@ void pd_write_pdf_header(t_pdoutstream *stm, char *version)
 	pd_puts(stm, version);
 	pd_putc(stm, '\n');
 	pd_puts(stm, "%\xE2\xE3\xCF\xD3\n");
+	if (stm) {
+		// keep a copy, so a digest can be started after the header
+		pduint32 vlen = version ? pdstrlen(version) : 0;
+		pduint32 len = 5 + vlen + 7;
+		if (stm->pos == len && len <= sizeof stm->header) {
+			memcpy(stm->header, "%PDF-", 5);
+			memcpy(stm->header + 5, version, vlen);
+			memcpy(stm->header + 5 + vlen, "\n%\xE2\xE3\xCF\xD3\n", 7);
+			stm->headerlen = len;
+		}
+	}
 }
 
 static pdbool freeTrailerEntry(t_pdatom atom, t_pdvalue value, void *cookie)
@@ -442,6 +751,127 @@ static pdbool freeTrailerEntry(t_pdatom atom, t_pdvalue value, void *cookie)
 	return PD_TRUE;
 }
 
+// Write the XREF table and the trailer, ending the document.
+static void write_xref_and_trailer(t_pdoutstream *stm, t_pdxref *xref, t_pdvalue trailer)
+{
+	pd_outstream_fire_event(stm, PDF_EVENT_BEFORE_XREF);
+	// note the position of the XREF table
+	pduint32 pos = pd_outstream_pos(stm);
+	// write the XREF table
+	pd_xref_writetable(xref, stm);
+	// write the trailer dictionary
+	pd_outstream_fire_event(stm, PDF_EVENT_BEFORE_TRAILER);
+	pd_puts(stm, "trailer\n");
+	// nothing in the trailer is encrypted:
+	// not the /ID strings, nor the /Encrypt dictionary.
+	t_pdencrypter *encrypter = stm->encrypter;
+	stm->encrypter = NULL;
+	pd_write_value(stm, trailer);
+	stm->encrypter = encrypter;
+	// write the EOF sequence, including pointer to XREF table
+	pd_putc(stm, '\n');
+	pd_outstream_fire_event(stm, PDF_EVENT_BEFORE_STARTXREF);
+	pd_puts(stm, "startxref\n");
+	pd_putint(stm, pos);
+	pd_puts(stm, "\n%%EOF\n");
+	// that's the last byte of output!
+}
+
+///////////////////////////////////////////////////////////////////////
+// Signatures
+
+// /ByteRange numbers are written this wide, so the positions of
+// everything after them are known before they are.
+#define SIG_NUMWIDTH 10
+
+void pd_outstream_reserve_signature(t_pdoutstream *stm, t_pdvalue ref, pduint32 maxlen)
+{
+	if (stm && IS_REFERENCE(ref)) {
+		stm->sigreserved = PD_TRUE;
+		stm->sigwritten = PD_FALSE;
+		stm->sigref = ref;
+		stm->sigmax = maxlen;
+		// keep it out of pd_xref_writeallpendingreferences:
+		// pd_write_endofdocument writes it.
+		pd_reference_mark_written(ref);
+	}
+}
+
+pdbool pd_outstream_get_signature(t_pdoutstream *stm, t_pdsignature_layout *layout)
+{
+	if (!stm || !stm->sigwritten) {
+		return PD_FALSE;
+	}
+	*layout = stm->siglayout;
+	return PD_TRUE;
+}
+
+static int count_bytes(const pduint8 *data, pduint32 offset, pduint32 len, void *cookie)
+{
+	(void)data; (void)offset; (void)cookie;
+	return len;
+}
+
+static void put_padded(t_pdoutstream *stm, pduint32 n)
+{
+	char num[12];
+	pditoa((pdint32)n, num);
+	pduint32 len = pdstrlen(num);
+	while (len++ < SIG_NUMWIDTH) {
+		pd_putc(stm, ' ');
+	}
+	pd_puts(stm, num);
+}
+
+static void write_signature(t_pdoutstream *stm, t_pdxref *xref, t_pdvalue trailer)
+{
+	static const char zeros[64] = "0000000000000000000000000000000000000000000000000000000000000000";
+	t_pdsignature_layout *sig = &stm->siglayout;
+	t_pdvalue ref = stm->sigref;
+	pduint32 onr = pd_reference_object_number(ref);
+	pd_reference_set_position(ref, pd_outstream_pos(stm));
+	pd_putint(stm, onr);
+	pd_puts(stm, " 0 obj\n");
+	if (pd_stream_is_encrypted(stm)) {
+		pd_encrypt_start_object(stm->encrypter, onr, 0);
+	}
+	pd_puts(stm, "<<");
+	pd_dict_foreach(pd_reference_get_value(ref), itemwriter, stm);
+	// " /ByteRange [0 a b c] /Contents <00...0> >>\nendobj\n"
+	// where a is the position of the '<' and b is just after the '>'
+	pduint32 a = pd_outstream_pos(stm) + 15 + 3 * SIG_NUMWIDTH + 2 + 12;
+	sig->contents_pos = a + 1;
+	sig->contents_len = 2 * stm->sigmax;
+	pduint32 b = a + 2 + sig->contents_len;
+	// measure the rest of the file, by writing it to nowhere
+	t_pdoutstream counter = *stm;
+	counter.writer = count_bytes;
+	counter.encrypter = NULL;
+	counter.digests = 0;
+	counter.pos = b + 11;
+	write_xref_and_trailer(&counter, xref, trailer);
+	sig->byterange[0] = 0;
+	sig->byterange[1] = a;
+	sig->byterange[2] = b;
+	sig->byterange[3] = pd_outstream_pos(&counter) - b;
+
+	pd_puts(stm, " /ByteRange [0 ");
+	put_padded(stm, sig->byterange[1]);
+	pd_putc(stm, ' ');
+	put_padded(stm, sig->byterange[2]);
+	pd_putc(stm, ' ');
+	put_padded(stm, sig->byterange[3]);
+	pd_puts(stm, "] /Contents <");
+	assert(pd_outstream_pos(stm) == sig->contents_pos);
+	pduint32 n;
+	for (n = sig->contents_len; n > sizeof zeros; n -= sizeof zeros) {
+		pd_putn(stm, zeros, 0, sizeof zeros);
+	}
+	pd_putn(stm, zeros, 0, n);
+	pd_puts(stm, "> >>\nendobj\n");
+	stm->sigwritten = PD_TRUE;
+}
+
 void pd_write_endofdocument(t_pdoutstream *stm, t_pdxref *xref, t_pdvalue catalog, t_pdvalue info, t_pdvalue caller_trailer)
 {
 	if (stm) {
@@ -452,28 +882,19 @@ void pd_write_endofdocument(t_pdoutstream *stm, t_pdxref *xref, t_pdvalue catalo
 			// create the trailer now
 			trailer = pd_trailer_new(pool, xref, catalog, info);
 		}
-		// drop the File ID into the trailer dictionary:
-		t_pdvalue file_id = pd_generate_file_id(pool, info);
+		pd_xref_writeallpendingreferences(xref, stm);
+		// drop the File ID into the trailer dictionary. From the MD5 of
+		// all the objects, if we have it, so different files get different IDs.
+		pduint8 digest[16];
+		t_pdvalue file_id = pd_outstream_md5(stm, digest) ?
+			pd_file_id_new(pool, digest) : pd_generate_file_id(pool, info);
 		// finally, stuff that 'ID' entry into the trailer
 		pd_dict_put(trailer, PDA_ID, file_id);
-
-		pd_xref_writeallpendingreferences(xref, stm);
-        pd_outstream_fire_event(stm, PDF_EVENT_BEFORE_XREF);
-		// note the position of the XREF table
-		pduint32 pos = pd_outstream_pos(stm);
-		// write the XREF table
-		pd_xref_writetable(xref, stm);
-		// write the trailer dictionary
-        pd_outstream_fire_event(stm, PDF_EVENT_BEFORE_TRAILER);
-        pd_puts(stm, "trailer\n");
-		pd_write_value(stm, trailer);
-		// write the EOF sequence, including pointer to XREF table
-		pd_putc(stm, '\n');
-        pd_outstream_fire_event(stm, PDF_EVENT_BEFORE_STARTXREF);
-		pd_puts(stm, "startxref\n");
-		pd_putint(stm, pos);
-		pd_puts(stm, "\n%%EOF\n");
-		// that's the last byte of output!
+		// a signature dictionary goes last, so it can say where the file ends
+		if (stm->sigreserved) {
+			write_signature(stm, xref, trailer);
+		}
+		write_xref_and_trailer(stm, xref, trailer);
 
 		// free the stuff that only we know about
 		// namely the file-id array in the trailer dict
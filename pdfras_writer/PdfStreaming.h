@@ -39,12 +39,57 @@ extern t_pdoutstream *pd_outstream_new(t_pdmempool *allocsys, t_OS *os);
 // Destroy a PDF output stream
 extern void pd_outstream_free(t_pdoutstream *stm);
 
+// Start a PDF output stream over, as if newly created, but writing
+// through the same writer with a new writer cookie.
+// Position goes back to 0, the encrypter, digests, signature and event handlers are dropped.
+extern void pd_outstream_restart(t_pdoutstream *stm, void *writercookie);
+
 // Attach an 'encrypter' to this stream.
 // By default this enables encryption of the PDF written thru this stream.
 extern void pd_outstream_set_encrypter(t_pdoutstream *stm, t_pdencrypter *crypt);
 
 // Return the encrypter currently associated with a stream - or NULL if none.
-extern t_pdencrypter* p_outstream_get_encrypter(t_pdoutstream *stm);
+extern t_pdencrypter* pd_outstream_get_encrypter(t_pdoutstream *stm);
+
+// Running digests a stream can keep of every byte written through it
+#define PD_DIGEST_MD5		1
+#define PD_DIGEST_SHA256	2
+
+// Choose which running digests (PD_DIGEST_ bits, 0 for none) a stream keeps.
+// A digest that is turned on starts from the beginning of the stream, so this
+// fails (returns PD_FALSE) if anything but the PDF header has been written.
+// Turning digests off always works.
+extern pdbool pd_outstream_set_digests(t_pdoutstream *stm, int digests);
+
+// Return the PD_DIGEST_ bits of the digests a stream is keeping.
+extern int pd_outstream_get_digests(t_pdoutstream *stm);
+
+// Get the MD5 (16 bytes) or SHA-256 (32 bytes) digest of everything
+// written to a stream so far. Writing can carry on afterwards.
+// Returns PD_FALSE, and stores nothing, if the stream isn't keeping that digest.
+extern pdbool pd_outstream_md5(t_pdoutstream *stm, pduint8 *digest);
+extern pdbool pd_outstream_sha256(t_pdoutstream *stm, pduint8 *digest);
+
+// Where a signature reserved with pd_outstream_reserve_signature was written
+typedef struct {
+	pduint32 byterange[4];		// /ByteRange: offset & length of the signed bytes before and after /Contents
+	pduint32 contents_pos;		// file position of the first hex digit of /Contents
+	pduint32 contents_len;		// number of hex digits reserved for the signature
+} t_pdsignature_layout;
+
+// Have pd_write_endofdocument write the indirect object ref (a dictionary)
+// as a signature dictionary, as the last object before the xref table: the
+// dictionary's own entries, then a /ByteRange covering the whole file except
+// the /Contents string, and a /Contents string of 2*maxlen '0' hex digits,
+// room for a detached signature of up to maxlen bytes to be written over.
+// Neither of those two entries is encrypted.
+// To fill in /ByteRange, the end of the document is written twice, the first
+// time just to measure it, so event handlers must give the same output each time.
+extern void pd_outstream_reserve_signature(t_pdoutstream *stm, t_pdvalue ref, pduint32 maxlen);
+
+// Once pd_write_endofdocument has written it, get the layout of the reserved
+// signature. Returns PD_FALSE if there isn't one (yet).
+extern pdbool pd_outstream_get_signature(t_pdoutstream *stm, t_pdsignature_layout *layout);
 
 // Write one character to a stream.
 extern void pd_putc(t_pdoutstream *stm, char c);
@@ -81,6 +126,14 @@ extern void pd_putint(t_pdoutstream *stm, pdint32 i);
 // Given an infinity, writes "inf", with a leading minus-sign if negative.
 extern void pd_putfloat(t_pdoutstream *stm, pddouble f);
 
+// Longest text pd_format_real can produce (for any double)
+#define PD_REAL_MAXLEN 352
+
+// Format a floating-point number exactly as pd_putfloat would write it.
+// buf must have room for PD_REAL_MAXLEN chars. No trailing 0 is stored.
+// Returns the number of chars stored.
+extern pduint32 pd_format_real(pddouble f, char *buf);
+
 // Return the current offset (position) in the stream.
 // (Number of bytes written to the stream since it was created.)
 extern pduint32 pd_outstream_pos(t_pdoutstream *stm);
@@ -92,11 +145,27 @@ extern void pd_write_value(t_pdoutstream *stm, t_pdvalue value);
 // If ref is not an indirect object OR has already been written, does nothing.
 extern void pd_write_reference_declaration(t_pdoutstream *stm, t_pdvalue ref);
 
+// Write an indirect stream object in pieces, for stream data that isn't
+// all available at once. pd_write_stream_begin writes everything up to
+// and including the 'stream' keyword, and returns the position where
+// the stream data starts. Then write the data with pd_write_stream_data, and
+// finish with pd_write_stream_end, passing that position.
+// The stream's /Length must be an (unwritten) forward reference, it is
+// resolved by pd_write_stream_end. Any data-ready callback is not used.
+extern pduint32 pd_write_stream_begin(t_pdoutstream *stm, t_pdvalue ref);
+extern void pd_write_stream_end(t_pdoutstream *stm, t_pdvalue ref, pduint32 startpos);
+
+// Write stream data (between 'stream' and 'endstream'), encrypting it
+// if the output is encrypted.
+extern void pd_write_stream_data(t_pdoutstream *stm, const void *data, pduint32 offset, pduint32 len);
+
 // Write the PDF header to the stream.
 // version is a string with the header version e.g. "1.4".
 extern void pd_write_pdf_header(t_pdoutstream *stm, char *version);
 
 // Write all the stuff that goes at the end of a PDF, to a stream.
+// If the stream is keeping an MD5 digest, the file /ID is the MD5 of
+// everything up to the xref table, otherwise it's an MD5 of the Info strings.
 extern void pd_write_endofdocument(t_pdoutstream *stm,
 	t_pdxref *xref,
 	t_pdvalue catalog,
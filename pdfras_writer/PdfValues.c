@@ -115,4 +115,44 @@ void pd_value_free(t_pdvalue *v)
 		}
 		*v = pdnullvalue();
 	}
+}
+
+static pdbool free_dict_entry(t_pdatom key, t_pdvalue value, void *cookie)
+{
+	(void)key; (void)cookie;
+	pd_value_free_deep(&value);
+	return PD_TRUE;
+}
+
+static pdbool free_array_entry(t_pdarray *arr, pduint32 index, t_pdvalue value, void *cookie)
+{
+	(void)arr; (void)index; (void)cookie;
+	pd_value_free_deep(&value);
+	return PD_TRUE;
+}
+
+void pd_value_free_deep(t_pdvalue *v)
+{
+	if (v) {
+		switch (v->pdtype) {
+		case TPDDICT:
+			pd_dict_foreach(*v, free_dict_entry, NULL);
+			if (pd_dict_is_stream(*v)) {
+				stream_free(*v);
+			}
+			else {
+				pd_dict_free(*v);
+			}
+			break;
+		case TPDARRAY:
+			pd_array_foreach(v->value.arrvalue, free_array_entry, NULL);
+			pd_array_free(v->value.arrvalue);
+			break;
+		default:
+			// strings, and values that don't own any storage
+			pd_value_free(v);
+			break;
+		}
+		*v = pdnullvalue();
+	}
 }
\ No newline at end of file
@@ -96,6 +96,12 @@ extern int pd_value_eq(t_pdvalue a, t_pdvalue b);
 // to the same underlying dict, stream, array or string.
 extern void pd_value_free(t_pdvalue *v);
 
+// Free a value along with every dict, stream, array and string
+// nested directly inside it. Indirect references are not followed.
+// Sets the value *v to pdnullvalue().
+// Only safe to use if nothing nested in *v is shared.
+extern void pd_value_free_deep(t_pdvalue *v);
+
 #ifdef __cplusplus
 }
 #endif
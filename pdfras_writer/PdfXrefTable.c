@@ -1,13 +1,24 @@
 #include "PdfXrefTable.h"
 #include "PdfString.h"
+#include <string.h>
 
 typedef struct t_pdreference {
 	pdint16 isWritten;
-	pdint16 objectNumber;
-	pduint32 pos;
+	pdint16 isRetired;
+	pduint32 objectNumber;
 	t_pdvalue value;
+	struct t_pdxref *xref;					// table this object is registered in
+	struct t_pdreference *prev, *next;		// links in the table's list of live objects
 } t_pdreference;
 
+typedef struct t_pdxref
+{
+	pduint32 nextObjectNumber;
+	t_pdreference *first, *last;			// live (not retired) indirect objects
+	pduint32 *offsets;						// file position of each object, indexed by object number - 1
+	pduint32 capacity;						// number of entries allocated in offsets
+} t_pdxref;
+
 pduint32 pd_reference_object_number(t_pdvalue ref)
 {
 	if (IS_REFERENCE(ref)) {
@@ -70,7 +81,8 @@ void pd_reference_resolve(t_pdvalue ref, t_pdvalue value)
 pduint32 pd_reference_get_position(t_pdvalue ref)
 {
 	if (IS_REFERENCE(ref)) {
-		return ref.value.refvalue->pos;
+		t_pdreference *pr = ref.value.refvalue;
+		return pr->xref->offsets[pr->objectNumber - 1];
 	}
 	else {
 		return 0; /* TODO FAIL */
@@ -80,24 +92,42 @@ pduint32 pd_reference_get_position(t_pdvalue ref)
 void pd_reference_set_position(t_pdvalue ref, pduint32 pos)
 {
 	if (IS_REFERENCE(ref)) {
-		ref.value.refvalue->pos = pos;
+		t_pdreference *pr = ref.value.refvalue;
+		pr->xref->offsets[pr->objectNumber - 1] = pos;
 	}
 	else {
 		// fail
 	}
 }
 
+void pd_reference_retire(t_pdvalue ref)
+{
+	if (IS_REFERENCE(ref)) {
+		t_pdreference *pr = ref.value.refvalue;
+		if (!pr->isRetired) {
+			t_pdxref *xref = pr->xref;
+			// unlink from the list of live objects
+			if (pr->prev) pr->prev->next = pr->next;
+			else xref->first = pr->next;
+			if (pr->next) pr->next->prev = pr->prev;
+			else xref->last = pr->prev;
+			pr->prev = pr->next = NULL;
+			pr->isRetired = 1;
+		}
+		// the value belongs to the caller now.
+		pr->value = pdnullvalue();
+	}
+}
 
-typedef struct t_xr {
-	t_pdreference *reference;
-	struct t_xr *next;
-} t_xr;
-
-typedef struct t_pdxref
+void pd_reference_release(t_pdvalue *ref)
 {
-	pduint32 nextObjectNumber;
-	t_xr *first, *last;
-} t_pdxref;
+	if (ref && IS_REFERENCE(*ref)) {
+		pd_reference_retire(*ref);
+		pd_free(ref->value.refvalue);
+		*ref = pdnullvalue();
+	}
+}
+
 
 t_pdxref *pd_xref_new(t_pdmempool *alloc)
 {
@@ -110,18 +140,16 @@ t_pdxref *pd_xref_new(t_pdmempool *alloc)
 
 void pd_xref_free(t_pdxref *xref)
 {
-	t_xr *walker, *next;
+	t_pdreference *walker, *next;
 	if (!xref) return;
 	walker = xref->first;
 	while (walker)
 	{
 		next = walker->next;
-		if (walker->reference) {
-			pd_free(walker->reference);
-		}
 		pd_free(walker);
 		walker = next;
 	}
+	pd_free(xref->offsets);
 	pd_free(xref);
 }
 
@@ -153,45 +181,56 @@ static pdbool __pd_reference_match(t_pdreference *ref, t_pdvalue value)
 }
 
 // Look for a value in an XREF table.
-// Returns a pointer to the XREF entry, if found, otherwise NULL.
+// Returns a pointer to the reference, if found, otherwise NULL.
 // Uses match to decide if any existing entry matches the value.
-static t_xr *findmatch(t_pdxref *xref, t_pdvalue value)
+// Only live objects are considered - a retired object has no value.
+static t_pdreference *findmatch(t_pdxref *xref, t_pdvalue value)
 {
-	t_xr *walker;
+	t_pdreference *walker;
 	for (walker = xref->first; walker; walker = walker->next)
 	{
-		if (__pd_reference_match(walker->reference, value)) {
+		if (__pd_reference_match(walker, value)) {
 			return walker;
 		}
 	}
 	return 0;
 }
 
-// Add a new indirect object into an XREF table and return the xref entry.
-static t_xr *add_reference(t_pdxref *xref, t_pdvalue value)
+// Add a new indirect object into an XREF table and return its reference.
+static t_pdreference *add_reference(t_pdxref *xref, t_pdvalue value)
 {
 	if (xref) {
-		// create XREF table entry
-		t_xr *xr = (t_xr *)pd_alloc_same_pool(xref, sizeof(t_xr));
-		if (xr) {
-			// create reference object
-			xr->reference = (t_pdreference *)pd_alloc_same_pool(xref, sizeof(t_pdreference));
-			if (xr->reference) {
-				// referenced value:
-				xr->reference->value = value;
-				// indirect object number
-				xr->reference->objectNumber = (pdint16)(xref->nextObjectNumber++);
-				// append to XREF table 
-				if (!xref->first) {
-					xref->first = xref->last = xr;
-				}
-				else {
-					xref->last->next = xr;
-					xref->last = xr;
-				}
-				return xr;
+		pduint32 index = xref->nextObjectNumber - 1;
+		if (index >= xref->capacity) {
+			// grow the table of object positions
+			pduint32 newcap = xref->capacity ? xref->capacity * 2 : 64;
+			pduint32 *offsets = (pduint32 *)pd_alloc_same_pool(xref, newcap * sizeof(pduint32));
+			if (!offsets) return NULL;
+			if (xref->offsets) {
+				memcpy(offsets, xref->offsets, xref->capacity * sizeof(pduint32));
+				pd_free(xref->offsets);
 			}
-			pd_free(xr);
+			xref->offsets = offsets;
+			xref->capacity = newcap;
+		}
+		// create reference object
+		t_pdreference *reference = (t_pdreference *)pd_alloc_same_pool(xref, sizeof(t_pdreference));
+		if (reference) {
+			// referenced value:
+			reference->value = value;
+			reference->xref = xref;
+			// indirect object number
+			reference->objectNumber = xref->nextObjectNumber++;
+			// append to the list of live objects
+			reference->prev = xref->last;
+			if (!xref->first) {
+				xref->first = reference;
+			}
+			else {
+				xref->last->next = reference;
+			}
+			xref->last = reference;
+			return reference;
 		}
 	}
 	return NULL;
@@ -200,10 +239,10 @@ static t_xr *add_reference(t_pdxref *xref, t_pdvalue value)
 t_pdvalue pd_xref_create_forward_reference(t_pdxref *xref)
 {
 	if (xref) {
-		t_xr *xr = add_reference(xref, pdnullvalue());
-		if (xr) {
+		t_pdreference *reference = add_reference(xref, pdnullvalue());
+		if (reference) {
 			t_pdvalue ref = { TPDREFERENCE };
-			ref.value.refvalue = xr->reference;
+			ref.value.refvalue = reference;
 			return ref;
 		}
 	}
@@ -219,14 +258,14 @@ t_pdvalue pd_xref_makereference(t_pdxref *xref, t_pdvalue value)
 	if (xref) {
 		// Is it in the XREF table already?
 		// (technically, is there a matching entry in the table already?)
-		t_xr *xr = findmatch(xref, value);
-		if (!xr) {
+		t_pdreference *reference = findmatch(xref, value);
+		if (!reference) {
 			// No reference to this value, create a reference
-			xr = add_reference(xref, value);
+			reference = add_reference(xref, value);
 		}
-		if (xr) {
+		if (reference) {
 			t_pdvalue ref = { TPDREFERENCE };
-			ref.value.refvalue = xr->reference;
+			ref.value.refvalue = reference;
 			return ref;
 		}
 	}
@@ -235,15 +274,7 @@ t_pdvalue pd_xref_makereference(t_pdxref *xref, t_pdvalue value)
 
 static int xref_size(t_pdxref *xref)
 {
-	int i = 0;
-	if (xref) {
-		t_xr *walker;
-		for (walker = xref->first; walker; walker = walker->next)
-		{
-			i++;
-		}
-	}
-	return i;
+	return xref ? (int)(xref->nextObjectNumber - 1) : 0;
 }
 
 static void write_entry(t_pdoutstream *os, pduint32 pos, char *gen, char status)
@@ -267,11 +298,11 @@ static void write_entry(t_pdoutstream *os, pduint32 pos, char *gen, char status)
 void pd_xref_writeallpendingreferences(t_pdxref *xref, t_pdoutstream *os)
 {
 	if (xref && os) {
-		t_xr *walker;
+		t_pdreference *walker;
 		for (walker = xref->first; walker; walker = walker->next)
 		{
 			t_pdvalue ref = { TPDREFERENCE };
-			ref.value.refvalue = walker->reference;
+			ref.value.refvalue = walker;
 			pd_write_reference_declaration(os, ref);
 		}
 	}
@@ -281,16 +312,16 @@ void pd_xref_writetable(t_pdxref *xref, t_pdoutstream *stm)
 {
 	if (xref && stm) {
 		int size = xref_size(xref);
-		t_xr *walker;
+		int i;
 		pd_puts(stm, "xref\n");
 		pd_putint(stm, 0);
 		pd_putc(stm, ' ');
 		pd_putint(stm, size + 1);
 		pd_putc(stm, '\n');
 		write_entry(stm, 0, "65535", 'f');
-		for (walker = xref->first; walker; walker = walker->next)
+		for (i = 0; i < size; i++)
 		{
-			write_entry(stm, walker->reference->pos, "00000", 'n');
+			write_entry(stm, xref->offsets[i], "00000", 'n');
 		}
 	}
 }
@@ -35,6 +35,17 @@ extern pduint32 pd_reference_get_position(t_pdvalue ref);
 // Record the file position of (the definition of) an indirect object.
 extern void pd_reference_set_position(t_pdvalue ref, pduint32 pos);
 
+// Retire an indirect object that has been written.
+// Its object number and file position stay in the XREF table, and
+// ref remains valid for writing as 'n 0 R', but the object is dropped
+// from the table's working set and its value is forgotten - freeing
+// that value is up to the caller.
+extern void pd_reference_retire(t_pdvalue ref);
+
+// Retire a written indirect object and free the reference itself.
+// Sets *ref to null. Only safe if nothing else still holds the reference.
+extern void pd_reference_release(t_pdvalue *ref);
+
 ///////////////////////////////////////////////////////////////////////
 // XREF tables
 
@@ -20,6 +20,9 @@
 #include "PdfXrefTable.h"
 #include "PdfStandardAtoms.h"
 #include "PdfStandardObjects.h"
+#include "PdfAES.h"
+#include "PdfSHA2.h"
+#include "PdfSecurityHandler.h"
 
 // auxiliary module with high-level (PDF/raster-specific) tests
 #include "pdfraster_tests.h"
@@ -170,6 +173,171 @@ void test_alloc()
 	ASSERT(pd_get_bytes_in_use(pool) == 0);
 }
 
+void test_arena_alloc()
+{
+	printf("arena allocation pool\n");
+	ASSERT(!pd_is_arena_pool(os.allocsys));
+	ASSERT(!pd_is_arena_pool(NULL));
+	// small slabs, so we cross lots of slab boundaries
+	t_pdmempool* pool = pd_alloc_new_arena_pool(&os, 4096);
+	ASSERT(pool);
+	ASSERT(pd_is_arena_pool(pool));
+	ASSERT(pd_get_block_count(pool) == 0);
+	ASSERT(pd_get_bytes_in_use(pool) == 0);
+
+	// same drill as test_alloc: a mix of slab-sized and platform-sized blocks
+	size_t bytes = 0;
+	static void* ptr[ALLOCS];
+	int i;
+	for (i = 0; i < ALLOCS; i++) {
+		size_t nb = i % 1000, j;
+		char* block = (char*)pd_alloc(pool, nb);
+		ASSERT(block != NULL);
+		bytes += nb;
+		for (j = 0; j < nb; j++) {
+			ASSERT(block[j] == 0);
+		}
+		ASSERT(pd_get_block_size(block) == nb);
+		ASSERT(pd_get_pool(block) == pool);
+		memset(block, 0xFF, nb);
+		ptr[i] = block;
+	}
+	ASSERT(pd_get_block_count(pool) == ALLOCS);
+	ASSERT(pd_get_bytes_in_use(pool) == bytes);
+
+	// free every other block
+	int blocks = ALLOCS;
+	for (i = 0; i < ALLOCS; i += 2) {
+		size_t nb = pd_get_block_size(ptr[i]);
+		pd_free(ptr[i]); bytes -= nb; blocks--;
+		ASSERT(pd_get_block_count(pool) == blocks);
+		ASSERT(pd_get_bytes_in_use(pool) == bytes);
+	}
+	// freed small blocks are recycled, and come back zeroed
+	void *small = pd_alloc(pool, 20);
+	ASSERT(small != NULL);
+	{
+		int recycled = 0;
+		for (i = 0; i < ALLOCS; i += 2) {
+			if (ptr[i] == small) recycled = 1;
+		}
+		ASSERT(recycled);
+	}
+	ASSERT(((char*)small)[0] == 0 && ((char*)small)[19] == 0);
+	ASSERT(pd_get_block_size(small) == 20);
+	pd_free(small);
+	// the survivors were not disturbed
+	for (i = 1; i < ALLOCS; i += 2) {
+		size_t nb = pd_get_block_size(ptr[i]);
+		ASSERT(nb == (size_t)(i % 1000));
+		ASSERT(nb == 0 || ((unsigned char*)ptr[i])[nb - 1] == 0xFF);
+	}
+	ASSERT(pd_get_block_count(pool) == blocks);
+	ASSERT(pd_get_bytes_in_use(pool) == bytes);
+
+	// bulk release
+	pd_pool_clean(pool);
+	ASSERT(pd_get_block_count(pool) == 0);
+	ASSERT(pd_get_bytes_in_use(pool) == 0);
+	// and the pool is still usable after a clean
+	ASSERT(pd_alloc(pool, 100) != NULL);
+	ASSERT(pd_alloc(pool, 10000) != NULL);
+	ASSERT(pd_get_block_count(pool) == 2);
+	ASSERT(pd_get_bytes_in_use(pool) == 10100);
+	// freeing a pool with blocks still in it is OK
+	pd_alloc_free_pool(pool);
+
+	// default slab size
+	pool = pd_alloc_new_arena_pool(&os, 0);
+	ASSERT(pool);
+	ASSERT(pd_alloc(pool, 0) != NULL);
+	ASSERT(pd_get_block_count(pool) == 1);
+	pd_alloc_free_pool(pool);
+}
+
+// Time a typical writer allocation pattern - lots of small blocks,
+// most of them living until the pool is released - in both pool modes.
+static double alloc_pattern_ms(t_pdmempool* pool)
+{
+	clock_t start = clock();
+	int round, i;
+	for (round = 0; round < 20; round++) {
+		for (i = 0; i < ALLOCS; i++) {
+			void *p = pd_alloc(pool, 8 + (i % 7) * 24);
+			if (i % 4 == 0) pd_free(p);
+		}
+		pd_pool_clean(pool);
+	}
+	return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+// The lookups content_generator does for each strip of a page:
+// find the strip's image in the page's /XObject dictionary, then
+// the image's /Height. Plus the page-level /Resources and /XObject.
+void hash_benchmark()
+{
+#define BENCH_STRIPS 64
+#define BENCH_PAGES 20000
+	printf("-- dictionary lookup benchmark --\n");
+	t_pdmempool* pool = pd_alloc_new_arena_pool(&os, 0);
+	t_pdatomtable* atoms = pd_atom_table_new(pool, 128);
+	t_pdvalue page = pd_dict_new(pool, 20);
+	t_pdvalue res = pd_dict_new(pool, 1);
+	t_pdvalue xobj = pd_dict_new(pool, 20);
+	pd_dict_put(page, PDA_Type, pdatomvalue(PDA_Page));
+	pd_dict_put(page, PDA_Resources, res);
+	pd_dict_put(page, PDA_MediaBox, pdnullvalue());
+	pd_dict_put(page, PDA_Rotate, pdintvalue(0));
+	pd_dict_put(res, PDA_XObject, xobj);
+	t_pdatom strip[BENCH_STRIPS];
+	int i, n;
+	for (i = 0; i < BENCH_STRIPS; i++) {
+		char name[5 + 12] = "strip";
+		pditoa(i, name + 5);
+		strip[i] = pd_atom_intern(atoms, name);
+		t_pdvalue img = pd_dict_new(pool, 10);
+		pd_dict_put(img, PDA_Type, pdatomvalue(PDA_XObject));
+		pd_dict_put(img, PDA_Subtype, pdatomvalue(PDA_Image));
+		pd_dict_put(img, PDA_Width, pdintvalue(2550));
+		pd_dict_put(img, PDA_Height, pdintvalue(i + 1));
+		pd_dict_put(img, PDA_BitsPerComponent, pdintvalue(1));
+		pd_dict_put(img, PDA_ColorSpace, pdatomvalue(PDA_DeviceGray));
+		pd_dict_put(img, PDA_Length, pdintvalue(0));
+		pd_dict_put(xobj, strip[i], img);
+	}
+
+	long total = 0;
+	pdbool succ;
+	clock_t start = clock();
+	for (n = 0; n < BENCH_PAGES; n++) {
+		t_pdvalue r = pd_dict_get(page, PDA_Resources, &succ);
+		t_pdvalue x = pd_dict_get(r, PDA_XObject, &succ);
+		for (i = 0; i < BENCH_STRIPS; i++) {
+			t_pdvalue img = pd_dict_get(x, strip[i], &succ);
+			total += pd_dict_get(img, PDA_Height, &succ).value.intvalue;
+		}
+	}
+	double ms = (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+	long lookups = (long)BENCH_PAGES * (2 + 2 * BENCH_STRIPS);
+	ASSERT(total == (long)BENCH_PAGES * (BENCH_STRIPS * (BENCH_STRIPS + 1) / 2));
+	printf("  %ld lookups: %.1f ms (%.1f ns/lookup)\n",
+		lookups, ms, ms * 1e6 / lookups);
+	pd_alloc_free_pool(pool);
+}
+
+void alloc_benchmark()
+{
+	printf("-- allocator benchmark --\n");
+	t_pdmempool* plain = pd_alloc_new_pool(&os);
+	t_pdmempool* arena = pd_alloc_new_arena_pool(&os, 0);
+	double plain_ms = alloc_pattern_ms(plain);
+	double arena_ms = alloc_pattern_ms(arena);
+	printf("  %d small allocs: plain pool %.1f ms, arena pool %.1f ms\n",
+		20 * ALLOCS, plain_ms, arena_ms);
+	pd_alloc_free_pool(plain);
+	pd_alloc_free_pool(arena);
+}
+
 void test_pditoa()
 {
 	printf("pditoa\n");
@@ -430,7 +598,7 @@ void test_int_output()
 	ASSERT(0 == strcmp(output, "2147483647"));
 
 	buffer.pos = 0;
-	pd_putint(out, 1 << 31);					// min pdint32
+	pd_putint(out, -2147483647 - 1);			// min pdint32
 	ASSERT(0 == strcmp(output, "-2147483648"));
 
 	buffer.pos = 0;
@@ -582,6 +750,17 @@ void test_floating_point_output()
 	pd_putfloat(out, 1.0 / 3);
 	ASSERT(0 == strcmp(output, "0.3333333333"));
 
+	// rounded once, from the exact value 1107728933.49999989... * 10^-14,
+	// not from the double nearest it, which is ...933.5
+	buffer.pos = 0;
+	pd_putfloat(out, 1.1077289334999999e-05);
+	ASSERT(0 == strcmp(output, "0.00001107728933"));
+
+	// times 10 it is 9254621866282081.25, beyond 2^53 where doubles are 2 apart
+	buffer.pos = 0;
+	pd_putfloat(out, 925462186628208.125);
+	ASSERT(0 == strcmp(output, "925462186628208.1"));
+
 	buffer.pos = 0;
 	pd_putfloat(out, 1.0E-12);
 	ASSERT(0 == strcmp(output, "0.000000000001"));
@@ -673,6 +852,40 @@ void test_floating_point_output()
 	ASSERT(pd_get_bytes_in_use(pool) == 0);
 }
 
+static int nullOutputWriter(const pduint8 * data, pduint32 offset, pduint32 len, void *cookie)
+{
+	(void)data; (void)offset; (void)cookie;
+	return len;
+}
+
+// Time pd_putfloat on the kind of reals a writer emits:
+// cm matrix operands, MediaBox entries and CalRGB/CalGray parameters.
+void float_benchmark()
+{
+#define FLOAT_REPS 200000
+	static const double reals[] = {
+		612, 0, 0, 72.48, 0, 719.52,
+		595.2756, 841.8898, 0.24, 1700.5,
+		0.9505, 1.0, 1.089, 2.2, 0.4124, 0.2126, 0.0193, 0.3576,
+	};
+	const int nreals = sizeof reals / sizeof reals[0];
+	printf("-- float output benchmark --\n");
+	t_OS nullos = os;
+	nullos.writeout = nullOutputWriter;
+	t_pdoutstream* out = pd_outstream_new(os.allocsys, &nullos);
+	int rep, i;
+	clock_t start = clock();
+	for (rep = 0; rep < FLOAT_REPS; rep++) {
+		for (i = 0; i < nreals; i++) {
+			pd_putfloat(out, reals[i] + rep * 0.01);
+		}
+	}
+	double ms = (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+	long count = (long)FLOAT_REPS * nreals;
+	printf("  %ld reals: %.1f ms (%.1f ns/real)\n", count, ms, ms * 1e6 / count);
+	pd_outstream_free(out);
+}
+
 static void validate_pdf_time_string(const char* sztime)
 {
 	int i;
@@ -1025,6 +1238,70 @@ void test_hashtables()
 	ASSERT(pd_get_bytes_in_use(pool) == 0);
 }
 
+// Lots of keys whose addresses differ only in their low bits -
+// the worst case for a hash of raw pointers.
+#define MANY_KEYS 5000
+static char many_keys[MANY_KEYS][8];
+
+// check that keys come in the order they were put: many_keys[0], [1], ...
+static pdbool iterInOrder(t_pdatom atom, t_pdvalue value, void *cookie)
+{
+	int* pcount = (int*)cookie;
+	ASSERT(atom == (t_pdatom)many_keys[*pcount]);
+	(*pcount)++;
+	return PD_TRUE;
+}
+
+void test_hashtable_growth()
+{
+	printf("hashtable growth\n");
+	t_pdmempool* pool = os.allocsys;
+	t_pdhashatomtovalue* table = pd_hashatomtovalue_new(pool, 0);
+	ASSERT(table != NULL);
+	// capacity is always a power of 2
+	ASSERT((__pd_hashatomtovalue_capacity(table) & (__pd_hashatomtovalue_capacity(table) - 1)) == 0);
+	t_pdhashatomtovalue* small = pd_hashatomtovalue_new(pool, 5);
+	ASSERT(__pd_hashatomtovalue_capacity(small) == 8);
+	pd_hashatomtovalue_free(small);
+
+	int i;
+	pdbool success;
+	for (i = 0; i < MANY_KEYS; i++) {
+		ASSERT(pd_hashatomtovalue_put(table, (t_pdatom)many_keys[i], pdintvalue(i)));
+		ASSERT(pd_hashatomtovalue_count(table) == i + 1);
+	}
+	int cap = __pd_hashatomtovalue_capacity(table);
+	ASSERT(cap > MANY_KEYS);
+	ASSERT((cap & (cap - 1)) == 0);
+	for (i = 0; i < MANY_KEYS; i++) {
+		t_pdvalue v = pd_hashatomtovalue_get(table, (t_pdatom)many_keys[i], &success);
+		ASSERT(success && IS_INT(v) && v.value.intvalue == i);
+	}
+	// keys in between the ones we put are not found
+	for (i = 0; i < MANY_KEYS; i++) {
+		ASSERT(!pd_hashatomtovalue_contains(table, (t_pdatom)(many_keys[i] + 1)));
+	}
+	// replace every other value, count doesn't change
+	for (i = 0; i < MANY_KEYS; i += 2) {
+		pd_hashatomtovalue_put(table, (t_pdatom)many_keys[i], pdintvalue(-i));
+	}
+	ASSERT(pd_hashatomtovalue_count(table) == MANY_KEYS);
+	ASSERT(__pd_hashatomtovalue_capacity(table) == cap);
+	for (i = 0; i < MANY_KEYS; i++) {
+		t_pdvalue v = pd_hashatomtovalue_get(table, (t_pdatom)many_keys[i], &success);
+		ASSERT(success && v.value.intvalue == ((i & 1) ? i : -i));
+	}
+	// foreach visits every entry exactly once, in the order they were added,
+	// whatever the addresses of the keys (so dictionaries are written the same every time)
+	callbacks = 0;
+	pd_hashatomtovalue_foreach(table, iterInOrder, &callbacks);
+	ASSERT(callbacks == MANY_KEYS);
+
+	pd_hashatomtovalue_free(table);
+	ASSERT(pd_get_block_count(pool) == 0);
+	ASSERT(pd_get_bytes_in_use(pool) == 0);
+}
+
 void test_atoms()
 {
 	printf("atoms\n");
@@ -1056,6 +1333,14 @@ void test_atoms()
 	ASSERT(pd_atom_intern(atoms, "foO") == foO);
 	ASSERT(pd_atom_intern(atoms, "bar") == bar);
 	ASSERT(pd_atom_table_count(atoms) == 4);
+	// the standard atoms are already in every table
+	ASSERT(pd_atom_intern(atoms, "Type") == PDA_Type);
+	ASSERT(pd_atom_intern(atoms, "XObject") == PDA_XObject);
+	ASSERT(pd_atom_intern(atoms, "Matrix") == PDA_Matrix);
+	ASSERT(pd_atom_intern(atoms, "K") == PDA_K);
+	ASSERT(pd_atom_table_count(atoms) == 4);
+	ASSERT(pd_atom_intern(atoms, "type") != PDA_Type);
+	ASSERT(pd_atom_table_count(atoms) == 5);
 
 	// Simulate a kind of expected load
 	int stripno;
@@ -1065,8 +1350,27 @@ void test_atoms()
 		t_pdatom strip = pd_atom_intern(atoms, stripName);
 		ASSERT(strip);
 		ASSERT(pd_strcmp(pd_atom_name(strip), stripName) == 0);
-		ASSERT(pd_atom_table_count(atoms) == 4+stripno+1);
+		ASSERT(pd_atom_table_count(atoms) == 5+stripno+1);
 	}
+	// every atom survives all the expansions
+	ASSERT(pd_atom_intern(atoms, "foo") == foo);
+	ASSERT(pd_atom_intern(atoms, "bar") == bar);
+	ASSERT(pd_atom_intern(atoms, "Type") == PDA_Type);
+	for (stripno = 0; stripno < 1000; stripno++) {
+		char stripName[20];
+		sprintf_s(stripName, 20, "strip%d", stripno);
+		t_pdatom strip = pd_atom_intern(atoms, stripName);
+		ASSERT(pd_strcmp(pd_atom_name(strip), stripName) == 0);
+	}
+	ASSERT(pd_atom_table_count(atoms) == 1005);
+	// a name too long for a single name chunk
+	char longName[5000];
+	memset(longName, 'x', sizeof longName - 1);
+	longName[sizeof longName - 1] = 0;
+	t_pdatom longAtom = pd_atom_intern(atoms, longName);
+	ASSERT(pd_strcmp(pd_atom_name(longAtom), longName) == 0);
+	ASSERT(pd_atom_intern(atoms, longName) == longAtom);
+	ASSERT(pd_atom_intern(atoms, "foo") == foo);
 
 	pd_atom_table_free(atoms);
 
@@ -1106,6 +1410,20 @@ static void generate_content(t_pdcontents_gen *gen, void *cookie)
 	pd_atom_table_free(atoms);
 }
 
+static void generate_odd_content(t_pdcontents_gen *gen, void *cookie)
+{
+	(void)cookie;
+	t_pdatomtable* atoms = pd_atom_table_new(pd_get_pool(gen), 4);
+	pd_gen_xobject(gen, pd_atom_intern(atoms, "Img 0"));
+	pd_gen_moveto(gen, 1.5, -2);
+	pd_gen_lineto(gen, 0.25, 100);
+	pd_gen_closepath(gen);
+	pd_gen_stroke(gen);
+	pd_gen_fill(gen, PD_FALSE);
+	pd_gen_fill(gen, PD_TRUE);
+	pd_atom_table_free(atoms);
+}
+
 static pdbool sink_put(const pduint8 *buffer, pduint32 offset, pduint32 len, void *cookie)
 {
 	t_pdoutstream *outstm = (t_pdoutstream *)cookie;
@@ -1145,6 +1463,24 @@ void test_contents_generator()
 	// the sink's sink_free handler should be called exactly once:
 	ASSERT(sink_free_hit == 1);
 
+	// a generator can be reused, its buffer starts over each time
+	sink = pd_datasink_new(pool, sink_put, sink_free, out);
+	buffer.pos = 0;
+	pd_contents_gen_reserve(gen, 4096);
+	pd_contents_generate(sink, gen);
+	ASSERT(0 == strcmp(output,
+		" q 1600 0 0 1100 0 1100 cm /strip0 Do Q q 1600 0 0 1100 0 0 cm /strip1 Do Q"));
+	pd_datasink_free(sink);
+	pd_contents_gen_free(gen);
+
+	// names that need escaping, and the other operators
+	gen = pd_contents_gen_new(pool, generate_odd_content, NULL);
+	sink = pd_datasink_new(pool, sink_put, sink_free, out);
+	buffer.pos = 0;
+	pd_contents_generate(sink, gen);
+	ASSERT(0 == strcmp(output,
+		" /Img#200 Do 1.5 -2 m 0.25 100 l h S f f*"));
+	pd_datasink_free(sink);
 	pd_contents_gen_free(gen);
 	pd_outstream_free(out);
 	// and when we're done, there should be nothing in the pool
@@ -1464,7 +1800,7 @@ void test_arrays()
 	ASSERT(0 == strcmp(output, "[ (hello?) 1.5 null ]"));
 	pd_value_free(&array);
 
-	pdint32 intlist[5] = { (1 << 31), 0, 771723882, -950158714, 0xDEAD };
+	pdint32 intlist[5] = { -2147483647 - 1, 0, 771723882, -950158714, 0xDEAD };
 	arr = pd_array_buildints(pool, 5, intlist);
 	ASSERT(pd_array_count(arr) == 5);
 	array = pdarrayvalue(arr);
@@ -1571,6 +1907,158 @@ void test_streams()
 	ASSERT(pd_get_bytes_in_use(pool) == 0);
 }
 
+// true if the n bytes at data are the bytes written in hex
+static int equals_hex(const pduint8* data, size_t n, const char* hex)
+{
+	size_t i;
+	if (strlen(hex) != 2 * n) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		unsigned b;
+		if (sscanf(hex + 2 * i, "%2x", &b) != 1 || b != data[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void test_aes()
+{
+	printf("AES\n");
+	pduint8 key[32], plain[16], out[16];
+	int i, pass;
+	for (i = 0; i < 32; i++) key[i] = (pduint8)i;
+	for (i = 0; i < 16; i++) plain[i] = (pduint8)(i * 0x11);
+	pdbool hw = pd_aes_use_hw(PD_FALSE);
+	// without and (if we can) with the AES instructions
+	for (pass = 0; pass < 2; pass++) {
+		pd_aes_use_hw(pass == 1);
+		t_pdaeskey k;
+		// FIPS-197 Appendix C examples
+		pd_aes_set_key(&k, key, 128);
+		pd_aes_encrypt_block(&k, plain, out);
+		ASSERT(equals_hex(out, 16, "69c4e0d86a7b0430d8cdb78070b4c55a"));
+		pd_aes_decrypt_block(&k, out, out);
+		ASSERT(memcmp(out, plain, 16) == 0);
+		pd_aes_set_key(&k, key, 256);
+		pd_aes_encrypt_block(&k, plain, out);
+		ASSERT(equals_hex(out, 16, "8ea2b7ca516745bfeafc49904b496089"));
+		pd_aes_decrypt_block(&k, out, out);
+		ASSERT(memcmp(out, plain, 16) == 0);
+
+		// CBC in pieces is the same as CBC all at once
+		pduint8 data[160], whole[160], pieces[160], iv[16];
+		for (i = 0; i < 160; i++) data[i] = (pduint8)(i * 7);
+		memset(iv, 0, 16);
+		pd_aes_cbc_encrypt(&k, iv, data, whole, 10);
+		// (the last block checked with openssl enc -aes-256-cbc -nopad)
+		ASSERT(equals_hex(whole + 144, 16, "5ff0617e707734fe57e0cc719d812894"));
+		memset(iv, 0, 16);
+		pd_aes_cbc_encrypt(&k, iv, data, pieces, 3);
+		pd_aes_cbc_encrypt(&k, iv, data + 48, pieces + 48, 7);
+		ASSERT(memcmp(whole, pieces, 160) == 0);
+		// and decrypts (in place) back to the original
+		memset(iv, 0, 16);
+		pd_aes_cbc_decrypt(&k, iv, pieces, pieces, 5);
+		pd_aes_cbc_decrypt(&k, iv, pieces + 80, pieces + 80, 5);
+		ASSERT(memcmp(data, pieces, 160) == 0);
+	}
+	pd_aes_use_hw(hw);
+}
+
+void test_sha2()
+{
+	printf("SHA-2\n");
+	// FIPS 180-2 examples
+	const char* abc = "abc";
+	const char* two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	const char* two512 = "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+		"hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+	pduint8 digest[PD_SHA512_SIZE];
+	pd_sha256("", 0, digest);
+	ASSERT(equals_hex(digest, 32, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+	pd_sha256(abc, 3, digest);
+	ASSERT(equals_hex(digest, 32, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+	pd_sha256(two, strlen(two), digest);
+	ASSERT(equals_hex(digest, 32, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+	pd_sha384(abc, 3, digest);
+	ASSERT(equals_hex(digest, 48, "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded163"
+		"1a8b605a43ff5bed8086072ba1e7cc2358baeca134c825a7"));
+	pd_sha384(two512, strlen(two512), digest);
+	ASSERT(equals_hex(digest, 48, "09330c33f71147e83d192fc782cd1b4753111b173b3b05d2"
+		"2fa08086e3b0f712fcc7c71a557e2db966c3e9fa91746039"));
+	pd_sha512(abc, 3, digest);
+	ASSERT(equals_hex(digest, 64, "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+		"2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f"));
+	pd_sha512(two512, strlen(two512), digest);
+	ASSERT(equals_hex(digest, 64, "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
+		"501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909"));
+
+	// hashing in odd-sized pieces gives the same result
+	pduint8 data[1000], whole[PD_SHA512_SIZE];
+	size_t i;
+	for (i = 0; i < sizeof data; i++) data[i] = (pduint8)(i * 31);
+	t_pdsha256 ctx256;
+	pd_sha256(data, sizeof data, whole);
+	pd_sha256_init(&ctx256);
+	for (i = 0; i < sizeof data; i += 13) {
+		pd_sha256_update(&ctx256, data + i, sizeof data - i < 13 ? sizeof data - i : 13);
+	}
+	pd_sha256_final(&ctx256, digest);
+	ASSERT(memcmp(whole, digest, PD_SHA256_SIZE) == 0);
+	t_pdsha512 ctx512;
+	pd_sha512(data, sizeof data, whole);
+	pd_sha512_init(&ctx512);
+	for (i = 0; i < sizeof data; i += 100) {
+		pd_sha512_update(&ctx512, data + i, 100);
+	}
+	pd_sha512_final(&ctx512, digest);
+	ASSERT(memcmp(whole, digest, PD_SHA512_SIZE) == 0);
+}
+
+// The encryption dictionary checks out, and encrypting a stream in
+// pieces comes to the size given by pd_encrypted_size.
+void test_stream_encryption()
+{
+	printf("stream encryption\n");
+	t_pdmempool* pool = os.allocsys;
+	t_pdencrypter* crypter = pd_encrypt_new_aes256(pool, "user", "owner", 0);
+	ASSERT(crypter != NULL);
+	if (!crypter) return;
+	// the encryption dictionary that goes with it
+	t_pdvalue dict = pd_encrypt_dictionary(crypter, pool);
+	pdbool succ;
+	ASSERT(pd_dict_get(dict, PDA_V, &succ).value.intvalue == 5);
+	ASSERT(pd_dict_get(dict, PDA_R, &succ).value.intvalue == 6);
+	t_pdvalue U = pd_dict_get(dict, PDA_U, &succ);
+	ASSERT(IS_STRING(U) && pd_string_length(U.value.stringvalue) == 48);
+	// The user password hashed with the validation salt is the start of /U
+	pduint8 hash[32];
+	const pduint8* u = pd_string_data(U.value.stringvalue);
+	pd_hash_password_r6((const pduint8*)"user", 4, u + 32, NULL, hash);
+	ASSERT(memcmp(hash, u, 32) == 0);
+	pd_hash_password_r6((const pduint8*)"owner", 5, u + 32, NULL, hash);
+	ASSERT(memcmp(hash, u, 32) != 0);
+	pd_value_free_deep(&dict);
+
+	pduint8 data[1000], enc[1000 + 2 * PD_ENCRYPT_SLACK];
+	pduint32 n, len = 0, sizes[] = { 0, 1, 15, 16, 17, 1000 };
+	int i;
+	for (i = 0; i < 1000; i++) data[i] = (pduint8)i;
+	for (i = 0; i < (int)(sizeof sizes / sizeof sizes[0]); i++) {
+		len = pd_encrypt_stream_begin(crypter, enc);
+		// feed it in uneven pieces
+		for (n = 0; n < sizes[i]; n += 7) {
+			len += pd_encrypt_stream_data(crypter, enc + len, data + n, sizes[i] - n < 7 ? sizes[i] - n : 7);
+		}
+		len += pd_encrypt_stream_end(crypter, enc + len);
+		ASSERT(len == pd_encrypted_size(crypter, sizes[i]));
+	}
+	pd_encrypt_free(crypter);
+	ASSERT(pd_get_block_count(pool) == 0);
+}
+
 void test_write_value()
 {
 	printf("writing t_pdvalue's\n");
@@ -1840,6 +2328,7 @@ int main(int argc, char** argv)
 	os.writeoutcookie = &buffer;
 
 	test_alloc();
+	test_arena_alloc();
 
 	test_pditoa();
 
@@ -1855,11 +2344,15 @@ int main(int argc, char** argv)
 	test_time_fns();
 
 	test_hashtables();
+	test_hashtable_growth();
 	test_atoms();
 	test_contents_generator();
 	test_arrays();
 	test_dicts();
 	test_streams();
+	test_aes();
+	test_sha2();
+	test_stream_encryption();
 	test_write_value();
 	test_xref_tables();
 
@@ -1868,6 +2361,10 @@ int main(int argc, char** argv)
 	// finally, high-level pdfraster.h tests
 	pdfraster_output_tests();
 
+	alloc_benchmark();
+	hash_benchmark();
+	float_benchmark();
+
 	unsigned fails = get_number_of_failures();
 
 	printf("------------------------------\n");
@@ -6,10 +6,12 @@
 
 #include "portability.h"
 #include "test_support.h"
-#include "pdfrasread.h"
 
 #include "PdfRaster.h"
 #include "PdfStandardObjects.h"
+#include "PdfSHA2.h"
+#include "PdfAES.h"
+#include "md5.h"
 
 typedef struct {
 	size_t		bufsize;
@@ -96,6 +98,800 @@ void pdfraster_minimal_file()
 	ASSERT(pd_get_bytes_in_use(os.allocsys) == 0);
 }
 
+static int countingWriter(const pduint8 * data, pduint32 offset, pduint32 len, void *cookie)
+{
+	(void)data; (void)offset;
+	*(unsigned long *)cookie += len;
+	return len;
+}
+
+// Number of pages written by the memory-use test
+#define MANY_PAGES 100000
+// Pages written before taking the baseline measurement
+#define WARMUP_PAGES 1000
+// Bytes each finished page may leave behind in the encoder's pool:
+// a file position for each of its objects (page, contents, contents length,
+// strip, strip length), allowing for slack as the xref table grows.
+#define PAGE_RESIDUE 48
+
+void pdfraster_memory_use()
+{
+	printf("PDF/raster: memory use over %d pages\n", MANY_PAGES);
+
+	unsigned long written = 0;
+	t_OS nullos = os;
+	nullos.writeout = countingWriter;
+	nullos.writeoutcookie = &written;
+
+	t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &nullos);
+	t_pdmempool* pool = pdfr_encoder_get_pool(enc);
+	ASSERT(pool != NULL);
+	pdfr_encoder_set_compression(enc, PDFRAS_UNCOMPRESSED);
+	pdfr_encoder_set_pixelformat(enc, PDFRAS_GRAY8);
+
+	pduint8 strip[64];
+	memset(strip, 0x80, sizeof strip);
+	size_t baseline = 0, peak = 0;
+	int p;
+	for (p = 0; p < MANY_PAGES; p++) {
+		pdfr_encoder_start_page(enc, 8);
+		pdfr_encoder_set_physical_page_number(enc, p + 1);
+		pdfr_encoder_write_strip(enc, 8, strip, sizeof strip);
+		pdfr_encoder_end_page(enc);
+		size_t inuse = pd_get_bytes_in_use(pool);
+		if (p + 1 == WARMUP_PAGES) {
+			baseline = inuse;
+		}
+		if (inuse > peak) {
+			peak = inuse;
+		}
+	}
+	ASSERT(pdfr_encoder_page_count(enc) == MANY_PAGES);
+	// After the warmup, memory only grows by the per-page residue
+	size_t allowed = baseline + (size_t)(MANY_PAGES - WARMUP_PAGES) * PAGE_RESIDUE;
+	ASSERT(peak <= allowed);
+	printf("  bytes in use: %lu after %d pages, %lu after %d pages (%.1f bytes/page)\n",
+		(unsigned long)baseline, WARMUP_PAGES, (unsigned long)peak, MANY_PAGES,
+		(double)(peak - baseline) / (MANY_PAGES - WARMUP_PAGES));
+	pdfr_encoder_end_document(enc);
+	ASSERT(written == (unsigned long)pdfr_encoder_bytes_written(enc));
+	pdfr_encoder_destroy(enc);
+}
+
+static int growingWriter(const pduint8 * data, pduint32 offset, pduint32 len, void *cookie)
+{
+	membuf* buff = (membuf *)cookie;
+	if (buff->pos + len + 1 > buff->bufsize) {
+		buff->bufsize = (buff->pos + len + 1) * 2;
+		buff->buffer = (pduint8*)realloc(buff->buffer, buff->bufsize);
+	}
+	memcpy(buff->buffer + buff->pos, data + offset, len);
+	buff->pos += len;
+	buff->buffer[buff->pos] = 0;
+	return len;
+}
+
+// Check the shape of the page tree written for a given number of pages:
+// the number of /Pages nodes, and the fan-out of every node.
+static void check_page_tree(int npages, int expected_nodes)
+{
+	membuf out = { 0, NULL, 0 };
+	t_OS bufos = os;
+	bufos.writeout = growingWriter;
+	bufos.writeoutcookie = &out;
+
+	t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	// no NULs in the strip data, so we can scan the output with strstr
+	pduint8 strip[8];
+	memset(strip, 'U', sizeof strip);
+	int p;
+	for (p = 0; p < npages; p++) {
+		pdfr_encoder_start_page(enc, 8);
+		pdfr_encoder_write_strip(enc, 8, strip, sizeof strip);
+		pdfr_encoder_end_page(enc);
+	}
+	pdfr_encoder_end_document(enc);
+	ASSERT(pdfr_encoder_page_count(enc) == npages);
+	pdfr_encoder_destroy(enc);
+
+	const char* text = (const char*)out.buffer;
+	int nodes = 0, pages = 0;
+	const char* node;
+	for (node = strstr(text, "/Type /Pages"); node; node = strstr(node + 1, "/Type /Pages")) {
+		nodes++;
+	}
+	for (node = strstr(text, "/Type /Page"); node; node = strstr(node + 1, "/Type /Page")) {
+		pages++;
+	}
+	ASSERT(nodes == expected_nodes);
+	ASSERT(pages - nodes == npages);
+	// no /Kids array holds more than PD_PAGETREE_FANOUT entries
+	const char* kids;
+	for (kids = strstr(text, "/Kids ["); kids; kids = strstr(kids + 1, "/Kids [")) {
+		int n = 0;
+		const char* p = kids;
+		const char* end = strchr(kids, ']');
+		while ((p = strstr(p + 1, " R")) != NULL && p < end) {
+			n++;
+		}
+		ASSERT(n > 0 || npages == 0);
+		ASSERT(n <= PD_PAGETREE_FANOUT);
+	}
+	free(out.buffer);
+}
+
+void pdfraster_page_tree()
+{
+	printf("PDF/raster: balanced page tree\n");
+	const int F = PD_PAGETREE_FANOUT;
+	check_page_tree(0, 1);
+	check_page_tree(1, 1);
+	check_page_tree(F, 1);
+	// one more page than fits in one node: two leaves under a new root
+	check_page_tree(F + 1, 3);
+	// F full leaves, then two partly-filled nodes on the way to a 3-level root
+	check_page_tree(F * F + 5, F + 1 + 2 + 1);
+}
+
+// The segments handed to pdfr_encoder_write_strip_v, so the writer
+// can tell whether it was passed them directly.
+static const t_pdfrasiovec* spySegs;
+static int spyNSegs;
+static int spyHits;
+
+static int segmentSpyWriter(const pduint8 * data, pduint32 offset, pduint32 len, void *cookie)
+{
+	int i;
+	for (i = 0; i < spyNSegs; i++) {
+		if (data + offset == spySegs[i].data && len == spySegs[i].len) {
+			spyHits++;
+		}
+	}
+	return growingWriter(data, offset, len, cookie);
+}
+
+void pdfraster_gather_strips()
+{
+	printf("PDF/raster: scatter/gather strip data\n");
+	membuf out = { 0, NULL, 0 };
+	t_OS bufos = os;
+	bufos.writeout = segmentSpyWriter;
+	bufos.writeoutcookie = &out;
+
+	// 6 rows of 64 bitonal pixels = 48 bytes, as one buffer
+	// and as pieces of a 'ring buffer', wrapping around its end.
+	char strip[48 + 1];
+	char ring[64];
+	int i;
+	for (i = 0; i < 48; i++) {
+		strip[i] = (char)('a' + i % 26);
+	}
+	strip[48] = 0;
+	memset(ring, '~', sizeof ring);
+	memcpy(ring + 40, strip, 24);
+	memcpy(ring, strip + 24, 24);
+	t_pdfrasiovec segs[4];
+	segs[0].data = (const pduint8*)ring + 40; segs[0].len = 5;
+	segs[1].data = (const pduint8*)ring + 45; segs[1].len = 0;
+	segs[2].data = (const pduint8*)ring + 45; segs[2].len = 19;
+	segs[3].data = (const pduint8*)ring;      segs[3].len = 24;
+	spySegs = segs;
+	spyNSegs = 4;
+	spyHits = 0;
+
+	t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	pdfr_encoder_start_page(enc, 64);
+	ASSERT(0 == pdfr_encoder_write_strip(enc, 6, (const pduint8*)strip, 48));
+	pdfr_encoder_end_page(enc);
+	ASSERT(spyHits == 0);
+	pdfr_encoder_start_page(enc, 64);
+	ASSERT(0 == pdfr_encoder_write_strip_v(enc, 6, segs, 4));
+	ASSERT(pdfr_encoder_get_page_height(enc) == 6);
+	pdfr_encoder_end_page(enc);
+	// each non-empty segment went to the writer as-is
+	ASSERT(spyHits == 3);
+	pdfr_encoder_end_document(enc);
+	pdfr_encoder_destroy(enc);
+	spyNSegs = 0;
+
+	// both pages' strips hold the same data, with the same /Length
+	const char* text = (const char*)out.buffer;
+	const char* first = strstr(text, strip);
+	ASSERT(first != NULL);
+	ASSERT(first && strstr(first + 1, strip) != NULL);
+	int lengths = 0;
+	const char* p;
+	for (p = strstr(text, "\n48\n"); p; p = strstr(p + 1, "\n48\n")) {
+		lengths++;
+	}
+	ASSERT(lengths == 2);
+	free(out.buffer);
+}
+
+// Stream one tall strip to the output a few rows at a time
+void pdfraster_incremental_strip()
+{
+#define INC_WIDTH 4800				// 8" at 600 dpi, bitonal
+#define INC_ROWS 6600				// 11" at 600 dpi
+#define INC_CHUNK_ROWS 20
+	printf("PDF/raster: incremental strip\n");
+	const int rowbytes = INC_WIDTH / 8;
+	membuf out = { 0, NULL, 0 };
+	t_OS bufos = os;
+	bufos.writeout = growingWriter;
+	bufos.writeoutcookie = &out;
+	pduint8 *chunk = (pduint8 *)malloc(rowbytes * INC_CHUNK_ROWS);
+	memset(chunk, 'U', rowbytes * INC_CHUNK_ROWS);
+
+	t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	t_pdmempool* pool = pdfr_encoder_get_pool(enc);
+	pdfr_encoder_set_resolution(enc, 600, 600);
+	// no open strip:
+	ASSERT(pdfr_encoder_write_strip_data(enc, chunk, rowbytes) == -1);
+	ASSERT(pdfr_encoder_end_strip(enc) == -1);
+	pdfr_encoder_start_page(enc, INC_WIDTH);
+	ASSERT(pdfr_encoder_begin_strip(enc, INC_ROWS) == 0);
+	// only one strip can be open at a time
+	ASSERT(pdfr_encoder_begin_strip(enc, INC_ROWS) == -1);
+	ASSERT(pdfr_encoder_write_strip(enc, 1, chunk, rowbytes) == -1);
+	size_t inuse = pd_get_bytes_in_use(pool);
+	int row;
+	for (row = 0; row < INC_ROWS; row += INC_CHUNK_ROWS) {
+		ASSERT(pdfr_encoder_write_strip_data(enc, chunk, rowbytes * INC_CHUNK_ROWS) == 0);
+	}
+	// the encoder buffers none of it
+	ASSERT(pd_get_bytes_in_use(pool) == inuse);
+	// height isn't counted until the strip ends
+	ASSERT(pdfr_encoder_get_page_height(enc) == 0);
+	ASSERT(pdfr_encoder_end_strip(enc) == 0);
+	ASSERT(pdfr_encoder_get_page_height(enc) == INC_ROWS);
+	// a regular strip after it
+	ASSERT(pdfr_encoder_write_strip(enc, INC_CHUNK_ROWS, chunk, rowbytes * INC_CHUNK_ROWS) == 0);
+	// and an open strip is ended by end_page
+	ASSERT(pdfr_encoder_begin_strip(enc, 1) == 0);
+	ASSERT(pdfr_encoder_write_strip_data(enc, chunk, rowbytes) == 0);
+	pdfr_encoder_end_page(enc);
+	pdfr_encoder_end_document(enc);
+	pdfr_encoder_destroy(enc);
+
+	const char* text = (const char*)out.buffer;
+	ASSERT(strstr(text, "/Height 6600") != NULL);
+	ASSERT(strstr(text, "/strip2 Do") != NULL);
+	// the three strips' /Length objects
+	char len0[20], len1[20], len2[20];
+	sprintf(len0, "\n%d\n", rowbytes * INC_ROWS);
+	sprintf(len1, "\n%d\n", rowbytes * INC_CHUNK_ROWS);
+	sprintf(len2, "\n%d\n", rowbytes);
+	ASSERT(strstr(text, len0) != NULL);
+	ASSERT(strstr(text, len1) != NULL);
+	ASSERT(strstr(text, len2) != NULL);
+	// the first strip's data runs from 'stream' to 'endstream'
+	const char* data = strstr(text, "stream\r\nUUUU");
+	ASSERT(data != NULL);
+	if (data) {
+		data += 8;
+		ASSERT(strncmp(data + rowbytes * INC_ROWS, "\r\nendstream", 11) == 0);
+	}
+	free(chunk);
+	free(out.buffer);
+}
+
+// platform blocks currently held, counted by countingAlloc/countingFree
+static long liveBlocks;
+
+static void *countingAlloc(size_t bytes)
+{
+	liveBlocks++;
+	return malloc(bytes);
+}
+
+static void countingFree(void *ptr)
+{
+	if (ptr) liveBlocks--;
+	free(ptr);
+}
+
+// Write a small one-page document
+static void write_small_document(t_pdfrasencoder* enc, int pageno)
+{
+	pduint8 strip[64];
+	memset(strip, 'U', sizeof strip);
+	pdfr_encoder_set_title(enc, "reset test");
+	pdfr_encoder_set_pixelformat(enc, PDFRAS_GRAY8);
+	pdfr_encoder_start_page(enc, 8);
+	pdfr_encoder_set_physical_page_number(enc, pageno);
+	pdfr_encoder_write_strip(enc, 8, strip, sizeof strip);
+	pdfr_encoder_end_page(enc);
+	pdfr_encoder_end_document(enc);
+}
+
+// True if two documents are the same apart from their creation time,
+// which may fall either side of a clock tick, and the file ID, which
+// is a digest of everything including the creation time.
+static int same_document(const membuf* a, const membuf* b)
+{
+	// skip over (D:YYYYMMDDHHmmSS and /ID [ <32 hex> <32 hex> ]
+	static const char* marks[] = { "(D:", "/ID [" };
+	static const size_t skips[] = { 17, 77 };
+	if (a->pos != b->pos) {
+		return 0;
+	}
+	size_t at = 0;
+	int i;
+	for (i = 0; i < 2; i++) {
+		const char* d1 = strstr((const char*)a->buffer + at, marks[i]);
+		const char* d2 = strstr((const char*)b->buffer + at, marks[i]);
+		if (!d1 || !d2 || d1 - (const char*)a->buffer != d2 - (const char*)b->buffer) {
+			return 0;
+		}
+		size_t mark = d1 - (const char*)a->buffer;
+		if (memcmp(a->buffer + at, b->buffer + at, mark - at) != 0) {
+			return 0;
+		}
+		at = mark + skips[i];
+	}
+	return memcmp(a->buffer + at, b->buffer + at, a->pos - at) == 0;
+}
+
+#define RESET_DOCS 20000
+
+void pdfraster_reset()
+{
+	printf("PDF/raster: encoder reset\n");
+	membuf out1 = { 0, NULL, 0 }, out2 = { 0, NULL, 0 };
+	t_OS bufos = os;
+	bufos.alloc = countingAlloc;
+	bufos.free = countingFree;
+	bufos.writeout = growingWriter;
+	bufos.writeoutcookie = &out1;
+
+	liveBlocks = 0;
+	t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	pdfr_encoder_set_compression(enc, PDFRAS_UNCOMPRESSED);
+	write_small_document(enc, 1);
+	// page settings go back to their defaults...
+	pdfr_encoder_set_resolution(enc, 600, 600);
+	pdfr_encoder_reset(enc, &out2);
+	ASSERT(pdfr_encoder_page_count(enc) == 0);
+	ASSERT(pdfr_encoder_bytes_written(enc) == 15);
+	write_small_document(enc, 1);
+	// ...so the second document is the same as the first
+	ASSERT(same_document(&out1, &out2));
+
+	// resetting in the middle of a page abandons it
+	membuf out3 = { 0, NULL, 0 };
+	pdfr_encoder_reset(enc, &out3);
+	pdfr_encoder_start_page(enc, 8);
+	ASSERT(pdfr_encoder_begin_strip(enc, 8) == 0);
+	out2.pos = 0;
+	pdfr_encoder_reset(enc, &out2);
+	write_small_document(enc, 1);
+	ASSERT(same_document(&out1, &out2));
+
+	pdfr_encoder_destroy(enc);
+	ASSERT(liveBlocks == 0);
+
+	// a run of documents holds on to no more memory than one
+	t_OS nullos = bufos;
+	unsigned long written = 0;
+	nullos.writeout = countingWriter;
+	nullos.writeoutcookie = &written;
+	enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &nullos);
+	write_small_document(enc, 1);
+	long blocks = liveBlocks;
+	int d;
+	for (d = 0; d < 1000; d++) {
+		pdfr_encoder_reset(enc, &written);
+		write_small_document(enc, d + 1);
+	}
+	ASSERT(liveBlocks == blocks);
+	pdfr_encoder_destroy(enc);
+	ASSERT(liveBlocks == 0);
+
+	// time a batch of small documents each way
+	clock_t t0 = clock();
+	for (d = 0; d < RESET_DOCS; d++) {
+		enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &nullos);
+		write_small_document(enc, d + 1);
+		pdfr_encoder_destroy(enc);
+	}
+	clock_t t1 = clock();
+	enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &nullos);
+	for (d = 0; d < RESET_DOCS; d++) {
+		pdfr_encoder_reset(enc, &written);
+		write_small_document(enc, d + 1);
+	}
+	clock_t t2 = clock();
+	pdfr_encoder_destroy(enc);
+	double createSecs = (double)(t1 - t0) / CLOCKS_PER_SEC;
+	double resetSecs = (double)(t2 - t1) / CLOCKS_PER_SEC;
+	printf("  %d one-page documents: create/destroy %.0f docs/sec, reset %.0f docs/sec\n",
+		RESET_DOCS,
+		createSecs > 0 ? RESET_DOCS / createSecs : 0.0,
+		resetSecs > 0 ? RESET_DOCS / resetSecs : 0.0);
+	free(out1.buffer);
+	free(out2.buffer);
+	free(out3.buffer);
+}
+
+// Check the encoder's digests against digests of what it wrote
+static void check_digests(t_pdfrasencoder* enc, const membuf* out)
+{
+	pduint8 digest[32], expected[32];
+	MD5_CTX md5;
+	MD5_Init(&md5);
+	MD5_Update(&md5, out->buffer, out->pos);
+	MD5_Final(expected, &md5);
+	ASSERT(pdfr_encoder_get_md5(enc, digest) == 0);
+	ASSERT(memcmp(digest, expected, 16) == 0);
+	pd_sha256(out->buffer, out->pos, expected);
+	ASSERT(pdfr_encoder_get_sha256(enc, digest) == 0);
+	ASSERT(memcmp(digest, expected, 32) == 0);
+}
+
+// Return the file ID of a document, as hex
+static const char* file_id(const membuf* out)
+{
+	const char* id = strstr((const char*)out->buffer, "/ID [ <");
+	return id ? id + 7 : "";
+}
+
+void pdfraster_digests()
+{
+	printf("PDF/raster: output digests\n");
+	membuf out1 = { 0, NULL, 0 }, out2 = { 0, NULL, 0 };
+	t_OS bufos = os;
+	bufos.writeout = growingWriter;
+	bufos.writeoutcookie = &out1;
+	pduint8 digest[32];
+
+	t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	// MD5 is on by default, SHA-256 can still be started after the header
+	ASSERT(pdfr_encoder_get_md5(enc, digest) == 0);
+	ASSERT(pdfr_encoder_get_sha256(enc, digest) == -1);
+	ASSERT(pdfr_encoder_set_digests(enc, PDFRAS_DIGEST_MD5 | PDFRAS_DIGEST_SHA256) == 0);
+	write_small_document(enc, 1);
+	check_digests(enc, &out1);
+
+	// the file ID is the MD5 of everything before the xref table
+	const char* sx = strstr((const char*)out1.buffer, "startxref\n");
+	ASSERT(sx != NULL);
+	long xrefpos = sx ? atol(sx + 10) : 0;
+	MD5_CTX md5;
+	MD5_Init(&md5);
+	MD5_Update(&md5, out1.buffer, xrefpos);
+	MD5_Final(digest, &md5);
+	char hex[33];
+	int i;
+	for (i = 0; i < 16; i++) {
+		sprintf(hex + 2 * i, "%02X", digest[i]);
+	}
+	ASSERT(strncmp(file_id(&out1), hex, 32) == 0);
+
+	// the digests carry over to the next document. Same metadata,
+	// different content: different file ID.
+	pdfr_encoder_reset(enc, &out2);
+	pdfr_encoder_set_title(enc, "reset test");
+	pdfr_encoder_set_pixelformat(enc, PDFRAS_GRAY8);
+	pdfr_encoder_start_page(enc, 8);
+	pduint8 strip[64];
+	memset(strip, 'V', sizeof strip);
+	pdfr_encoder_write_strip(enc, 8, strip, sizeof strip);
+	// too late to start a digest now, but not to stop one
+	ASSERT(pdfr_encoder_set_digests(enc, PDFRAS_DIGEST_MD5 | PDFRAS_DIGEST_SHA256) == 0);
+	ASSERT(pdfr_encoder_set_digests(enc, PDFRAS_DIGEST_MD5) == 0);
+	ASSERT(pdfr_encoder_set_digests(enc, PDFRAS_DIGEST_MD5 | PDFRAS_DIGEST_SHA256) == -1);
+	ASSERT(pdfr_encoder_get_sha256(enc, digest) == -1);
+	pdfr_encoder_end_page(enc);
+	pdfr_encoder_end_document(enc);
+	ASSERT(pdfr_encoder_get_md5(enc, digest) == 0);
+	ASSERT(strncmp(file_id(&out1), file_id(&out2), 32) != 0);
+
+	// with no MD5, the file ID comes from the Info strings
+	ASSERT(pdfr_encoder_set_digests(enc, 0) == 0);
+	out2.pos = 0;
+	pdfr_encoder_reset(enc, &out2);
+	write_small_document(enc, 1);
+	ASSERT(pdfr_encoder_get_md5(enc, digest) == -1);
+	ASSERT(strncmp(file_id(&out1), file_id(&out2), 32) != 0);
+	pdfr_encoder_destroy(enc);
+
+	// digests of an encrypted document are of the encrypted output
+	out1.pos = 0;
+	enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	ASSERT(pdfr_encoder_set_encryption(enc, "user", "owner", PDFRAS_PERM_ALL) == 0);
+	ASSERT(pdfr_encoder_set_digests(enc, PDFRAS_DIGEST_MD5 | PDFRAS_DIGEST_SHA256) == 0);
+	write_small_document(enc, 1);
+	check_digests(enc, &out1);
+	pdfr_encoder_destroy(enc);
+
+	free(out1.buffer);
+	free(out2.buffer);
+}
+
+// strstr for output that may have NULs in it:
+// find needle in the buffer at or after from.
+static const char* find_in(const membuf* buf, const char* from, const char* needle)
+{
+	const char* end = (const char*)buf->buffer + buf->pos;
+	size_t n = strlen(needle);
+	for (; from + n <= end; from++) {
+		if (memcmp(from, needle, n) == 0) {
+			return from;
+		}
+	}
+	return NULL;
+}
+
+// Find the hex string value of /key in text, and decode it into out
+static size_t get_hex_entry(const char* text, const char* key, pduint8* out, size_t maxlen)
+{
+	const char* p = strstr(text, key);
+	size_t n = 0;
+	if (p && (p = strchr(p, '<')) != NULL) {
+		unsigned b;
+		for (p++; n < maxlen && sscanf(p, "%2x", &b) == 1 && *p != '>'; p += 2) {
+			out[n++] = (pduint8)b;
+		}
+	}
+	return n;
+}
+
+// Decrypt AESV3 data: IV, then CBC-encrypted and padded data.
+// Returns the length of the plain data, or -1 if the padding is wrong.
+static long decrypt_aesv3(const t_pdaeskey* key, const pduint8* data, size_t len, pduint8* out)
+{
+	pduint8 iv[16];
+	if (len < 32 || len % 16) return -1;
+	memcpy(iv, data, 16);
+	pd_aes_cbc_decrypt(key, iv, data + 16, out, (len - 16) / 16);
+	pduint8 pad = out[len - 17];
+	if (pad < 1 || pad > 16) return -1;
+	return (long)(len - 16 - pad);
+}
+
+static t_pdfrassignature signature;
+static int signatureCalls;
+
+static void onSignature(t_pdfrasencoder* enc, const t_pdfrassignature* sig, void* cookie)
+{
+	(void)enc;
+	signature = *sig;
+	signatureCalls++;
+	// everything has been written by now
+	ASSERT(((membuf*)cookie)->pos == (unsigned)(sig->byteRange[2] + sig->byteRange[3]));
+}
+
+// Check that a signature is where the encoder said, and fill it in
+static void check_signature(membuf* out, long maxlen)
+{
+	const t_pdfrassignature* sig = &signature;
+	const char* text = (const char*)out->buffer;
+	ASSERT(sig->byteRange[0] == 0);
+	ASSERT(sig->contentsLength == 2 * maxlen);
+	ASSERT(sig->contentsOffset == sig->byteRange[1] + 1);
+	ASSERT(sig->byteRange[2] == sig->contentsOffset + sig->contentsLength + 1);
+	ASSERT(sig->byteRange[2] + sig->byteRange[3] == (long)out->pos);
+	ASSERT(text[sig->byteRange[1]] == '<');
+	ASSERT(text[sig->byteRange[2] - 1] == '>');
+	long i;
+	for (i = 0; i < sig->contentsLength; i++) {
+		if (text[sig->contentsOffset + i] != '0') break;
+	}
+	ASSERT(i == sig->contentsLength);
+	// the /ByteRange written in the file agrees
+	long br[4] = { -1, -1, -1, -1 };
+	const char* p = find_in(out, text, "/ByteRange [");
+	ASSERT(p != NULL);
+	if (p) {
+		sscanf(p + 12, "%ld %ld %ld %ld", &br[0], &br[1], &br[2], &br[3]);
+	}
+	ASSERT(memcmp(br, sig->byteRange, sizeof br) == 0);
+	// the signed data runs up to /Contents, and on from just after it
+	ASSERT(strncmp(text + sig->byteRange[1] - 10, "/Contents ", 10) == 0);
+	ASSERT(strncmp(text + sig->byteRange[2], " >>\nendobj\n", 11) == 0);
+	ASSERT(find_in(out, text, "/AcroForm") != NULL);
+	ASSERT(find_in(out, text, "/SigFlags 3") != NULL);
+	ASSERT(find_in(out, text, "/Annots [ ") != NULL);
+	ASSERT(find_in(out, text, "/FT /Sig") != NULL);
+	ASSERT(find_in(out, text, "/SubFilter /adbe.pkcs7.detached") != NULL);
+	// patching in a signature leaves the rest of the file alone
+	memcpy(out->buffer + sig->contentsOffset, "3082", 4);
+	ASSERT(text[sig->byteRange[2] - 1] == '>');
+}
+
+void pdfraster_signature()
+{
+	printf("PDF/raster: signature placeholder\n");
+	membuf out = { 0, NULL, 0 };
+	t_OS bufos = os;
+	bufos.writeout = growingWriter;
+	bufos.writeoutcookie = &out;
+
+	// reserved before the first page
+	t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	signatureCalls = 0;
+	ASSERT(pdfr_encoder_reserve_signature(enc, 4096, onSignature, &out) == 0);
+	ASSERT(pdfr_encoder_reserve_signature(enc, 4096, onSignature, &out) == -1);
+	write_small_document(enc, 1);
+	ASSERT(signatureCalls == 1);
+	check_signature(&out, 4096);
+
+	// reserved on an open page, in an encrypted document
+	out.pos = 0;
+	pdfr_encoder_reset(enc, &out);
+	ASSERT(pdfr_encoder_set_encryption(enc, "user", "owner", PDFRAS_PERM_ALL) == 0);
+	pduint8 strip[64];
+	memset(strip, 'S', sizeof strip);
+	pdfr_encoder_set_pixelformat(enc, PDFRAS_GRAY8);
+	pdfr_encoder_start_page(enc, 8);
+	ASSERT(pdfr_encoder_reserve_signature(enc, 100, onSignature, &out) == 0);
+	pdfr_encoder_write_strip(enc, 8, strip, sizeof strip);
+	pdfr_encoder_end_page(enc);
+	pdfr_encoder_end_document(enc);
+	ASSERT(signatureCalls == 2);
+	check_signature(&out, 100);
+
+	// after a reset there's no signature until asked for
+	out.pos = 0;
+	pdfr_encoder_reset(enc, &out);
+	write_small_document(enc, 3);
+	ASSERT(signatureCalls == 2);
+	ASSERT(find_in(&out, (const char*)out.buffer, "/ByteRange") == NULL);
+	pdfr_encoder_destroy(enc);
+	free(out.buffer);
+}
+
+#define ENC_WIDTH 300
+#define ENC_ROWS 10
+
+// Write an encrypted document, and decrypt it with the user password
+void pdfraster_encryption()
+{
+	printf("PDF/raster: encryption\n");
+	membuf out = { 0, NULL, 0 };
+	t_OS bufos = os;
+	bufos.writeout = growingWriter;
+	bufos.writeoutcookie = &out;
+	pduint8 strip[ENC_WIDTH * ENC_ROWS];
+	int i;
+	// nothing like 'stream' or a NUL in here
+	for (i = 0; i < (int)sizeof strip; i++) strip[i] = (pduint8)('A' + i % 26);
+
+	t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	pdfr_encoder_set_title(enc, "Top Secret");
+	ASSERT(pdfr_encoder_set_encryption(enc, "user", "owner", PDFRAS_PERM_PRINT) == 0);
+	// can only be done once
+	ASSERT(pdfr_encoder_set_encryption(enc, "user", "owner", PDFRAS_PERM_PRINT) == -1);
+	pdfr_encoder_set_pixelformat(enc, PDFRAS_GRAY8);
+	pdfr_encoder_start_page(enc, ENC_WIDTH);
+	ASSERT(pdfr_encoder_write_strip(enc, ENC_ROWS, strip, sizeof strip) == 0);
+	// and a strip written in pieces
+	ASSERT(pdfr_encoder_begin_strip(enc, ENC_ROWS) == 0);
+	for (i = 0; i < ENC_ROWS; i++) {
+		ASSERT(pdfr_encoder_write_strip_data(enc, strip + i * ENC_WIDTH, ENC_WIDTH) == 0);
+	}
+	ASSERT(pdfr_encoder_end_strip(enc) == 0);
+	pdfr_encoder_end_page(enc);
+	pdfr_encoder_end_document(enc);
+	pdfr_encoder_destroy(enc);
+
+	// too late to turn on encryption once something has been written
+	membuf late = { 0, NULL, 0 };
+	bufos.writeoutcookie = &late;
+	enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &bufos);
+	pdfr_encoder_write_document_xmp(enc, "<x:xmpmeta/>");
+	ASSERT(pdfr_encoder_set_encryption(enc, "user", NULL, PDFRAS_PERM_ALL) == -1);
+	pdfr_encoder_destroy(enc);
+	free(late.buffer);
+
+	const char* text = (const char*)out.buffer;
+	// the encryption dictionary is in the trailer, and not itself encrypted
+	const char* trailer = find_in(&out, text, "trailer");
+	ASSERT(trailer != NULL);
+	if (!trailer) return;
+	ASSERT(strstr(trailer, "/Encrypt <<") != NULL);
+	ASSERT(strstr(trailer, "/Filter /Standard") != NULL);
+	ASSERT(strstr(trailer, "/V 5") != NULL);
+	ASSERT(strstr(trailer, "/R 6") != NULL);
+	ASSERT(strstr(trailer, "/CFM /AESV3") != NULL);
+	ASSERT(find_in(&out, text, "/ExtensionLevel 8") != NULL);
+	// no plain text gets out
+	ASSERT(find_in(&out, text, "Top Secret") == NULL);
+	ASSERT(find_in(&out, text, "ABCDEFGHIJ") == NULL);
+
+	// recover the file key with the user password
+	pduint8 U[48], UE[32], kek[32], filekey[32];
+	ASSERT(get_hex_entry(trailer, "/U ", U, 48) == 48);
+	ASSERT(get_hex_entry(trailer, "/UE ", UE, 32) == 32);
+	pd_hash_password_r6((const pduint8*)"user", 4, U + 32, NULL, kek);
+	ASSERT(memcmp(kek, U, 32) == 0);
+	// the key salt gives the key that unlocks /UE
+	pd_hash_password_r6((const pduint8*)"user", 4, U + 40, NULL, kek);
+	t_pdaeskey key;
+	pduint8 iv[16] = { 0 };
+	pd_aes_set_key(&key, kek, 256);
+	pd_aes_cbc_decrypt(&key, iv, UE, filekey, 2);
+	pd_aes_set_key(&key, filekey, 256);
+
+	// and decrypt both strips with it
+	pduint8 plain[sizeof strip + 32];
+	int strips = 0;
+	const char* p = text;
+	while ((p = find_in(&out, p, "/Subtype /Image")) != NULL) {
+		const char* data = find_in(&out, p, "stream\r\n") + 8;
+		const char* end = find_in(&out, data, "\r\nendstream");
+		long len = decrypt_aesv3(&key, (const pduint8*)data, end - data, plain);
+		ASSERT(len == sizeof strip);
+		ASSERT(memcmp(plain, strip, sizeof strip) == 0);
+		strips++;
+		p = end;
+	}
+	ASSERT(strips == 2);
+	// the title string too
+	pduint8 title[64];
+	size_t tlen = get_hex_entry(find_in(&out, text, "/Title "), "/Title ", title, sizeof title);
+	ASSERT(decrypt_aesv3(&key, title, tlen, plain) == 10);
+	ASSERT(memcmp(plain, "Top Secret", 10) == 0);
+	free(out.buffer);
+}
+
+// Writer that copies the data somewhere, as a real one would
+static int copyingWriter(const pduint8 * data, pduint32 offset, pduint32 len, void *cookie)
+{
+	static pduint8 sink[65536];
+	pduint32 done = 0;
+	while (done < len) {
+		pduint32 n = len - done < sizeof sink ? len - done : sizeof sink;
+		memcpy(sink, data + offset + done, n);
+		done += n;
+	}
+	*(unsigned long *)cookie += len;
+	return len;
+}
+
+// Throughput of writing strips, with and without encryption
+void pdfraster_encryption_benchmark()
+{
+#define BENCH_STRIP_BYTES (1 << 20)
+#define BENCH_STRIPS 128
+	printf("-- encryption benchmark --\n");
+	unsigned long written = 0;
+	t_OS nullos = os;
+	nullos.writeout = copyingWriter;
+	nullos.writeoutcookie = &written;
+	pduint8 *strip = (pduint8 *)malloc(BENCH_STRIP_BYTES);
+	memset(strip, 0x55, BENCH_STRIP_BYTES);
+	const char* modes[] = { "unencrypted", "AES-256 (AES-NI)", "AES-256 (portable)" };
+	pdbool hw = pd_aes_use_hw(PD_TRUE);
+	int mode;
+	for (mode = 0; mode < 3; mode++) {
+		if (mode == 1 && !pd_aes_hw_available()) {
+			continue;
+		}
+		pd_aes_use_hw(mode == 1);
+		t_pdfrasencoder* enc = pdfr_encoder_create(PDFRAS_API_LEVEL, &nullos);
+		if (mode) {
+			pdfr_encoder_set_encryption(enc, "user", NULL, PDFRAS_PERM_ALL);
+		}
+		pdfr_encoder_set_pixelformat(enc, PDFRAS_GRAY8);
+		pdfr_encoder_start_page(enc, 1024);
+		clock_t start = clock();
+		int s;
+		for (s = 0; s < BENCH_STRIPS; s++) {
+			pdfr_encoder_write_strip(enc, BENCH_STRIP_BYTES / 1024, strip, BENCH_STRIP_BYTES);
+		}
+		double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+		pdfr_encoder_end_page(enc);
+		pdfr_encoder_end_document(enc);
+		pdfr_encoder_destroy(enc);
+		printf("  %s: %d MB in %.1f ms, %.0f MB/s\n", modes[mode], BENCH_STRIPS,
+			secs * 1000, secs > 0 ? BENCH_STRIPS / secs : 0.0);
+	}
+	pd_aes_use_hw(hw);
+	free(strip);
+}
+
 void pdfraster_output_tests(void)
 {
 	printf("-----------------\n");
@@ -108,4 +904,13 @@ void pdfraster_output_tests(void)
 	os.writeoutcookie = &buffer;
 
 	pdfraster_minimal_file();
+	pdfraster_page_tree();
+	pdfraster_gather_strips();
+	pdfraster_incremental_strip();
+	pdfraster_reset();
+	pdfraster_digests();
+	pdfraster_signature();
+	pdfraster_encryption();
+	pdfraster_memory_use();
+	pdfraster_encryption_benchmark();
 }
\ No newline at end of file